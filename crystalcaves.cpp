@@ -14,10 +14,16 @@
 
 #ifdef __APPLE__
 #include <GLUT/glut.h>
+#include <OpenGL/OpenGL.h>  // CGL swap interval
 #else
 #include <GL/glut.h>
 #endif
 
+// glutGetProcAddress for resolving GL extension functions
+#if !defined(__APPLE__) && !defined(_WIN32)
+#include <GL/freeglut_ext.h>
+#endif
+
 #include <cmath>
 #include <iostream>
 #include <string>
@@ -25,16 +31,49 @@
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <set>
+#include <tuple>
+#include <array>
+#include <random>
 #include <algorithm>
 #include <thread>
 #include <chrono>
 #include <mutex>
+#include <charconv>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <condition_variable>
+#include <atomic>
+#include <queue>
+#include <sys/stat.h>
+
+// dlopen for the headless benchmark's EGL context (no link-time dependency)
+#if defined(__linux__)
+#include <dlfcn.h>
+#endif
+
+// SSE for the batched frustum tests; other targets use the scalar loop
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define HAVE_SSE 1
+#include <xmmintrin.h>
+#endif
 
 // Windows multimedia for sound
 #ifdef _WIN32
 #include <windows.h>
 #include <mmsystem.h>
 #pragma comment(lib, "winmm.lib")
+#else
+// POSIX memory mapping for fast model loading
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #endif
 
 // STB Image for texture loading
@@ -42,481 +81,4995 @@
 #include "stb_image.h"
 
 // ============================================================================
-// TEXTURE LOADER FUNCTION
+// GL EXTENSIONS - Entry points beyond OpenGL 1.1, resolved at startup
 // ============================================================================
 
-GLuint loadTexture(const std::string& filename) {
-    int width, height, channels;
-    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &channels, 0);
-    
-    if (!data) {
-        std::cerr << "Failed to load texture: " << filename << std::endl;
-        return 0;
-    }
-    
-    std::cout << "Loaded texture: " << filename << " (" << width << "x" << height << ", " << channels << " channels)" << std::endl;
-    
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    
-    // Set texture parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    
-    // Upload texture data
-    GLenum format = (channels == 4) ? GL_RGBA : GL_RGB;
-    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-    
-    stbi_image_free(data);
-    
-    return textureID;
-}
+// Windows only exports OpenGL 1.1 from opengl32.dll, so buffer objects are
+// looked up at runtime. macOS exports them directly from OpenGL.framework.
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER         0x8892
+#define GL_ELEMENT_ARRAY_BUFFER 0x8893
+#define GL_STATIC_DRAW          0x88E4
+#endif
 
-// ============================================================================
-// BACKGROUND MUSIC VARIABLES
-// ============================================================================
+// GL_EXT_texture_filter_anisotropic (core only since OpenGL 4.6)
+#ifndef GL_TEXTURE_MAX_ANISOTROPY_EXT
+#define GL_TEXTURE_MAX_ANISOTROPY_EXT     0x84FE
+#define GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT 0x84FF
+#endif
 
-bool backgroundMusicPlaying = false;  // Track if background music is playing
-std::string currentBackgroundMusic = "";  // Current background music file
-std::mutex musicMutex;  // Mutex to ensure only one music plays at a time
+// Compressed internal formats; uploads hand the driver plain pixels and let
+// it encode the blocks
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_LUMINANCE_LATC1_EXT
+#define GL_COMPRESSED_LUMINANCE_LATC1_EXT       0x8C70
+#define GL_COMPRESSED_LUMINANCE_ALPHA_LATC2_EXT 0x8C72
+#endif
+#ifndef GL_TEXTURE_COMPRESSED
+#define GL_TEXTURE_COMPRESSED 0x86A1
+#endif
+#ifndef GL_TEXTURE_MAX_LEVEL
+#define GL_TEXTURE_MAX_LEVEL 0x813D
+#endif
 
-// ============================================================================
-// SOUND FUNCTION
-// ============================================================================
+// GLSL programs (OpenGL 2.0) and instanced arrays (OpenGL 3.3 /
+// GL_ARB_instanced_arrays), used by the instanced draw path
+#ifndef GL_VERTEX_SHADER
+#define GL_FRAGMENT_SHADER  0x8B30
+#define GL_VERTEX_SHADER    0x8B31
+#define GL_COMPILE_STATUS   0x8B81
+#define GL_LINK_STATUS      0x8B82
+#define GL_INFO_LOG_LENGTH  0x8B84
+#endif
+#ifndef GL_DYNAMIC_DRAW
+#define GL_DYNAMIC_DRAW 0x88E8
+#endif
 
-void playDamageSound() {
-#ifdef _WIN32
-    // Play obstacle.wav asynchronously (non-blocking)
-    PlaySound(TEXT("obstacle.wav"), NULL, SND_FILENAME | SND_ASYNC);
+// Query objects (OpenGL 1.5) timing GPU work (OpenGL 3.3 /
+// GL_ARB_timer_query), used by the profiler
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT           0x8866
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
 #endif
-}
 
-void playKeySound() {
-#ifdef _WIN32
-    // Play keys.wav asynchronously (non-blocking)
-    PlaySound(TEXT("keys.wav"), NULL, SND_FILENAME | SND_ASYNC);
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
 #endif
-}
 
-void playExplosionSound() {
-#ifdef _WIN32
-    // Play explosion.wav asynchronously (non-blocking)
-    PlaySound(TEXT("explosion.wav"), NULL, SND_FILENAME | SND_ASYNC);
+// Framebuffer objects (OpenGL 3.0 / GL_ARB_framebuffer_object), for the
+// headless benchmark's render target and baking the text atlas
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER          0x8D40
+#define GL_RENDERBUFFER         0x8D41
+#define GL_COLOR_ATTACHMENT0    0x8CE0
+#define GL_DEPTH_ATTACHMENT     0x8D00
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#endif
+#ifndef GL_FRAMEBUFFER_BINDING
+#define GL_FRAMEBUFFER_BINDING 0x8CA6
+#endif
+#ifndef GL_DEPTH_COMPONENT24
+#define GL_DEPTH_COMPONENT24 0x81A6
 #endif
-}
 
-void playCrystalSound() {
-#ifdef _WIN32
-    // Play crystal.wav asynchronously (non-blocking)
-    PlaySound(TEXT("crystal.wav"), NULL, SND_FILENAME | SND_ASYNC);
+#ifndef APIENTRY
+#define APIENTRY
 #endif
-}
 
-void playGameWinSound() {
-#ifdef _WIN32
-    // Play game win.wav asynchronously (non-blocking)
-    PlaySound(TEXT("game win.wav"), NULL, SND_FILENAME | SND_ASYNC);
+typedef ptrdiff_t GLsizeiptrValue;
+typedef void (APIENTRY *GenBuffersFunc)(GLsizei n, GLuint* buffers);
+typedef void (APIENTRY *DeleteBuffersFunc)(GLsizei n, const GLuint* buffers);
+typedef void (APIENTRY *BindBufferFunc)(GLenum target, GLuint buffer);
+typedef void (APIENTRY *BufferDataFunc)(GLenum target, GLsizeiptrValue size, const void* data, GLenum usage);
+typedef GLuint (APIENTRY *CreateShaderFunc)(GLenum type);
+typedef void (APIENTRY *ShaderSourceFunc)(GLuint shader, GLsizei count, const char* const* source, const GLint* length);
+typedef void (APIENTRY *CompileShaderFunc)(GLuint shader);
+typedef void (APIENTRY *GetShaderivFunc)(GLuint shader, GLenum name, GLint* value);
+typedef void (APIENTRY *GetShaderInfoLogFunc)(GLuint shader, GLsizei size, GLsizei* length, char* log);
+typedef void (APIENTRY *DeleteShaderFunc)(GLuint shader);
+typedef GLuint (APIENTRY *CreateProgramFunc)();
+typedef void (APIENTRY *AttachShaderFunc)(GLuint program, GLuint shader);
+typedef void (APIENTRY *BindAttribLocationFunc)(GLuint program, GLuint index, const char* name);
+typedef void (APIENTRY *LinkProgramFunc)(GLuint program);
+typedef void (APIENTRY *GetProgramivFunc)(GLuint program, GLenum name, GLint* value);
+typedef void (APIENTRY *GetProgramInfoLogFunc)(GLuint program, GLsizei size, GLsizei* length, char* log);
+typedef void (APIENTRY *DeleteProgramFunc)(GLuint program);
+typedef void (APIENTRY *UseProgramFunc)(GLuint program);
+typedef GLint (APIENTRY *GetUniformLocationFunc)(GLuint program, const char* name);
+typedef void (APIENTRY *Uniform1iFunc)(GLint location, GLint value);
+typedef void (APIENTRY *Uniform1ivFunc)(GLint location, GLsizei count, const GLint* values);
+typedef void (APIENTRY *Uniform3fFunc)(GLint location, GLfloat x, GLfloat y, GLfloat z);
+typedef void (APIENTRY *EnableVertexAttribArrayFunc)(GLuint index);
+typedef void (APIENTRY *DisableVertexAttribArrayFunc)(GLuint index);
+typedef void (APIENTRY *VertexAttribPointerFunc)(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer);
+typedef void (APIENTRY *VertexAttribDivisorFunc)(GLuint index, GLuint divisor);
+typedef void (APIENTRY *DrawElementsInstancedFunc)(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instances);
+typedef void (APIENTRY *GenQueriesFunc)(GLsizei n, GLuint* ids);
+typedef void (APIENTRY *DeleteQueriesFunc)(GLsizei n, const GLuint* ids);
+typedef void (APIENTRY *BeginQueryFunc)(GLenum target, GLuint id);
+typedef void (APIENTRY *EndQueryFunc)(GLenum target);
+typedef void (APIENTRY *GetQueryObjectivFunc)(GLuint id, GLenum name, GLint* value);
+typedef void (APIENTRY *GetQueryObjectui64vFunc)(GLuint id, GLenum name, uint64_t* value);
+typedef void (APIENTRY *GenFramebuffersFunc)(GLsizei n, GLuint* framebuffers);
+typedef void (APIENTRY *DeleteFramebuffersFunc)(GLsizei n, const GLuint* framebuffers);
+typedef void (APIENTRY *BindFramebufferFunc)(GLenum target, GLuint framebuffer);
+typedef GLenum (APIENTRY *CheckFramebufferStatusFunc)(GLenum target);
+typedef void (APIENTRY *GenRenderbuffersFunc)(GLsizei n, GLuint* renderbuffers);
+typedef void (APIENTRY *DeleteRenderbuffersFunc)(GLsizei n, const GLuint* renderbuffers);
+typedef void (APIENTRY *BindRenderbufferFunc)(GLenum target, GLuint renderbuffer);
+typedef void (APIENTRY *RenderbufferStorageFunc)(GLenum target, GLenum format, GLsizei width, GLsizei height);
+typedef void (APIENTRY *FramebufferRenderbufferFunc)(GLenum target, GLenum attachment, GLenum renderbufferTarget, GLuint renderbuffer);
+
+struct GLExtensions {
+    bool hasBuffers;
+    GenBuffersFunc genBuffers;
+    DeleteBuffersFunc deleteBuffers;
+    BindBufferFunc bindBuffer;
+    BufferDataFunc bufferData;
+    float maxAnisotropy;  // 1.0 when anisotropic filtering is unsupported
+    bool hasS3TC;         // DXT1/DXT5 for RGB/RGBA textures
+    bool hasLATC;         // RGTC blocks for luminance(-alpha) textures
+    bool softwareRenderer;  // llvmpipe, softpipe, swrast: shaders run on the CPU
+    
+    // GLSL programs plus per-instance vertex attributes; hasInstancing is
+    // false unless every entry point below resolved
+    bool hasInstancing;
+    CreateShaderFunc createShader;
+    ShaderSourceFunc shaderSource;
+    CompileShaderFunc compileShader;
+    GetShaderivFunc getShaderiv;
+    GetShaderInfoLogFunc getShaderInfoLog;
+    DeleteShaderFunc deleteShader;
+    CreateProgramFunc createProgram;
+    AttachShaderFunc attachShader;
+    BindAttribLocationFunc bindAttribLocation;
+    LinkProgramFunc linkProgram;
+    GetProgramivFunc getProgramiv;
+    GetProgramInfoLogFunc getProgramInfoLog;
+    DeleteProgramFunc deleteProgram;
+    UseProgramFunc useProgram;
+    GetUniformLocationFunc getUniformLocation;
+    Uniform1iFunc uniform1i;
+    Uniform1ivFunc uniform1iv;
+    Uniform3fFunc uniform3f;
+    EnableVertexAttribArrayFunc enableVertexAttribArray;
+    DisableVertexAttribArrayFunc disableVertexAttribArray;
+    VertexAttribPointerFunc vertexAttribPointer;
+    VertexAttribDivisorFunc vertexAttribDivisor;
+    DrawElementsInstancedFunc drawElementsInstanced;
+    
+    // GL_TIME_ELAPSED queries for the profiler's GPU track
+    bool hasTimerQuery;
+    GenQueriesFunc genQueries;
+    DeleteQueriesFunc deleteQueries;
+    BeginQueryFunc beginQuery;
+    EndQueryFunc endQuery;
+    GetQueryObjectivFunc getQueryObjectiv;
+    GetQueryObjectui64vFunc getQueryObjectui64v;
+    
+    // Offscreen render targets (baking the text atlas)
+    bool hasFramebuffers;
+    GenFramebuffersFunc genFramebuffers;
+    DeleteFramebuffersFunc deleteFramebuffers;
+    BindFramebufferFunc bindFramebuffer;
+    CheckFramebufferStatusFunc checkFramebufferStatus;
+    GenRenderbuffersFunc genRenderbuffers;
+    DeleteRenderbuffersFunc deleteRenderbuffers;
+    BindRenderbufferFunc bindRenderbuffer;
+    RenderbufferStorageFunc renderbufferStorage;
+    FramebufferRenderbufferFunc framebufferRenderbuffer;
+    
+    GLExtensions() : hasBuffers(false), genBuffers(nullptr), deleteBuffers(nullptr),
+                     bindBuffer(nullptr), bufferData(nullptr), maxAnisotropy(1.0f),
+                     hasS3TC(false), hasLATC(false), softwareRenderer(false), hasInstancing(false),
+                     createShader(nullptr), shaderSource(nullptr), compileShader(nullptr),
+                     getShaderiv(nullptr), getShaderInfoLog(nullptr), deleteShader(nullptr),
+                     createProgram(nullptr), attachShader(nullptr), bindAttribLocation(nullptr),
+                     linkProgram(nullptr), getProgramiv(nullptr), getProgramInfoLog(nullptr),
+                     deleteProgram(nullptr), useProgram(nullptr), getUniformLocation(nullptr),
+                     uniform1i(nullptr), uniform1iv(nullptr), uniform3f(nullptr),
+                     enableVertexAttribArray(nullptr), disableVertexAttribArray(nullptr), vertexAttribPointer(nullptr),
+                     vertexAttribDivisor(nullptr), drawElementsInstanced(nullptr),
+                     hasTimerQuery(false), genQueries(nullptr), deleteQueries(nullptr), beginQuery(nullptr),
+                     endQuery(nullptr), getQueryObjectiv(nullptr), getQueryObjectui64v(nullptr),
+                     hasFramebuffers(false), genFramebuffers(nullptr), deleteFramebuffers(nullptr),
+                     bindFramebuffer(nullptr), checkFramebufferStatus(nullptr), genRenderbuffers(nullptr),
+                     deleteRenderbuffers(nullptr), bindRenderbuffer(nullptr), renderbufferStorage(nullptr),
+                     framebufferRenderbuffer(nullptr) {}
+};
+
+GLExtensions glExt;
+
+// Set by a context created without GLUT (the headless benchmark) to the
+// lookup function of its own API
+void* (*contextProcAddress)(const char* name) = nullptr;
+
+// Look up an extension function by name (needs a current GL context)
+void* getGLProcAddress(const char* name) {
+    if (contextProcAddress) return contextProcAddress(name);
+#if defined(__APPLE__)
+    (void)name;
+    return nullptr;
+#elif defined(_WIN32)
+    return (void*)wglGetProcAddress(name);
+#else
+    return (void*)glutGetProcAddress(name);
 #endif
 }
 
-void playGameOverSound() {
-#ifdef _WIN32
-    // Play game over.wav asynchronously (non-blocking)
-    PlaySound(TEXT("game over.wav"), NULL, SND_FILENAME | SND_ASYNC);
+// Resolve all extension entry points; call once after the window is created
+void loadGLExtensions() {
+#ifdef __APPLE__
+    glExt.genBuffers = (GenBuffersFunc)glGenBuffers;
+    glExt.deleteBuffers = (DeleteBuffersFunc)glDeleteBuffers;
+    glExt.bindBuffer = (BindBufferFunc)glBindBuffer;
+    glExt.bufferData = (BufferDataFunc)glBufferData;
+#else
+    glExt.genBuffers = (GenBuffersFunc)getGLProcAddress("glGenBuffers");
+    glExt.deleteBuffers = (DeleteBuffersFunc)getGLProcAddress("glDeleteBuffers");
+    glExt.bindBuffer = (BindBufferFunc)getGLProcAddress("glBindBuffer");
+    glExt.bufferData = (BufferDataFunc)getGLProcAddress("glBufferData");
+#endif
+    glExt.hasBuffers = glExt.genBuffers && glExt.deleteBuffers && glExt.bindBuffer && glExt.bufferData;
+    
+#ifndef __APPLE__
+    // The legacy (2.1) context macOS gives GLUT has no instanced arrays, so
+    // instanced batches there always take the merged-buffer fallback
+    glExt.createShader = (CreateShaderFunc)getGLProcAddress("glCreateShader");
+    glExt.shaderSource = (ShaderSourceFunc)getGLProcAddress("glShaderSource");
+    glExt.compileShader = (CompileShaderFunc)getGLProcAddress("glCompileShader");
+    glExt.getShaderiv = (GetShaderivFunc)getGLProcAddress("glGetShaderiv");
+    glExt.getShaderInfoLog = (GetShaderInfoLogFunc)getGLProcAddress("glGetShaderInfoLog");
+    glExt.deleteShader = (DeleteShaderFunc)getGLProcAddress("glDeleteShader");
+    glExt.createProgram = (CreateProgramFunc)getGLProcAddress("glCreateProgram");
+    glExt.attachShader = (AttachShaderFunc)getGLProcAddress("glAttachShader");
+    glExt.bindAttribLocation = (BindAttribLocationFunc)getGLProcAddress("glBindAttribLocation");
+    glExt.linkProgram = (LinkProgramFunc)getGLProcAddress("glLinkProgram");
+    glExt.getProgramiv = (GetProgramivFunc)getGLProcAddress("glGetProgramiv");
+    glExt.getProgramInfoLog = (GetProgramInfoLogFunc)getGLProcAddress("glGetProgramInfoLog");
+    glExt.deleteProgram = (DeleteProgramFunc)getGLProcAddress("glDeleteProgram");
+    glExt.useProgram = (UseProgramFunc)getGLProcAddress("glUseProgram");
+    glExt.getUniformLocation = (GetUniformLocationFunc)getGLProcAddress("glGetUniformLocation");
+    glExt.uniform1i = (Uniform1iFunc)getGLProcAddress("glUniform1i");
+    glExt.uniform1iv = (Uniform1ivFunc)getGLProcAddress("glUniform1iv");
+    glExt.uniform3f = (Uniform3fFunc)getGLProcAddress("glUniform3f");
+    glExt.enableVertexAttribArray = (EnableVertexAttribArrayFunc)getGLProcAddress("glEnableVertexAttribArray");
+    glExt.disableVertexAttribArray = (DisableVertexAttribArrayFunc)getGLProcAddress("glDisableVertexAttribArray");
+    glExt.vertexAttribPointer = (VertexAttribPointerFunc)getGLProcAddress("glVertexAttribPointer");
+    glExt.vertexAttribDivisor = (VertexAttribDivisorFunc)getGLProcAddress("glVertexAttribDivisor");
+    if (!glExt.vertexAttribDivisor) {
+        glExt.vertexAttribDivisor = (VertexAttribDivisorFunc)getGLProcAddress("glVertexAttribDivisorARB");
+    }
+    glExt.drawElementsInstanced = (DrawElementsInstancedFunc)getGLProcAddress("glDrawElementsInstanced");
+    if (!glExt.drawElementsInstanced) {
+        glExt.drawElementsInstanced = (DrawElementsInstancedFunc)getGLProcAddress("glDrawElementsInstancedARB");
+    }
+    if (!glExt.drawElementsInstanced) {
+        glExt.drawElementsInstanced = (DrawElementsInstancedFunc)getGLProcAddress("glDrawElementsInstancedEXT");
+    }
+    glExt.hasInstancing = glExt.hasBuffers && glExt.createShader && glExt.shaderSource && glExt.compileShader &&
+                          glExt.getShaderiv && glExt.getShaderInfoLog && glExt.deleteShader &&
+                          glExt.createProgram && glExt.attachShader && glExt.bindAttribLocation &&
+                          glExt.linkProgram && glExt.getProgramiv && glExt.getProgramInfoLog &&
+                          glExt.deleteProgram && glExt.useProgram && glExt.getUniformLocation &&
+                          glExt.uniform1i && glExt.uniform1iv && glExt.uniform3f && glExt.enableVertexAttribArray &&
+                          glExt.disableVertexAttribArray && glExt.vertexAttribPointer &&
+                          glExt.vertexAttribDivisor && glExt.drawElementsInstanced;
+    
+    glExt.genQueries = (GenQueriesFunc)getGLProcAddress("glGenQueries");
+    glExt.deleteQueries = (DeleteQueriesFunc)getGLProcAddress("glDeleteQueries");
+    glExt.beginQuery = (BeginQueryFunc)getGLProcAddress("glBeginQuery");
+    glExt.endQuery = (EndQueryFunc)getGLProcAddress("glEndQuery");
+    glExt.getQueryObjectiv = (GetQueryObjectivFunc)getGLProcAddress("glGetQueryObjectiv");
+    glExt.getQueryObjectui64v = (GetQueryObjectui64vFunc)getGLProcAddress("glGetQueryObjectui64v");
+    
+    glExt.genFramebuffers = (GenFramebuffersFunc)getGLProcAddress("glGenFramebuffers");
+    glExt.deleteFramebuffers = (DeleteFramebuffersFunc)getGLProcAddress("glDeleteFramebuffers");
+    glExt.bindFramebuffer = (BindFramebufferFunc)getGLProcAddress("glBindFramebuffer");
+    glExt.checkFramebufferStatus = (CheckFramebufferStatusFunc)getGLProcAddress("glCheckFramebufferStatus");
+    glExt.genRenderbuffers = (GenRenderbuffersFunc)getGLProcAddress("glGenRenderbuffers");
+    glExt.deleteRenderbuffers = (DeleteRenderbuffersFunc)getGLProcAddress("glDeleteRenderbuffers");
+    glExt.bindRenderbuffer = (BindRenderbufferFunc)getGLProcAddress("glBindRenderbuffer");
+    glExt.renderbufferStorage = (RenderbufferStorageFunc)getGLProcAddress("glRenderbufferStorage");
+    glExt.framebufferRenderbuffer = (FramebufferRenderbufferFunc)getGLProcAddress("glFramebufferRenderbuffer");
+    glExt.hasFramebuffers = glExt.genFramebuffers && glExt.deleteFramebuffers && glExt.bindFramebuffer &&
+                            glExt.checkFramebufferStatus && glExt.genRenderbuffers && glExt.deleteRenderbuffers &&
+                            glExt.bindRenderbuffer && glExt.renderbufferStorage && glExt.framebufferRenderbuffer;
 #endif
+    
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    
+    // Entry points resolve on drivers without the extension, so the name
+    // has to be advertised as well (it is on every 3.3+ driver)
+    glExt.hasTimerQuery = glExt.genQueries && glExt.deleteQueries && glExt.beginQuery && glExt.endQuery &&
+                          glExt.getQueryObjectiv && glExt.getQueryObjectui64v && extensions &&
+                          strstr(extensions, "GL_ARB_timer_query");
+    if (extensions && (strstr(extensions, "GL_EXT_texture_filter_anisotropic") ||
+                       strstr(extensions, "GL_ARB_texture_filter_anisotropic"))) {
+        glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &glExt.maxAnisotropy);
+    }
+    glExt.hasS3TC = extensions && strstr(extensions, "GL_EXT_texture_compression_s3tc");
+    glExt.hasLATC = extensions && strstr(extensions, "GL_EXT_texture_compression_latc");
+    const char* renderer = (const char*)glGetString(GL_RENDERER);
+    glExt.softwareRenderer = renderer && (strstr(renderer, "llvmpipe") || strstr(renderer, "softpipe") ||
+                                          strstr(renderer, "swrast") || strstr(renderer, "Software Rasterizer"));
+    
+    std::cout << "GL renderer: " << (const char*)glGetString(GL_RENDERER)
+              << " (buffer objects " << (glExt.hasBuffers ? "available" : "unavailable")
+              << ", max anisotropy " << glExt.maxAnisotropy
+              << ", S3TC " << (glExt.hasS3TC ? "yes" : "no")
+              << ", LATC " << (glExt.hasLATC ? "yes" : "no")
+              << ", instancing " << (glExt.hasInstancing ? "yes" : "no")
+              << ", timer queries " << (glExt.hasTimerQuery ? "yes" : "no")
+              << ", framebuffer objects " << (glExt.hasFramebuffers ? "yes" : "no") << ")" << std::endl;
 }
 
-void playJumpSound() {
-#ifdef _WIN32
-    // Play jump.wav asynchronously (non-blocking)
-    PlaySound(TEXT("jump.wav"), NULL, SND_FILENAME | SND_ASYNC);
+// ============================================================================
+// GL CALL COUNTS - Thin wrappers tallying draws, triangles and state calls
+// ============================================================================
+
+// The render code's draw and state calls are routed through glCounter by
+// the macros at the end of this section, which feeds the performance
+// overlay ('O'). Display lists are tallied while compiled and charged again
+// on every glCallList, so list and immediate paths report alike. GLU and
+// GLUT shapes draw inside the libraries; their wrappers in GLUT SHAPES
+// charge them instead. Build with -DCOUNT_GL_CALLS=0 to call GL directly.
+#ifndef COUNT_GL_CALLS
+#define COUNT_GL_CALLS 1
 #endif
-}
 
-// Forward declaration
-void stopBackgroundMusic();
+struct GLCallCounts {
+    size_t drawCalls;      // glBegin/glEnd pairs, glDrawArrays/Elements (instanced: once)
+    size_t triangles;      // Quads, strips and polygons as the triangles they make
+    size_t listCalls;      // glCallList
+    size_t textureBinds;   // glBindTexture
+    size_t materialCalls;  // glMaterial
+    
+    GLCallCounts() : drawCalls(0), triangles(0), listCalls(0), textureBinds(0), materialCalls(0) {}
+    
+    GLCallCounts& operator+=(const GLCallCounts& other) {
+        drawCalls += other.drawCalls;
+        triangles += other.triangles;
+        listCalls += other.listCalls;
+        textureBinds += other.textureBinds;
+        materialCalls += other.materialCalls;
+        return *this;
+    }
+    
+    GLCallCounts operator-(const GLCallCounts& other) const {
+        GLCallCounts result;
+        result.drawCalls = drawCalls - other.drawCalls;
+        result.triangles = triangles - other.triangles;
+        result.listCalls = listCalls - other.listCalls;
+        result.textureBinds = textureBinds - other.textureBinds;
+        result.materialCalls = materialCalls - other.materialCalls;
+        return result;
+    }
+};
 
-void playBackgroundMusic(const char* filename) {
-#ifdef _WIN32
-    std::lock_guard<std::mutex> lock(musicMutex);
+class GLCallCounter {
+public:
+    GLCallCounter() : beginMode(GL_POINTS), beginVertices(0), compilingList(0) {}
     
-    // Stop any current background music completely
-    backgroundMusicPlaying = false;
-    currentBackgroundMusic = "";
+    void begin(GLenum mode) {
+        beginMode = mode;
+        beginVertices = 0;
+    }
+    void vertex() { beginVertices++; }
+    void end() { draw(beginMode, beginVertices); }
     
-    // Force close all MCI devices that might be playing
-    mciSendString("close all", NULL, 0, NULL);
+    void draw(GLenum mode, size_t vertices, size_t instances = 1) {
+        GLCallCounts& target = current();
+        target.drawCalls++;
+        target.triangles += trianglesFor(mode, vertices) * instances;
+    }
     
-    // Give it a moment to stop completely
-    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    // A shape the libraries tessellate themselves
+    void shape(size_t triangles) {
+        GLCallCounts& target = current();
+        target.drawCalls++;
+        target.triangles += triangles;
+    }
     
-    // Store the new filename
-    currentBackgroundMusic = filename;
-    backgroundMusicPlaying = true;
+    void bindTexture() { current().textureBinds++; }
+    void material() { current().materialCalls++; }
     
-    std::cout << "Starting background music: " << filename << std::endl;
+    // Only GL_COMPILE lists are made here, so compiling draws nothing now
+    void newList(GLuint list) {
+        compilingList = list;
+        listCounts[list] = GLCallCounts();
+    }
+    void endList() { compilingList = 0; }
     
-    // Create a thread to handle looping background music
-    std::thread([filename]() {  // Capture filename by value
-        std::string localFilename = filename;
-        std::string musicAlias = "bgm";  // Use simple fixed alias
-        
-        while (backgroundMusicPlaying && currentBackgroundMusic == localFilename) {
-            char errorMsg[256];
-            char returnString[128];
-            MCIERROR error;
-            
-            // Force close any existing bgm
-            mciSendString("close bgm", NULL, 0, NULL);
-            
-            // Open the file
-            std::string command = "open \"" + localFilename + "\" type waveaudio alias bgm";
-            error = mciSendString(command.c_str(), NULL, 0, NULL);
-            if (error != 0) {
-                mciGetErrorString(error, errorMsg, 256);
-                std::cout << "Error opening background music: " << errorMsg << std::endl;
-                break;
-            }
-            
-            // Play the music (non-blocking)
-            error = mciSendString("play bgm", NULL, 0, NULL);
-            if (error != 0) {
-                mciGetErrorString(error, errorMsg, 256);
-                std::cout << "Error playing background music: " << errorMsg << std::endl;
-                mciSendString("close bgm", NULL, 0, NULL);
-                break;
-            }
-            
-            // Wait for the music to finish playing, checking status every 100ms
-            while (backgroundMusicPlaying && currentBackgroundMusic == localFilename) {
-                mciSendString("status bgm mode", returnString, sizeof(returnString), NULL);
-                if (strcmp(returnString, "stopped") == 0 || strcmp(returnString, "") == 0) {
-                    break;  // Song finished, loop to play again
-                }
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            }
-            
-            // Close after playing
-            mciSendString("close bgm", NULL, 0, NULL);
+    void callList(GLuint list) {
+        GLCallCounts& target = current();
+        target.listCalls++;
+        auto it = listCounts.find(list);
+        if (it != listCounts.end()) target += it->second;
+    }
+    
+    // Everything issued since the last reset (once per frame)
+    const GLCallCounts& totals() const { return frame; }
+    void reset() { frame = GLCallCounts(); }
+    
+private:
+    GLCallCounts& current() { return compilingList ? listCounts[compilingList] : frame; }
+    
+    static size_t trianglesFor(GLenum mode, size_t vertices) {
+        switch (mode) {
+            case GL_TRIANGLES: return vertices / 3;
+            case GL_QUADS: return vertices / 4 * 2;
+            case GL_TRIANGLE_STRIP:
+            case GL_TRIANGLE_FAN:
+            case GL_QUAD_STRIP:
+            case GL_POLYGON: return vertices > 2 ? vertices - 2 : 0;
+            default: return 0;  // Points and lines
         }
-    }).detach();
-#endif
-}
+    }
+    
+    GLenum beginMode;
+    size_t beginVertices;
+    GLuint compilingList;
+    GLCallCounts frame;
+    std::unordered_map<GLuint, GLCallCounts> listCounts;
+};
 
-void stopBackgroundMusic() {
-#ifdef _WIN32
-    backgroundMusicPlaying = false;
-    currentBackgroundMusic = "";
-    // Force close all MCI devices
-    mciSendString("close all", NULL, 0, NULL);
-    std::cout << "Stopped background music" << std::endl;
-#endif
-}
+GLCallCounter glCounter;
 
-void playExplosionThenDamageSound() {
-#ifdef _WIN32
-    // Create a thread to play sounds sequentially without blocking the game
-    std::thread([]() {
-        // Play explosion sound and wait for it to finish
-        PlaySound(TEXT("explosion.wav"), NULL, SND_FILENAME | SND_SYNC);
-        // Then play damage sound
-        PlaySound(TEXT("obstacle.wav"), NULL, SND_FILENAME | SND_ASYNC);
-    }).detach();
-#endif
+#if COUNT_GL_CALLS
+inline void countedBegin(GLenum mode) { glCounter.begin(mode); glBegin(mode); }
+inline void countedEnd() { glEnd(); glCounter.end(); }
+inline void countedVertex2f(GLfloat x, GLfloat y) { glCounter.vertex(); glVertex2f(x, y); }
+inline void countedVertex3f(GLfloat x, GLfloat y, GLfloat z) { glCounter.vertex(); glVertex3f(x, y, z); }
+inline void countedDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices) {
+    glCounter.draw(mode, (size_t)count);
+    glDrawElements(mode, count, type, indices);
+}
+inline void countedDrawArrays(GLenum mode, GLint first, GLsizei count) {
+    glCounter.draw(mode, (size_t)count);
+    glDrawArrays(mode, first, count);
+}
+inline void countedNewList(GLuint list, GLenum mode) { glNewList(list, mode); glCounter.newList(list); }
+inline void countedEndList() { glEndList(); glCounter.endList(); }
+inline void countedCallList(GLuint list) { glCounter.callList(list); glCallList(list); }
+inline void countedBindTexture(GLenum target, GLuint texture) { glCounter.bindTexture(); glBindTexture(target, texture); }
+inline void countedMaterialf(GLenum face, GLenum name, GLfloat value) { glCounter.material(); glMaterialf(face, name, value); }
+inline void countedMaterialfv(GLenum face, GLenum name, const GLfloat* values) {
+    glCounter.material();
+    glMaterialfv(face, name, values);
 }
 
-void playExplosionThenGameOverSound() {
-#ifdef _WIN32
-    // Create a thread to play sounds sequentially without blocking the game
-    std::thread([]() {
-        // Play explosion sound and wait for it to finish
-        PlaySound(TEXT("explosion.wav"), NULL, SND_FILENAME | SND_SYNC);
-        // Then play game over sound
-        PlaySound(TEXT("game over.wav"), NULL, SND_FILENAME | SND_ASYNC);
-    }).detach();
+#define glBegin countedBegin
+#define glEnd countedEnd
+#define glVertex2f countedVertex2f
+#define glVertex3f countedVertex3f
+#define glDrawElements countedDrawElements
+#define glDrawArrays countedDrawArrays
+#define glNewList countedNewList
+#define glEndList countedEndList
+#define glCallList countedCallList
+#define glBindTexture countedBindTexture
+#define glMaterialf countedMaterialf
+#define glMaterialfv countedMaterialfv
 #endif
-}
 
-// ============================================================================
-// VECTOR3 STRUCT - Basic 3D vector operations
-// ============================================================================
+// GL calls and CPU time of one named part of the frame (sky, flowers,
+// stones, bats...), for the overlay's breakdown
+struct RenderSectionStats {
+    const char* name;  // String literal
+    GLCallCounts counts;
+    double ms;
+};
 
-struct Vector3 {
-    float x, y, z;
+// Charges what is issued while it is open to the current name. next()
+// moves on to the following part without a new scope. Sections nest with
+// exclusive totals: a parent stops charging while a child is open. Does
+// nothing unless collecting is on (the overlay is showing).
+class RenderSection {
+public:
+    explicit RenderSection(const char* sectionName) : name(nullptr), parent(nullptr) {
+        if (!collecting || !sectionName) return;
+        parent = active;
+        if (parent) parent->charge();
+        active = this;
+        name = sectionName;
+        restart();
+    }
     
-    Vector3() : x(0), y(0), z(0) {}
-    Vector3(float x, float y, float z) : x(x), y(y), z(z) {}
+    ~RenderSection() { end(); }
     
-    Vector3 operator+(const Vector3& v) const { return Vector3(x + v.x, y + v.y, z + v.z); }
-    Vector3 operator-(const Vector3& v) const { return Vector3(x - v.x, y - v.y, z - v.z); }
-    Vector3 operator*(float s) const { return Vector3(x * s, y * s, z * s); }
+    void next(const char* sectionName) {
+        if (!name) return;
+        charge();
+        name = sectionName;
+    }
     
-    Vector3 cross(const Vector3& v) const {
-        return Vector3(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x);
+    void end() {
+        if (!name) return;
+        charge();
+        name = nullptr;
+        active = parent;
+        if (parent) parent->restart();
     }
     
-    float length() const { return sqrt(x * x + y * y + z * z); }
+    // Name items queued now should be drawn under (nullptr outside sections)
+    static const char* currentName() { return active ? active->name : nullptr; }
     
-    Vector3 normalized() const {
-        float len = length();
-        if (len > 0) return Vector3(x / len, y / len, z / len);
-        return Vector3(0, 0, 0);
+    static bool collecting;
+    static std::vector<RenderSectionStats> frame;  // This frame, in first-use order
+    
+private:
+    void restart() {
+        baseline = glCounter.totals();
+        start = std::chrono::steady_clock::now();
+    }
+    
+    void charge() {
+        auto now = std::chrono::steady_clock::now();
+        RenderSectionStats* stats = nullptr;
+        for (auto& entry : frame) {
+            if (entry.name == name || strcmp(entry.name, name) == 0) stats = &entry;
+        }
+        if (!stats) {
+            frame.push_back({ name, GLCallCounts(), 0.0 });
+            stats = &frame.back();
+        }
+        stats->counts += glCounter.totals() - baseline;
+        stats->ms += std::chrono::duration<double, std::milli>(now - start).count();
+        baseline = glCounter.totals();
+        start = now;
     }
+    
+    const char* name;
+    RenderSection* parent;
+    GLCallCounts baseline;
+    std::chrono::steady_clock::time_point start;
+    
+    static RenderSection* active;
 };
 
-struct Vector2 {
-    float u, v;
-    Vector2() : u(0), v(0) {}
-    Vector2(float u, float v) : u(u), v(v) {}
-};
+bool RenderSection::collecting = false;
+std::vector<RenderSectionStats> RenderSection::frame;
+RenderSection* RenderSection::active = nullptr;
 
 // ============================================================================
-// MATERIAL STRUCT - For MTL file support
+// RENDER STATE - Shadow copy of GL state that drops redundant changes
 // ============================================================================
 
-struct Material {
-    std::string name;
-    float ambient[4];
-    float diffuse[4];
-    float specular[4];
-    float emission[4];
-    float shininess;
-    float transparency;
-    std::string textureFile;
-    GLuint textureId;
+// Capabilities the scenes toggle per object, the 2D texture binding, and the
+// material parameters GL_COLOR_MATERIAL leaves alone (specular, emission,
+// shininess) all go through renderState, which remembers the last value
+// sent and skips calls that would not change it. Ambient and diffuse follow
+// glColor (GL_AMBIENT_AND_DIFFUSE tracking), so they are always sent.
+// Anything that changes state behind the cache's back must say so:
+// display lists are compiled between beginList/endList (calls pass straight
+// into the list) and replayed with callList, which forgets what it knew.
+struct RenderStateStats {
+    size_t enables;          // glEnable/glDisable sent
+    size_t textureBinds;
+    size_t materialChanges;  // glMaterial calls sent
+    size_t skipped;          // Redundant calls dropped
+    size_t drawItems;        // Items flushed by render queues
+};
+
+class RenderStateCache {
+public:
+    RenderStateCache() : caching(true), recording(false) {
+        invalidate();
+        resetStats();
+    }
     
-    Material() : shininess(32.0f), transparency(1.0f), textureId(0) {
-        ambient[0] = 0.2f; ambient[1] = 0.2f; ambient[2] = 0.2f; ambient[3] = 1.0f;
-        diffuse[0] = 0.8f; diffuse[1] = 0.8f; diffuse[2] = 0.8f; diffuse[3] = 1.0f;
-        specular[0] = 1.0f; specular[1] = 1.0f; specular[2] = 1.0f; specular[3] = 1.0f;
-        emission[0] = 0.0f; emission[1] = 0.0f; emission[2] = 0.0f; emission[3] = 1.0f;
+    void enable(GLenum cap) { setCap(cap, true); }
+    void disable(GLenum cap) { setCap(cap, false); }
+    
+    bool isEnabled(GLenum cap) {
+        int index = capIndex(cap);
+        if (index < 0 || caps[index] < 0) return glIsEnabled(cap) == GL_TRUE;
+        return caps[index] == 1;
     }
     
-    void apply() const {
-        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, ambient);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, diffuse);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, specular);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, emission);
-        glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, shininess);
-        glColor4f(diffuse[0], diffuse[1], diffuse[2], diffuse[3]);
-        
-        // Bind texture if available
-        if (textureId != 0) {
-            glEnable(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D, textureId);
-        } else {
-            glDisable(GL_TEXTURE_2D);
+    void bindTexture(GLuint texture) {
+        if (!recording && caching && textureKnown && boundTexture == texture) {
+            stats.skipped++;
+            return;
+        }
+        glBindTexture(GL_TEXTURE_2D, texture);
+        stats.textureBinds++;
+        if (recording) return;
+        boundTexture = texture;
+        textureKnown = true;
+    }
+    
+    // Deleting the bound texture rebinds 0; call before glDeleteTextures
+    void forgetTexture(GLuint texture) {
+        if (textureKnown && boundTexture == texture) boundTexture = 0;
+    }
+    
+    // glMaterialfv(GL_FRONT_AND_BACK, pname, values)
+    void material(GLenum pname, const GLfloat* values) {
+        GLfloat* cached = (pname == GL_SPECULAR) ? specular : (pname == GL_EMISSION) ? emission : nullptr;
+        bool* known = (pname == GL_SPECULAR) ? &specularKnown : &emissionKnown;
+        if (cached && !recording && caching && *known && memcmp(cached, values, sizeof(specular)) == 0) {
+            stats.skipped++;
+            return;
+        }
+        glMaterialfv(GL_FRONT_AND_BACK, pname, values);
+        stats.materialChanges++;
+        if (!cached || recording) return;
+        memcpy(cached, values, sizeof(specular));
+        *known = true;
+    }
+    
+    void shininess(GLfloat value) {
+        if (!recording && caching && shininessKnown && shininessValue == value) {
+            stats.skipped++;
+            return;
+        }
+        glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, value);
+        stats.materialChanges++;
+        if (recording) return;
+        shininessValue = value;
+        shininessKnown = true;
+    }
+    
+    void beginList(GLuint list) {
+        glNewList(list, GL_COMPILE);
+        recording = true;
+    }
+    
+    void endList() {
+        glEndList();
+        recording = false;
+    }
+    
+    void callList(GLuint list) {
+        glCallList(list);
+        invalidate();
+    }
+    
+    // Forget everything; the next call of each kind is sent
+    void invalidate() {
+        for (int i = 0; i < CAP_COUNT; i++) caps[i] = -1;
+        textureKnown = specularKnown = emissionKnown = shininessKnown = false;
+        boundTexture = 0;
+    }
+    
+    // Off (--no-state-cache or 'G') sends every call, still counting them
+    void setCaching(bool enabled) { caching = enabled; }
+    bool isCaching() const { return caching; }
+    
+    void resetStats() { memset(&stats, 0, sizeof(stats)); }
+    
+    RenderStateStats stats;
+    
+private:
+    enum { CAP_TEXTURE_2D, CAP_LIGHTING, CAP_BLEND, CAP_DEPTH_TEST, CAP_CULL_FACE, CAP_FOG, CAP_COUNT };
+    
+    static int capIndex(GLenum cap) {
+        switch (cap) {
+            case GL_TEXTURE_2D: return CAP_TEXTURE_2D;
+            case GL_LIGHTING: return CAP_LIGHTING;
+            case GL_BLEND: return CAP_BLEND;
+            case GL_DEPTH_TEST: return CAP_DEPTH_TEST;
+            case GL_CULL_FACE: return CAP_CULL_FACE;
+            case GL_FOG: return CAP_FOG;
+            default: return -1;
+        }
+    }
+    
+    void setCap(GLenum cap, bool on) {
+        int index = capIndex(cap);
+        if (index >= 0 && !recording && caching && caps[index] == (on ? 1 : 0)) {
+            stats.skipped++;
+            return;
         }
+        if (on) glEnable(cap);
+        else glDisable(cap);
+        stats.enables++;
+        if (index >= 0 && !recording) caps[index] = on ? 1 : 0;
     }
+    
+    bool caching;
+    bool recording;  // Inside glNewList: calls are compiled, not executed
+    int8_t caps[CAP_COUNT];  // -1 = unknown
+    GLuint boundTexture;
+    bool textureKnown;
+    GLfloat specular[4], emission[4];
+    GLfloat shininessValue;
+    bool specularKnown, emissionKnown, shininessKnown;
 };
 
+RenderStateCache renderState;
+RenderStateStats lastFrameStateStats = { 0, 0, 0, 0, 0 };
+
 // ============================================================================
-// FACE STRUCT - Represents a polygon face
+// PROFILER - Scoped CPU/GPU timing kept in per-thread rings, Chrome trace export
 // ============================================================================
 
-struct Face {
-    std::vector<int> vertexIndices;
-    std::vector<int> texCoordIndices;
-    std::vector<int> normalIndices;
-    std::string materialName;
-};
+// Build with -DENABLE_PROFILER=0 to compile every PROFILE_* marker out
+#ifndef ENABLE_PROFILER
+#define ENABLE_PROFILER 1
+#endif
 
-// ============================================================================
-// OBJ MODEL CLASS - Complete OBJ file loader
-// ============================================================================
+// One finished scope. Names are string literals, so nothing is copied.
+struct TraceEvent {
+    const char* name;
+    int64_t startNs;     // Since Profiler::origin
+    int64_t durationNs;
+};
 
-class OBJModel {
+// Fixed ring of the newest events on one thread. Only the owning thread
+// writes; exporters read up to the published count without taking a lock
+// and drop anything the writer may have lapped while they copied.
+class TraceBuffer {
 public:
-    std::vector<Vector3> vertices;
-    std::vector<Vector3> normals;
-    std::vector<Vector2> texCoords;
-    std::vector<Face> faces;
-    std::map<std::string, Material> materials;
+    static const uint64_t CAPACITY = 1 << 16;  // Power of two
     
-    // Bounding box
-    Vector3 minBounds, maxBounds;
-    Vector3 center;
-    float boundingRadius;
+    TraceBuffer(int id, const std::string& name) : threadId(id), threadName(name), events(CAPACITY), written(0) {}
     
-    // Display list for faster rendering
-    GLuint displayList;
-    bool hasDisplayList;
-    bool hasTextures;  // Flag to indicate if model uses textures
+    void push(const char* name, int64_t startNs, int64_t durationNs) {
+        uint64_t index = written.load(std::memory_order_relaxed);
+        TraceEvent& event = events[index & (CAPACITY - 1)];
+        event.name = name;
+        event.startNs = startNs;
+        event.durationNs = durationNs;
+        written.store(index + 1, std::memory_order_release);
+    }
     
-    // Transform properties
-    Vector3 position;
-    Vector3 rotation;
-    Vector3 scale;
+    // Copy the events still in the ring that started at or after sinceNs
+    void snapshot(int64_t sinceNs, std::vector<TraceEvent>& out) const {
+        uint64_t end = written.load(std::memory_order_acquire);
+        uint64_t begin = end > CAPACITY ? end - CAPACITY : 0;
+        size_t first = out.size();
+        for (uint64_t i = begin; i < end; i++) out.push_back(events[i & (CAPACITY - 1)]);
+        
+        // Slots the writer reused during the copy hold newer events than
+        // their position says; throw those away
+        // (including the slot of the event being written right now)
+        uint64_t after = written.load(std::memory_order_acquire) + 1;
+        uint64_t stale = after > CAPACITY ? after - CAPACITY : 0;
+        size_t drop = stale > begin ? (size_t)std::min(stale - begin, end - begin) : 0;
+        out.erase(out.begin() + first, out.begin() + first + drop);
+        out.erase(std::remove_if(out.begin() + first, out.end(),
+                                 [sinceNs](const TraceEvent& event) { return event.startNs < sinceNs; }),
+                  out.end());
+    }
     
-    std::string name;
-    bool isLoaded;
+    const int threadId;
+    std::string threadName;  // Guarded by the profiler's registry mutex
     
-    OBJModel() : hasDisplayList(false), isLoaded(false), displayList(0), hasTextures(false) {
-        position = Vector3(0, 0, 0);
-        rotation = Vector3(0, 0, 0);
-        scale = Vector3(1, 1, 1);
+private:
+    std::vector<TraceEvent> events;
+    std::atomic<uint64_t> written;
+};
+
+// A GL_TIME_ELAPSED query waiting for its result
+struct PendingGpuQuery {
+    GLuint query;
+    const char* name;
+    int64_t submitNs;  // CPU time the pass was issued
+};
+
+class Profiler {
+public:
+    // Track for GPU pass times; written from the GL thread only
+    static const int GPU_THREAD_ID = 1000;
+    
+    Profiler() : origin(std::chrono::steady_clock::now()), nextThreadId(0), gpuActive(false), gpuCursorNs(0),
+                 gpuTrack(GPU_THREAD_ID, "GPU") {}
+    
+    int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
     }
     
-    ~OBJModel() {
-        if (hasDisplayList) {
-            glDeleteLists(displayList, 1);
+    // This thread's ring, registered on first use
+    TraceBuffer& threadBuffer() {
+        thread_local TraceBuffer* buffer = nullptr;
+        if (!buffer) {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            int id = nextThreadId++;
+            buffers.push_back(std::unique_ptr<TraceBuffer>(new TraceBuffer(id, "thread " + std::to_string(id))));
+            buffer = buffers.back().get();
         }
+        return *buffer;
     }
     
-    // Load OBJ file
-    bool load(const std::string& filename) {
-        std::ifstream file(filename);
-        if (!file.is_open()) {
-            std::cerr << "Error: Could not open OBJ file: " << filename << std::endl;
+    void setThreadName(const std::string& name) {
+        TraceBuffer& buffer = threadBuffer();
+        std::lock_guard<std::mutex> lock(registryMutex);
+        buffer.threadName = name;
+    }
+    
+    // GPU passes don't nest: a pass opened inside another is not timed
+    bool beginGpuPass(const char* name) {
+        if (!glExt.hasTimerQuery || gpuActive || pendingGpu.size() >= MAX_PENDING_QUERIES) return false;
+        GLuint query = 0;
+        if (!freeQueries.empty()) {
+            query = freeQueries.back();
+            freeQueries.pop_back();
+        } else {
+            glExt.genQueries(1, &query);
+        }
+        glExt.beginQuery(GL_TIME_ELAPSED, query);
+        pendingGpu.push_back({ query, name, now() });
+        gpuActive = true;
+        return true;
+    }
+    
+    void endGpuPass() {
+        glExt.endQuery(GL_TIME_ELAPSED);
+        gpuActive = false;
+    }
+    
+    // Move finished GPU timings onto the GPU track without waiting on the
+    // driver; results usually land a frame or two after the pass. Each pass
+    // is placed at its submit time, or after the previous pass if the GPU
+    // was still busy then.
+    void collectGpu() {
+        while (!pendingGpu.empty()) {
+            const PendingGpuQuery& pending = pendingGpu.front();
+            GLint available = 0;
+            glExt.getQueryObjectiv(pending.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) break;
+            uint64_t elapsedNs = 0;
+            glExt.getQueryObjectui64v(pending.query, GL_QUERY_RESULT, &elapsedNs);
+            int64_t startNs = std::max(pending.submitNs, gpuCursorNs);
+            gpuTrack.push(pending.name, startNs, (int64_t)elapsedNs);
+            gpuCursorNs = startNs + (int64_t)elapsedNs;
+            freeQueries.push_back(pending.query);
+            pendingGpu.pop_front();
+        }
+    }
+    
+    // Write the last `seconds` of every track as Chrome trace_event JSON
+    // (load in chrome://tracing or ui.perfetto.dev)
+    bool exportTrace(const std::string& path, double seconds) {
+        int64_t sinceNs = now() - (int64_t)(seconds * 1e9);
+        std::ofstream out(path);
+        if (!out) {
+            std::cerr << "Error: cannot write trace " << path << std::endl;
             return false;
         }
         
-        std::cout << "Loading OBJ model: " << filename << std::endl;
-        
-        // Extract directory path for MTL file loading
-        std::string directory = "";
-        size_t lastSlash = filename.find_last_of("/\\");
-        if (lastSlash != std::string::npos) {
-            directory = filename.substr(0, lastSlash + 1);
+        std::vector<const TraceBuffer*> tracks;
+        std::vector<std::string> names;
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            for (const auto& buffer : buffers) {
+                tracks.push_back(buffer.get());
+                names.push_back(buffer->threadName);
+            }
+        }
+        tracks.push_back(&gpuTrack);
+        names.push_back(gpuTrack.threadName);
+        
+        out << "{\"traceEvents\":[\n";
+        out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Crystal Caves\"}}";
+        size_t eventCount = 0;
+        char line[256];
+        std::vector<TraceEvent> events;
+        for (size_t t = 0; t < tracks.size(); t++) {
+            out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tracks[t]->threadId
+                << ",\"args\":{\"name\":\"" << names[t] << "\"}}";
+            events.clear();
+            tracks[t]->snapshot(sinceNs, events);
+            for (const TraceEvent& event : events) {
+                snprintf(line, sizeof(line),
+                         ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                         event.name, tracks[t] == &gpuTrack ? "gpu" : "cpu", tracks[t]->threadId,
+                         event.startNs / 1000.0, event.durationNs / 1000.0);
+                out << line;
+            }
+            eventCount += events.size();
         }
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
         
-        name = filename;
-        std::string currentMaterial = "";
-        std::string line;
+        std::cout << "Profiler: wrote " << eventCount << " events from the last " << seconds << " s ("
+                  << tracks.size() << " tracks) to " << path << std::endl;
+        return true;
+    }
+    
+private:
+    static const size_t MAX_PENDING_QUERIES = 64;
+    
+    std::chrono::steady_clock::time_point origin;
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+    int nextThreadId;
+    
+    bool gpuActive;
+    int64_t gpuCursorNs;
+    std::deque<PendingGpuQuery> pendingGpu;
+    std::vector<GLuint> freeQueries;
+    TraceBuffer gpuTrack;
+};
+
+Profiler profiler;
+double traceSeconds = 5.0;     // Span written by the 'P' key and --trace-out (--trace-seconds)
+std::string traceOutputPath;   // --trace-out: written when the headless benchmark ends
+
+// Records one event on the current thread when it goes out of scope
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* scopeName) : name(scopeName), startNs(profiler.now()) {}
+    ~ProfileScope() {
+        int64_t endNs = profiler.now();
+        profiler.threadBuffer().push(name, startNs, endNs - startNs);
+    }
+    
+private:
+    const char* name;
+    int64_t startNs;
+};
+
+// Times the GL commands issued in scope on the GPU track
+class GpuProfileScope {
+public:
+    explicit GpuProfileScope(const char* name) : active(profiler.beginGpuPass(name)) {}
+    ~GpuProfileScope() {
+        if (active) profiler.endGpuPass();
+    }
+    
+private:
+    bool active;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#if ENABLE_PROFILER
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) GpuProfileScope PROFILE_CONCAT(gpuProfileScope, __LINE__)(name)
+#define PROFILE_THREAD_NAME(name) profiler.setThreadName(name)
+#define PROFILE_COLLECT_GPU() profiler.collectGpu()
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_GPU_SCOPE(name)
+#define PROFILE_THREAD_NAME(name)
+#define PROFILE_COLLECT_GPU()
+#endif
+
+// ============================================================================
+// GLUT SHAPES - Solid primitives that also draw without GLUT
+// ============================================================================
+
+// freeglut's shapes and fonts exit the program unless glutInit opened a
+// window, so headless runs draw GLU quadrics with the same size, axes and
+// tessellation instead, and leave out HUD text
+bool headlessRendering = false;
+
+GLUquadric* shapeQuadric() {
+    static GLUquadric* quadric = gluNewQuadric();
+    return quadric;
+}
+
+void solidCube(float size) {
+    if (!headlessRendering) {
+        glutSolidCube(size);
+        glCounter.shape(12);
+        return;
+    }
+
+    // Counter-clockwise faces seen from outside, like glutSolidCube
+    static const float normals[6][3] = { {0, 0, 1}, {0, 0, -1}, {0, 1, 0}, {0, -1, 0}, {1, 0, 0}, {-1, 0, 0} };
+    static const float corners[6][4][3] = {
+        { {-1, -1, 1}, {1, -1, 1}, {1, 1, 1}, {-1, 1, 1} },
+        { {-1, -1, -1}, {-1, 1, -1}, {1, 1, -1}, {1, -1, -1} },
+        { {-1, 1, -1}, {-1, 1, 1}, {1, 1, 1}, {1, 1, -1} },
+        { {-1, -1, -1}, {1, -1, -1}, {1, -1, 1}, {-1, -1, 1} },
+        { {1, -1, -1}, {1, 1, -1}, {1, 1, 1}, {1, -1, 1} },
+        { {-1, -1, -1}, {-1, -1, 1}, {-1, 1, 1}, {-1, 1, -1} }
+    };
+    float half = size * 0.5f;
+    glBegin(GL_QUADS);
+    for (int face = 0; face < 6; face++) {
+        glNormal3fv(normals[face]);
+        for (const auto& c : corners[face]) glVertex3f(c[0] * half, c[1] * half, c[2] * half);
+    }
+    glEnd();
+}
+
+void solidSphere(float radius, int slices, int stacks) {
+    glCounter.shape((size_t)slices * std::max(stacks - 1, 1) * 2);
+    if (!headlessRendering) {
+        glutSolidSphere(radius, slices, stacks);
+        return;
+    }
+    gluSphere(shapeQuadric(), radius, slices, stacks);
+}
+
+// Cone along +Z with its base disk at z = 0, like glutSolidCone
+void solidCone(float base, float height, int slices, int stacks) {
+    glCounter.shape((size_t)slices * (stacks * 2 + 1));
+    if (!headlessRendering) {
+        glutSolidCone(base, height, slices, stacks);
+        return;
+    }
+    GLUquadric* quadric = shapeQuadric();
+    gluCylinder(quadric, base, 0.0, height, slices, stacks);
+    gluQuadricOrientation(quadric, GLU_INSIDE);
+    gluDisk(quadric, 0.0, base, slices, 1);
+    gluQuadricOrientation(quadric, GLU_OUTSIDE);
+}
+
+// ============================================================================
+// BITMAP TEXT - GLUT fonts baked into one texture atlas, drawn as a batch
+// ============================================================================
+
+// glutBitmapCharacter sends every glyph as its own glBitmap, which is slow on
+// most drivers and stalls the HUD once the perf overlay's dozen lines are up.
+// At startup each GLUT font the game uses is drawn once into an offscreen
+// framebuffer and read back, so the atlas holds exactly the pixels GLUT
+// would have drawn, with the same advances: a string placed with drawText at
+// (x, y) lands where glRasterPos2f(x, y) + glutBitmapCharacter put it.
+// drawText only queues quads; renderHUD flushes the whole frame's text with
+// one glDrawArrays. Laid-out strings are cached by font and text, so static
+// labels are not re-laid out every frame. Without framebuffer objects (or
+// before init) drawText falls back to glutBitmapCharacter.
+class TextRenderer {
+public:
+    static const int FIRST_CHAR = 32;   // Printable ASCII only
+    static const int CHAR_COUNT = 96;
+    static const int ATLAS_WIDTH = 512;
+    
+    TextRenderer() : atlas(0), atlasHeight(0), frame(0) {}
+    
+    bool isReady() const { return atlas != 0; }
+    
+    // Bake the atlas; needs GLUT fonts and a current context
+    bool init() {
+        if (atlas != 0) return true;
+        if (!glExt.hasFramebuffers) {
+            std::cout << "Text atlas: no framebuffer objects, using glutBitmapCharacter" << std::endl;
+            return false;
+        }
         
-        while (std::getline(file, line)) {
-            // Remove carriage return if present (Windows line endings)
-            if (!line.empty() && line.back() == '\r') {
-                line.pop_back();
+        // Glyph cells are laid out 16 x 6, sized for the largest font
+        int cellWidth = 0, cellHeight = 0;
+        for (FontInfo& font : fonts) {
+            font.maxAdvance = 0;
+            for (int c = 0; c < CHAR_COUNT; c++) {
+                font.maxAdvance = std::max(font.maxAdvance, glutBitmapWidth(font.font, FIRST_CHAR + c));
             }
+            cellWidth = std::max(cellWidth, font.maxAdvance + font.size + 8);
+            cellHeight = std::max(cellHeight, font.size * 2 + 8);
+        }
+        const int width = cellWidth * 16;
+        const int height = cellHeight * (CHAR_COUNT / 16);
+        
+        GLint previousFramebuffer = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        GLuint framebuffer = 0, colorBuffer = 0;
+        glExt.genFramebuffers(1, &framebuffer);
+        glExt.genRenderbuffers(1, &colorBuffer);
+        glExt.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glExt.bindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glExt.renderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glExt.framebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        bool complete = glExt.checkFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        
+        std::vector<unsigned char> bitmaps[FONT_COUNT];
+        if (complete) {
+            glPushAttrib(GL_ALL_ATTRIB_BITS);
+            glMatrixMode(GL_PROJECTION);
+            glPushMatrix();
+            glLoadIdentity();
+            gluOrtho2D(0, width, 0, height);
+            glMatrixMode(GL_MODELVIEW);
+            glPushMatrix();
+            glLoadIdentity();
+            glViewport(0, 0, width, height);
+            glDisable(GL_LIGHTING);
+            glDisable(GL_TEXTURE_2D);
+            glDisable(GL_DEPTH_TEST);
+            glDisable(GL_BLEND);
+            glDisable(GL_FOG);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
             
-            std::istringstream iss(line);
-            std::string prefix;
-            iss >> prefix;
-            
-            if (prefix == "v") {
-                // Vertex position
-                Vector3 v;
-                iss >> v.x >> v.y >> v.z;
-                vertices.push_back(v);
-            }
-            else if (prefix == "vn") {
-                // Vertex normal
-                Vector3 n;
-                iss >> n.x >> n.y >> n.z;
-                normals.push_back(n);
-            }
-            else if (prefix == "vt") {
-                // Texture coordinate
-                Vector2 t;
-                iss >> t.u >> t.v;
-                texCoords.push_back(t);
-            }
-            else if (prefix == "f") {
-                // Face
-                Face face;
-                face.materialName = currentMaterial;
-                std::string vertexData;
-                
-                while (iss >> vertexData) {
-                    int vIdx = 0, vtIdx = 0, vnIdx = 0;
-                    
-                    // Parse face vertex data (formats: v, v/vt, v/vt/vn, v//vn)
-                    size_t pos1 = vertexData.find('/');
-                    if (pos1 == std::string::npos) {
-                        // Format: v
-                        vIdx = std::stoi(vertexData);
-                    } else {
-                        vIdx = std::stoi(vertexData.substr(0, pos1));
-                        size_t pos2 = vertexData.find('/', pos1 + 1);
-                        if (pos2 == std::string::npos) {
-                            // Format: v/vt
-                            vtIdx = std::stoi(vertexData.substr(pos1 + 1));
-                        } else {
-                            // Format: v/vt/vn or v//vn
-                            std::string vtStr = vertexData.substr(pos1 + 1, pos2 - pos1 - 1);
-                            if (!vtStr.empty()) {
-                                vtIdx = std::stoi(vtStr);
-                            }
-                            vnIdx = std::stoi(vertexData.substr(pos2 + 1));
-                        }
-                    }
-                    
-                    // OBJ indices are 1-based, convert to 0-based
-                    // Negative indices are relative to current count
-                    if (vIdx < 0) vIdx = vertices.size() + vIdx + 1;
-                    if (vtIdx < 0) vtIdx = texCoords.size() + vtIdx + 1;
-                    if (vnIdx < 0) vnIdx = normals.size() + vnIdx + 1;
-                    
-                    face.vertexIndices.push_back(vIdx - 1);
-                    face.texCoordIndices.push_back(vtIdx - 1);
-                    face.normalIndices.push_back(vnIdx - 1);
+            for (int f = 0; f < FONT_COUNT; f++) {
+                glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+                glClear(GL_COLOR_BUFFER_BIT);
+                glColor3f(1.0f, 1.0f, 1.0f);
+                for (int c = 0; c < CHAR_COUNT; c++) {
+                    glRasterPos2i((c % 16) * cellWidth + cellOriginX(f), (c / 16) * cellHeight + cellOriginY(f));
+                    glutBitmapCharacter(fonts[f].font, FIRST_CHAR + c);
                 }
-                
-                if (face.vertexIndices.size() >= 3) {
-                    faces.push_back(face);
-                }
-            }
-            else if (prefix == "mtllib") {
-                // Material library - read rest of line to handle filenames with spaces
-                std::string mtlFile;
-                std::getline(iss >> std::ws, mtlFile);
-                loadMTL(directory + mtlFile);
-            }
-            else if (prefix == "usemtl") {
-                // Use material - read rest of line to handle material names with spaces
-                std::getline(iss >> std::ws, currentMaterial);
+                bitmaps[f].resize((size_t)width * height * 4);
+                glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, bitmaps[f].data());
             }
+            
+            glMatrixMode(GL_PROJECTION);
+            glPopMatrix();
+            glMatrixMode(GL_MODELVIEW);
+            glPopMatrix();
+            glPopAttrib();
+            renderState.invalidate();
         }
         
-        file.close();
-        
-        // Calculate bounds
-        calculateBounds();
+        glExt.bindFramebuffer(GL_FRAMEBUFFER, (GLuint)previousFramebuffer);
+        glExt.bindRenderbuffer(GL_RENDERBUFFER, 0);
+        glExt.deleteRenderbuffers(1, &colorBuffer);
+        glExt.deleteFramebuffers(1, &framebuffer);
+        if (!complete) {
+            std::cout << "Text atlas: framebuffer incomplete, using glutBitmapCharacter" << std::endl;
+            return false;
+        }
         
-        // Generate normals if not provided
-        if (normals.empty()) {
-            generateNormals();
+        // Tight bounds of every glyph relative to its pen position
+        for (int f = 0; f < FONT_COUNT; f++) {
+            for (int c = 0; c < CHAR_COUNT; c++) {
+                Glyph& glyph = fonts[f].glyphs[c];
+                glyph.advance = (float)glutBitmapWidth(fonts[f].font, FIRST_CHAR + c);
+                int cellX = (c % 16) * cellWidth, cellY = (c / 16) * cellHeight;
+                int minX = cellWidth, minY = cellHeight, maxX = -1, maxY = -1;
+                for (int y = 0; y < cellHeight; y++) {
+                    for (int x = 0; x < cellWidth; x++) {
+                        if (bitmaps[f][((size_t)(cellY + y) * width + cellX + x) * 4] == 0) continue;
+                        minX = std::min(minX, x);
+                        minY = std::min(minY, y);
+                        maxX = std::max(maxX, x);
+                        maxY = std::max(maxY, y);
+                    }
+                }
+                glyph.width = maxX >= 0 ? maxX - minX + 1 : 0;
+                glyph.height = maxY >= 0 ? maxY - minY + 1 : 0;
+                glyph.offsetX = minX - cellOriginX(f);
+                glyph.offsetY = minY - cellOriginY(f);
+                glyph.sourceX = cellX + minX;
+                glyph.sourceY = cellY + minY;
+            }
         }
         
-        // Create display list for faster rendering
-        // Check if any materials have textures
-        hasTextures = false;
-        for (const auto& mat : materials) {
-            if (mat.second.textureId != 0) {
-                hasTextures = true;
-                break;
+        // Shelf-pack every font's glyphs into one alpha texture
+        int penX = 1, penY = 1, shelfHeight = 0;
+        for (FontInfo& font : fonts) {
+            for (Glyph& glyph : font.glyphs) {
+                if (glyph.width == 0) continue;
+                if (penX + glyph.width + 1 > ATLAS_WIDTH) {
+                    penX = 1;
+                    penY += shelfHeight + 1;
+                    shelfHeight = 0;
+                }
+                glyph.atlasX = penX;
+                glyph.atlasY = penY;
+                penX += glyph.width + 1;
+                shelfHeight = std::max(shelfHeight, glyph.height);
             }
         }
+        atlasHeight = 1;
+        while (atlasHeight < penY + shelfHeight + 1) atlasHeight *= 2;
         
-        // Create display list for all models (including textured ones)
-        createDisplayList();
+        std::vector<unsigned char> texels((size_t)ATLAS_WIDTH * atlasHeight, 0);
+        for (int f = 0; f < FONT_COUNT; f++) {
+            for (Glyph& glyph : fonts[f].glyphs) {
+                for (int y = 0; y < glyph.height; y++) {
+                    for (int x = 0; x < glyph.width; x++) {
+                        size_t source = ((size_t)(glyph.sourceY + y) * width + glyph.sourceX + x) * 4;
+                        texels[(size_t)(glyph.atlasY + y) * ATLAS_WIDTH + glyph.atlasX + x] = bitmaps[f][source];
+                    }
+                }
+                glyph.u0 = (float)glyph.atlasX / ATLAS_WIDTH;
+                glyph.v0 = (float)glyph.atlasY / atlasHeight;
+                glyph.u1 = (float)(glyph.atlasX + glyph.width) / ATLAS_WIDTH;
+                glyph.v1 = (float)(glyph.atlasY + glyph.height) / atlasHeight;
+            }
+        }
         
-        isLoaded = true;
-        std::cout << "Loaded OBJ: " << vertices.size() << " vertices, " 
-                  << faces.size() << " faces, " 
-                  << materials.size() << " materials" << std::endl;
+        glGenTextures(1, &atlas);
+        renderState.bindTexture(atlas);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, ATLAS_WIDTH, atlasHeight, 0, GL_ALPHA, GL_UNSIGNED_BYTE, texels.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        renderState.bindTexture(0);
         
+        std::cout << "Text atlas: " << FONT_COUNT << " fonts, " << ATLAS_WIDTH << "x" << atlasHeight << std::endl;
         return true;
     }
     
-    // Load MTL material file
-    bool loadMTL(const std::string& filename) {
-        std::ifstream file(filename);
-        if (!file.is_open()) {
-            std::cerr << "Warning: Could not open MTL file: " << filename << std::endl;
-            return false;
-        }
+    void cleanup() {
+        if (atlas == 0) return;
+        renderState.forgetTexture(atlas);
+        glDeleteTextures(1, &atlas);
+        atlas = 0;
+        layouts.clear();
+        batch.clear();
+    }
+    
+    // Queue text with its pen starting at (x, y), like glRasterPos2f; false
+    // if the font was not baked and the caller has to draw it itself
+    bool add(void* font, float x, float y, const std::string& text, float r, float g, float b) {
+        int f = fontIndex(font);
+        if (atlas == 0 || f < 0) return false;
         
-        std::cout << "Loading MTL file: " << filename << std::endl;
+        std::string key = std::string(1, (char)('0' + f)) + text;
+        auto found = layouts.find(key);
+        if (found == layouts.end()) {
+            found = layouts.emplace(key, layout(fonts[f], text)).first;
+        }
+        Layout& cached = found->second;
+        cached.lastUsed = frame;
         
-        Material* currentMat = nullptr;
-        std::string line;
+        float originX = std::floor(x), originY = std::floor(y);
+        for (const LayoutVertex& v : cached.vertices) {
+            batch.push_back({ originX + v.x, originY + v.y, v.u, v.v, r, g, b });
+        }
+        return true;
+    }
+    
+    // Draw everything queued this frame; call inside renderHUD's 2D projection
+    void flush() {
+        frame++;
+        if (frame % 60 == 0) pruneLayouts();
+        if (batch.empty()) return;
         
-        while (std::getline(file, line)) {
+        renderState.disable(GL_LIGHTING);
+        renderState.disable(GL_DEPTH_TEST);
+        renderState.enable(GL_TEXTURE_2D);
+        renderState.enable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        renderState.bindTexture(atlas);
+        if (glExt.hasBuffers) glExt.bindBuffer(GL_ARRAY_BUFFER, 0);
+        
+        const GLsizei stride = sizeof(TextVertex);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, stride, &batch[0].x);
+        glTexCoordPointer(2, GL_FLOAT, stride, &batch[0].u);
+        glColorPointer(3, GL_FLOAT, stride, &batch[0].r);
+        glDrawArrays(GL_QUADS, 0, (GLsizei)batch.size());
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        
+        renderState.disable(GL_BLEND);
+        renderState.disable(GL_TEXTURE_2D);
+        batch.clear();
+    }
+    
+private:
+    enum { FONT_COUNT = 4 };
+    
+    struct Glyph {
+        float advance;
+        int width, height;        // Tight bounds, 0 for blank glyphs
+        int offsetX, offsetY;     // Bottom-left corner relative to the pen
+        int sourceX, sourceY;     // In the baked framebuffer
+        int atlasX, atlasY;
+        float u0, v0, u1, v1;
+    };
+    
+    struct FontInfo {
+        void* font;
+        int size;                 // Nominal pixel height, sizes the bake cells
+        int maxAdvance;
+        Glyph glyphs[CHAR_COUNT];
+    };
+    
+    struct LayoutVertex { float x, y, u, v; };
+    
+    struct Layout {
+        std::vector<LayoutVertex> vertices;  // Quads relative to the pen start
+        unsigned int lastUsed;
+    };
+    
+    // Float color, so it rounds the same as the glColor3f it replaces
+    struct TextVertex {
+        float x, y, u, v;
+        float r, g, b;
+    };
+    
+    int cellOriginX(int f) const { return fonts[f].size / 2 + 4; }
+    int cellOriginY(int f) const { return fonts[f].size / 2 + 4; }
+    
+    int fontIndex(void* font) const {
+        for (int f = 0; f < FONT_COUNT; f++) {
+            if (fonts[f].font == font) return f;
+        }
+        return -1;
+    }
+    
+    Layout layout(const FontInfo& font, const std::string& text) const {
+        Layout result;
+        result.lastUsed = frame;
+        result.vertices.reserve(text.size() * 4);
+        float pen = 0.0f;
+        for (char ch : text) {
+            int c = (unsigned char)ch - FIRST_CHAR;
+            if (c < 0 || c >= CHAR_COUNT) continue;
+            const Glyph& glyph = font.glyphs[c];
+            if (glyph.width > 0) {
+                float x0 = pen + glyph.offsetX, y0 = (float)glyph.offsetY;
+                float x1 = x0 + glyph.width, y1 = y0 + glyph.height;
+                result.vertices.push_back({ x0, y0, glyph.u0, glyph.v0 });
+                result.vertices.push_back({ x1, y0, glyph.u1, glyph.v0 });
+                result.vertices.push_back({ x1, y1, glyph.u1, glyph.v1 });
+                result.vertices.push_back({ x0, y1, glyph.u0, glyph.v1 });
+            }
+            pen += glyph.advance;
+        }
+        return result;
+    }
+    
+    // Drop layouts not drawn for a few seconds (scores, overlay numbers)
+    void pruneLayouts() {
+        for (auto it = layouts.begin(); it != layouts.end();) {
+            if (frame - it->second.lastUsed > 300) it = layouts.erase(it);
+            else ++it;
+        }
+    }
+    
+    FontInfo fonts[FONT_COUNT] = {
+        { GLUT_BITMAP_8_BY_13, 13, 0, {} },
+        { GLUT_BITMAP_HELVETICA_12, 12, 0, {} },
+        { GLUT_BITMAP_HELVETICA_18, 18, 0, {} },
+        { GLUT_BITMAP_TIMES_ROMAN_24, 24, 0, {} },
+    };
+    GLuint atlas;
+    int atlasHeight;
+    unsigned int frame;
+    std::unordered_map<std::string, Layout> layouts;
+    std::vector<TextVertex> batch;  // This frame's quads
+};
+
+TextRenderer textRenderer;
+
+// Draw text with its pen starting at (x, y) in window pixels. Batched through
+// the atlas when it is ready (shown at the next textRenderer.flush()),
+// otherwise drawn right away with glutBitmapCharacter.
+void drawText(void* font, float x, float y, const std::string& text, float r, float g, float b) {
+    if (headlessRendering) return;
+    if (textRenderer.add(font, x, y, text, r, g, b)) return;
+    glColor3f(r, g, b);
+    glRasterPos2f(x, y);
+    for (char c : text) {
+        glutBitmapCharacter(font, c);
+    }
+}
+
+// ============================================================================
+// TEXTURE SETTINGS - Per-texture filtering and quality read from textures.cfg
+// ============================================================================
+
+// Config format, one texture per line (paths with spaces go in quotes):
+//   global                  budget=32
+//   default                 filter=trilinear mipmaps=on anisotropy=4
+//   "models/herbe 2.jpg"    anisotropy=8 priority=2
+// filter:     nearest | bilinear | trilinear (mip blending)
+// mipmaps:    on | off (off uploads level 0 only)
+// anisotropy: 1-16, clamped to what the driver supports
+// maxsize:    largest width/height in texels, bigger images are halved at
+//             load time (0 = no limit)
+// compress:   on | off, S3TC or RGTC/LATC blocks when the driver has them
+// priority:   importance under the budget; the lowest priority textures are
+//             downscaled first
+// budget:     estimated texture memory allowed in MB (0 = no limit)
+// Keys left out of a texture line fall back to the "default" line.
+enum TextureFilter { TEXTURE_FILTER_NEAREST, TEXTURE_FILTER_BILINEAR, TEXTURE_FILTER_TRILINEAR };
+
+struct TextureSettings {
+    TextureFilter filter;
+    bool mipmaps;
+    float anisotropy;
+    int maxSize;
+    bool compress;
+    int priority;
+    
+    TextureSettings() : filter(TEXTURE_FILTER_TRILINEAR), mipmaps(true), anisotropy(1.0f),
+                        maxSize(0), compress(false), priority(1) {}
+};
+
+// Lexically normalised path used as the registry key: '/' separators,
+// no "." segments, ".." folded where possible (case-insensitive on Windows)
+std::string canonicalTexturePath(const std::string& path) {
+    std::string unified = path;
+    std::replace(unified.begin(), unified.end(), '\\', '/');
+    
+    std::vector<std::string> segments;
+    size_t start = 0;
+    while (start <= unified.size()) {
+        size_t end = unified.find('/', start);
+        if (end == std::string::npos) end = unified.size();
+        std::string segment = unified.substr(start, end - start);
+        if (segment == "..") {
+            if (!segments.empty() && segments.back() != "..") segments.pop_back();
+            else segments.push_back(segment);
+        } else if (!segment.empty() && segment != ".") {
+            segments.push_back(segment);
+        }
+        start = end + 1;
+    }
+    
+    std::string canonical = (!unified.empty() && unified[0] == '/') ? "/" : "";
+    for (size_t i = 0; i < segments.size(); i++) {
+        if (i > 0) canonical += '/';
+        canonical += segments[i];
+    }
+#ifdef _WIN32
+    std::transform(canonical.begin(), canonical.end(), canonical.begin(), ::tolower);
+#endif
+    return canonical;
+}
+
+class TextureConfig {
+public:
+    TextureConfig() : budget(0) {}
+    
+    // Read the config; a missing file keeps the built-in defaults. Must run
+    // before any loader thread starts, lookups are unsynchronised.
+    bool load(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file.is_open()) return false;
+        
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(file, line)) {
+            lineNumber++;
+            size_t start = line.find_first_not_of(" \t\r");
+            if (start == std::string::npos || line[start] == '#') continue;
+            
+            // Texture path, optionally quoted
+            std::string path;
+            size_t end;
+            if (line[start] == '"') {
+                end = line.find('"', start + 1);
+                if (end == std::string::npos) {
+                    std::cerr << filename << ":" << lineNumber << ": unterminated quote" << std::endl;
+                    continue;
+                }
+                path = line.substr(start + 1, end - start - 1);
+                end++;
+            } else {
+                end = line.find_first_of(" \t\r", start);
+                if (end == std::string::npos) end = line.size();
+                path = line.substr(start, end - start);
+            }
+            
+            Override entry;
+            std::istringstream keys(line.substr(end));
+            std::string token;
+            while (keys >> token) {
+                size_t eq = token.find('=');
+                std::string key = token.substr(0, eq);
+                std::string value = (eq == std::string::npos) ? "" : token.substr(eq + 1);
+                if (key == "filter" && (value == "nearest" || value == "bilinear" || value == "trilinear")) {
+                    entry.values.filter = (value == "nearest") ? TEXTURE_FILTER_NEAREST :
+                                   (value == "bilinear") ? TEXTURE_FILTER_BILINEAR : TEXTURE_FILTER_TRILINEAR;
+                    entry.hasFilter = true;
+                } else if (key == "mipmaps" && (value == "on" || value == "off")) {
+                    entry.values.mipmaps = (value == "on");
+                    entry.hasMipmaps = true;
+                } else if (key == "anisotropy" && atof(value.c_str()) >= 1.0f) {
+                    entry.values.anisotropy = std::min(16.0f, (float)atof(value.c_str()));
+                    entry.hasAnisotropy = true;
+                } else if (key == "maxsize" && !value.empty() && isdigit((unsigned char)value[0])) {
+                    entry.values.maxSize = atoi(value.c_str());
+                    entry.hasMaxSize = true;
+                } else if (key == "compress" && (value == "on" || value == "off")) {
+                    entry.values.compress = (value == "on");
+                    entry.hasCompress = true;
+                } else if (key == "priority" && !value.empty()) {
+                    entry.values.priority = atoi(value.c_str());
+                    entry.hasPriority = true;
+                } else if (key == "budget" && path == "global" && !value.empty() && isdigit((unsigned char)value[0])) {
+                    budget = (size_t)(atof(value.c_str()) * 1024 * 1024);
+                } else {
+                    std::cerr << filename << ":" << lineNumber << ": ignoring '" << token << "'" << std::endl;
+                }
+            }
+            
+            if (path == "default") {
+                entry.applyTo(defaults);
+            } else if (path != "global") {
+                overrides[canonicalTexturePath(path)] = entry;
+            }
+        }
+        
+        std::cout << "Texture settings: " << filename << " (" << overrides.size() << " overrides";
+        if (budget > 0) std::cout << ", budget " << budget / (1024 * 1024) << " MB";
+        std::cout << ")" << std::endl;
+        return true;
+    }
+    
+    TextureSettings settingsFor(const std::string& path) const {
+        TextureSettings settings = defaults;
+        auto it = overrides.find(canonicalTexturePath(path));
+        if (it != overrides.end()) it->second.applyTo(settings);
+        return settings;
+    }
+    
+    // Estimated texture memory the registry may keep resident (0 = no limit)
+    size_t budgetBytes() const { return budget; }
+    void setBudgetBytes(size_t bytes) { budget = bytes; }
+    
+private:
+    // Only the keys present on a line override the defaults
+    struct Override {
+        bool hasFilter, hasMipmaps, hasAnisotropy, hasMaxSize, hasCompress, hasPriority;
+        TextureSettings values;
+        
+        Override() : hasFilter(false), hasMipmaps(false), hasAnisotropy(false),
+                     hasMaxSize(false), hasCompress(false), hasPriority(false) {}
+        
+        void applyTo(TextureSettings& settings) const {
+            if (hasFilter) settings.filter = values.filter;
+            if (hasMipmaps) settings.mipmaps = values.mipmaps;
+            if (hasAnisotropy) settings.anisotropy = values.anisotropy;
+            if (hasMaxSize) settings.maxSize = values.maxSize;
+            if (hasCompress) settings.compress = values.compress;
+            if (hasPriority) settings.priority = values.priority;
+        }
+    };
+    
+    size_t budget;
+    TextureSettings defaults;
+    std::map<std::string, Override> overrides;  // Canonical path -> settings
+};
+
+TextureConfig textureConfig;
+
+// Set the sampling state of the bound texture. With useMipmaps false the
+// texture samples level 0 only (bilinear, no anisotropy) even if it has a
+// mip chain, which is how the renderer behaved before mipmapping.
+void applyTextureFilter(const TextureSettings& settings, bool hasMipmaps, bool useMipmaps) {
+    bool mipmapped = hasMipmaps && useMipmaps;
+    GLint minFilter, magFilter;
+    switch (settings.filter) {
+        case TEXTURE_FILTER_NEAREST:
+            minFilter = mipmapped ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST;
+            magFilter = GL_NEAREST;
+            break;
+        case TEXTURE_FILTER_BILINEAR:
+            minFilter = mipmapped ? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR;
+            magFilter = GL_LINEAR;
+            break;
+        default:
+            minFilter = mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR;
+            magFilter = GL_LINEAR;
+            break;
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+    
+    if (glExt.maxAnisotropy > 1.0f) {
+        float anisotropy = mipmapped ? std::min(settings.anisotropy, glExt.maxAnisotropy) : 1.0f;
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisotropy);
+    }
+}
+
+// ============================================================================
+// TEXTURE LOADER FUNCTION
+// ============================================================================
+
+// Pixels decoded by stb_image, already reduced to the configured maximum
+// size and with any mip chain built; decoding is safe on any thread,
+// uploading needs the GL thread
+struct DecodedImage {
+    std::string path;
+    int width, height, channels;       // Level 0 as it will be uploaded
+    int sourceWidth, sourceHeight;     // Size of the image file
+    TextureSettings settings;
+    std::vector<std::vector<unsigned char>> levels;  // Level 0, then mips when enabled
+    
+    DecodedImage() : width(0), height(0), channels(0), sourceWidth(0), sourceHeight(0) {}
+    DecodedImage(DecodedImage&&) = default;
+    DecodedImage& operator=(DecodedImage&&) = default;
+    DecodedImage(const DecodedImage&) = delete;
+    DecodedImage& operator=(const DecodedImage&) = delete;
+    
+    bool isValid() const { return !levels.empty(); }
+};
+
+// Halve an image with a 2x2 box filter. Odd dimensions repeat the last
+// row/column so non-power-of-two textures still reduce down to 1x1.
+void downsampleImage(const unsigned char* src, int width, int height, int channels,
+                     std::vector<unsigned char>& dst, int& dstWidth, int& dstHeight) {
+    dstWidth = std::max(1, width / 2);
+    dstHeight = std::max(1, height / 2);
+    dst.resize((size_t)dstWidth * dstHeight * channels);
+    
+    for (int y = 0; y < dstHeight; y++) {
+        const unsigned char* row0 = src + (size_t)std::min(y * 2, height - 1) * width * channels;
+        const unsigned char* row1 = src + (size_t)std::min(y * 2 + 1, height - 1) * width * channels;
+        unsigned char* out = &dst[(size_t)y * dstWidth * channels];
+        for (int x = 0; x < dstWidth; x++) {
+            int x0 = std::min(x * 2, width - 1) * channels;
+            int x1 = std::min(x * 2 + 1, width - 1) * channels;
+            for (int c = 0; c < channels; c++) {
+                *out++ = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+            }
+        }
+    }
+}
+
+// Decode a texture, shrink it to its maxsize and, when its settings ask for
+// mipmaps, build the full mip chain on the CPU so loader threads do that
+// work instead of the GL thread
+DecodedImage decodeImage(const std::string& filename) {
+    PROFILE_SCOPE("decodeImage");
+    DecodedImage image;
+    image.path = filename;
+    image.settings = textureConfig.settingsFor(filename);
+    
+    unsigned char* pixels = stbi_load(filename.c_str(), &image.width, &image.height, &image.channels, 0);
+    if (!pixels) {
+        std::cerr << "Failed to load texture: " << filename << std::endl;
+        return image;
+    }
+    image.sourceWidth = image.width;
+    image.sourceHeight = image.height;
+    image.levels.emplace_back(pixels, pixels + (size_t)image.width * image.height * image.channels);
+    stbi_image_free(pixels);
+    
+    int maxSize = image.settings.maxSize;
+    while (maxSize > 0 && std::max(image.width, image.height) > maxSize) {
+        std::vector<unsigned char> smaller;
+        downsampleImage(image.levels[0].data(), image.width, image.height, image.channels,
+                        smaller, image.width, image.height);
+        image.levels[0].swap(smaller);
+    }
+    
+    if (image.settings.mipmaps) {
+        int width = image.width, height = image.height;
+        while (width > 1 || height > 1) {
+            std::vector<unsigned char> level;
+            downsampleImage(image.levels.back().data(), width, height, image.channels, level, width, height);
+            image.levels.push_back(std::move(level));
+        }
+    }
+    return image;
+}
+
+// Client pixel format for a channel count
+GLenum texturePixelFormat(int channels) {
+    switch (channels) {
+        case 1: return GL_LUMINANCE;
+        case 2: return GL_LUMINANCE_ALPHA;
+        case 4: return GL_RGBA;
+        default: return GL_RGB;
+    }
+}
+
+// Internal format to upload as: a compressed block format when requested
+// and supported, otherwise the pixel format itself
+GLenum textureInternalFormat(int channels, bool compress) {
+    if (compress && glExt.hasS3TC && channels == 3) return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    if (compress && glExt.hasS3TC && channels == 4) return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    if (compress && glExt.hasLATC && channels == 1) return GL_COMPRESSED_LUMINANCE_LATC1_EXT;
+    if (compress && glExt.hasLATC && channels == 2) return GL_COMPRESSED_LUMINANCE_ALPHA_LATC2_EXT;
+    return texturePixelFormat(channels);
+}
+
+// Estimated video memory for a texture and its mip levels. Block formats
+// store each 4x4 texel block in 8 or 16 bytes; uncompressed RGB is padded
+// to 4 bytes per texel by practically every driver.
+size_t estimateTextureBytes(int width, int height, int levelCount, GLenum internalFormat) {
+    size_t bytes = 0;
+    for (int level = 0; level < levelCount; level++) {
+        size_t blocks = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+        switch (internalFormat) {
+            case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+            case GL_COMPRESSED_LUMINANCE_LATC1_EXT:
+                bytes += blocks * 8;
+                break;
+            case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            case GL_COMPRESSED_LUMINANCE_ALPHA_LATC2_EXT:
+                bytes += blocks * 16;
+                break;
+            case GL_LUMINANCE:
+                bytes += (size_t)width * height;
+                break;
+            case GL_LUMINANCE_ALPHA:
+                bytes += (size_t)width * height * 2;
+                break;
+            default:
+                bytes += (size_t)width * height * 4;
+                break;
+        }
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+    return bytes;
+}
+
+// Specify levels 0..n-1 of the bound texture from tightly packed pixels,
+// each level half the size of the previous one
+void uploadTextureLevels(const std::vector<std::vector<unsigned char>>& levels, int width, int height,
+                         int channels, GLenum internalFormat) {
+    // Rows are tightly packed, which matters for RGB images and mip levels
+    // whose row size is not a multiple of 4
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    GLenum format = texturePixelFormat(channels);
+    for (size_t i = 0; i < levels.size(); i++) {
+        glTexImage2D(GL_TEXTURE_2D, (GLint)i, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, levels[i].data());
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+}
+
+GLuint uploadTexture(const DecodedImage& image, GLenum& internalFormat) {
+    if (!image.isValid()) return 0;
+    
+    std::ostringstream info;  // Printed in one piece, loader threads log too
+    info << "Loaded texture: " << image.path << " (" << image.width << "x" << image.height << ", " << image.channels << " channels";
+    if (image.width != image.sourceWidth || image.height != image.sourceHeight) {
+        info << ", reduced from " << image.sourceWidth << "x" << image.sourceHeight;
+    }
+    if (image.levels.size() > 1) info << ", " << image.levels.size() - 1 << " mip levels";
+    
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    renderState.bindTexture(textureID);
+    
+    // Set texture parameters
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    applyTextureFilter(image.settings, image.levels.size() > 1, true);
+    
+    // Upload texture data
+    internalFormat = textureInternalFormat(image.channels, image.settings.compress);
+    uploadTextureLevels(image.levels, image.width, image.height, image.channels, internalFormat);
+    
+    // Drivers may accept a compressed format and still store plain texels
+    if (internalFormat != texturePixelFormat(image.channels)) {
+        GLint compressed = GL_FALSE;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+        if (compressed) info << ", compressed";
+        else internalFormat = texturePixelFormat(image.channels);
+    }
+    std::cout << info.str() << ")" << std::endl;
+    
+    return textureID;
+}
+
+// ============================================================================
+// TEXTURE REGISTRY - Reference-counted textures shared by path
+// ============================================================================
+
+class TextureRegistry {
+public:
+    TextureRegistry() : residentBytes(0), mipmapsEnabled(true) {}
+    
+    // Return the texture for a path, decoding and uploading it on first use.
+    // Every successful acquire must be matched by a release().
+    GLuint acquire(const std::string& path) {
+        GLuint id = addRef(canonicalTexturePath(path));
+        if (id != 0) return id;
+        return insert(decodeImage(path));
+    }
+    
+    // Same, for an image a loader thread has already decoded (the pixels
+    // are only uploaded when the path is not resident yet)
+    GLuint acquire(const DecodedImage& image) {
+        GLuint id = addRef(canonicalTexturePath(image.path));
+        if (id != 0) return id;
+        return insert(image);
+    }
+    
+    // Drop one reference; the GL texture is deleted with the last one
+    void release(GLuint id) {
+        if (id == 0) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto byId = pathById.find(id);
+        if (byId == pathById.end()) return;
+        
+        auto entry = entries.find(byId->second);
+        if (--entry->second.refCount > 0) return;
+        
+        renderState.forgetTexture(id);
+        glDeleteTextures(1, &id);
+        residentBytes -= entry->second.bytes;
+        entries.erase(entry);
+        pathById.erase(byId);
+    }
+    
+    bool isResident(const std::string& path) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.count(canonicalTexturePath(path)) != 0;
+    }
+    
+    // Estimated video memory held by all resident textures
+    size_t bytesResident() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return residentBytes;
+    }
+    
+    size_t textureCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+    
+    // Switch every resident texture between its mip chain and level 0 only
+    // (GL thread). Used by the 'M' key and the --bench-mips comparison.
+    void setMipmapsEnabled(bool enabled) {
+        std::lock_guard<std::mutex> lock(mutex);
+        mipmapsEnabled = enabled;
+        for (const auto& it : entries) {
+            renderState.bindTexture(it.second.id);
+            applyTextureFilter(it.second.settings, it.second.levelCount > 1, enabled);
+        }
+        renderState.bindTexture(0);
+    }
+    
+    bool areMipmapsEnabled() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return mipmapsEnabled;
+    }
+    
+    // Halve the least important textures until the estimated memory fits
+    // the budget (GL thread). Lowest priority goes first; among equals the
+    // largest texture is shrunk, so detail is lost where it saves the most.
+    // Textures whose longer side is 64 texels or less are left alone.
+    void enforceBudget(size_t budget) {
+        if (budget == 0) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t before = residentBytes;
+        int steps = 0;
+        
+        while (residentBytes > budget) {
+            Entry* victim = nullptr;
+            for (auto& it : entries) {
+                Entry& entry = it.second;
+                if (std::max(entry.width, entry.height) <= 64) continue;
+                if (!victim || entry.settings.priority < victim->settings.priority ||
+                    (entry.settings.priority == victim->settings.priority && entry.bytes > victim->bytes)) {
+                    victim = &entry;
+                }
+            }
+            if (!victim) break;
+            downscale(*victim);
+            steps++;
+        }
+        renderState.bindTexture(0);
+        
+        if (steps > 0 || residentBytes > budget) {
+            std::cout << "Texture budget " << budget / 1024 << " KB: " << before / 1024 << " KB -> "
+                      << residentBytes / 1024 << " KB after " << steps << " downscales" << std::endl;
+        }
+    }
+    
+    // One line per resident texture, for the budget report
+    void printReport() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& it : entries) {
+            const Entry& entry = it.second;
+            std::cout << "  " << it.first << ": " << entry.width << "x" << entry.height
+                      << (entry.internalFormat != texturePixelFormat(entry.channels) ? " compressed" : "")
+                      << ", priority " << entry.settings.priority << ", " << entry.bytes / 1024 << " KB" << std::endl;
+        }
+    }
+    
+private:
+    struct Entry {
+        GLuint id;
+        int refCount;
+        int width, height, channels;
+        int levelCount;
+        GLenum internalFormat;
+        size_t bytes;  // Estimated video memory of all levels
+        TextureSettings settings;
+    };
+    
+    std::map<std::string, Entry> entries;    // Canonical path -> texture
+    std::map<GLuint, std::string> pathById;
+    size_t residentBytes;
+    bool mipmapsEnabled;
+    mutable std::mutex mutex;                // Loader threads query isResident()
+    
+    GLuint addRef(const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it == entries.end()) return 0;
+        it->second.refCount++;
+        return it->second.id;
+    }
+    
+    GLuint insert(const DecodedImage& image) {
+        GLenum internalFormat;
+        GLuint id = uploadTexture(image, internalFormat);
+        if (id == 0) return 0;
+        
+        Entry entry;
+        entry.id = id;
+        entry.refCount = 1;
+        entry.width = image.width;
+        entry.height = image.height;
+        entry.channels = image.channels;
+        entry.levelCount = (int)image.levels.size();
+        entry.internalFormat = internalFormat;
+        entry.bytes = estimateTextureBytes(image.width, image.height, entry.levelCount, internalFormat);
+        entry.settings = image.settings;
+        
+        std::string key = canonicalTexturePath(image.path);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!mipmapsEnabled) applyTextureFilter(entry.settings, entry.levelCount > 1, false);
+        entries[key] = entry;
+        pathById[id] = key;
+        residentBytes += entry.bytes;
+        return id;
+    }
+    
+    // Re-specify a texture at half its size. Mipmapped textures drop their
+    // top level (the rest are read back from GL); single-level textures are
+    // read back and box-filtered. Compressed textures read back decoded.
+    void downscale(Entry& entry) {
+        renderState.bindTexture(entry.id);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        GLenum format = texturePixelFormat(entry.channels);
+        
+        std::vector<std::vector<unsigned char>> levels;
+        int width = std::max(1, entry.width / 2);
+        int height = std::max(1, entry.height / 2);
+        if (entry.levelCount > 1) {
+            int levelWidth = width, levelHeight = height;
+            for (int level = 1; level < entry.levelCount; level++) {
+                levels.emplace_back((size_t)levelWidth * levelHeight * entry.channels);
+                glGetTexImage(GL_TEXTURE_2D, level, format, GL_UNSIGNED_BYTE, levels.back().data());
+                levelWidth = std::max(1, levelWidth / 2);
+                levelHeight = std::max(1, levelHeight / 2);
+            }
+        } else {
+            std::vector<unsigned char> full((size_t)entry.width * entry.height * entry.channels);
+            glGetTexImage(GL_TEXTURE_2D, 0, format, GL_UNSIGNED_BYTE, full.data());
+            levels.emplace_back();
+            downsampleImage(full.data(), entry.width, entry.height, entry.channels, levels.back(), width, height);
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        
+        uploadTextureLevels(levels, width, height, entry.channels, entry.internalFormat);
+        
+        residentBytes -= entry.bytes;
+        entry.width = width;
+        entry.height = height;
+        entry.levelCount = (int)levels.size();
+        entry.bytes = estimateTextureBytes(width, height, entry.levelCount, entry.internalFormat);
+        residentBytes += entry.bytes;
+    }
+};
+
+TextureRegistry textureRegistry;
+
+// Load a texture through the registry; release it with releaseTexture()
+GLuint loadTexture(const std::string& filename) {
+    PROFILE_SCOPE("loadTexture");
+    return textureRegistry.acquire(filename);
+}
+
+void releaseTexture(GLuint textureId) {
+    textureRegistry.release(textureId);
+}
+
+// ============================================================================
+// BACKGROUND MUSIC VARIABLES
+// ============================================================================
+
+bool backgroundMusicPlaying = false;  // Track if background music is playing
+std::string currentBackgroundMusic = "";  // Current background music file
+std::mutex musicMutex;  // Mutex to ensure only one music plays at a time
+
+// ============================================================================
+// SOUND FUNCTION
+// ============================================================================
+
+void playDamageSound() {
+#ifdef _WIN32
+    // Play obstacle.wav asynchronously (non-blocking)
+    PlaySound(TEXT("obstacle.wav"), NULL, SND_FILENAME | SND_ASYNC);
+#endif
+}
+
+void playKeySound() {
+#ifdef _WIN32
+    // Play keys.wav asynchronously (non-blocking)
+    PlaySound(TEXT("keys.wav"), NULL, SND_FILENAME | SND_ASYNC);
+#endif
+}
+
+void playExplosionSound() {
+#ifdef _WIN32
+    // Play explosion.wav asynchronously (non-blocking)
+    PlaySound(TEXT("explosion.wav"), NULL, SND_FILENAME | SND_ASYNC);
+#endif
+}
+
+void playCrystalSound() {
+#ifdef _WIN32
+    // Play crystal.wav asynchronously (non-blocking)
+    PlaySound(TEXT("crystal.wav"), NULL, SND_FILENAME | SND_ASYNC);
+#endif
+}
+
+void playGameWinSound() {
+#ifdef _WIN32
+    // Play game win.wav asynchronously (non-blocking)
+    PlaySound(TEXT("game win.wav"), NULL, SND_FILENAME | SND_ASYNC);
+#endif
+}
+
+void playGameOverSound() {
+#ifdef _WIN32
+    // Play game over.wav asynchronously (non-blocking)
+    PlaySound(TEXT("game over.wav"), NULL, SND_FILENAME | SND_ASYNC);
+#endif
+}
+
+void playJumpSound() {
+#ifdef _WIN32
+    // Play jump.wav asynchronously (non-blocking)
+    PlaySound(TEXT("jump.wav"), NULL, SND_FILENAME | SND_ASYNC);
+#endif
+}
+
+// Forward declaration
+void stopBackgroundMusic();
+
+void playBackgroundMusic(const char* filename) {
+#ifdef _WIN32
+    std::lock_guard<std::mutex> lock(musicMutex);
+    
+    // Stop any current background music completely
+    backgroundMusicPlaying = false;
+    currentBackgroundMusic = "";
+    
+    // Force close all MCI devices that might be playing
+    mciSendString("close all", NULL, 0, NULL);
+    
+    // Give it a moment to stop completely
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    
+    // Store the new filename
+    currentBackgroundMusic = filename;
+    backgroundMusicPlaying = true;
+    
+    std::cout << "Starting background music: " << filename << std::endl;
+    
+    // Create a thread to handle looping background music
+    std::thread([filename]() {  // Capture filename by value
+        std::string localFilename = filename;
+        std::string musicAlias = "bgm";  // Use simple fixed alias
+        
+        while (backgroundMusicPlaying && currentBackgroundMusic == localFilename) {
+            char errorMsg[256];
+            char returnString[128];
+            MCIERROR error;
+            
+            // Force close any existing bgm
+            mciSendString("close bgm", NULL, 0, NULL);
+            
+            // Open the file
+            std::string command = "open \"" + localFilename + "\" type waveaudio alias bgm";
+            error = mciSendString(command.c_str(), NULL, 0, NULL);
+            if (error != 0) {
+                mciGetErrorString(error, errorMsg, 256);
+                std::cout << "Error opening background music: " << errorMsg << std::endl;
+                break;
+            }
+            
+            // Play the music (non-blocking)
+            error = mciSendString("play bgm", NULL, 0, NULL);
+            if (error != 0) {
+                mciGetErrorString(error, errorMsg, 256);
+                std::cout << "Error playing background music: " << errorMsg << std::endl;
+                mciSendString("close bgm", NULL, 0, NULL);
+                break;
+            }
+            
+            // Wait for the music to finish playing, checking status every 100ms
+            while (backgroundMusicPlaying && currentBackgroundMusic == localFilename) {
+                mciSendString("status bgm mode", returnString, sizeof(returnString), NULL);
+                if (strcmp(returnString, "stopped") == 0 || strcmp(returnString, "") == 0) {
+                    break;  // Song finished, loop to play again
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            
+            // Close after playing
+            mciSendString("close bgm", NULL, 0, NULL);
+        }
+    }).detach();
+#else
+    (void)filename;
+#endif
+}
+
+void stopBackgroundMusic() {
+#ifdef _WIN32
+    backgroundMusicPlaying = false;
+    currentBackgroundMusic = "";
+    // Force close all MCI devices
+    mciSendString("close all", NULL, 0, NULL);
+    std::cout << "Stopped background music" << std::endl;
+#endif
+}
+
+void playExplosionThenDamageSound() {
+#ifdef _WIN32
+    // Create a thread to play sounds sequentially without blocking the game
+    std::thread([]() {
+        // Play explosion sound and wait for it to finish
+        PlaySound(TEXT("explosion.wav"), NULL, SND_FILENAME | SND_SYNC);
+        // Then play damage sound
+        PlaySound(TEXT("obstacle.wav"), NULL, SND_FILENAME | SND_ASYNC);
+    }).detach();
+#endif
+}
+
+void playExplosionThenGameOverSound() {
+#ifdef _WIN32
+    // Create a thread to play sounds sequentially without blocking the game
+    std::thread([]() {
+        // Play explosion sound and wait for it to finish
+        PlaySound(TEXT("explosion.wav"), NULL, SND_FILENAME | SND_SYNC);
+        // Then play game over sound
+        PlaySound(TEXT("game over.wav"), NULL, SND_FILENAME | SND_ASYNC);
+    }).detach();
+#endif
+}
+
+// ============================================================================
+// VECTOR3 STRUCT - Basic 3D vector operations
+// ============================================================================
+
+struct Vector3 {
+    float x, y, z;
+    
+    Vector3() : x(0), y(0), z(0) {}
+    Vector3(float x, float y, float z) : x(x), y(y), z(z) {}
+    
+    Vector3 operator+(const Vector3& v) const { return Vector3(x + v.x, y + v.y, z + v.z); }
+    Vector3 operator-(const Vector3& v) const { return Vector3(x - v.x, y - v.y, z - v.z); }
+    Vector3 operator*(float s) const { return Vector3(x * s, y * s, z * s); }
+    
+    Vector3 cross(const Vector3& v) const {
+        return Vector3(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x);
+    }
+    
+    float length() const { return sqrt(x * x + y * y + z * z); }
+    
+    Vector3 normalized() const {
+        float len = length();
+        if (len > 0) return Vector3(x / len, y / len, z / len);
+        return Vector3(0, 0, 0);
+    }
+};
+
+struct Vector2 {
+    float u, v;
+    Vector2() : u(0), v(0) {}
+    Vector2(float u, float v) : u(u), v(v) {}
+};
+
+// ============================================================================
+// MATERIAL STRUCT - For MTL file support
+// ============================================================================
+
+struct Material {
+    std::string name;
+    float ambient[4];
+    float diffuse[4];
+    float specular[4];
+    float emission[4];
+    float shininess;
+    float transparency;
+    std::string textureFile;
+    std::string texturePath;  // textureFile resolved against the MTL directory
+    GLuint textureId;
+    
+    Material() : shininess(32.0f), transparency(1.0f), textureId(0) {
+        ambient[0] = 0.2f; ambient[1] = 0.2f; ambient[2] = 0.2f; ambient[3] = 1.0f;
+        diffuse[0] = 0.8f; diffuse[1] = 0.8f; diffuse[2] = 0.8f; diffuse[3] = 1.0f;
+        specular[0] = 1.0f; specular[1] = 1.0f; specular[2] = 1.0f; specular[3] = 1.0f;
+        emission[0] = 0.0f; emission[1] = 0.0f; emission[2] = 0.0f; emission[3] = 1.0f;
+    }
+    
+    void apply() const {
+        applyColors();
+        
+        // Bind texture if available
+        if (textureId != 0) {
+            renderState.enable(GL_TEXTURE_2D);
+            renderState.bindTexture(textureId);
+        } else {
+            renderState.disable(GL_TEXTURE_2D);
+        }
+    }
+    
+    // Lighting colours only, for callers that bind their own texture
+    void applyColors() const {
+        renderState.material(GL_AMBIENT, ambient);
+        renderState.material(GL_DIFFUSE, diffuse);
+        renderState.material(GL_SPECULAR, specular);
+        renderState.material(GL_EMISSION, emission);
+        renderState.shininess(shininess);
+        glColor4f(diffuse[0], diffuse[1], diffuse[2], diffuse[3]);
+    }
+};
+
+// ============================================================================
+// MAPPED FILE - Read-only view of a whole file (mmap, bulk read as fallback)
+// ============================================================================
+
+class MappedFile {
+public:
+    const char* data;
+    size_t size;
+
+    MappedFile() : data(nullptr), size(0), mappedBase(nullptr)
+#ifdef _WIN32
+        , fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL)
+#endif
+    {}
+
+    ~MappedFile() {
+        close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Map the whole file into memory. Falls back to reading it into a heap
+    // buffer when the platform refuses to map it (e.g. empty files).
+    bool open(const std::string& filename) {
+        close();
+#ifdef _WIN32
+        fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                                 OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (fileHandle != INVALID_HANDLE_VALUE) {
+            LARGE_INTEGER fileSize;
+            if (GetFileSizeEx(fileHandle, &fileSize) && fileSize.QuadPart > 0) {
+                mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+                if (mappingHandle != NULL) {
+                    mappedBase = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+                    if (mappedBase) {
+                        data = static_cast<const char*>(mappedBase);
+                        size = static_cast<size_t>(fileSize.QuadPart);
+                        return true;
+                    }
+                }
+            }
+            close();
+        }
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                void* base = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (base != MAP_FAILED) {
+                    mappedBase = base;
+                    data = static_cast<const char*>(base);
+                    size = static_cast<size_t>(st.st_size);
+                    ::close(fd);
+                    return true;
+                }
+            }
+            ::close(fd);
+        }
+#endif
+        // Fallback: bulk read into an owned buffer
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file.is_open()) return false;
+        std::streamsize length = file.tellg();
+        if (length < 0) return false;
+        file.seekg(0, std::ios::beg);
+        buffer.resize(static_cast<size_t>(length));
+        if (length > 0 && !file.read(buffer.data(), length)) {
+            buffer.clear();
+            return false;
+        }
+        data = buffer.data();
+        size = buffer.size();
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (mappedBase) UnmapViewOfFile(mappedBase);
+        if (mappingHandle != NULL) CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+        mappingHandle = NULL;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (mappedBase) munmap(mappedBase, size);
+#endif
+        mappedBase = nullptr;
+        buffer.clear();
+        data = nullptr;
+        size = 0;
+    }
+
+private:
+    void* mappedBase;
+    std::vector<char> buffer;
+#ifdef _WIN32
+    HANDLE fileHandle;
+    HANDLE mappingHandle;
+#endif
+};
+
+// ============================================================================
+// TEXT CURSOR - In-place tokenizer used by the OBJ parser
+// ============================================================================
+
+struct TextCursor {
+    const char* pos;
+    const char* end;
+
+    TextCursor(const char* begin, const char* finish) : pos(begin), end(finish) {}
+
+    bool atEnd() const { return pos >= end; }
+
+    void skipSpaces() {
+        while (pos < end && (*pos == ' ' || *pos == '\t')) ++pos;
+    }
+
+    bool atLineEnd() const {
+        return pos >= end || *pos == '\n' || *pos == '\r';
+    }
+
+    // Advance past the current line (and its terminator)
+    void nextLine() {
+        const char* newline = static_cast<const char*>(memchr(pos, '\n', end - pos));
+        pos = newline ? newline + 1 : end;
+    }
+
+    // Read a whitespace-delimited token without copying it
+    void readToken(const char*& tokenBegin, size_t& tokenLength) {
+        skipSpaces();
+        tokenBegin = pos;
+        skipToken();
+        tokenLength = pos - tokenBegin;
+    }
+
+    // Skip the remainder of the token under the cursor
+    void skipToken() {
+        while (pos < end && *pos != ' ' && *pos != '\t' && *pos != '\n' && *pos != '\r') ++pos;
+    }
+
+    // Rest of the line after leading whitespace, minus the line terminator
+    std::string restOfLine() {
+        skipSpaces();
+        const char* start = pos;
+        while (pos < end && *pos != '\n') ++pos;
+        const char* stop = pos;
+        if (stop > start && stop[-1] == '\r') --stop;
+        return std::string(start, stop);
+    }
+
+    bool readFloat(float& value) {
+        skipSpaces();
+        const char* start = pos;
+        if (start < end && *start == '+') ++start;  // from_chars rejects a leading '+'
+        std::from_chars_result result = std::from_chars(start, end, value);
+        if (result.ec != std::errc()) return false;
+        pos = result.ptr;
+        return true;
+    }
+
+    bool readInt(int& value) {
+        const char* start = pos;
+        if (start < end && *start == '+') ++start;
+        std::from_chars_result result = std::from_chars(start, end, value);
+        if (result.ec != std::errc()) return false;
+        pos = result.ptr;
+        return true;
+    }
+};
+
+// ============================================================================
+// MATERIAL RANGE - Run of triangle corners drawn with one material
+// ============================================================================
+
+struct MaterialRange {
+    int materialId;   // index into OBJModel::materials, -1 = keep current material
+    int firstCorner;
+    int cornerCount;
+};
+
+// ============================================================================
+// GPU MESH - Indexed vertex/index buffers shared by the model loaders
+// ============================================================================
+
+// How models submit their geometry; selectable at runtime ('V' key or
+// --render-path) so the three paths can be compared
+enum MeshRenderPath {
+    RENDER_PATH_IMMEDIATE,     // glBegin/glEnd every frame
+    RENDER_PATH_DISPLAY_LIST,  // pre-compiled display lists
+    RENDER_PATH_BUFFERS        // VBO/IBO with glDrawElements
+};
+
+MeshRenderPath meshRenderPath = RENDER_PATH_BUFFERS;
+
+const char* meshRenderPathName(MeshRenderPath path) {
+    switch (path) {
+        case RENDER_PATH_IMMEDIATE: return "immediate mode";
+        case RENDER_PATH_DISPLAY_LIST: return "display lists";
+        default: return "vertex buffers";
+    }
+}
+
+// Interleaved vertex layout uploaded to the VBO
+struct MeshVertex {
+    float px, py, pz;
+    float nx, ny, nz;
+    float u, v;
+};
+
+class GpuMesh {
+public:
+    std::vector<MeshVertex> vertices;  // Deduplicated vertices
+    std::vector<uint32_t> indices;     // Three per triangle
+    
+    GLuint vbo, ibo;
+    GLenum indexType;                  // GL_UNSIGNED_SHORT when every index fits
+    bool uploaded;
+    
+    GpuMesh() : vbo(0), ibo(0), indexType(GL_UNSIGNED_INT), uploaded(false) {}
+    ~GpuMesh() { release(); }
+    
+    GpuMesh(const GpuMesh&) = delete;
+    GpuMesh& operator=(const GpuMesh&) = delete;
+    
+    // Create the GL buffers from the CPU arrays (no-op without buffer support)
+    bool upload() {
+        release();
+        if (!glExt.hasBuffers || vertices.empty() || indices.empty()) return false;
+        
+        glExt.genBuffers(1, &vbo);
+        glExt.bindBuffer(GL_ARRAY_BUFFER, vbo);
+        glExt.bufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(MeshVertex), vertices.data(), GL_STATIC_DRAW);
+        glExt.bindBuffer(GL_ARRAY_BUFFER, 0);
+        
+        glExt.genBuffers(1, &ibo);
+        glExt.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+        if (vertices.size() <= 65536) {
+            std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+            indexType = GL_UNSIGNED_SHORT;
+            glExt.bufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(uint16_t), shortIndices.data(), GL_STATIC_DRAW);
+        } else {
+            indexType = GL_UNSIGNED_INT;
+            glExt.bufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+        }
+        glExt.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        
+        uploaded = true;
+        return true;
+    }
+    
+    void release() {
+        if (uploaded && glExt.hasBuffers) {
+            glExt.deleteBuffers(1, &vbo);
+            glExt.deleteBuffers(1, &ibo);
+        }
+        vbo = ibo = 0;
+        uploaded = false;
+    }
+    
+    // Bind buffers and vertex array pointers; withTexCoords = false leaves
+    // texture coordinates to the caller (e.g. texgen)
+    void bind(bool withTexCoords = true) const {
+        glExt.bindBuffer(GL_ARRAY_BUFFER, vbo);
+        glExt.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+        
+        const char* base = nullptr;
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, sizeof(MeshVertex), base + offsetof(MeshVertex, px));
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glNormalPointer(GL_FLOAT, sizeof(MeshVertex), base + offsetof(MeshVertex, nx));
+        if (withTexCoords) {
+            glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+            glTexCoordPointer(2, GL_FLOAT, sizeof(MeshVertex), base + offsetof(MeshVertex, u));
+        }
+    }
+    
+    void unbind() const {
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glExt.bindBuffer(GL_ARRAY_BUFFER, 0);
+        glExt.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+    
+    // Draw a run of indices (mesh must be bound)
+    void drawRange(int firstIndex, int indexCount) const {
+        size_t indexSize = (indexType == GL_UNSIGNED_SHORT) ? sizeof(uint16_t) : sizeof(uint32_t);
+        glDrawElements(GL_TRIANGLES, indexCount, indexType, (const char*)nullptr + firstIndex * indexSize);
+    }
+    
+    // Replace the vertex buffer contents (same vertex count as uploaded);
+    // used for geometry re-transformed on the CPU every frame
+    void updateVertices(const MeshVertex* data, size_t count) const {
+        glExt.bindBuffer(GL_ARRAY_BUFFER, vbo);
+        glExt.bufferData(GL_ARRAY_BUFFER, count * sizeof(MeshVertex), data, GL_DYNAMIC_DRAW);
+        glExt.bindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    
+    // Submit the CPU arrays with glBegin/glEnd, for the immediate path and
+    // for compiling display lists (indexCount -1 = to the end)
+    void drawImmediate(int firstIndex = 0, int indexCount = -1) const {
+        int end = (indexCount < 0) ? (int)indices.size() : firstIndex + indexCount;
+        glBegin(GL_TRIANGLES);
+        for (int i = firstIndex; i < end; i++) {
+            const MeshVertex& v = vertices[indices[i]];
+            glNormal3f(v.nx, v.ny, v.nz);
+            glTexCoord2f(v.u, v.v);
+            glVertex3f(v.px, v.py, v.pz);
+        }
+        glEnd();
+    }
+};
+
+// Key for merging identical (position, texcoord, normal) corners
+struct CornerKey {
+    int vertex, texCoord, normal;
+    
+    bool operator==(const CornerKey& other) const {
+        return vertex == other.vertex && texCoord == other.texCoord && normal == other.normal;
+    }
+};
+
+struct CornerKeyHash {
+    size_t operator()(const CornerKey& key) const {
+        size_t h = (size_t)key.vertex * 73856093u;
+        h ^= (size_t)key.texCoord * 19349663u;
+        h ^= (size_t)key.normal * 83492791u;
+        return h;
+    }
+};
+
+// ============================================================================
+// RENDER QUEUE - Draw items sorted by state before submission
+// ============================================================================
+
+// Scenes submit draw items keyed by (pass, texture, material, mesh) and
+// flush once; items are drawn in key order, so objects sharing a texture or
+// material run back to back and renderState drops the repeated changes.
+// Each item sets its own lighting, texture and material (nullptr leaves the
+// material to its draw callback) instead of inheriting whatever the previous
+// object left behind; a run of items with the same material and texture
+// applies the material once, so callbacks that change material state must
+// set whatever they change themselves. Blended items keep their submission
+// order, and each is drawn under the render section that was open when it
+// was submitted.
+enum RenderPass {
+    PASS_OPAQUE,
+    PASS_BLENDED
+};
+
+class RenderQueue {
+public:
+    void submit(RenderPass pass, GLuint texture, const Material* material, const void* mesh, bool lit,
+                std::function<void()> draw) {
+        RenderItem item;
+        item.key = 0;
+        item.pass = pass;
+        item.texture = texture;
+        item.material = material;
+        item.mesh = mesh;
+        item.lit = lit;
+        item.order = (uint32_t)items.size();
+        item.section = RenderSection::currentName();
+        item.draw = std::move(draw);
+        items.push_back(std::move(item));
+    }
+    
+    // Draw everything submitted since the last flush; leaves texturing off
+    // and emission cleared, as the scenes expect between objects
+    void flush() {
+        if (items.empty()) return;
+        
+        // Slots in first-submission order stand in for pointers in the key
+        std::unordered_map<const void*, uint64_t> materialSlots, meshSlots;
+        for (auto& item : items) {
+            uint64_t materialSlot = materialSlots.emplace(item.material, materialSlots.size()).first->second;
+            uint64_t meshSlot = meshSlots.emplace(item.mesh, meshSlots.size()).first->second;
+            item.key = (uint64_t)item.pass << 60;
+            if (item.pass == PASS_BLENDED) {
+                item.key |= item.order;
+            } else {
+                item.key |= ((uint64_t)item.texture & 0xFFFFF) << 40 | (materialSlot & 0xFFFFF) << 20 | (meshSlot & 0xFFFFF);
+            }
+        }
+        std::sort(items.begin(), items.end(), [](const RenderItem& a, const RenderItem& b) {
+            return a.key != b.key ? a.key < b.key : a.order < b.order;
+        });
+        
+        // Material last applied, cleared by items that set their own
+        const Material* appliedMaterial = nullptr;
+        GLuint appliedTexture = 0;
+        for (const auto& item : items) {
+            RenderSection section(item.section);
+            if (item.lit) renderState.enable(GL_LIGHTING);
+            else renderState.disable(GL_LIGHTING);
+            if (item.pass == PASS_BLENDED) renderState.enable(GL_BLEND);
+            else renderState.disable(GL_BLEND);
+            if (item.material != appliedMaterial || item.texture != appliedTexture) {
+                // An item's own texture replaces the material's, so only the
+                // colours are applied and GL_TEXTURE_2D isn't toggled off first
+                if (item.material && item.texture) item.material->applyColors();
+                else if (item.material) item.material->apply();
+                appliedMaterial = item.material;
+                appliedTexture = item.texture;
+            }
+            if (item.texture) {
+                renderState.enable(GL_TEXTURE_2D);
+                renderState.bindTexture(item.texture);
+            } else if (!item.material || !item.material->textureId) {
+                renderState.disable(GL_TEXTURE_2D);
+            }
+            item.draw();
+        }
+        
+        static const GLfloat noEmission[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        renderState.material(GL_EMISSION, noEmission);
+        renderState.disable(GL_TEXTURE_2D);
+        renderState.disable(GL_BLEND);
+        renderState.enable(GL_LIGHTING);
+        
+        renderState.stats.drawItems += items.size();
+        items.clear();
+    }
+    
+private:
+    struct RenderItem {
+        uint64_t key;
+        uint32_t order;
+        RenderPass pass;
+        GLuint texture;              // 0: the material's texture, or none
+        const Material* material;
+        const void* mesh;            // Only compared, never dereferenced
+        bool lit;
+        const char* section;
+        std::function<void()> draw;
+    };
+    
+    std::vector<RenderItem> items;  // Capacity kept between frames
+};
+
+// ============================================================================
+// FRUSTUM CULLING - Bounding sphere tests against the camera view volume
+// ============================================================================
+
+// The six planes of the camera's view volume in world space, rebuilt each
+// frame from the projection captured in reshape() and the gluLookAt view
+struct Frustum {
+    float planes[6][4];  // a, b, c, d: a*x + b*y + c*z + d >= 0 inside, (a, b, c) unit length
+    bool valid;          // false until a projection and view have been seen
+    
+    Frustum() : valid(false) {
+        memset(planes, 0, sizeof(planes));
+    }
+    
+    // Gribb/Hartmann extraction from the rows of projection * view (both
+    // column-major, as returned by glGetFloatv)
+    void extract(const float* projection, const float* view) {
+        float clip[16];
+        for (int column = 0; column < 4; column++) {
+            for (int row = 0; row < 4; row++) {
+                float sum = 0.0f;
+                for (int k = 0; k < 4; k++) sum += projection[k * 4 + row] * view[column * 4 + k];
+                clip[column * 4 + row] = sum;
+            }
+        }
+        
+        // left/right, bottom/top, near/far from the x, y and z rows
+        valid = true;
+        for (int axis = 0; axis < 3; axis++) {
+            for (int column = 0; column < 4; column++) {
+                planes[axis * 2][column] = clip[column * 4 + 3] + clip[column * 4 + axis];
+                planes[axis * 2 + 1][column] = clip[column * 4 + 3] - clip[column * 4 + axis];
+            }
+        }
+        for (auto& plane : planes) {
+            float length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+            if (length < 1e-6f) {
+                valid = false;
+                return;
+            }
+            for (float& value : plane) value /= length;
+        }
+    }
+    
+    bool sphereVisible(float x, float y, float z, float radius) const {
+        if (!valid) return true;
+        for (const auto& plane : planes) {
+            if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < -radius) return false;
+        }
+        return true;
+    }
+    
+    // Test count spheres given as separate x, y, z, radius arrays, writing
+    // 1 (visible) or 0 to visible[i]; four at a time with SSE. Returns the
+    // number visible.
+    size_t cullSpheres(const float* x, const float* y, const float* z, const float* radius,
+                       size_t count, uint8_t* visible) const {
+        if (!valid) {
+            memset(visible, 1, count);
+            return count;
+        }
+        
+        size_t visibleCount = 0;
+        size_t i = 0;
+#ifdef HAVE_SSE
+        __m128 a[6], b[6], c[6], d[6];
+        for (int p = 0; p < 6; p++) {
+            a[p] = _mm_set1_ps(planes[p][0]);
+            b[p] = _mm_set1_ps(planes[p][1]);
+            c[p] = _mm_set1_ps(planes[p][2]);
+            d[p] = _mm_set1_ps(planes[p][3]);
+        }
+        for (; i + 4 <= count; i += 4) {
+            __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i), pz = _mm_loadu_ps(z + i);
+            __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+            __m128 inside = _mm_setzero_ps();
+            for (int p = 0; p < 6; p++) {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[p], px), _mm_mul_ps(b[p], py)),
+                                             _mm_add_ps(_mm_mul_ps(c[p], pz), d[p]));
+                __m128 inFront = _mm_cmpge_ps(distance, negRadius);
+                inside = (p == 0) ? inFront : _mm_and_ps(inside, inFront);
+            }
+            int mask = _mm_movemask_ps(inside);
+            for (int k = 0; k < 4; k++) {
+                visible[i + k] = (uint8_t)((mask >> k) & 1);
+                visibleCount += visible[i + k];
+            }
+        }
+#endif
+        for (; i < count; i++) {
+            visible[i] = sphereVisible(x[i], y[i], z[i], radius[i]) ? 1 : 0;
+            visibleCount += visible[i];
+        }
+        return visibleCount;
+    }
+};
+
+// Objects drawn and skipped in the current frame; lastFrameCullStats holds
+// the previous complete frame for reporting
+struct CullStats {
+    size_t visible;
+    size_t culled;
+};
+
+bool frustumCulling = true;  // 'C' or --no-cull
+Frustum viewFrustum;
+float cameraProjection[16];  // Captured in reshape()
+float cameraPixelScale = 0.0f;  // Pixels per unit at unit distance, also from reshape()
+CullStats cullStats = { 0, 0 };
+CullStats lastFrameCullStats = { 0, 0 };
+
+// Test one object against the view and count it; everything passes with
+// culling switched off
+bool sphereInView(float x, float y, float z, float radius) {
+    bool visible = !frustumCulling || viewFrustum.sphereVisible(x, y, z, radius);
+    if (visible) cullStats.visible++;
+    else cullStats.culled++;
+    return visible;
+}
+
+// Batched form of sphereInView; returns the number visible
+size_t spheresInView(const float* x, const float* y, const float* z, const float* radius,
+                     size_t count, uint8_t* visible) {
+    size_t visibleCount = count;
+    if (frustumCulling) visibleCount = viewFrustum.cullSpheres(x, y, z, radius, count, visible);
+    else memset(visible, 1, count);
+    cullStats.visible += visibleCount;
+    cullStats.culled += count - visibleCount;
+    return visibleCount;
+}
+
+// ============================================================================
+// LEVEL OF DETAIL - Simplified mesh copies picked by projected size
+// ============================================================================
+
+// Models get up to LOD_MAX_LEVELS simplified copies, made by quadric edge
+// collapse (Garland & Heckbert) with each vertex collapsing onto one of its
+// neighbours, so every level is a subset of the original vertices and the
+// mesh cache stores levels as index lists only. Level k + 1 is drawn once
+// the model's bounding sphere shrinks below lodPixelRadius[k] pixels; each
+// level doubles the allowed error and halves the switch radius, so the
+// error at a switch stays around a pixel and a half. Across a switch the
+// two levels are cross-faded with complementary polygon stipples.
+#define LOD_MAX_LEVELS 4
+#define LOD_BLEND_STEPS 4      // Stipple densities in a cross-fade
+#define LOD_BLEND_BAND 1.25f   // Cross-fade from threshold * band down to threshold
+#define LOD_BORDER_WEIGHT 10.0 // Quadric weight keeping open edges, UV seams and material borders
+
+static const float lodTargetRatios[LOD_MAX_LEVELS] = { 0.5f, 0.25f, 0.12f, 0.06f };  // Of the full triangle count
+static const float lodMaxErrors[LOD_MAX_LEVELS] = { 0.005f, 0.01f, 0.02f, 0.04f };   // Of the bounding box diagonal
+static const float lodPixelRadius[LOD_MAX_LEVELS] = { 160.0f, 80.0f, 40.0f, 20.0f };
+
+// Triangles submitted this frame by LOD-aware draws, and what they would
+// have been at full detail; lastFrameLodStats holds the previous frame
+struct LodStats {
+    size_t fullTriangles;
+    size_t drawnTriangles;
+};
+
+bool lodEnabled = true;  // 'K' or --no-lod
+LodStats lodStats = { 0, 0 };
+LodStats lastFrameLodStats = { 0, 0 };
+
+// One simplified level with its own compact buffers and material runs
+struct MeshLod {
+    GpuMesh mesh;
+    std::vector<MaterialRange> ranges;
+    GLuint displayList;
+    
+    MeshLod() : displayList(0) {}
+    ~MeshLod() {
+        if (displayList) glDeleteLists(displayList, 1);
+    }
+    
+    int triangleCount() const { return (int)mesh.indices.size() / 3; }
+};
+
+typedef std::vector<std::unique_ptr<MeshLod>> MeshLodChain;  // Finest first
+
+struct LodChoice {
+    int level;  // 0 = full mesh, k = chain[k - 1]
+    int blend;  // 0, or the share of level + 1 cross-faded in, in 1/LOD_BLEND_STEPS
+};
+
+// Where the caller's transform puts a model's origin in world space, and
+// its largest axis scale. Models pick their level from this and lodEye on
+// the CPU rather than reading the modelview back for every draw.
+struct LodPlacement {
+    Vector3 origin;
+    float scale;
+    
+    LodPlacement() : scale(1.0f) {}
+    LodPlacement(const Vector3& origin, float scale) : origin(origin), scale(scale) {}
+};
+
+Vector3 lodEye;  // This frame's camera position, set by display()
+
+// Radius in pixels of a sphere at the given distance from the eye
+float projectedRadius(float radius, float distance) {
+    if (cameraPixelScale <= 0.0f) return 1e30f;
+    return radius * cameraPixelScale / std::max(distance, 0.1f);
+}
+
+LodChoice chooseLod(float pixelRadius, int levelCount) {
+    LodChoice choice = { 0, 0 };
+    if (!lodEnabled) return choice;
+    for (int k = 0; k < levelCount && k < LOD_MAX_LEVELS; k++) {
+        float threshold = lodPixelRadius[k];
+        if (pixelRadius >= threshold * LOD_BLEND_BAND) break;
+        if (pixelRadius >= threshold) {
+            float fade = (threshold * LOD_BLEND_BAND - pixelRadius) / (threshold * (LOD_BLEND_BAND - 1.0f));
+            choice.blend = std::min(LOD_BLEND_STEPS - 1, (int)(fade * LOD_BLEND_STEPS));
+            break;
+        }
+        choice.level = k + 1;
+    }
+    return choice;
+}
+
+// 32x32 stipples from a 4x4 ordered dither: for a given blend the coarser
+// level's pattern covers exactly the pixels the finer one leaves out
+const GLubyte* lodStipple(int blend, bool coarser) {
+    static GLubyte patterns[LOD_BLEND_STEPS][2][128];
+    static bool built = false;
+    if (!built) {
+        static const int dither[4][4] = { { 0, 8, 2, 10 }, { 12, 4, 14, 6 }, { 3, 11, 1, 9 }, { 15, 7, 13, 5 } };
+        memset(patterns, 0, sizeof(patterns));
+        for (int b = 0; b < LOD_BLEND_STEPS; b++) {
+            for (int y = 0; y < 32; y++) {
+                for (int x = 0; x < 32; x++) {
+                    bool coarse = dither[y % 4][x % 4] < b * 16 / LOD_BLEND_STEPS;
+                    patterns[b][coarse ? 1 : 0][y * 4 + x / 8] |= (GLubyte)(0x80 >> (x % 8));
+                }
+            }
+        }
+        built = true;
+    }
+    return patterns[blend][coarser ? 1 : 0];
+}
+
+void beginLodBlend(int blend, bool coarser) {
+    glEnable(GL_POLYGON_STIPPLE);
+    glPolygonStipple(lodStipple(blend, coarser));
+}
+
+void endLodBlend() {
+    glDisable(GL_POLYGON_STIPPLE);
+}
+
+// Symmetric 4x4 error quadric: sum of squared distances to a set of planes
+struct Quadric {
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+    
+    Quadric() : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0) {}
+    
+    void addPlane(double a, double b, double c, double d, double weight) {
+        a2 += weight * a * a; ab += weight * a * b; ac += weight * a * c; ad += weight * a * d;
+        b2 += weight * b * b; bc += weight * b * c; bd += weight * b * d;
+        c2 += weight * c * c; cd += weight * c * d;
+        d2 += weight * d * d;
+    }
+    
+    void add(const Quadric& q) {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+    }
+    
+    double error(double x, double y, double z) const {
+        return a2 * x * x + 2.0 * ab * x * y + 2.0 * ac * x * z + 2.0 * ad * x +
+               b2 * y * y + 2.0 * bc * y * z + 2.0 * bd * y +
+               c2 * z * z + 2.0 * cd * z + d2;
+    }
+};
+
+// Collapse edges of the triangles in indices (into vertices) until at most
+// targetTriangles remain or the cheapest collapse would cost more than
+// maxError squared. Vertices at the same position (UV and normal seams)
+// move together, and corners are moved to the attribute vertex on their
+// side of the seam. triangleRanges[t] tags triangle t (its material run);
+// both arrays are rewritten with the survivors in their original order.
+void simplifyTriangles(const std::vector<MeshVertex>& vertices, std::vector<uint32_t>& indices,
+                       std::vector<int>& triangleRanges, size_t targetTriangles, float maxError) {
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount <= targetTriangles) return;
+    
+    // Weld: position[v] is the id shared by every vertex at v's position
+    std::vector<uint32_t> byPosition(vertices.size());
+    for (size_t v = 0; v < vertices.size(); v++) byPosition[v] = (uint32_t)v;
+    auto samePlace = [&vertices](uint32_t a, uint32_t b) {
+        const MeshVertex& p = vertices[a];
+        const MeshVertex& q = vertices[b];
+        return p.px == q.px && p.py == q.py && p.pz == q.pz;
+    };
+    std::sort(byPosition.begin(), byPosition.end(), [&vertices](uint32_t a, uint32_t b) {
+        const MeshVertex& p = vertices[a];
+        const MeshVertex& q = vertices[b];
+        if (p.px != q.px) return p.px < q.px;
+        if (p.py != q.py) return p.py < q.py;
+        return p.pz < q.pz;
+    });
+    std::vector<uint32_t> position(vertices.size());
+    std::vector<Vector3> points;
+    std::vector<std::vector<uint32_t>> attributesAt;
+    for (size_t i = 0; i < byPosition.size(); i++) {
+        uint32_t v = byPosition[i];
+        if (i == 0 || !samePlace(byPosition[i - 1], v)) {
+            points.push_back(Vector3(vertices[v].px, vertices[v].py, vertices[v].pz));
+            attributesAt.emplace_back();
+        }
+        position[v] = (uint32_t)points.size() - 1;
+        attributesAt.back().push_back(v);
+    }
+    size_t pointCount = points.size();
+    
+    // Face planes, plus a perpendicular plane along every border edge
+    std::vector<Quadric> quadrics(pointCount);
+    std::vector<std::vector<uint32_t>> trianglesAt(pointCount);
+    std::vector<Vector3> faceNormals(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++) {
+        const Vector3& a = points[position[indices[t * 3]]];
+        const Vector3& b = points[position[indices[t * 3 + 1]]];
+        const Vector3& c = points[position[indices[t * 3 + 2]]];
+        Vector3 n = (b - a).cross(c - a).normalized();
+        faceNormals[t] = n;
+        double d = -(n.x * a.x + n.y * a.y + n.z * a.z);
+        for (int k = 0; k < 3; k++) {
+            uint32_t p = position[indices[t * 3 + k]];
+            quadrics[p].addPlane(n.x, n.y, n.z, d, 1.0);
+            trianglesAt[p].push_back((uint32_t)t);
+        }
+    }
+    
+    struct EdgeSide { uint32_t from, to, attributeFrom, attributeTo, triangle; };
+    std::vector<EdgeSide> sides;
+    sides.reserve(triangleCount * 3);
+    for (size_t t = 0; t < triangleCount; t++) {
+        for (int k = 0; k < 3; k++) {
+            uint32_t va = indices[t * 3 + k], vb = indices[t * 3 + (k + 1) % 3];
+            uint32_t pa = position[va], pb = position[vb];
+            if (pa == pb) continue;
+            if (pa > pb) { std::swap(pa, pb); std::swap(va, vb); }
+            EdgeSide side = { pa, pb, va, vb, (uint32_t)t };
+            sides.push_back(side);
+        }
+    }
+    std::sort(sides.begin(), sides.end(), [](const EdgeSide& a, const EdgeSide& b) {
+        return a.from != b.from ? a.from < b.from : a.to < b.to;
+    });
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+    for (size_t i = 0; i < sides.size();) {
+        size_t end = i;
+        while (end < sides.size() && sides[end].from == sides[i].from && sides[end].to == sides[i].to) end++;
+        bool border = (end - i) != 2;
+        if (!border) {
+            const EdgeSide& s = sides[i];
+            const EdgeSide& o = sides[i + 1];
+            border = s.attributeFrom != o.attributeFrom || s.attributeTo != o.attributeTo ||
+                     triangleRanges[s.triangle] != triangleRanges[o.triangle];
+        }
+        if (border) {
+            const Vector3& a = points[sides[i].from];
+            const Vector3& b = points[sides[i].to];
+            Vector3 edge = b - a;
+            Vector3 n = edge.cross(faceNormals[sides[i].triangle]).normalized();
+            double d = -(n.x * a.x + n.y * a.y + n.z * a.z);
+            double weight = LOD_BORDER_WEIGHT * edge.length() * edge.length();
+            quadrics[sides[i].from].addPlane(n.x, n.y, n.z, d, weight);
+            quadrics[sides[i].to].addPlane(n.x, n.y, n.z, d, weight);
+        }
+        edges.push_back(std::make_pair(sides[i].from, sides[i].to));
+        i = end;
+    }
+    std::vector<EdgeSide>().swap(sides);
+    
+    // Cheapest collapses first; entries go stale when either end changes
+    struct Collapse {
+        double cost;
+        uint32_t from, to, fromVersion, toVersion;
+        bool operator>(const Collapse& other) const { return cost > other.cost; }
+    };
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+    std::vector<uint32_t> versions(pointCount, 0);
+    std::vector<bool> removed(pointCount, false);
+    auto pushEdge = [&](uint32_t a, uint32_t b) {
+        Quadric q = quadrics[a];
+        q.add(quadrics[b]);
+        double toB = q.error(points[b].x, points[b].y, points[b].z);
+        double toA = q.error(points[a].x, points[a].y, points[a].z);
+        Collapse c = { std::min(toA, toB), toB <= toA ? a : b, toB <= toA ? b : a, 0, 0 };
+        c.fromVersion = versions[c.from];
+        c.toVersion = versions[c.to];
+        queue.push(c);
+    };
+    for (const auto& edge : edges) pushEdge(edge.first, edge.second);
+    std::vector<std::pair<uint32_t, uint32_t>>().swap(edges);
+    
+    std::vector<bool> alive(triangleCount, true);
+    size_t aliveCount = triangleCount;
+    double maxCost = (double)maxError * maxError;
+    auto hasPoint = [&](uint32_t t, uint32_t p) {
+        return position[indices[t * 3]] == p || position[indices[t * 3 + 1]] == p || position[indices[t * 3 + 2]] == p;
+    };
+    
+    std::vector<std::pair<uint32_t, uint32_t>> sideMap;  // Attribute at from -> attribute at to
+    std::vector<uint32_t> neighbours;
+    while (aliveCount > targetTriangles && !queue.empty()) {
+        Collapse c = queue.top();
+        queue.pop();
+        if (c.cost > maxCost) break;
+        if (removed[c.from] || removed[c.to] ||
+            versions[c.from] != c.fromVersion || versions[c.to] != c.toVersion) {
+            continue;
+        }
+        
+        // Refuse collapses that fold a remaining triangle over
+        bool folds = false;
+        for (uint32_t t : trianglesAt[c.from]) {
+            if (!alive[t] || hasPoint(t, c.to)) continue;
+            Vector3 corners[3];
+            for (int k = 0; k < 3; k++) {
+                uint32_t p = position[indices[t * 3 + k]];
+                corners[k] = points[p == c.from ? c.to : p];
+            }
+            Vector3 n = (corners[1] - corners[0]).cross(corners[2] - corners[0]);
+            float length = n.length();
+            const Vector3& old = faceNormals[t];
+            if (length <= 0.0f || (n.x * old.x + n.y * old.y + n.z * old.z) < 0.2f * length) {
+                folds = true;
+                break;
+            }
+        }
+        if (folds) continue;
+        
+        // Triangles on the edge disappear and say which attribute vertex at
+        // 'to' belongs with each one at 'from'
+        sideMap.clear();
+        for (uint32_t t : trianglesAt[c.from]) {
+            if (!alive[t] || !hasPoint(t, c.to)) continue;
+            uint32_t fromAttribute = 0, toAttribute = 0;
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = indices[t * 3 + k];
+                if (position[v] == c.from) fromAttribute = v;
+                if (position[v] == c.to) toAttribute = v;
+            }
+            sideMap.push_back(std::make_pair(fromAttribute, toAttribute));
+            alive[t] = false;
+            aliveCount--;
+        }
+        
+        for (uint32_t t : trianglesAt[c.from]) {
+            if (!alive[t]) continue;
+            for (int k = 0; k < 3; k++) {
+                uint32_t& v = indices[t * 3 + k];
+                if (position[v] != c.from) continue;
+                uint32_t target = UINT32_MAX;
+                for (const auto& pair : sideMap) {
+                    if (pair.first == v) { target = pair.second; break; }
+                }
+                if (target == UINT32_MAX) {
+                    // Not on the collapsed edge: closest UV and normal at 'to'
+                    float best = 1e30f;
+                    for (uint32_t candidate : attributesAt[c.to]) {
+                        const MeshVertex& a = vertices[v];
+                        const MeshVertex& b = vertices[candidate];
+                        float du = a.u - b.u, dv = a.v - b.v;
+                        float dn = (a.nx - b.nx) * (a.nx - b.nx) + (a.ny - b.ny) * (a.ny - b.ny) + (a.nz - b.nz) * (a.nz - b.nz);
+                        float distance = du * du + dv * dv + 0.5f * dn;
+                        if (distance < best) { best = distance; target = candidate; }
+                    }
+                }
+                v = target;
+            }
+            trianglesAt[c.to].push_back(t);
+        }
+        
+        quadrics[c.to].add(quadrics[c.from]);
+        removed[c.from] = true;
+        std::vector<uint32_t>().swap(trianglesAt[c.from]);
+        versions[c.to]++;
+        
+        // Drop dead triangles from 'to' and queue its edges again
+        std::vector<uint32_t>& around = trianglesAt[c.to];
+        around.erase(std::remove_if(around.begin(), around.end(), [&alive](uint32_t t) { return !alive[t]; }),
+                     around.end());
+        neighbours.clear();
+        for (uint32_t t : around) {
+            for (int k = 0; k < 3; k++) {
+                uint32_t p = position[indices[t * 3 + k]];
+                if (p != c.to) neighbours.push_back(p);
+            }
+        }
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+        for (uint32_t p : neighbours) pushEdge(c.to, p);
+    }
+    
+    size_t out = 0;
+    for (size_t t = 0; t < triangleCount; t++) {
+        if (!alive[t]) continue;
+        for (int k = 0; k < 3; k++) indices[out * 3 + k] = indices[t * 3 + k];
+        triangleRanges[out] = triangleRanges[t];
+        out++;
+    }
+    indices.resize(out * 3);
+    triangleRanges.resize(out);
+}
+
+// Index lists for the LOD chain of a mesh, each simplified from the one
+// before, indexing vertices and with its own material runs (in the order of
+// ranges). Stops once a level removes less than a tenth of the triangles.
+void generateLodLevels(const std::vector<MeshVertex>& vertices, const std::vector<uint32_t>& indices,
+                       const std::vector<MaterialRange>& ranges, float size,
+                       std::vector<std::vector<uint32_t>>& lodIndices,
+                       std::vector<std::vector<MaterialRange>>& lodRanges) {
+    lodIndices.clear();
+    lodRanges.clear();
+    size_t fullTriangles = indices.size() / 3;
+    if (fullTriangles < 64) return;
+    
+    std::vector<uint32_t> current = indices;
+    std::vector<int> triangleRanges(fullTriangles, -1);
+    for (size_t r = 0; r < ranges.size(); r++) {
+        for (int c = ranges[r].firstCorner; c < ranges[r].firstCorner + ranges[r].cornerCount; c += 3) {
+            triangleRanges[c / 3] = (int)r;
+        }
+    }
+    
+    for (int level = 0; level < LOD_MAX_LEVELS; level++) {
+        size_t before = current.size() / 3;
+        simplifyTriangles(vertices, current, triangleRanges, (size_t)(fullTriangles * lodTargetRatios[level]),
+                          lodMaxErrors[level] * size);
+        if (current.size() / 3 > before * 9 / 10 || current.empty()) break;
+        
+        std::vector<MaterialRange> levelRanges;
+        std::vector<uint32_t> levelIndices;
+        levelIndices.reserve(current.size());
+        for (size_t r = 0; r <= ranges.size(); r++) {
+            // Triangles outside every range (r == ranges.size()) keep the current material
+            int tag = (r == ranges.size()) ? -1 : (int)r;
+            MaterialRange range = { r == ranges.size() ? -1 : ranges[r].materialId, (int)levelIndices.size(), 0 };
+            for (size_t t = 0; t < triangleRanges.size(); t++) {
+                if (triangleRanges[t] != tag) continue;
+                levelIndices.insert(levelIndices.end(), current.begin() + t * 3, current.begin() + t * 3 + 3);
+            }
+            range.cornerCount = (int)levelIndices.size() - range.firstCorner;
+            if (range.cornerCount > 0) levelRanges.push_back(range);
+        }
+        lodIndices.push_back(levelIndices);
+        lodRanges.push_back(levelRanges);
+    }
+}
+
+// Build the chain's meshes from generateLodLevels output, keeping only the
+// vertices each level uses (CPU arrays; upload on the GL thread)
+void buildLodChain(MeshLodChain& chain, const std::vector<MeshVertex>& vertices,
+                   const std::vector<std::vector<uint32_t>>& lodIndices,
+                   const std::vector<std::vector<MaterialRange>>& lodRanges) {
+    chain.clear();
+    std::vector<uint32_t> remap(vertices.size());
+    for (size_t level = 0; level < lodIndices.size() && level < lodRanges.size(); level++) {
+        std::unique_ptr<MeshLod> lod(new MeshLod());
+        std::fill(remap.begin(), remap.end(), UINT32_MAX);
+        lod->mesh.indices.reserve(lodIndices[level].size());
+        for (uint32_t v : lodIndices[level]) {
+            if (v >= vertices.size()) {
+                chain.clear();
+                return;
+            }
+            if (remap[v] == UINT32_MAX) {
+                remap[v] = (uint32_t)lod->mesh.vertices.size();
+                lod->mesh.vertices.push_back(vertices[v]);
+            }
+            lod->mesh.indices.push_back(remap[v]);
+        }
+        lod->ranges = lodRanges[level];
+        chain.push_back(std::move(lod));
+    }
+}
+
+// ============================================================================
+// INSTANCING - Many copies of one mesh (trees, rocks, plants) per draw
+// ============================================================================
+
+// Per-instance transform, applied as translate * rotateY * sway * scale (the
+// order the scenes used with glTranslatef/glRotatef/glScalef). Sway is a tilt
+// about Z of amplitude * sin(time * frequency + swayPhase) degrees, set per
+// batch with InstanceBatch::setSway.
+struct InstanceTransform {
+    float x, y, z;
+    float rotationY;  // Degrees
+    float scaleX, scaleY, scaleZ;
+    float swayPhase;  // Radians
+};
+
+// How instance batches submit their copies; --instancing overrides the default
+enum InstancingMode {
+    INSTANCING_AUTO,      // Hardware instancing on GPUs, otherwise merged
+    INSTANCING_HARDWARE,  // Instancing shader whenever it compiles, software rasterizers too
+    INSTANCING_MERGED,    // Copies pre-transformed into one static buffer
+    INSTANCING_OFF        // One draw per copy, as before batching
+};
+
+InstancingMode instancingMode = INSTANCING_AUTO;
+
+// Attribute slots for the per-instance data; 6 and 7 are free of the
+// built-in aliases some drivers use for gl_Vertex, gl_Normal and texcoords
+#define INSTANCE_ATTRIB_OFFSET 6
+#define INSTANCE_ATTRIB_SCALE  7
+
+// Fixed-function lighting for instanced draws: the instance transform is
+// applied in the vertex shader, and lights, materials, color material and the
+// texture environment are read from the current GL state, so batches look the
+// same as the glPushMatrix loops they replace
+static const char* instanceVertexSource =
+    "#version 120\n"
+    "attribute vec4 instanceOffset;  // xyz translation, w rotation about Y (degrees)\n"
+    "attribute vec4 instanceScale;   // xyz scale, w sway phase\n"
+    "uniform vec3 sway;              // amplitude (degrees), angular frequency, time\n"
+    "uniform int lightCount;\n"
+    "uniform int lights[8];  // Enabled GL_LIGHTi, first lightCount entries\n"
+    "uniform int lighting;\n"
+    "uniform int colorMaterial;\n"
+    "varying vec4 color;\n"
+    "vec3 rotateY(vec3 v, float c, float s) { return vec3(c * v.x + s * v.z, v.y, -s * v.x + c * v.z); }\n"
+    "vec3 rotateZ(vec3 v, float c, float s) { return vec3(c * v.x - s * v.y, s * v.x + c * v.y, v.z); }\n"
+    "void main() {\n"
+    "    float angle = radians(instanceOffset.w);\n"
+    "    float c = cos(angle), s = sin(angle);\n"
+    "    float swayAngle = radians(sway.x * sin(sway.z * sway.y + instanceScale.w));\n"
+    "    float cz = cos(swayAngle), sz = sin(swayAngle);\n"
+    "    vec3 position = rotateY(rotateZ(gl_Vertex.xyz * instanceScale.xyz, cz, sz), c, s) + instanceOffset.xyz;\n"
+    "    vec4 eye = gl_ModelViewMatrix * vec4(position, 1.0);\n"
+    "    gl_Position = gl_ProjectionMatrix * eye;\n"
+    "    gl_TexCoord[0] = gl_TextureMatrix[0] * gl_MultiTexCoord0;\n"
+    "    if (lighting == 0) { color = gl_Color; return; }\n"
+    "    vec3 N = normalize(gl_NormalMatrix * rotateY(rotateZ(gl_Normal / instanceScale.xyz, cz, sz), c, s));\n"
+    "    vec4 ambient = colorMaterial != 0 ? gl_Color : gl_FrontMaterial.ambient;\n"
+    "    vec4 diffuse = colorMaterial != 0 ? gl_Color : gl_FrontMaterial.diffuse;\n"
+    "    vec4 sum = gl_FrontMaterial.emission + gl_LightModel.ambient * ambient;\n"
+    "    for (int k = 0; k < lightCount; k++) {\n"
+    "        int i = lights[k];\n"
+    "        vec4 lp = gl_LightSource[i].position;\n"
+    "        vec3 L = lp.xyz;\n"
+    "        float attenuation = 1.0;\n"
+    "        if (lp.w != 0.0) {\n"
+    "            L = lp.xyz - eye.xyz;\n"
+    "            float d = length(L);\n"
+    "            attenuation = 1.0 / (gl_LightSource[i].constantAttenuation + gl_LightSource[i].linearAttenuation * d +\n"
+    "                                 gl_LightSource[i].quadraticAttenuation * d * d);\n"
+    "        }\n"
+    "        L = normalize(L);\n"
+    "        float NdotL = max(dot(N, L), 0.0);\n"
+    "        vec4 term = gl_LightSource[i].ambient * ambient + NdotL * gl_LightSource[i].diffuse * diffuse;\n"
+    "        if (NdotL > 0.0) {\n"
+    "            float NdotH = max(dot(N, normalize(L + vec3(0.0, 0.0, 1.0))), 0.0);\n"
+    "            term += pow(NdotH, gl_FrontMaterial.shininess) * gl_LightSource[i].specular * gl_FrontMaterial.specular;\n"
+    "        }\n"
+    "        sum += attenuation * term;\n"
+    "    }\n"
+    "    color = clamp(vec4(sum.rgb, diffuse.a), 0.0, 1.0);\n"
+    "}\n";
+
+static const char* instanceFragmentSource =
+    "#version 120\n"
+    "uniform sampler2D texture0;\n"
+    "uniform int textureMode;  // 0 off, 1 GL_MODULATE, 2 GL_REPLACE\n"
+    "varying vec4 color;\n"
+    "void main() {\n"
+    "    vec4 result = color;\n"
+    "    if (textureMode != 0) {\n"
+    "        vec4 texel = texture2D(texture0, gl_TexCoord[0].st);\n"
+    "        result = textureMode == 1 ? color * texel : vec4(texel.rgb, color.a * texel.a);\n"
+    "    }\n"
+    "    gl_FragColor = result;\n"
+    "}\n";
+
+class InstanceShader {
+public:
+    bool ready;
+    
+    InstanceShader() : ready(false), program(0), lightCountLocation(-1), lightsLocation(-1), lightingLocation(-1),
+                       colorMaterialLocation(-1), textureModeLocation(-1), swayLocation(-1) {}
+    
+    // Compile and link the program; on failure instancing falls back to
+    // merged buffers
+    bool init() {
+        if (!glExt.hasInstancing) return false;
+        
+        GLuint vertexShader = compileStage(GL_VERTEX_SHADER, instanceVertexSource, "vertex");
+        GLuint fragmentShader = compileStage(GL_FRAGMENT_SHADER, instanceFragmentSource, "fragment");
+        if (!vertexShader || !fragmentShader) {
+            if (vertexShader) glExt.deleteShader(vertexShader);
+            if (fragmentShader) glExt.deleteShader(fragmentShader);
+            return false;
+        }
+        
+        program = glExt.createProgram();
+        glExt.attachShader(program, vertexShader);
+        glExt.attachShader(program, fragmentShader);
+        glExt.bindAttribLocation(program, INSTANCE_ATTRIB_OFFSET, "instanceOffset");
+        glExt.bindAttribLocation(program, INSTANCE_ATTRIB_SCALE, "instanceScale");
+        glExt.linkProgram(program);
+        glExt.deleteShader(vertexShader);
+        glExt.deleteShader(fragmentShader);
+        
+        GLint linked = 0;
+        glExt.getProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            char log[1024] = "";
+            glExt.getProgramInfoLog(program, sizeof(log), nullptr, log);
+            std::cerr << "Instancing shader failed to link, using merged buffers: " << log << std::endl;
+            glExt.deleteProgram(program);
+            program = 0;
+            return false;
+        }
+        
+        lightCountLocation = glExt.getUniformLocation(program, "lightCount");
+        lightsLocation = glExt.getUniformLocation(program, "lights");
+        lightingLocation = glExt.getUniformLocation(program, "lighting");
+        colorMaterialLocation = glExt.getUniformLocation(program, "colorMaterial");
+        textureModeLocation = glExt.getUniformLocation(program, "textureMode");
+        swayLocation = glExt.getUniformLocation(program, "sway");
+        glExt.useProgram(program);
+        glExt.uniform1i(glExt.getUniformLocation(program, "texture0"), 0);
+        glExt.useProgram(0);
+        
+        ready = true;
+        return true;
+    }
+    
+    void begin() const { glExt.useProgram(program); }
+    void end() const { glExt.useProgram(0); }
+    
+    void setSway(float amplitude, float frequency, float time) const {
+        glExt.uniform3f(swayLocation, amplitude, frequency, time);
+    }
+    
+    // Copy the fixed-function switches the shader cannot read itself; call
+    // after anything (e.g. Material::apply) that may have changed them
+    void syncState() const {
+        GLint lights[8];
+        GLint lightCount = 0;
+        for (int i = 0; i < 8; i++) {
+            if (glIsEnabled(GL_LIGHT0 + i)) lights[lightCount++] = i;
+        }
+        glExt.uniform1i(lightCountLocation, lightCount);
+        glExt.uniform1iv(lightsLocation, lightCount, lights);
+        glExt.uniform1i(lightingLocation, glIsEnabled(GL_LIGHTING) ? 1 : 0);
+        glExt.uniform1i(colorMaterialLocation, glIsEnabled(GL_COLOR_MATERIAL) ? 1 : 0);
+        
+        int textureMode = 0;
+        if (glIsEnabled(GL_TEXTURE_2D)) {
+            GLint envMode = GL_MODULATE;
+            glGetTexEnviv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, &envMode);
+            textureMode = (envMode == GL_REPLACE) ? 2 : 1;
+        }
+        glExt.uniform1i(textureModeLocation, textureMode);
+    }
+    
+private:
+    GLuint program;
+    GLint lightCountLocation, lightsLocation, lightingLocation, colorMaterialLocation, textureModeLocation;
+    GLint swayLocation;
+    
+    static GLuint compileStage(GLenum type, const char* source, const char* label) {
+        GLuint shader = glExt.createShader(type);
+        glExt.shaderSource(shader, 1, &source, nullptr);
+        glExt.compileShader(shader);
+        
+        GLint compiled = 0;
+        glExt.getShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if (!compiled) {
+            char log[1024] = "";
+            glExt.getShaderInfoLog(shader, sizeof(log), nullptr, log);
+            std::cerr << "Instancing " << label << " shader failed to compile: " << log << std::endl;
+            glExt.deleteShader(shader);
+            return 0;
+        }
+        return shader;
+    }
+};
+
+InstanceShader instanceShader;
+
+// A list of transforms for one mesh. With the buffer render path every copy
+// goes out in one glDrawElementsInstanced per material range, or, without
+// instancing support, in one glDrawElements per material from a merged
+// buffer holding every copy pre-transformed (re-transformed on the CPU each
+// frame while the batch sways). The display list and immediate paths keep
+// drawing the copies one at a time. Copies outside the view frustum are
+// dropped first, in one batched sphere test per draw, and with a LOD chain
+// the batched paths draw each copy at the level its projected size picks.
+class InstanceBatch {
+public:
+    InstanceBatch() : instanceVbo(0), instancesDirty(true), swayAmplitude(0.0f), swayFrequency(0.0f),
+                      swayTime(0.0f), boundsSource(nullptr), boundsVertexCount(0), boundsDirty(true) {}
+    ~InstanceBatch() { release(); }
+    
+    InstanceBatch(const InstanceBatch&) = delete;
+    InstanceBatch& operator=(const InstanceBatch&) = delete;
+    
+    void add(float x, float y, float z, float rotationY, float scaleX, float scaleY, float scaleZ,
+             float swayPhase = 0.0f) {
+        InstanceTransform t = { x, y, z, rotationY, scaleX, scaleY, scaleZ, swayPhase };
+        instances.push_back(t);
+        instancesDirty = true;
+        boundsDirty = true;
+        mergedLevels.clear();
+    }
+    
+    void clear() {
+        instances.clear();
+        boundsDirty = true;
+        release();
+    }
+    
+    size_t size() const { return instances.size(); }
+    
+    // Tilt every copy about Z by amplitude * sin(time * frequency + swayPhase)
+    // degrees; time is updated each frame with setSwayTime
+    void setSway(float amplitude, float frequency) {
+        swayAmplitude = amplitude;
+        swayFrequency = frequency;
+    }
+    void setSwayTime(float time) { swayTime = time; }
+    
+    // Free the GL buffers (instances are kept and re-uploaded on next draw)
+    void release() {
+        if (instanceVbo && glExt.hasBuffers) glExt.deleteBuffers(1, &instanceVbo);
+        instanceVbo = 0;
+        instancesDirty = true;
+        mergedLevels.clear();
+    }
+    
+    // Draw every copy of mesh. ranges are its material runs, applyMaterial(id)
+    // is called for each run with id >= 0 (empty ranges draw the whole mesh
+    // in the current material), and drawSingle(at) draws one copy in the
+    // current transform when the copies go out one at a time (and picks its
+    // own level there from the copy's placement). lods is the mesh's simplified chain, if it has one.
+    template <typename ApplyMaterial, typename DrawSingle>
+    void draw(const GpuMesh& mesh, const std::vector<MaterialRange>& ranges,
+              ApplyMaterial applyMaterial, DrawSingle drawSingle, const MeshLodChain* lods = nullptr) {
+        if (instances.empty()) return;
+        
+        size_t visibleCount = cullInstances(mesh);
+        if (visibleCount == 0) return;
+        
+        size_t meshTriangles = mesh.indices.size() / 3;
+        bool batched = meshRenderPath == RENDER_PATH_BUFFERS && mesh.uploaded && instancingMode != INSTANCING_OFF;
+        if (!batched) {
+            if (!lods) {
+                lodStats.fullTriangles += visibleCount * meshTriangles;
+                lodStats.drawnTriangles += visibleCount * meshTriangles;
+            }
+            for (size_t i = 0; i < instances.size(); i++) {
+                if (!instanceVisible[i]) continue;
+                const InstanceTransform& t = instances[i];
+                glPushMatrix();
+                glTranslatef(t.x, t.y, t.z);
+                glRotatef(t.rotationY, 0.0f, 1.0f, 0.0f);
+                if (swayAmplitude != 0.0f) glRotatef(swayAngle(t), 0.0f, 0.0f, 1.0f);
+                glScalef(t.scaleX, t.scaleY, t.scaleZ);
+                drawSingle(LodPlacement(Vector3(t.x, t.y, t.z), std::max(t.scaleX, std::max(t.scaleY, t.scaleZ))));
+                glPopMatrix();
+            }
+            return;
+        }
+        
+        lodStats.fullTriangles += visibleCount * meshTriangles;
+        int levelCount = (lods && lodEnabled) ? (int)lods->size() : 0;
+        if (levelCount == 0) {
+            drawPass(0, mesh, ranges, applyMaterial, instanceVisible, visibleCount);
+            lodStats.drawnTriangles += visibleCount * meshTriangles;
+            return;
+        }
+        
+        // One pass per level and cross-fade step; a cross-fading copy is
+        // drawn at both levels through complementary stipples
+        chooseLevels(levelCount);
+        for (int level = 0; level <= levelCount; level++) {
+            for (int blend = 0; blend < LOD_BLEND_STEPS; blend++) {
+                size_t count = selectCopies(level, blend);
+                if (count == 0) continue;
+                if (blend) beginLodBlend(blend, false);
+                drawLevel(level, mesh, ranges, *lods, applyMaterial, count);
+                if (blend) {
+                    beginLodBlend(blend, true);
+                    drawLevel(level + 1, mesh, ranges, *lods, applyMaterial, count);
+                    endLodBlend();
+                }
+            }
+        }
+    }
+    
+private:
+    std::vector<InstanceTransform> instances;
+    GLuint instanceVbo;
+    bool instancesDirty;
+    float swayAmplitude, swayFrequency, swayTime;
+    
+    // Bounding spheres (x, y, z, radius arrays for the batched test), rebuilt
+    // when the instances or the source mesh change, and this frame's result
+    std::vector<float> boundsX, boundsY, boundsZ, boundsRadius;
+    std::vector<uint8_t> instanceVisible;
+    const GpuMesh* boundsSource;
+    size_t boundsVertexCount;
+    bool boundsDirty;
+    
+    // This frame's level and cross-fade step per copy, and the copies in
+    // the pass being drawn
+    std::vector<uint8_t> instanceLevel, instanceBlend, instanceSelected;
+    std::vector<InstanceTransform> selectedInstances;  // Uploaded instead of all for a subset
+    
+    // Merged fallback for one LOD level, rebuilt when the instances or the
+    // source mesh change
+    struct MergedCopy {
+        GpuMesh mesh;
+        std::vector<MaterialRange> ranges;
+        const GpuMesh* source;
+        GLuint sourceVbo;
+        size_t sourceVertexCount, sourceIndexCount;
+        std::vector<MeshVertex> swayVertices;  // Per-frame copy while swaying
+        std::vector<float> swayBuiltAt;        // swayTime each copy was last transformed at
+        
+        MergedCopy() : source(nullptr), sourceVbo(0), sourceVertexCount(0), sourceIndexCount(0) {}
+    };
+    std::vector<std::unique_ptr<MergedCopy>> mergedLevels;  // Index = LOD level
+    
+    float swayAngle(const InstanceTransform& t) const {
+        return swayAmplitude * sinf(swayTime * swayFrequency + t.swayPhase);
+    }
+    
+    // Each copy is bounded by a sphere about its origin: the farthest mesh
+    // vertex times the largest scale, which neither the Y rotation nor the
+    // sway tilt can exceed. Fills instanceVisible; returns the visible count.
+    size_t cullInstances(const GpuMesh& mesh) {
+        if (boundsDirty || boundsSource != &mesh || boundsVertexCount != mesh.vertices.size()) {
+            float meshRadius = 0.0f;
+            for (const auto& v : mesh.vertices) {
+                meshRadius = std::max(meshRadius, v.px * v.px + v.py * v.py + v.pz * v.pz);
+            }
+            // No CPU copy to measure: never cull
+            meshRadius = mesh.vertices.empty() ? 1e30f : sqrtf(meshRadius);
+            
+            size_t count = instances.size();
+            boundsX.resize(count);
+            boundsY.resize(count);
+            boundsZ.resize(count);
+            boundsRadius.resize(count);
+            for (size_t i = 0; i < count; i++) {
+                const InstanceTransform& t = instances[i];
+                boundsX[i] = t.x;
+                boundsY[i] = t.y;
+                boundsZ[i] = t.z;
+                boundsRadius[i] = meshRadius * std::max(fabsf(t.scaleX), std::max(fabsf(t.scaleY), fabsf(t.scaleZ)));
+            }
+            instanceVisible.resize(count);
+            instanceLevel.resize(count);
+            instanceBlend.resize(count);
+            instanceSelected.resize(count);
+            boundsSource = &mesh;
+            boundsVertexCount = mesh.vertices.size();
+            boundsDirty = false;
+        }
+        return spheresInView(boundsX.data(), boundsY.data(), boundsZ.data(), boundsRadius.data(),
+                             instances.size(), instanceVisible.data());
+    }
+    
+    // Level for each visible copy from its bounding sphere's projected size,
+    // measured from lodEye like a single model's placement
+    void chooseLevels(int levelCount) {
+        for (size_t i = 0; i < instances.size(); i++) {
+            if (!instanceVisible[i]) continue;
+            float x = boundsX[i] - lodEye.x;
+            float y = boundsY[i] - lodEye.y;
+            float z = boundsZ[i] - lodEye.z;
+            LodChoice choice = chooseLod(projectedRadius(boundsRadius[i], sqrtf(x * x + y * y + z * z)), levelCount);
+            instanceLevel[i] = (uint8_t)choice.level;
+            instanceBlend[i] = (uint8_t)choice.blend;
+        }
+    }
+    
+    size_t selectCopies(int level, int blend) {
+        size_t count = 0;
+        for (size_t i = 0; i < instances.size(); i++) {
+            instanceSelected[i] = instanceVisible[i] && instanceLevel[i] == level && instanceBlend[i] == blend;
+            count += instanceSelected[i];
+        }
+        return count;
+    }
+    
+    template <typename ApplyMaterial>
+    void drawLevel(int level, const GpuMesh& mesh, const std::vector<MaterialRange>& ranges, const MeshLodChain& lods,
+                   ApplyMaterial& applyMaterial, size_t count) {
+        const GpuMesh* levelMesh = &mesh;
+        const std::vector<MaterialRange>* levelRanges = &ranges;
+        if (level > 0 && lods[level - 1]->mesh.uploaded) {
+            levelMesh = &lods[level - 1]->mesh;
+            if (!ranges.empty()) levelRanges = &lods[level - 1]->ranges;
+        } else {
+            level = 0;
+        }
+        drawPass(level, *levelMesh, *levelRanges, applyMaterial, instanceSelected, count);
+        lodStats.drawnTriangles += count * (levelMesh->indices.size() / 3);
+    }
+    
+    template <typename ApplyMaterial>
+    void drawPass(int level, const GpuMesh& mesh, const std::vector<MaterialRange>& ranges,
+                  ApplyMaterial& applyMaterial, const std::vector<uint8_t>& selected, size_t count) {
+        if ((instancingMode == INSTANCING_AUTO || instancingMode == INSTANCING_HARDWARE) && instanceShader.ready) {
+            drawInstanced(mesh, ranges, applyMaterial, selected, count);
+        } else {
+            drawMerged(level, mesh, ranges, applyMaterial, selected, count);
+        }
+    }
+    
+    template <typename ApplyMaterial>
+    void drawInstanced(const GpuMesh& mesh, const std::vector<MaterialRange>& ranges, ApplyMaterial& applyMaterial,
+                       const std::vector<uint8_t>& selected, size_t selectedCount) {
+        if (selectedCount < instances.size()) {
+            // Stream just the selected copies; the full set goes back up
+            // once every copy is drawn in one pass again
+            selectedInstances.clear();
+            for (size_t i = 0; i < instances.size(); i++) {
+                if (selected[i]) selectedInstances.push_back(instances[i]);
+            }
+            if (!instanceVbo) glExt.genBuffers(1, &instanceVbo);
+            glExt.bindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+            glExt.bufferData(GL_ARRAY_BUFFER, selectedInstances.size() * sizeof(InstanceTransform),
+                             selectedInstances.data(), GL_DYNAMIC_DRAW);
+            instancesDirty = true;
+        } else if (instancesDirty) {
+            if (!instanceVbo) glExt.genBuffers(1, &instanceVbo);
+            glExt.bindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+            glExt.bufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceTransform), instances.data(), GL_STATIC_DRAW);
+            instancesDirty = false;
+        }
+        
+        mesh.bind();
+        const char* base = nullptr;
+        glExt.bindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+        glExt.enableVertexAttribArray(INSTANCE_ATTRIB_OFFSET);
+        glExt.vertexAttribPointer(INSTANCE_ATTRIB_OFFSET, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform), base + offsetof(InstanceTransform, x));
+        glExt.vertexAttribDivisor(INSTANCE_ATTRIB_OFFSET, 1);
+        glExt.enableVertexAttribArray(INSTANCE_ATTRIB_SCALE);
+        glExt.vertexAttribPointer(INSTANCE_ATTRIB_SCALE, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform), base + offsetof(InstanceTransform, scaleX));
+        glExt.vertexAttribDivisor(INSTANCE_ATTRIB_SCALE, 1);
+        
+        size_t indexSize = (mesh.indexType == GL_UNSIGNED_SHORT) ? sizeof(uint16_t) : sizeof(uint32_t);
+        GLsizei count = (GLsizei)selectedCount;
+        instanceShader.begin();
+        instanceShader.setSway(swayAmplitude, swayFrequency, swayTime);
+        if (ranges.empty()) {
+            instanceShader.syncState();
+            glExt.drawElementsInstanced(GL_TRIANGLES, (GLsizei)mesh.indices.size(), mesh.indexType, nullptr, count);
+            glCounter.draw(GL_TRIANGLES, mesh.indices.size(), count);
+        }
+        for (const auto& range : ranges) {
+            if (range.materialId >= 0) applyMaterial(range.materialId);
+            instanceShader.syncState();
+            glExt.drawElementsInstanced(GL_TRIANGLES, range.cornerCount, mesh.indexType,
+                                        base + range.firstCorner * indexSize, count);
+            glCounter.draw(GL_TRIANGLES, range.cornerCount, count);
+        }
+        instanceShader.end();
+        
+        glExt.vertexAttribDivisor(INSTANCE_ATTRIB_OFFSET, 0);
+        glExt.vertexAttribDivisor(INSTANCE_ATTRIB_SCALE, 0);
+        glExt.disableVertexAttribArray(INSTANCE_ATTRIB_OFFSET);
+        glExt.disableVertexAttribArray(INSTANCE_ATTRIB_SCALE);
+        mesh.unbind();
+    }
+    
+    // Each material run in the merged buffer holds the copies in order, so
+    // consecutive selected copies go out as one glDrawElements
+    template <typename ApplyMaterial>
+    void drawMerged(int level, const GpuMesh& mesh, const std::vector<MaterialRange>& ranges,
+                    ApplyMaterial& applyMaterial, const std::vector<uint8_t>& selected, size_t selectedCount) {
+        if ((int)mergedLevels.size() <= level) mergedLevels.resize(level + 1);
+        if (!mergedLevels[level]) mergedLevels[level].reset(new MergedCopy());
+        MergedCopy& merged = *mergedLevels[level];
+        if (merged.source != &mesh || merged.sourceVbo != mesh.vbo ||
+            merged.sourceVertexCount != mesh.vertices.size() || merged.sourceIndexCount != mesh.indices.size()) {
+            buildMerged(merged, mesh, ranges);
+        }
+        if (!merged.mesh.uploaded) return;
+        
+        // Only copies drawn this pass whose angle moved since they were last
+        // built are re-transformed, and nothing is re-uploaded when none did
+        // (paused, or a later pass of the same frame over copies already done)
+        if (swayAmplitude != 0.0f) {
+            size_t vertexCount = mesh.vertices.size();
+            merged.swayVertices.resize(vertexCount * instances.size());
+            merged.swayBuiltAt.resize(instances.size(), NAN);
+            bool changed = false;
+            for (size_t i = 0; i < instances.size(); i++) {
+                if (!selected[i] || merged.swayBuiltAt[i] == swayTime) continue;
+                transformVertices(instances[i], swayAngle(instances[i]), mesh.vertices,
+                                  &merged.swayVertices[i * vertexCount]);
+                merged.swayBuiltAt[i] = swayTime;
+                changed = true;
+            }
+            if (changed) merged.mesh.updateVertices(merged.swayVertices.data(), merged.swayVertices.size());
+        }
+        
+        size_t count = instances.size();
+        merged.mesh.bind();
+        for (const auto& range : merged.ranges) {
+            if (range.materialId >= 0) applyMaterial(range.materialId);
+            if (selectedCount == count) {
+                merged.mesh.drawRange(range.firstCorner, range.cornerCount);
+                continue;
+            }
+            int cornersPerCopy = range.cornerCount / (int)count;
+            for (size_t i = 0; i < count;) {
+                if (!selected[i]) { i++; continue; }
+                size_t end = i;
+                while (end < count && selected[end]) end++;
+                merged.mesh.drawRange(range.firstCorner + (int)i * cornersPerCopy, (int)(end - i) * cornersPerCopy);
+                i = end;
+            }
+        }
+        merged.mesh.unbind();
+    }
+    
+    // Pre-transform every copy into one vertex buffer, with the indices
+    // grouped so each material is a single run across all copies
+    void buildMerged(MergedCopy& merged, const GpuMesh& mesh, const std::vector<MaterialRange>& ranges) {
+        merged.mesh.release();
+        merged.mesh.vertices.clear();
+        merged.mesh.indices.clear();
+        merged.ranges.clear();
+        merged.source = &mesh;
+        merged.sourceVbo = mesh.vbo;
+        merged.sourceVertexCount = mesh.vertices.size();
+        merged.sourceIndexCount = mesh.indices.size();
+        merged.swayVertices.clear();
+        merged.swayBuiltAt.clear();
+        
+        size_t vertexCount = mesh.vertices.size();
+        merged.mesh.vertices.resize(vertexCount * instances.size());
+        for (size_t i = 0; i < instances.size(); i++) {
+            transformVertices(instances[i], 0.0f, mesh.vertices, &merged.mesh.vertices[i * vertexCount]);
+        }
+        
+        std::vector<MaterialRange> sourceRanges = ranges;
+        if (sourceRanges.empty()) {
+            MaterialRange whole = { -1, 0, (int)mesh.indices.size() };
+            sourceRanges.push_back(whole);
+        }
+        
+        std::vector<int> materialOrder;
+        for (const auto& range : sourceRanges) {
+            if (std::find(materialOrder.begin(), materialOrder.end(), range.materialId) == materialOrder.end()) {
+                materialOrder.push_back(range.materialId);
+            }
+        }
+        
+        merged.mesh.indices.reserve(mesh.indices.size() * instances.size());
+        for (int materialId : materialOrder) {
+            MaterialRange out = { materialId, (int)merged.mesh.indices.size(), 0 };
+            for (size_t i = 0; i < instances.size(); i++) {
+                uint32_t baseVertex = (uint32_t)(i * mesh.vertices.size());
+                for (const auto& range : sourceRanges) {
+                    if (range.materialId != materialId) continue;
+                    for (int k = range.firstCorner; k < range.firstCorner + range.cornerCount; k++) {
+                        merged.mesh.indices.push_back(mesh.indices[k] + baseVertex);
+                    }
+                }
+            }
+            out.cornerCount = (int)merged.mesh.indices.size() - out.firstCorner;
+            merged.ranges.push_back(out);
+        }
+        
+        merged.mesh.upload();
+        
+        // Only the GL copy is drawn; drop the CPU arrays
+        std::vector<MeshVertex>().swap(merged.mesh.vertices);
+        std::vector<uint32_t>().swap(merged.mesh.indices);
+    }
+    
+    // One copy of the source vertices in world space; sway in degrees
+    static void transformVertices(const InstanceTransform& t, float sway, const std::vector<MeshVertex>& source,
+                                  MeshVertex* out) {
+        float yaw = t.rotationY * (float)M_PI / 180.0f;
+        float tilt = sway * (float)M_PI / 180.0f;
+        float cy = cosf(yaw), sy = sinf(yaw);
+        float cz = cosf(tilt), sz = sinf(tilt);
+        
+        const MeshVertex* in = source.data();
+        const MeshVertex* end = in + source.size();
+#ifdef HAVE_SSE
+        // Four vertices at a time: each is two rows of four floats, so a pair
+        // of 4x4 transposes gives px,py,pz,nx and ny,nz,u,v lanes. Same
+        // operations in the same order as the scalar tail below.
+        __m128 vcy = _mm_set1_ps(cy), vsy = _mm_set1_ps(sy), vnegSy = _mm_set1_ps(-sy);
+        __m128 vcz = _mm_set1_ps(cz), vsz = _mm_set1_ps(sz);
+        __m128 scaleX = _mm_set1_ps(t.scaleX), scaleY = _mm_set1_ps(t.scaleY), scaleZ = _mm_set1_ps(t.scaleZ);
+        __m128 tx = _mm_set1_ps(t.x), ty = _mm_set1_ps(t.y), tz = _mm_set1_ps(t.z);
+        __m128 zero = _mm_setzero_ps();
+        for (; in + 4 <= end; in += 4, out += 4) {
+            const float* f = &in->px;
+            __m128 px = _mm_loadu_ps(f), py = _mm_loadu_ps(f + 8), pz = _mm_loadu_ps(f + 16), nx = _mm_loadu_ps(f + 24);
+            __m128 ny = _mm_loadu_ps(f + 4), nz = _mm_loadu_ps(f + 12), u = _mm_loadu_ps(f + 20), v = _mm_loadu_ps(f + 28);
+            _MM_TRANSPOSE4_PS(px, py, pz, nx);
+            _MM_TRANSPOSE4_PS(ny, nz, u, v);
+            
+            px = _mm_mul_ps(px, scaleX); py = _mm_mul_ps(py, scaleY); pz = _mm_mul_ps(pz, scaleZ);
+            __m128 x = _mm_sub_ps(_mm_mul_ps(vcz, px), _mm_mul_ps(vsz, py));
+            __m128 y = _mm_add_ps(_mm_mul_ps(vsz, px), _mm_mul_ps(vcz, py));
+            __m128 ox = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vcy, x), _mm_mul_ps(vsy, pz)), tx);
+            __m128 oy = _mm_add_ps(y, ty);
+            __m128 oz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vnegSy, x), _mm_mul_ps(vcy, pz)), tz);
+            
+            nx = _mm_div_ps(nx, scaleX); ny = _mm_div_ps(ny, scaleY); nz = _mm_div_ps(nz, scaleZ);
+            __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)),
+                                                   _mm_mul_ps(nz, nz)));
+            __m128 nonZero = _mm_cmpgt_ps(length, zero);
+            nx = _mm_or_ps(_mm_and_ps(nonZero, _mm_div_ps(nx, length)), _mm_andnot_ps(nonZero, nx));
+            ny = _mm_or_ps(_mm_and_ps(nonZero, _mm_div_ps(ny, length)), _mm_andnot_ps(nonZero, ny));
+            nz = _mm_or_ps(_mm_and_ps(nonZero, _mm_div_ps(nz, length)), _mm_andnot_ps(nonZero, nz));
+            x = _mm_sub_ps(_mm_mul_ps(vcz, nx), _mm_mul_ps(vsz, ny));
+            __m128 ony = _mm_add_ps(_mm_mul_ps(vsz, nx), _mm_mul_ps(vcz, ny));
+            __m128 onx = _mm_add_ps(_mm_mul_ps(vcy, x), _mm_mul_ps(vsy, nz));
+            __m128 onz = _mm_add_ps(_mm_mul_ps(vnegSy, x), _mm_mul_ps(vcy, nz));
+            
+            _MM_TRANSPOSE4_PS(ox, oy, oz, onx);
+            _MM_TRANSPOSE4_PS(ony, onz, u, v);
+            float* o = &out->px;
+            _mm_storeu_ps(o, ox); _mm_storeu_ps(o + 8, oy); _mm_storeu_ps(o + 16, oz); _mm_storeu_ps(o + 24, onx);
+            _mm_storeu_ps(o + 4, ony); _mm_storeu_ps(o + 12, onz); _mm_storeu_ps(o + 20, u); _mm_storeu_ps(o + 28, v);
+        }
+#endif
+        for (; in < end; in++) {
+            const MeshVertex& v = *in;
+            MeshVertex& o = *out++;
+            o.u = v.u;
+            o.v = v.v;
+            
+            float px = v.px * t.scaleX, py = v.py * t.scaleY, pz = v.pz * t.scaleZ;
+            float x = cz * px - sz * py, y = sz * px + cz * py;
+            o.px = cy * x + sy * pz + t.x;
+            o.py = y + t.y;
+            o.pz = -sy * x + cy * pz + t.z;
+            
+            // Normals take the inverse scale, then the same rotations
+            float nx = v.nx / t.scaleX, ny = v.ny / t.scaleY, nz = v.nz / t.scaleZ;
+            float length = sqrtf(nx * nx + ny * ny + nz * nz);
+            if (length > 0.0f) { nx /= length; ny /= length; nz /= length; }
+            x = cz * nx - sz * ny;
+            y = sz * nx + cz * ny;
+            o.nx = cy * x + sy * nz;
+            o.ny = y;
+            o.nz = -sy * x + cy * nz;
+        }
+    }
+};
+
+// Indexed sphere laid out like gluSphere with texturing on: z is the polar
+// axis, s wraps once around it and t runs from 0 at -z to 1 at +z. Fills the
+// CPU arrays only; the caller uploads.
+void buildSphereMesh(GpuMesh& mesh, float radius, int slices, int stacks) {
+    mesh.vertices.clear();
+    mesh.indices.clear();
+    
+    for (int i = 0; i <= stacks; i++) {
+        float rho = (float)M_PI * i / stacks;
+        for (int j = 0; j <= slices; j++) {
+            float theta = (j == slices) ? 0.0f : 2.0f * (float)M_PI * j / slices;
+            MeshVertex v;
+            v.nx = -sinf(theta) * sinf(rho);
+            v.ny = cosf(theta) * sinf(rho);
+            v.nz = cosf(rho);
+            v.px = v.nx * radius;
+            v.py = v.ny * radius;
+            v.pz = v.nz * radius;
+            v.u = (float)j / slices;
+            v.v = 1.0f - (float)i / stacks;
+            mesh.vertices.push_back(v);
+        }
+    }
+    
+    // Counter-clockwise from outside; the pole triangles collapse to nothing
+    // and are left out
+    for (int i = 0; i < stacks; i++) {
+        for (int j = 0; j < slices; j++) {
+            uint32_t a = i * (slices + 1) + j;
+            uint32_t b = a + slices + 1;
+            uint32_t c = b + 1;
+            uint32_t d = a + 1;
+            if (i != stacks - 1) {
+                mesh.indices.push_back(a); mesh.indices.push_back(b); mesh.indices.push_back(c);
+            }
+            if (i != 0) {
+                mesh.indices.push_back(a); mesh.indices.push_back(c); mesh.indices.push_back(d);
+            }
+        }
+    }
+}
+
+// Procedural rock: a sphere pushed in and out along each direction by a few
+// random sine waves, with smooth normals recomputed from the new faces. The
+// displacement depends only on direction, so the seam column and the pole
+// rings (duplicated vertices) stay closed. Same seed, same rock.
+void buildRockMesh(GpuMesh& mesh, unsigned seed, int slices, int stacks) {
+    buildSphereMesh(mesh, 1.0f, slices, stacks);
+    
+    struct Wave { float dx, dy, dz, frequency, phase, amplitude; };
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<Wave> waves;
+    float amplitude = 0.12f;
+    for (int k = 0; k < 5; k++) {
+        Wave w;
+        float length;
+        do {
+            w.dx = unit(rng); w.dy = unit(rng); w.dz = unit(rng);
+            length = sqrtf(w.dx * w.dx + w.dy * w.dy + w.dz * w.dz);
+        } while (length < 0.1f || length > 1.0f);
+        w.dx /= length; w.dy /= length; w.dz /= length;
+        w.frequency = 1.5f + 1.5f * (k + (unit(rng) + 1.0f) * 0.5f);
+        w.phase = unit(rng) * (float)M_PI;
+        w.amplitude = amplitude;
+        amplitude *= 0.6f;
+        waves.push_back(w);
+    }
+    
+    for (auto& v : mesh.vertices) {
+        float radius = 1.0f;
+        for (const auto& w : waves) {
+            radius += w.amplitude * sinf(w.frequency * (v.nx * w.dx + v.ny * w.dy + v.nz * w.dz) + w.phase);
+        }
+        v.px = v.nx * radius;
+        v.py = v.ny * radius;
+        v.pz = v.nz * radius;
+    }
+    
+    // Vertices at the same spot (seam, poles) share one normal: accumulate
+    // on the first vertex of each ring position
+    auto shared = [slices, stacks](uint32_t index) -> uint32_t {
+        int i = index / (slices + 1), j = index % (slices + 1);
+        if (i == 0 || i == stacks) return i * (slices + 1);
+        return i * (slices + 1) + (j == slices ? 0 : j);
+    };
+    std::vector<Vector3> normals(mesh.vertices.size());
+    for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+        const MeshVertex& a = mesh.vertices[mesh.indices[t]];
+        const MeshVertex& b = mesh.vertices[mesh.indices[t + 1]];
+        const MeshVertex& c = mesh.vertices[mesh.indices[t + 2]];
+        Vector3 faceNormal = Vector3(b.px - a.px, b.py - a.py, b.pz - a.pz)
+                                 .cross(Vector3(c.px - a.px, c.py - a.py, c.pz - a.pz));
+        for (int k = 0; k < 3; k++) {
+            Vector3& n = normals[shared(mesh.indices[t + k])];
+            n = n + faceNormal;
+        }
+    }
+    for (size_t k = 0; k < mesh.vertices.size(); k++) {
+        Vector3 n = normals[shared((uint32_t)k)].normalized();
+        mesh.vertices[k].nx = n.x;
+        mesh.vertices[k].ny = n.y;
+        mesh.vertices[k].nz = n.z;
+    }
+    
+    mesh.upload();
+}
+
+// ============================================================================
+// GROUND COVER - Flowers and grass tufts baked into meshes, drawn in batches
+// ============================================================================
+
+// Append a box like glutSolidCube(1) scaled to size, tilted about Z and
+// moved to center (flat normals, counter-clockwise faces)
+void appendBox(GpuMesh& mesh, float cx, float cy, float cz, float sizeX, float sizeY, float sizeZ, float tiltZ) {
+    static const float faces[6][3] = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+    float angle = tiltZ * (float)M_PI / 180.0f;
+    float c = cosf(angle), s = sinf(angle);
+    
+    for (const auto& n : faces) {
+        // Two axes spanning the face; v = n x u makes u x v = n
+        float u[3] = { n[1] != 0 ? 1.0f : 0.0f, n[1] != 0 ? 0.0f : 1.0f, 0.0f };
+        float v[3] = { n[1] * u[2] - n[2] * u[1], n[2] * u[0] - n[0] * u[2], n[0] * u[1] - n[1] * u[0] };
+        
+        uint32_t base = (uint32_t)mesh.vertices.size();
+        const float corners[4][2] = { {-1, -1}, {1, -1}, {1, 1}, {-1, 1} };
+        for (const auto& k : corners) {
+            float px = 0.5f * sizeX * (n[0] + k[0] * u[0] + k[1] * v[0]);
+            float py = 0.5f * sizeY * (n[1] + k[0] * u[1] + k[1] * v[1]);
+            float pz = 0.5f * sizeZ * (n[2] + k[0] * u[2] + k[1] * v[2]);
+            MeshVertex vertex;
+            vertex.px = c * px - s * py + cx;
+            vertex.py = s * px + c * py + cy;
+            vertex.pz = pz + cz;
+            vertex.nx = c * n[0] - s * n[1];
+            vertex.ny = s * n[0] + c * n[1];
+            vertex.nz = n[2];
+            vertex.u = (k[0] + 1) * 0.5f;
+            vertex.v = (k[1] + 1) * 0.5f;
+            mesh.vertices.push_back(vertex);
+        }
+        uint32_t quad[6] = { base, base + 1, base + 2, base, base + 2, base + 3 };
+        mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+    }
+}
+
+// Append an ellipsoid like glutSolidSphere(1, slices, stacks) scaled to
+// radii, turned about Y and moved to center
+void appendEllipsoid(GpuMesh& mesh, float cx, float cy, float cz, float rx, float ry, float rz,
+                     float turnY, int slices, int stacks) {
+    GpuMesh sphere;
+    buildSphereMesh(sphere, 1.0f, slices, stacks);
+    float angle = turnY * (float)M_PI / 180.0f;
+    float c = cosf(angle), s = sinf(angle);
+    
+    uint32_t base = (uint32_t)mesh.vertices.size();
+    for (const auto& v : sphere.vertices) {
+        MeshVertex out = v;
+        float px = v.px * rx, py = v.py * ry, pz = v.pz * rz;
+        out.px = c * px + s * pz + cx;
+        out.py = py + cy;
+        out.pz = -s * px + c * pz + cz;
+        Vector3 n = Vector3(v.nx / rx, v.ny / ry, v.nz / rz).normalized();
+        out.nx = c * n.x + s * n.z;
+        out.ny = n.y;
+        out.nz = -s * n.x + c * n.z;
+        mesh.vertices.push_back(out);
+    }
+    for (uint32_t index : sphere.indices) mesh.indices.push_back(base + index);
+}
+
+// Flower parts, used as material ids in the flower mesh's ranges
+enum FlowerPart { FLOWER_STEM, FLOWER_PETALS, FLOWER_CENTER };
+
+class GroundCover {
+public:
+    static constexpr int FLOWER_COLORS = 6;  // Red, yellow, blue, white, pink, purple
+    
+    GroundCover() : tuftList(0) {
+        for (int k = 0; k < FLOWER_COLORS; k++) flowerLists[k] = 0;
+    }
+    ~GroundCover() { release(); }
+    
+    // Bake the flower and tuft meshes and their display lists (needs a GL context)
+    void build() {
+        release();
+        buildFlowerMesh();
+        buildTuftMesh();
+        
+        for (int k = 0; k < FLOWER_COLORS; k++) {
+            flowerLists[k] = glGenLists(1);
+            renderState.beginList(flowerLists[k]);
+            drawFlowerImmediate(k);
+            renderState.endList();
+            flowerBatches[k].setSway(3.0f, 2.0f);
+        }
+        tuftList = glGenLists(1);
+        renderState.beginList(tuftList);
+        drawTuftImmediate();
+        renderState.endList();
+        tuftBatch.setSway(6.0f, 2.5f);
+    }
+    
+    void release() {
+        clear();
+        flowerMesh.release();
+        tuftMesh.release();
+        for (int k = 0; k < FLOWER_COLORS; k++) {
+            if (flowerLists[k]) glDeleteLists(flowerLists[k], 1);
+            flowerLists[k] = 0;
+        }
+        if (tuftList) glDeleteLists(tuftList, 1);
+        tuftList = 0;
+    }
+    
+    void clear() {
+        for (auto& batch : flowerBatches) batch.clear();
+        tuftBatch.clear();
+    }
+    
+    void addFlower(float x, float z, float scale, int colorType, float swayPhase) {
+        flowerBatches[colorType % FLOWER_COLORS].add(x, 0.0f, z, 0.0f, scale, scale, scale, swayPhase);
+    }
+    
+    void addTuft(float x, float z, float scale, float rotationY, float swayPhase) {
+        tuftBatch.add(x, 0.0f, z, rotationY, scale, scale, scale, swayPhase);
+    }
+    
+    size_t flowerCount() const {
+        size_t count = 0;
+        for (const auto& batch : flowerBatches) count += batch.size();
+        return count;
+    }
+    size_t tuftCount() const { return tuftBatch.size(); }
+    
+    // Everything sways with sin(time * frequency + phase)
+    void render(float time) {
+        renderState.disable(GL_TEXTURE_2D);
+        renderState.enable(GL_LIGHTING);
+        
+        for (int k = 0; k < FLOWER_COLORS; k++) {
+            flowerBatches[k].setSwayTime(time);
+            flowerBatches[k].draw(flowerMesh, flowerRanges, [k](int part) { applyPart(part, k); }, [this, k](const LodPlacement&) {
+                if (meshRenderPath != RENDER_PATH_IMMEDIATE && flowerLists[k]) renderState.callList(flowerLists[k]);
+                else drawFlowerImmediate(k);
+            });
+        }
+        
+        tuftBatch.setSwayTime(time);
+        tuftBatch.draw(tuftMesh, tuftRanges, [](int) { applyGrass(); }, [this](const LodPlacement&) {
+            if (meshRenderPath != RENDER_PATH_IMMEDIATE && tuftList) renderState.callList(tuftList);
+            else drawTuftImmediate();
+        });
+    }
+    
+private:
+    GpuMesh flowerMesh, tuftMesh;
+    std::vector<MaterialRange> flowerRanges, tuftRanges;
+    GLuint flowerLists[FLOWER_COLORS];
+    GLuint tuftList;
+    InstanceBatch flowerBatches[FLOWER_COLORS];
+    InstanceBatch tuftBatch;
+    
+    static void applyColor(float r, float g, float b, float ambientScale) {
+        GLfloat diffuse[] = { r, g, b, 1.0f };
+        GLfloat ambient[] = { r * ambientScale, g * ambientScale, b * ambientScale, 1.0f };
+        renderState.material(GL_DIFFUSE, diffuse);
+        renderState.material(GL_AMBIENT, ambient);
+        glColor3f(r, g, b);
+    }
+    
+    static void applyPart(int part, int colorType) {
+        static const float petalColors[FLOWER_COLORS][3] = {
+            { 1.0f, 0.2f, 0.2f },  // Red
+            { 1.0f, 0.9f, 0.2f },  // Yellow
+            { 0.3f, 0.4f, 0.9f },  // Blue
+            { 1.0f, 1.0f, 1.0f },  // White
+            { 1.0f, 0.5f, 0.7f },  // Pink
+            { 0.7f, 0.3f, 0.9f },  // Purple
+        };
+        if (part == FLOWER_STEM) {
+            applyColor(0.2f, 0.6f, 0.1f, 0.5f);
+        } else if (part == FLOWER_PETALS) {
+            const float* c = petalColors[colorType];
+            applyColor(c[0], c[1], c[2], 0.4f);
+        } else {
+            applyColor(1.0f, 0.8f, 0.2f, 0.5f);
+        }
+    }
+    
+    static void applyGrass() { applyColor(0.35f, 0.7f, 0.2f, 0.6f); }
+    
+    void drawFlowerImmediate(int colorType) const {
+        for (const auto& range : flowerRanges) {
+            applyPart(range.materialId, colorType);
+            flowerMesh.drawImmediate(range.firstCorner, range.cornerCount);
+        }
+    }
+    
+    void drawTuftImmediate() const {
+        applyGrass();
+        tuftMesh.drawImmediate();
+    }
+    
+    // Unit flower, 1 tall: stem with two leaves, five petals and a center
+    void buildFlowerMesh() {
+        flowerMesh.vertices.clear();
+        flowerMesh.indices.clear();
+        flowerRanges.clear();
+        
+        MaterialRange stem = { FLOWER_STEM, 0, 0 };
+        appendBox(flowerMesh, 0.0f, 0.5f, 0.0f, 0.1f, 1.0f, 0.1f, 0.0f);
+        appendBox(flowerMesh, 0.08f, 0.3f, 0.0f, 0.3f, 0.15f, 0.08f, 30.0f);
+        appendBox(flowerMesh, -0.08f, 0.5f, 0.0f, 0.3f, 0.15f, 0.08f, -30.0f);
+        stem.cornerCount = (int)flowerMesh.indices.size();
+        flowerRanges.push_back(stem);
+        
+        MaterialRange petals = { FLOWER_PETALS, (int)flowerMesh.indices.size(), 0 };
+        for (int p = 0; p < 5; p++) {
+            float angle = p * 72.0f * (float)M_PI / 180.0f;
+            appendEllipsoid(flowerMesh, 0.2f * cosf(angle), 1.0f, -0.2f * sinf(angle),
+                            0.25f, 0.08f, 0.15f, p * 72.0f, 6, 4);
+        }
+        petals.cornerCount = (int)flowerMesh.indices.size() - petals.firstCorner;
+        flowerRanges.push_back(petals);
+        
+        MaterialRange center = { FLOWER_CENTER, (int)flowerMesh.indices.size(), 0 };
+        appendEllipsoid(flowerMesh, 0.0f, 1.0f, 0.0f, 0.12f, 0.12f, 0.12f, 0.0f, 8, 6);
+        center.cornerCount = (int)flowerMesh.indices.size() - center.firstCorner;
+        flowerRanges.push_back(center);
+        
+        flowerMesh.upload();
+    }
+    
+    // Unit tuft: seven tapered blades fanned around Y, leaning outwards,
+    // each with a front and a back face so culling keeps both sides
+    void buildTuftMesh() {
+        tuftMesh.vertices.clear();
+        tuftMesh.indices.clear();
+        tuftRanges.clear();
+        
+        const int blades = 7;
+        for (int b = 0; b < blades; b++) {
+            float turn = b * 2.0f * (float)M_PI / blades + 0.4f * (b % 2);
+            float height = 0.35f + 0.1f * ((b * 3) % 4);
+            float lean = 0.12f + 0.04f * (b % 3);
+            float dx = cosf(turn), dz = -sinf(turn);     // Lean direction
+            float sx = -dz * 0.045f, sz = dx * 0.045f;   // Half base width, across the lean
+            
+            float points[3][3] = {
+                { -sx, 0.0f, -sz },
+                { sx, 0.0f, sz },
+                { dx * lean, height, dz * lean },
+            };
+            Vector3 n = Vector3(points[1][0] - points[0][0], points[1][1] - points[0][1], points[1][2] - points[0][2])
+                            .cross(Vector3(points[2][0] - points[0][0], points[2][1] - points[0][1], points[2][2] - points[0][2]))
+                            .normalized();
+            for (int side = 0; side < 2; side++) {
+                uint32_t base = (uint32_t)tuftMesh.vertices.size();
+                float sign = side ? -1.0f : 1.0f;
+                for (int k = 0; k < 3; k++) {
+                    MeshVertex v;
+                    v.px = points[k][0]; v.py = points[k][1]; v.pz = points[k][2];
+                    v.nx = n.x * sign; v.ny = n.y * sign; v.nz = n.z * sign;
+                    v.u = (float)(k == 1); v.v = (float)(k == 2);
+                    tuftMesh.vertices.push_back(v);
+                }
+                if (side == 0) { tuftMesh.indices.push_back(base); tuftMesh.indices.push_back(base + 1); tuftMesh.indices.push_back(base + 2); }
+                else { tuftMesh.indices.push_back(base); tuftMesh.indices.push_back(base + 2); tuftMesh.indices.push_back(base + 1); }
+            }
+        }
+        MaterialRange grass = { 0, 0, (int)tuftMesh.indices.size() };
+        tuftRanges.push_back(grass);
+        
+        tuftMesh.upload();
+    }
+};
+
+// ============================================================================
+// MESH CACHE - Versioned binary cache (.ccmesh) written next to model sources
+// ============================================================================
+
+// File layout: MeshCacheHeader, MeshVertex[vertexCount], uint32_t[indexCount],
+// MaterialRange[rangeCount], MaterialRange[groupCount], then materialCount +
+// libraryCount + groupCount NUL-terminated strings, then lodCount levels of
+// uint32_t indexCount, uint32_t rangeCount, uint32_t[indexCount] (into the
+// full vertex array), MaterialRange[rangeCount]. A cache is stale when the
+// source size differs, or when its mtime differs and its FNV-1a hash no
+// longer matches; a hash match just updates the stored mtime.
+#define MESH_CACHE_VERSION 4
+
+enum MeshCacheSource {
+    MESH_CACHE_OBJ = 1,
+    MESH_CACHE_3DS = 2
+};
+
+enum MeshCacheFlags {
+    MESH_CACHE_HAS_TEXCOORDS = 1,
+    MESH_CACHE_SMOOTH_NORMALS = 2,  // 3DS: every face smoothed
+    MESH_CACHE_FLAT_NORMALS = 4     // 3DS: every face flat (neither: smoothing groups)
+};
+
+struct MeshCacheHeader {
+    char magic[8];             // "CCMESH" + NULs
+    uint32_t version;
+    uint32_t sourceKind;       // MeshCacheSource
+    uint64_t sourceSize;
+    int64_t sourceMtime;       // Nanoseconds
+    uint64_t sourceHash;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t rangeCount;
+    uint32_t materialCount;
+    uint32_t libraryCount;
+    uint32_t groupCount;
+    uint32_t stringBytes;
+    uint32_t faceCount;        // Source faces, for logging
+    uint32_t flags;            // MeshCacheFlags
+    float minBounds[3];
+    float maxBounds[3];
+    uint32_t lodCount;
+    uint32_t lodBytes;         // Size of the LOD levels block
+};
+
+// Everything a loader needs to rebuild its mesh without parsing the source
+struct MeshCacheData {
+    uint32_t sourceKind;
+    uint32_t faceCount;
+    uint32_t flags;
+    Vector3 minBounds, maxBounds;
+    std::vector<MeshVertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<MaterialRange> ranges;
+    std::vector<std::string> materialNames;  // Index = material ID used by ranges
+    std::vector<std::string> libraries;      // mtllib entries (OBJ only)
+    std::vector<MaterialRange> groups;       // Named index runs (3DS objects); materialId = groupNames index
+    std::vector<std::string> groupNames;
+    std::vector<std::vector<uint32_t>> lodIndices;        // Simplified levels (see generateLodLevels)
+    std::vector<std::vector<MaterialRange>> lodRanges;
+    
+    MeshCacheData() : sourceKind(0), faceCount(0), flags(0) {}
+};
+
+// Set by --no-mesh-cache to always parse model sources
+bool useMeshCache = true;
+
+std::string meshCachePath(const std::string& sourcePath) {
+    return sourcePath + ".ccmesh";
+}
+
+uint64_t hashBytes(const char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;  // FNV-1a 64
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool getFileStamp(const std::string& path, uint64_t& size, int64_t& mtime) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    size = (uint64_t)st.st_size;
+    
+    // Nanosecond mtime where available, so edits within a second are seen
+#if defined(__APPLE__)
+    mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    mtime = (int64_t)st.st_mtime * 1000000000LL;
+#else
+    mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+// Write the cache for a source file whose bytes were just parsed.
+// Writes to a temporary file first so an interrupted run never leaves a
+// truncated cache behind.
+bool writeMeshCache(const std::string& sourcePath, const char* sourceData, size_t sourceSize,
+                    const MeshCacheData& cache) {
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "CCMESH", 6);
+    header.version = MESH_CACHE_VERSION;
+    header.sourceKind = cache.sourceKind;
+    
+    uint64_t statSize = 0;
+    if (!getFileStamp(sourcePath, statSize, header.sourceMtime)) return false;
+    header.sourceSize = sourceSize;
+    header.sourceHash = hashBytes(sourceData, sourceSize);
+    
+    std::string strings;
+    for (const auto& materialName : cache.materialNames) strings.append(materialName.c_str(), materialName.size() + 1);
+    for (const auto& library : cache.libraries) strings.append(library.c_str(), library.size() + 1);
+    for (const auto& groupName : cache.groupNames) strings.append(groupName.c_str(), groupName.size() + 1);
+    
+    header.vertexCount = (uint32_t)cache.vertices.size();
+    header.indexCount = (uint32_t)cache.indices.size();
+    header.rangeCount = (uint32_t)cache.ranges.size();
+    header.materialCount = (uint32_t)cache.materialNames.size();
+    header.libraryCount = (uint32_t)cache.libraries.size();
+    header.groupCount = (uint32_t)cache.groups.size();
+    header.stringBytes = (uint32_t)strings.size();
+    header.faceCount = cache.faceCount;
+    header.flags = cache.flags;
+    header.minBounds[0] = cache.minBounds.x; header.minBounds[1] = cache.minBounds.y; header.minBounds[2] = cache.minBounds.z;
+    header.maxBounds[0] = cache.maxBounds.x; header.maxBounds[1] = cache.maxBounds.y; header.maxBounds[2] = cache.maxBounds.z;
+    header.lodCount = (uint32_t)std::min(cache.lodIndices.size(), cache.lodRanges.size());
+    for (uint32_t level = 0; level < header.lodCount; level++) {
+        header.lodBytes += 2 * sizeof(uint32_t) + (uint32_t)(cache.lodIndices[level].size() * sizeof(uint32_t) +
+                                                             cache.lodRanges[level].size() * sizeof(MaterialRange));
+    }
+    
+    std::string cachePath = meshCachePath(sourcePath);
+    std::string tempPath = cachePath + ".tmp";
+    std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cerr << "Warning: Could not write mesh cache: " << cachePath << std::endl;
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(cache.vertices.data()), cache.vertices.size() * sizeof(MeshVertex));
+    out.write(reinterpret_cast<const char*>(cache.indices.data()), cache.indices.size() * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char*>(cache.ranges.data()), cache.ranges.size() * sizeof(MaterialRange));
+    out.write(reinterpret_cast<const char*>(cache.groups.data()), cache.groups.size() * sizeof(MaterialRange));
+    out.write(strings.data(), strings.size());
+    for (uint32_t level = 0; level < header.lodCount; level++) {
+        uint32_t counts[2] = { (uint32_t)cache.lodIndices[level].size(), (uint32_t)cache.lodRanges[level].size() };
+        out.write(reinterpret_cast<const char*>(counts), sizeof(counts));
+        out.write(reinterpret_cast<const char*>(cache.lodIndices[level].data()), counts[0] * sizeof(uint32_t));
+        out.write(reinterpret_cast<const char*>(cache.lodRanges[level].data()), counts[1] * sizeof(MaterialRange));
+    }
+    out.close();
+    if (!out) {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    
+    std::remove(cachePath.c_str());  // rename does not replace on Windows
+    if (std::rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    std::cout << "Wrote mesh cache: " << cachePath << std::endl;
+    return true;
+}
+
+// Map and validate the cache for a source file. Returns false when there is
+// no cache, it is stale, or it fails validation; the caller then parses.
+bool readMeshCache(const std::string& sourcePath, uint32_t sourceKind, MeshCacheData& cache) {
+    std::string cachePath = meshCachePath(sourcePath);
+    uint64_t sourceSize = 0;
+    int64_t sourceMtime = 0;
+    if (!getFileStamp(sourcePath, sourceSize, sourceMtime)) return false;
+    
+    MappedFile file;
+    if (!file.open(cachePath)) return false;
+    if (file.size < sizeof(MeshCacheHeader)) return false;
+    
+    MeshCacheHeader header;
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, "CCMESH", 6) != 0 || header.version != MESH_CACHE_VERSION ||
+        header.sourceKind != sourceKind) {
+        return false;
+    }
+    
+    // Stale check: size first, then mtime, then content hash (a checkout can
+    // touch the mtime without changing the file)
+    if (header.sourceSize != sourceSize) return false;
+    bool touched = header.sourceMtime != sourceMtime;
+    if (touched) {
+        MappedFile source;
+        if (!source.open(sourcePath) || hashBytes(source.data, source.size) != header.sourceHash) {
+            return false;
+        }
+    }
+    
+    uint64_t expectedSize = sizeof(MeshCacheHeader) +
+                            (uint64_t)header.vertexCount * sizeof(MeshVertex) +
+                            (uint64_t)header.indexCount * sizeof(uint32_t) +
+                            ((uint64_t)header.rangeCount + header.groupCount) * sizeof(MaterialRange) +
+                            header.stringBytes + header.lodBytes;
+    if (expectedSize != file.size) {
+        std::cerr << "Warning: Ignoring corrupt mesh cache: " << cachePath << std::endl;
+        return false;
+    }
+    
+    const char* cursor = file.data + sizeof(MeshCacheHeader);
+    cache.vertices.resize(header.vertexCount);
+    memcpy(cache.vertices.data(), cursor, header.vertexCount * sizeof(MeshVertex));
+    cursor += header.vertexCount * sizeof(MeshVertex);
+    cache.indices.resize(header.indexCount);
+    memcpy(cache.indices.data(), cursor, header.indexCount * sizeof(uint32_t));
+    cursor += header.indexCount * sizeof(uint32_t);
+    cache.ranges.resize(header.rangeCount);
+    memcpy(cache.ranges.data(), cursor, header.rangeCount * sizeof(MaterialRange));
+    cursor += header.rangeCount * sizeof(MaterialRange);
+    cache.groups.resize(header.groupCount);
+    memcpy(cache.groups.data(), cursor, header.groupCount * sizeof(MaterialRange));
+    cursor += header.groupCount * sizeof(MaterialRange);
+    
+    // Split the string table
+    const char* stringsEnd = cursor + header.stringBytes;
+    cache.materialNames.clear();
+    cache.libraries.clear();
+    cache.groupNames.clear();
+    for (uint32_t i = 0; i < header.materialCount + header.libraryCount + header.groupCount; i++) {
+        const char* terminator = (const char*)memchr(cursor, '\0', stringsEnd - cursor);
+        if (!terminator) return false;
+        std::string value(cursor, terminator);
+        if (i < header.materialCount) cache.materialNames.push_back(value);
+        else if (i < header.materialCount + header.libraryCount) cache.libraries.push_back(value);
+        else cache.groupNames.push_back(value);
+        cursor = terminator + 1;
+    }
+    
+    // LOD levels, each header checked against what is left of the block
+    cursor = stringsEnd;
+    const char* lodEnd = cursor + header.lodBytes;
+    cache.lodIndices.assign(header.lodCount, std::vector<uint32_t>());
+    cache.lodRanges.assign(header.lodCount, std::vector<MaterialRange>());
+    for (uint32_t level = 0; level < header.lodCount; level++) {
+        uint32_t counts[2];
+        if ((size_t)(lodEnd - cursor) < sizeof(counts)) return false;
+        memcpy(counts, cursor, sizeof(counts));
+        cursor += sizeof(counts);
+        uint64_t levelBytes = (uint64_t)counts[0] * sizeof(uint32_t) + (uint64_t)counts[1] * sizeof(MaterialRange);
+        if ((uint64_t)(lodEnd - cursor) < levelBytes) return false;
+        cache.lodIndices[level].resize(counts[0]);
+        memcpy(cache.lodIndices[level].data(), cursor, counts[0] * sizeof(uint32_t));
+        cursor += counts[0] * sizeof(uint32_t);
+        cache.lodRanges[level].resize(counts[1]);
+        memcpy(cache.lodRanges[level].data(), cursor, counts[1] * sizeof(MaterialRange));
+        cursor += counts[1] * sizeof(MaterialRange);
+    }
+    if (cursor != lodEnd) return false;
+    
+    // Every index list is whole triangles of in-range vertices, and every
+    // run covers whole triangles inside the list it refers to, so the
+    // loaders can index per triangle without checking again
+    auto validTriangles = [&](const std::vector<uint32_t>& indices) {
+        if (indices.size() % 3 != 0) return false;
+        for (uint32_t index : indices) {
+            if (index >= header.vertexCount) return false;
+        }
+        return true;
+    };
+    auto validRun = [](const MaterialRange& range, size_t indexCount, int idCount) {
+        return range.firstCorner >= 0 && range.cornerCount >= 0 &&
+               range.firstCorner % 3 == 0 && range.cornerCount % 3 == 0 &&
+               (uint64_t)range.firstCorner + range.cornerCount <= indexCount && range.materialId < idCount;
+    };
+    bool valid = validTriangles(cache.indices);
+    for (const auto& range : cache.ranges) valid = valid && validRun(range, cache.indices.size(), (int)header.materialCount);
+    for (const auto& group : cache.groups) {
+        valid = valid && group.materialId >= 0 && validRun(group, cache.indices.size(), (int)header.groupCount);
+    }
+    for (uint32_t level = 0; level < header.lodCount; level++) {
+        valid = valid && validTriangles(cache.lodIndices[level]);
+        for (const auto& range : cache.lodRanges[level]) {
+            valid = valid && validRun(range, cache.lodIndices[level].size(), (int)header.materialCount);
+        }
+    }
+    if (!valid) {
+        std::cerr << "Warning: Ignoring corrupt mesh cache: " << cachePath << std::endl;
+        return false;
+    }
+    
+    cache.sourceKind = header.sourceKind;
+    cache.faceCount = header.faceCount;
+    cache.flags = header.flags;
+    cache.minBounds = Vector3(header.minBounds[0], header.minBounds[1], header.minBounds[2]);
+    cache.maxBounds = Vector3(header.maxBounds[0], header.maxBounds[1], header.maxBounds[2]);
+    
+    // Same contents under a new mtime: store the new stamp so later runs
+    // skip the hash again (after unmapping, which Windows requires)
+    if (touched) {
+        file.close();
+        std::fstream stamp(cachePath, std::ios::binary | std::ios::in | std::ios::out);
+        if (stamp.is_open()) {
+            stamp.seekp(offsetof(MeshCacheHeader, sourceMtime));
+            stamp.write(reinterpret_cast<const char*>(&sourceMtime), sizeof(sourceMtime));
+        }
+    }
+    return true;
+}
+
+// ============================================================================
+// OBJ MODEL CLASS - Complete OBJ file loader
+// ============================================================================
+
+class OBJModel {
+public:
+    std::vector<Vector3> vertices;
+    std::vector<Vector3> normals;
+    std::vector<Vector2> texCoords;
+    
+    // Faces are fan-triangulated at load time into flat corner arrays
+    // (three corners per triangle, indices are 0-based, -1 = not present)
+    std::vector<int> cornerVertices;
+    std::vector<int> cornerTexCoords;
+    std::vector<int> cornerNormals;
+    std::vector<int> faceOffsets;    // first corner of each source face, plus an end entry
+    std::vector<int> faceMaterials;  // material ID per source face
+    std::vector<MaterialRange> materialRanges;  // corners grouped by material
+    GpuMesh gpuMesh;                 // one index per corner, so ranges apply unchanged
+    MeshLodChain lods;               // simplified copies of gpuMesh, finest first
+    
+    std::vector<Material> materials;
+    std::map<std::string, int> materialIds;      // material name -> index into materials
+    std::vector<bool> materialDefined;           // false for usemtl names no MTL defines
+    std::vector<std::string> materialLibraries;  // mtllib entries, loaded after parsing
+    
+    // Bounding box
+    Vector3 minBounds, maxBounds;
+    Vector3 center;
+    float boundingRadius;
+    
+    // Display list for faster rendering
+    GLuint displayList;
+    bool hasDisplayList;
+    bool hasTextures;  // Flag to indicate if model uses textures
+    
+    // Transform properties
+    Vector3 position;
+    Vector3 rotation;
+    Vector3 scale;
+    
+    std::string name;
+    bool isLoaded;
+    bool loadedFromCache;
+    
+    OBJModel() : displayList(0), hasDisplayList(false), hasTextures(false), isLoaded(false), loadedFromCache(false) {
+        position = Vector3(0, 0, 0);
+        rotation = Vector3(0, 0, 0);
+        scale = Vector3(1, 1, 1);
+    }
+    
+    ~OBJModel() {
+        if (hasDisplayList) {
+            glDeleteLists(displayList, 1);
+        }
+        for (const auto& mat : materials) {
+            releaseTexture(mat.textureId);
+        }
+    }
+    
+    // Load OBJ file
+    bool load(const std::string& filename) {
+        if (!loadCPU(filename)) return false;
+        uploadGL();
+        return true;
+    }
+    
+    // CPU half of load(): mesh (from cache or source) and MTL files. Makes no
+    // GL calls, so the asset loader runs it on a worker thread.
+    bool loadCPU(const std::string& filename) {
+        PROFILE_SCOPE("OBJModel::loadCPU");
+        std::cout << "Loading OBJ model: " << filename << std::endl;
+        
+        // Extract directory path for MTL file loading
+        std::string directory = "";
+        size_t lastSlash = filename.find_last_of("/\\");
+        if (lastSlash != std::string::npos) {
+            directory = filename.substr(0, lastSlash + 1);
+        }
+        
+        name = filename;
+        loadedFromCache = useMeshCache && loadCache(filename);
+        if (!loadedFromCache && !loadSource(filename, useMeshCache)) {
+            return false;
+        }
+        
+        // Load material libraries referenced by the file
+        for (const auto& mtlFile : materialLibraries) {
+            loadMTL(directory + mtlFile);
+        }
+        
+        // Faces naming a material no MTL file defined render without one
+        for (int& materialId : faceMaterials) {
+            if (materialId >= 0 && !materialDefined[materialId]) materialId = -1;
+        }
+        for (auto& range : materialRanges) {
+            if (range.materialId >= 0 && !materialDefined[range.materialId]) range.materialId = -1;
+        }
+        for (auto& lod : lods) {
+            for (auto& range : lod->ranges) {
+                if (range.materialId >= 0 && !materialDefined[range.materialId]) range.materialId = -1;
+            }
+        }
+        return true;
+    }
+    
+    // GL half of load(): material textures, display list and buffers.
+    // decodedTextures (one entry per material) holds images already decoded
+    // by a loader thread; without it textures are decoded here.
+    void uploadGL(const std::vector<DecodedImage>* decodedTextures = nullptr) {
+        PROFILE_SCOPE("OBJModel::uploadGL");
+        for (size_t i = 0; i < materials.size(); i++) {
+            Material& mat = materials[i];
+            if (mat.texturePath.empty()) continue;
+            if (decodedTextures && i < decodedTextures->size() && (*decodedTextures)[i].isValid()) {
+                mat.textureId = textureRegistry.acquire((*decodedTextures)[i]);
+            } else {
+                mat.textureId = loadTexture(mat.texturePath);
+            }
+        }
+        
+        // Create display list for faster rendering
+        // Check if any materials have textures
+        hasTextures = false;
+        for (const auto& mat : materials) {
+            if (mat.textureId != 0) {
+                hasTextures = true;
+                break;
+            }
+        }
+        
+        // Create display list for all models (including textured ones)
+        createDisplayList();
+        
+        // Vertex/index buffers for the buffer render path
+        gpuMesh.upload();
+        
+        // The same for each LOD level
+        for (auto& lod : lods) {
+            lod->displayList = glGenLists(1);
+            renderState.beginList(lod->displayList);
+            for (const auto& range : lod->ranges) {
+                if (range.materialId >= 0) {
+                    materials[range.materialId].apply();
+                }
+                lod->mesh.drawImmediate(range.firstCorner, range.cornerCount);
+            }
+            renderState.disable(GL_TEXTURE_2D);
+            renderState.endList();
+            lod->mesh.upload();
+        }
+        
+        isLoaded = true;
+        std::cout << "Loaded OBJ" << (loadedFromCache ? " from cache" : "") << ": " << vertices.size() << " vertices, " 
+                  << faceCount() << " faces, " 
+                  << materials.size() << " materials" << std::endl;
+        if (!lods.empty()) {
+            std::cout << "  LOD levels: " << gpuMesh.indices.size() / 3;
+            for (const auto& lod : lods) std::cout << " -> " << lod->triangleCount();
+            std::cout << " triangles" << std::endl;
+        }
+    }
+    
+    // Parse the OBJ text and build the indexed mesh (no GL calls, so this
+    // also runs offline for --rebuild-caches); optionally writes the cache
+    bool loadSource(const std::string& filename, bool writeCache) {
+        MappedFile file;
+        if (!file.open(filename)) {
+            std::cerr << "Error: Could not open OBJ file: " << filename << std::endl;
+            return false;
+        }
+        
+        parseOBJ(file.data, file.size);
+        
+        // Calculate bounds
+        calculateBounds();
+        
+        // Generate normals if not provided
+        if (normals.empty()) {
+            generateNormals();
+        }
+        
+        groupFacesByMaterial();
+        buildGpuMesh();
+        
+        std::vector<std::vector<uint32_t>> lodIndices;
+        std::vector<std::vector<MaterialRange>> lodRanges;
+        generateLodLevels(gpuMesh.vertices, gpuMesh.indices, materialRanges, (maxBounds - minBounds).length(),
+                          lodIndices, lodRanges);
+        buildLodChain(lods, gpuMesh.vertices, lodIndices, lodRanges);
+        
+        if (writeCache) {
+            MeshCacheData cache;
+            cache.sourceKind = MESH_CACHE_OBJ;
+            cache.faceCount = faceCount();
+            cache.minBounds = minBounds;
+            cache.maxBounds = maxBounds;
+            cache.vertices = gpuMesh.vertices;
+            cache.indices = gpuMesh.indices;
+            cache.ranges = materialRanges;
+            for (const auto& mat : materials) cache.materialNames.push_back(mat.name);
+            cache.libraries = materialLibraries;
+            cache.lodIndices.swap(lodIndices);
+            cache.lodRanges.swap(lodRanges);
+            writeMeshCache(filename, file.data, file.size, cache);
+        }
+        return true;
+    }
+    
+    // Rebuild the model from its .ccmesh cache. The cache holds the
+    // deduplicated mesh, so vertices/normals/texCoords become per-mesh-vertex
+    // arrays, every corner indexes all three with the same value, and each
+    // triangle counts as one face.
+    bool loadCache(const std::string& filename) {
+        MeshCacheData cache;
+        if (!readMeshCache(filename, MESH_CACHE_OBJ, cache)) return false;
+        
+        size_t vertexCount = cache.vertices.size();
+        vertices.resize(vertexCount);
+        normals.resize(vertexCount);
+        texCoords.resize(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++) {
+            const MeshVertex& mv = cache.vertices[i];
+            vertices[i] = Vector3(mv.px, mv.py, mv.pz);
+            normals[i] = Vector3(mv.nx, mv.ny, mv.nz);
+            texCoords[i].u = mv.u;
+            texCoords[i].v = mv.v;
+        }
+        
+        cornerVertices.assign(cache.indices.begin(), cache.indices.end());
+        cornerTexCoords = cornerVertices;
+        cornerNormals = cornerVertices;
+        
+        for (const auto& materialName : cache.materialNames) findOrAddMaterial(materialName);
+        materialLibraries = cache.libraries;
+        materialRanges = cache.ranges;
+        
+        int triangleCount = (int)cache.indices.size() / 3;
+        faceOffsets.resize(triangleCount + 1);
+        faceMaterials.assign(triangleCount, -1);
+        for (int t = 0; t <= triangleCount; t++) faceOffsets[t] = t * 3;
+        for (const auto& range : materialRanges) {
+            for (int c = range.firstCorner; c < range.firstCorner + range.cornerCount; c += 3) {
+                faceMaterials[c / 3] = range.materialId;
+            }
+        }
+        
+        setBounds(cache.minBounds, cache.maxBounds);
+        buildLodChain(lods, cache.vertices, cache.lodIndices, cache.lodRanges);
+        
+        gpuMesh.vertices.swap(cache.vertices);
+        gpuMesh.indices.swap(cache.indices);
+        return true;
+    }
+    
+    // Parse OBJ text in place: tokens are read straight out of the file
+    // buffer with from_chars, so there are no per-line string allocations
+    void parseOBJ(const char* data, size_t size) {
+        TextCursor cursor(data, data + size);
+        int currentMaterial = -1;
+        
+        // Corners of the face being parsed, reused across faces
+        std::vector<int> polyVertices, polyTexCoords, polyNormals;
+        
+        while (!cursor.atEnd()) {
+            const char* keyword;
+            size_t keywordLength;
+            cursor.readToken(keyword, keywordLength);
+            
+            if (keywordLength == 1 && keyword[0] == 'v') {
+                // Vertex position
+                Vector3 v;
+                cursor.readFloat(v.x) && cursor.readFloat(v.y) && cursor.readFloat(v.z);
+                vertices.push_back(v);
+            }
+            else if (keywordLength == 2 && keyword[0] == 'v' && keyword[1] == 'n') {
+                // Vertex normal
+                Vector3 n;
+                cursor.readFloat(n.x) && cursor.readFloat(n.y) && cursor.readFloat(n.z);
+                normals.push_back(n);
+            }
+            else if (keywordLength == 2 && keyword[0] == 'v' && keyword[1] == 't') {
+                // Texture coordinate
+                Vector2 t;
+                cursor.readFloat(t.u) && cursor.readFloat(t.v);
+                texCoords.push_back(t);
+            }
+            else if (keywordLength == 1 && keyword[0] == 'f') {
+                // Face
+                polyVertices.clear();
+                polyTexCoords.clear();
+                polyNormals.clear();
+                
+                while (true) {
+                    cursor.skipSpaces();
+                    if (cursor.atLineEnd()) break;
+                    
+                    // Parse face vertex data (formats: v, v/vt, v/vt/vn, v//vn)
+                    int vIdx = 0, vtIdx = 0, vnIdx = 0;
+                    bool valid = cursor.readInt(vIdx);
+                    if (valid && !cursor.atEnd() && *cursor.pos == '/') {
+                        ++cursor.pos;
+                        if (!cursor.atEnd() && *cursor.pos != '/') {
+                            cursor.readInt(vtIdx);
+                        }
+                        if (!cursor.atEnd() && *cursor.pos == '/') {
+                            ++cursor.pos;
+                            cursor.readInt(vnIdx);
+                        }
+                    }
+                    
+                    // Skip whatever is left of this corner token
+                    cursor.skipToken();
+                    if (!valid) continue;
+                    
+                    // OBJ indices are 1-based, convert to 0-based
+                    // Negative indices are relative to current count
+                    if (vIdx < 0) vIdx = vertices.size() + vIdx + 1;
+                    if (vtIdx < 0) vtIdx = texCoords.size() + vtIdx + 1;
+                    if (vnIdx < 0) vnIdx = normals.size() + vnIdx + 1;
+                    
+                    polyVertices.push_back(vIdx - 1);
+                    polyTexCoords.push_back(vtIdx - 1);
+                    polyNormals.push_back(vnIdx - 1);
+                }
+                
+                // Triangulate quads and polygons as a fan around the first corner
+                if (polyVertices.size() >= 3) {
+                    if (faceOffsets.empty()) faceOffsets.push_back(0);
+                    for (size_t i = 1; i + 1 < polyVertices.size(); i++) {
+                        const size_t fan[3] = { 0, i, i + 1 };
+                        for (size_t c : fan) {
+                            cornerVertices.push_back(polyVertices[c]);
+                            cornerTexCoords.push_back(polyTexCoords[c]);
+                            cornerNormals.push_back(polyNormals[c]);
+                        }
+                    }
+                    faceOffsets.push_back((int)cornerVertices.size());
+                    faceMaterials.push_back(currentMaterial);
+                }
+            }
+            else if (keywordLength == 6 && memcmp(keyword, "mtllib", 6) == 0) {
+                // Material library - rest of line to handle filenames with spaces
+                materialLibraries.push_back(cursor.restOfLine());
+            }
+            else if (keywordLength == 6 && memcmp(keyword, "usemtl", 6) == 0) {
+                // Use material - rest of line to handle material names with spaces
+                std::string materialName = cursor.restOfLine();
+                currentMaterial = materialName.empty() ? -1 : findOrAddMaterial(materialName);
+            }
+            
+            cursor.nextLine();
+        }
+    }
+    
+    // Number of source faces (before triangulation)
+    int faceCount() const {
+        return faceOffsets.empty() ? 0 : (int)faceOffsets.size() - 1;
+    }
+    
+    // Returns the ID of the named material, adding an empty one if needed
+    int findOrAddMaterial(const std::string& materialName) {
+        auto it = materialIds.find(materialName);
+        if (it != materialIds.end()) return it->second;
+        
+        int id = (int)materials.size();
+        materials.push_back(Material());
+        materials.back().name = materialName;
+        materialDefined.push_back(false);
+        materialIds[materialName] = id;
+        return id;
+    }
+    
+    // Load MTL material file
+    bool loadMTL(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file.is_open()) {
+            std::cerr << "Warning: Could not open MTL file: " << filename << std::endl;
+            return false;
+        }
+        
+        std::cout << "Loading MTL file: " << filename << std::endl;
+        
+        Material* currentMat = nullptr;
+        std::string line;
+        
+        while (std::getline(file, line)) {
             if (!line.empty() && line.back() == '\r') {
                 line.pop_back();
             }
@@ -528,9 +5081,11 @@ public:
             if (prefix == "newmtl") {
                 std::string matName;
                 iss >> matName;
-                materials[matName] = Material();
-                materials[matName].name = matName;
-                currentMat = &materials[matName];
+                int id = findOrAddMaterial(matName);
+                materials[id] = Material();
+                materials[id].name = matName;
+                materialDefined[id] = true;
+                currentMat = &materials[id];
             }
             else if (currentMat != nullptr) {
                 if (prefix == "Ka") {
@@ -545,796 +5100,2008 @@ public:
                 else if (prefix == "Ke") {
                     iss >> currentMat->emission[0] >> currentMat->emission[1] >> currentMat->emission[2];
                 }
-                else if (prefix == "Ns") {
-                    iss >> currentMat->shininess;
-                    // OBJ shininess is 0-1000, OpenGL is 0-128
-                    currentMat->shininess = std::min(currentMat->shininess * 128.0f / 1000.0f, 128.0f);
+                else if (prefix == "Ns") {
+                    iss >> currentMat->shininess;
+                    // OBJ shininess is 0-1000, OpenGL is 0-128
+                    currentMat->shininess = std::min(currentMat->shininess * 128.0f / 1000.0f, 128.0f);
+                }
+                else if (prefix == "d" || prefix == "Tr") {
+                    iss >> currentMat->transparency;
+                    if (prefix == "Tr") currentMat->transparency = 1.0f - currentMat->transparency;
+                    currentMat->diffuse[3] = currentMat->transparency;
+                    currentMat->ambient[3] = currentMat->transparency;
+                }
+                else if (prefix == "map_Kd") {
+                    std::string texFile;
+                    std::getline(iss >> std::ws, texFile);
+                    currentMat->textureFile = texFile;
+                    
+                    // Extract directory from MTL filename and load texture
+                    std::string directory = "";
+                    size_t lastSlash = filename.find_last_of("/\\");
+                    if (lastSlash != std::string::npos) {
+                        directory = filename.substr(0, lastSlash + 1);
+                    }
+                    
+                    // Texture is created later, on the GL thread, by uploadGL()
+                    currentMat->texturePath = directory + texFile;
+                }
+            }
+        }
+        
+        file.close();
+        return true;
+    }
+    
+    // Calculate bounding box
+    void calculateBounds() {
+        if (vertices.empty()) return;
+        
+        Vector3 lo = vertices[0], hi = vertices[0];
+        
+        for (const auto& v : vertices) {
+            lo.x = std::min(lo.x, v.x);
+            lo.y = std::min(lo.y, v.y);
+            lo.z = std::min(lo.z, v.z);
+            hi.x = std::max(hi.x, v.x);
+            hi.y = std::max(hi.y, v.y);
+            hi.z = std::max(hi.z, v.z);
+        }
+        
+        setBounds(lo, hi);
+    }
+    
+    // Set the bounding box and derive center and radius from it
+    void setBounds(const Vector3& lo, const Vector3& hi) {
+        minBounds = lo;
+        maxBounds = hi;
+        
+        center = Vector3(
+            (minBounds.x + maxBounds.x) / 2.0f,
+            (minBounds.y + maxBounds.y) / 2.0f,
+            (minBounds.z + maxBounds.z) / 2.0f
+        );
+        
+        boundingRadius = (maxBounds - minBounds).length() / 2.0f;
+    }
+    
+    // Radius about the model's own origin that encloses every vertex, for
+    // culling copies placed with glTranslatef/glRotatef/glScalef
+    float originRadius() const {
+        return center.length() + boundingRadius;
+    }
+    
+    // Generate normals if not present in OBJ file
+    void generateNormals() {
+        normals.assign(vertices.size(), Vector3(0, 0, 0));
+        
+        for (int f = 0; f < faceCount(); f++) {
+            int first = faceOffsets[f];
+            int last = faceOffsets[f + 1];
+            
+            // Calculate face normal from the first triangle
+            Vector3 v0 = vertices[cornerVertices[first]];
+            Vector3 v1 = vertices[cornerVertices[first + 1]];
+            Vector3 v2 = vertices[cornerVertices[first + 2]];
+            
+            Vector3 edge1 = v1 - v0;
+            Vector3 edge2 = v2 - v0;
+            Vector3 faceNormal = edge1.cross(edge2).normalized();
+            
+            // Add face normal to each vertex of the face once: the fan centre,
+            // the second corner of every triangle and the final corner
+            normals[cornerVertices[first]] = normals[cornerVertices[first]] + faceNormal;
+            for (int c = first + 1; c < last; c += 3) {
+                normals[cornerVertices[c]] = normals[cornerVertices[c]] + faceNormal;
+            }
+            normals[cornerVertices[last - 1]] = normals[cornerVertices[last - 1]] + faceNormal;
+        }
+        
+        // Normalize all vertex normals
+        for (auto& n : normals) {
+            n = n.normalized();
+        }
+        
+        // Update corner normal indices
+        cornerNormals = cornerVertices;
+    }
+    
+    // Reorder faces so each material's triangles are contiguous (stable, in
+    // material ID order) and record one MaterialRange per material
+    void groupFacesByMaterial() {
+        materialRanges.clear();
+        int count = faceCount();
+        if (count == 0) return;
+        
+        std::vector<int> order(count);
+        for (int f = 0; f < count; f++) order[f] = f;
+        std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+            return faceMaterials[a] < faceMaterials[b];
+        });
+        
+        std::vector<int> sortedVertices, sortedTexCoords, sortedNormals;
+        std::vector<int> sortedOffsets, sortedMaterials;
+        sortedVertices.reserve(cornerVertices.size());
+        sortedTexCoords.reserve(cornerTexCoords.size());
+        sortedNormals.reserve(cornerNormals.size());
+        sortedOffsets.reserve(faceOffsets.size());
+        sortedMaterials.reserve(faceMaterials.size());
+        sortedOffsets.push_back(0);
+        
+        for (int f : order) {
+            int first = faceOffsets[f];
+            int last = faceOffsets[f + 1];
+            int materialId = faceMaterials[f];
+            
+            if (materialRanges.empty() || materialRanges.back().materialId != materialId) {
+                materialRanges.push_back({ materialId, (int)sortedVertices.size(), 0 });
+            }
+            materialRanges.back().cornerCount += last - first;
+            
+            sortedVertices.insert(sortedVertices.end(), cornerVertices.begin() + first, cornerVertices.begin() + last);
+            sortedTexCoords.insert(sortedTexCoords.end(), cornerTexCoords.begin() + first, cornerTexCoords.begin() + last);
+            sortedNormals.insert(sortedNormals.end(), cornerNormals.begin() + first, cornerNormals.begin() + last);
+            sortedOffsets.push_back((int)sortedVertices.size());
+            sortedMaterials.push_back(materialId);
+        }
+        
+        cornerVertices.swap(sortedVertices);
+        cornerTexCoords.swap(sortedTexCoords);
+        cornerNormals.swap(sortedNormals);
+        faceOffsets.swap(sortedOffsets);
+        faceMaterials.swap(sortedMaterials);
+    }
+    
+    // Emit one triangle corner in immediate mode
+    void emitCorner(int c) const {
+        int vIdx = cornerVertices[c];
+        int nIdx = cornerNormals[c];
+        int tIdx = cornerTexCoords[c];
+        if (tIdx >= 0 && tIdx < (int)texCoords.size()) {
+            glTexCoord2f(texCoords[tIdx].u, texCoords[tIdx].v);
+        }
+        if (nIdx >= 0 && nIdx < (int)normals.size()) {
+            glNormal3f(normals[nIdx].x, normals[nIdx].y, normals[nIdx].z);
+        }
+        if (vIdx >= 0 && vIdx < (int)vertices.size()) {
+            glVertex3f(vertices[vIdx].x, vertices[vIdx].y, vertices[vIdx].z);
+        }
+    }
+    
+    // Emit the triangles of each material range, applying the material once per range
+    void emitMaterialRanges() const {
+        for (const auto& range : materialRanges) {
+            if (range.materialId >= 0) {
+                materials[range.materialId].apply();
+            }
+            
+            glBegin(GL_TRIANGLES);
+            int end = range.firstCorner + range.cornerCount;
+            for (int c = range.firstCorner; c < end; c++) {
+                emitCorner(c);
+            }
+            glEnd();
+        }
+    }
+    
+    // Build the indexed mesh: corners sharing position, texcoord and normal
+    // become one vertex, index order follows the corner arrays
+    void buildGpuMesh() {
+        gpuMesh.vertices.clear();
+        gpuMesh.indices.clear();
+        gpuMesh.indices.reserve(cornerVertices.size());
+        
+        std::unordered_map<CornerKey, uint32_t, CornerKeyHash> vertexForCorner;
+        vertexForCorner.reserve(cornerVertices.size());
+        
+        for (size_t c = 0; c < cornerVertices.size(); c++) {
+            CornerKey key = { cornerVertices[c], cornerTexCoords[c], cornerNormals[c] };
+            auto inserted = vertexForCorner.emplace(key, (uint32_t)gpuMesh.vertices.size());
+            if (inserted.second) {
+                MeshVertex mv = { 0, 0, 0, 0, 1, 0, 0, 0 };
+                if (key.vertex >= 0 && key.vertex < (int)vertices.size()) {
+                    mv.px = vertices[key.vertex].x;
+                    mv.py = vertices[key.vertex].y;
+                    mv.pz = vertices[key.vertex].z;
+                }
+                if (key.normal >= 0 && key.normal < (int)normals.size()) {
+                    mv.nx = normals[key.normal].x;
+                    mv.ny = normals[key.normal].y;
+                    mv.nz = normals[key.normal].z;
                 }
-                else if (prefix == "d" || prefix == "Tr") {
-                    iss >> currentMat->transparency;
-                    if (prefix == "Tr") currentMat->transparency = 1.0f - currentMat->transparency;
-                    currentMat->diffuse[3] = currentMat->transparency;
-                    currentMat->ambient[3] = currentMat->transparency;
+                if (key.texCoord >= 0 && key.texCoord < (int)texCoords.size()) {
+                    mv.u = texCoords[key.texCoord].u;
+                    mv.v = texCoords[key.texCoord].v;
                 }
-                else if (prefix == "map_Kd") {
-                    std::string texFile;
-                    std::getline(iss >> std::ws, texFile);
-                    currentMat->textureFile = texFile;
-                    
-                    // Extract directory from MTL filename and load texture
-                    std::string directory = "";
-                    size_t lastSlash = filename.find_last_of("/\\");
-                    if (lastSlash != std::string::npos) {
-                        directory = filename.substr(0, lastSlash + 1);
+                gpuMesh.vertices.push_back(mv);
+            }
+            gpuMesh.indices.push_back(inserted.first->second);
+        }
+    }
+    
+    // Create OpenGL display list for faster rendering (batched by material)
+    void createDisplayList() {
+        displayList = glGenLists(1);
+        renderState.beginList(displayList);
+        
+        emitMaterialRanges();
+        
+        // Disable textures at end of display list
+        renderState.disable(GL_TEXTURE_2D);
+        
+        renderState.endList();
+        hasDisplayList = true;
+    }
+    
+    // Render the model; at is where the caller's transform puts it
+    void render(const LodPlacement& at = LodPlacement()) const {
+        if (!isLoaded) return;
+        
+        glPushMatrix();
+        
+        // Apply transformations
+        glTranslatef(position.x, position.y, position.z);
+        glRotatef(rotation.x, 1.0f, 0.0f, 0.0f);
+        glRotatef(rotation.y, 0.0f, 1.0f, 0.0f);
+        glRotatef(rotation.z, 0.0f, 0.0f, 1.0f);
+        glScalef(scale.x, scale.y, scale.z);
+        
+        drawMesh(placed(at));
+        
+        // Ensure textures are disabled after rendering
+        renderState.disable(GL_TEXTURE_2D);
+        
+        glPopMatrix();
+    }
+    
+    // Level for a copy placed at 'at': the bounding sphere about the model
+    // origin, grown by the placement's scale, projected from the origin's
+    // distance to the eye
+    LodChoice lodFor(const LodPlacement& at) const {
+        LodChoice choice = { 0, 0 };
+        if (lods.empty() || !lodEnabled) return choice;
+        float distance = (at.origin - lodEye).length();
+        return chooseLod(projectedRadius(originRadius() * at.scale, distance), (int)lods.size());
+    }
+    
+    // The model's own position and scale on top of the caller's placement.
+    // The caller's rotation is not applied to position; models drawn inside
+    // a caller's transform keep position at the origin.
+    LodPlacement placed(const LodPlacement& at) const {
+        float ownScale = std::max(scale.x, std::max(scale.y, scale.z));
+        return LodPlacement(at.origin + position * at.scale, at.scale * ownScale);
+    }
+    
+    int levelTriangles(int level) const {
+        return level == 0 ? (int)gpuMesh.indices.size() / 3 : lods[level - 1]->triangleCount();
+    }
+    
+    // Draw at the current level with drawLevel(level), cross-fading into the
+    // next level through complementary stipples near a switch
+    template <typename DrawLevel>
+    void drawWithLod(const LodPlacement& at, DrawLevel drawLevel) const {
+        LodChoice choice = lodFor(at);
+        lodStats.fullTriangles += levelTriangles(0);
+        lodStats.drawnTriangles += levelTriangles(choice.level);
+        if (choice.blend == 0) {
+            drawLevel(choice.level);
+            return;
+        }
+        beginLodBlend(choice.blend, false);
+        drawLevel(choice.level);
+        beginLodBlend(choice.blend, true);
+        drawLevel(choice.level + 1);
+        endLodBlend();
+        lodStats.drawnTriangles += levelTriangles(choice.level + 1);
+    }
+    
+    // Draw the mesh with its own materials in the current transform, using
+    // the selected render path (falls back when a path is unavailable);
+    // at is where that transform puts the mesh origin
+    void drawMesh(const LodPlacement& at) const {
+        drawWithLod(at, [this](int level) { drawMeshLevel(level); });
+    }
+    
+    void drawMeshLevel(int level) const {
+        if (level > 0) {
+            const MeshLod& lod = *lods[level - 1];
+            if (meshRenderPath == RENDER_PATH_BUFFERS && lod.mesh.uploaded) {
+                lod.mesh.bind();
+                for (const auto& range : lod.ranges) {
+                    if (range.materialId >= 0) {
+                        materials[range.materialId].apply();
                     }
-                    
-                    std::string fullTexPath = directory + texFile;
-                    currentMat->textureId = loadTexture(fullTexPath);
+                    lod.mesh.drawRange(range.firstCorner, range.cornerCount);
+                }
+                lod.mesh.unbind();
+                renderState.disable(GL_TEXTURE_2D);
+            } else if (meshRenderPath != RENDER_PATH_IMMEDIATE && lod.displayList) {
+                renderState.callList(lod.displayList);
+            } else {
+                for (const auto& range : lod.ranges) {
+                    if (range.materialId >= 0) {
+                        materials[range.materialId].apply();
+                    }
+                    lod.mesh.drawImmediate(range.firstCorner, range.cornerCount);
                 }
+                renderState.disable(GL_TEXTURE_2D);
             }
+            return;
         }
         
-        file.close();
-        return true;
+        if (meshRenderPath == RENDER_PATH_BUFFERS && gpuMesh.uploaded) {
+            gpuMesh.bind();
+            for (const auto& range : materialRanges) {
+                if (range.materialId >= 0) {
+                    materials[range.materialId].apply();
+                }
+                gpuMesh.drawRange(range.firstCorner, range.cornerCount);
+            }
+            gpuMesh.unbind();
+            renderState.disable(GL_TEXTURE_2D);
+        } else if (meshRenderPath != RENDER_PATH_IMMEDIATE && hasDisplayList) {
+            renderState.callList(displayList);
+        } else {
+            renderDirect();
+        }
     }
     
-    // Calculate bounding box
-    void calculateBounds() {
-        if (vertices.empty()) return;
+    // Direct rendering for textured models (batched for performance)
+    void renderDirect() const {
+        emitMaterialRanges();
+    }
+    
+    // Render with external texture (bypasses display list to use caller's bound texture)
+    void renderWithTexture(const LodPlacement& at = LodPlacement()) const {
+        if (!isLoaded) return;
         
-        minBounds = maxBounds = vertices[0];
+        glPushMatrix();
         
-        for (const auto& v : vertices) {
-            minBounds.x = std::min(minBounds.x, v.x);
-            minBounds.y = std::min(minBounds.y, v.y);
-            minBounds.z = std::min(minBounds.z, v.z);
-            maxBounds.x = std::max(maxBounds.x, v.x);
-            maxBounds.y = std::max(maxBounds.y, v.y);
-            maxBounds.z = std::max(maxBounds.z, v.z);
-        }
+        glTranslatef(position.x, position.y, position.z);
+        glRotatef(rotation.x, 1.0f, 0.0f, 0.0f);
+        glRotatef(rotation.y, 0.0f, 1.0f, 0.0f);
+        glRotatef(rotation.z, 0.0f, 0.0f, 1.0f);
+        glScalef(scale.x, scale.y, scale.z);
         
-        center = Vector3(
-            (minBounds.x + maxBounds.x) / 2.0f,
-            (minBounds.y + maxBounds.y) / 2.0f,
-            (minBounds.z + maxBounds.z) / 2.0f
-        );
+        // Render without materials (no display list) to use caller's bound texture
+        drawWithLod(placed(at), [this](int level) {
+            const GpuMesh& mesh = (level == 0) ? gpuMesh : lods[level - 1]->mesh;
+            if (meshRenderPath == RENDER_PATH_BUFFERS && mesh.uploaded) {
+                mesh.bind();
+                mesh.drawRange(0, (int)mesh.indices.size());
+                mesh.unbind();
+            } else if (level > 0) {
+                mesh.drawImmediate();
+            } else {
+                glBegin(GL_TRIANGLES);
+                for (int c = 0; c < (int)cornerVertices.size(); c++) {
+                    emitCorner(c);
+                }
+                glEnd();
+            }
+        });
         
-        boundingRadius = (maxBounds - minBounds).length() / 2.0f;
+        glPopMatrix();
     }
     
-    // Generate normals if not present in OBJ file
-    void generateNormals() {
-        normals.resize(vertices.size(), Vector3(0, 0, 0));
+    // Render with procedural UV mapping based on vertex positions (for models without proper UVs)
+    void renderWithProceduralUV(float uvScale = 0.01f, const LodPlacement& at = LodPlacement()) const {
+        if (!isLoaded) return;
         
-        for (const auto& face : faces) {
-            if (face.vertexIndices.size() < 3) continue;
-            
-            // Calculate face normal
-            Vector3 v0 = vertices[face.vertexIndices[0]];
-            Vector3 v1 = vertices[face.vertexIndices[1]];
-            Vector3 v2 = vertices[face.vertexIndices[2]];
-            
-            Vector3 edge1 = v1 - v0;
-            Vector3 edge2 = v2 - v0;
-            Vector3 faceNormal = edge1.cross(edge2).normalized();
+        glPushMatrix();
+        
+        glTranslatef(position.x, position.y, position.z);
+        glRotatef(rotation.x, 1.0f, 0.0f, 0.0f);
+        glRotatef(rotation.y, 0.0f, 1.0f, 0.0f);
+        glRotatef(rotation.z, 0.0f, 0.0f, 1.0f);
+        glScalef(scale.x, scale.y, scale.z);
+        
+        // Render with procedural UV based on vertex position
+        drawWithLod(placed(at), [this, uvScale](int level) {
+            const GpuMesh& mesh = (level == 0) ? gpuMesh : lods[level - 1]->mesh;
+            bool buffers = meshRenderPath == RENDER_PATH_BUFFERS && mesh.uploaded;
+            if (buffers || level > 0) {
+                // Same box mapping via object-linear texgen: u = x * scale, v = y * scale
+                const GLfloat planeS[] = { uvScale, 0.0f, 0.0f, 0.0f };
+                const GLfloat planeT[] = { 0.0f, uvScale, 0.0f, 0.0f };
+                glTexGeni(GL_S, GL_TEXTURE_GEN_MODE, GL_OBJECT_LINEAR);
+                glTexGeni(GL_T, GL_TEXTURE_GEN_MODE, GL_OBJECT_LINEAR);
+                glTexGenfv(GL_S, GL_OBJECT_PLANE, planeS);
+                glTexGenfv(GL_T, GL_OBJECT_PLANE, planeT);
+                glEnable(GL_TEXTURE_GEN_S);
+                glEnable(GL_TEXTURE_GEN_T);
+                
+                if (buffers) {
+                    mesh.bind(false);
+                    mesh.drawRange(0, (int)mesh.indices.size());
+                    mesh.unbind();
+                } else {
+                    mesh.drawImmediate();
+                }
+                
+                glDisable(GL_TEXTURE_GEN_S);
+                glDisable(GL_TEXTURE_GEN_T);
+                return;
+            }
             
-            // Add face normal to all vertices of the face
-            for (int idx : face.vertexIndices) {
-                normals[idx] = normals[idx] + faceNormal;
+            glBegin(GL_TRIANGLES);
+            for (int c = 0; c < (int)cornerVertices.size(); c++) {
+                int vIdx = cornerVertices[c];
+                int nIdx = cornerNormals[c];
+                if (vIdx < 0 || vIdx >= (int)vertices.size()) continue;
+                
+                // Generate UV from vertex position (box mapping)
+                const Vector3& p = vertices[vIdx];
+                glTexCoord2f(p.x * uvScale, p.y * uvScale);
+                if (nIdx >= 0 && nIdx < (int)normals.size()) {
+                    glNormal3f(normals[nIdx].x, normals[nIdx].y, normals[nIdx].z);
+                }
+                glVertex3f(p.x, p.y, p.z);
+            }
+            glEnd();
+        });
+        
+        glPopMatrix();
+    }
+    
+    // Render with custom color (ignores material)
+    void renderWithColor(float r, float g, float b, float a = 1.0f, const LodPlacement& at = LodPlacement()) const {
+        if (!isLoaded) return;
+        
+        glPushMatrix();
+        
+        glTranslatef(position.x, position.y, position.z);
+        glRotatef(rotation.x, 1.0f, 0.0f, 0.0f);
+        glRotatef(rotation.y, 0.0f, 1.0f, 0.0f);
+        glRotatef(rotation.z, 0.0f, 0.0f, 1.0f);
+        glScalef(scale.x, scale.y, scale.z);
+        
+        glColor4f(r, g, b, a);
+        
+        GLfloat matDiffuse[] = { r, g, b, a };
+        renderState.material(GL_DIFFUSE, matDiffuse);
+        
+        drawMesh(placed(at));
+        
+        glPopMatrix();
+    }
+    
+    // Set position
+    void setPosition(float x, float y, float z) {
+        position = Vector3(x, y, z);
+    }
+    
+    // Set rotation (degrees)
+    void setRotation(float rx, float ry, float rz) {
+        rotation = Vector3(rx, ry, rz);
+    }
+    
+    // Set scale
+    void setScale(float sx, float sy, float sz) {
+        scale = Vector3(sx, sy, sz);
+    }
+    
+    void setUniformScale(float s) {
+        scale = Vector3(s, s, s);
+    }
+};
+
+// ============================================================================
+// 3DS CHUNK READER - Bounds-checked little-endian decoding over a byte span
+// ============================================================================
+
+// 3DS file chunk IDs
+#define MAIN3DS          0x4D4D
+#define EDIT3DS          0x3D3D
+#define EDIT_MATERIAL    0xAFFF
+#define EDIT_OBJECT      0x4000
+#define OBJ_TRIMESH      0x4100
+#define TRI_VERTEXL      0x4110
+#define TRI_FACEL        0x4120
+#define TRI_MATERIAL     0x4130
+#define TRI_MAPCOORD     0x4140
+#define TRI_SMOOTH       0x4150
+#define MAT_NAME         0xA000
+#define MAT_AMBIENT      0xA010
+#define MAT_DIFFUSE      0xA020
+#define MAT_SPECULAR     0xA030
+#define MAT_SHININESS    0xA040
+#define MAT_TRANSPARENCY 0xA050
+#define MAT_TEXMAP       0xA200
+#define MAT_MAPNAME      0xA300
+#define COLOR_F          0x0010
+#define COLOR_24         0x0011
+#define LIN_COLOR_24     0x0012
+#define LIN_COLOR_F      0x0013
+#define PERCENT_I        0x0030
+#define PERCENT_F        0x0031
+
+// Cursor over one chunk's bytes (usually inside a MappedFile). Reads past
+// the end return zero and mark the reader failed instead of touching memory
+// outside the span, so a truncated or corrupt file can only lose data.
+class ChunkReader {
+public:
+    ChunkReader() : pos(nullptr), end(nullptr), failed(false) {}
+    ChunkReader(const unsigned char* begin, const unsigned char* end) : pos(begin), end(end), failed(false) {}
+    
+    size_t remaining() const { return (size_t)(end - pos); }
+    bool atEnd() const { return pos >= end; }
+    bool hasFailed() const { return failed; }
+    
+    // Claim the next count bytes for bulk decoding (nullptr if too short)
+    const unsigned char* take(size_t count) {
+        if (remaining() < count) {
+            failed = true;
+            pos = end;
+            return nullptr;
+        }
+        const unsigned char* start = pos;
+        pos += count;
+        return start;
+    }
+    
+    static uint16_t decodeU16(const unsigned char* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+    static uint32_t decodeU32(const unsigned char* p) {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+    static float decodeFloat(const unsigned char* p) {
+        uint32_t bits = decodeU32(p);
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    
+    uint8_t readU8() { const unsigned char* p = take(1); return p ? p[0] : 0; }
+    uint16_t readU16() { const unsigned char* p = take(2); return p ? decodeU16(p) : 0; }
+    uint32_t readU32() { const unsigned char* p = take(4); return p ? decodeU32(p) : 0; }
+    float readFloat() { const unsigned char* p = take(4); return p ? decodeFloat(p) : 0.0f; }
+    
+    // NUL-terminated string, found with one memchr
+    std::string readString() {
+        const unsigned char* terminator = (const unsigned char*)memchr(pos, 0, remaining());
+        if (!terminator) {
+            failed = true;
+            pos = end;
+            return std::string();
+        }
+        std::string value((const char*)pos, (const char*)terminator);
+        pos = terminator + 1;
+        return value;
+    }
+    
+    // Read the next child chunk header and return its body as a reader of
+    // exactly the declared length. A length shorter than the 6-byte header
+    // or running past this reader's end is rejected (and ends iteration).
+    bool nextChunk(uint16_t& id, ChunkReader& body) {
+        if (atEnd()) return false;
+        const unsigned char* header = take(6);
+        if (!header) return false;
+        id = decodeU16(header);
+        uint32_t length = decodeU32(header + 2);
+        if (length < 6 || length - 6 > remaining()) {
+            std::cerr << "Warning: 3DS chunk 0x" << std::hex << id << std::dec << " has bad length "
+                      << length << " (" << remaining() + 6 << " bytes left in parent)" << std::endl;
+            failed = true;
+            pos = end;
+            return false;
+        }
+        body = ChunkReader(pos, pos + (length - 6));
+        pos += length - 6;
+        return true;
+    }
+    
+private:
+    const unsigned char* pos;
+    const unsigned char* end;
+    bool failed;
+};
+
+// ============================================================================
+// 3DS MODEL CLASS - 3DS loader on the shared GpuMesh pipeline
+// ============================================================================
+
+// How Model3DS computes normals (set before loading)
+enum Normals3DS {
+    NORMALS_3DS_SMOOTHING_GROUPS,  // Faces sharing a smoothing group blend, group 0 stays flat
+    NORMALS_3DS_FLAT,
+    NORMALS_3DS_SMOOTH             // Every face blends with its neighbours
+};
+
+class Model3DS {
+public:
+    // A named EDIT_OBJECT: a run of triangles in the shared index buffer
+    struct SubMesh {
+        std::string name;
+        int firstIndex;
+        int indexCount;
+    };
+    
+    // Parsed geometry, every object's vertices concatenated; indices are
+    // already offset to the object's first vertex. 3DS objects hold at most
+    // 65535 vertices, so exporters split large meshes across objects; the
+    // merged mesh switches to 32-bit indices when it needs them.
+    std::vector<Vector3> vertices;
+    std::vector<std::pair<float, float>> texCoords;  // UV coordinates, one per vertex when present
+    std::vector<uint32_t> indices;                   // Three per triangle
+    std::vector<int> triangleMaterials;              // Per triangle, -1 = none
+    std::vector<uint32_t> smoothingGroups;           // Per triangle bitmask, 0 = flat
+    std::vector<SubMesh> subMeshes;
+    std::vector<Material> materials;                 // EDIT_MATERIAL (0xAFFF) chunks
+    std::vector<MaterialRange> materialRanges;       // Material runs, objects sorted by material
+    float minY, maxY, minZ, maxZ;  // For positioning on ground
+    
+    GpuMesh gpuMesh;               // Vertices with normals, drawn by every render path
+    Normals3DS normalMode;
+    
+    Vector3 position;
+    Vector3 rotation;
+    Vector3 scale;
+    
+    GLuint displayList;
+    bool hasDisplayList;
+    bool isLoaded;
+    bool loadedFromCache;
+    std::string name;
+    
+    Model3DS() : minY(0), maxY(0), minZ(0), maxZ(0), normalMode(NORMALS_3DS_SMOOTHING_GROUPS), displayList(0),
+                 hasDisplayList(false), isLoaded(false), loadedFromCache(false), skippedFaces(0) {
+        position = Vector3(0, 0, 0);
+        rotation = Vector3(0, 0, 0);
+        scale = Vector3(1, 1, 1);
+    }
+    
+    ~Model3DS() {
+        if (hasDisplayList) {
+            glDeleteLists(displayList, 1);
+        }
+        for (auto& material : materials) {
+            releaseTexture(material.textureId);
+        }
+    }
+    
+    Model3DS(const Model3DS&) = delete;
+    Model3DS& operator=(const Model3DS&) = delete;
+    
+    // Parse a whole 3DS file held in memory (no GL calls)
+    bool parse(const unsigned char* data, size_t size, const std::string& directory) {
+        ChunkReader file(data, data + size);
+        uint16_t id;
+        ChunkReader mainChunk;
+        if (!file.nextChunk(id, mainChunk) || id != MAIN3DS) {
+            std::cerr << "Error: Not a valid 3DS file!" << std::endl;
+            return false;
+        }
+        
+        uint16_t childId;
+        ChunkReader child;
+        while (mainChunk.nextChunk(childId, child)) {
+            if (childId == EDIT3DS) parseEditor(child, directory);
+        }
+        if (mainChunk.hasFailed()) {
+            std::cerr << "Warning: 3DS file is truncated or corrupt, keeping what was read" << std::endl;
+        }
+        
+        // Pad UVs for trailing objects that had none
+        if (!texCoords.empty()) texCoords.resize(vertices.size(), std::make_pair(0.0f, 0.0f));
+        return true;
+    }
+    
+    bool load(const std::string& filename) {
+        if (!loadCPU(filename)) return false;
+        uploadGL();
+        return true;
+    }
+    
+    // CPU half of load() (cache or chunk parse plus normals), safe on a worker thread
+    bool loadCPU(const std::string& filename) {
+        PROFILE_SCOPE("Model3DS::loadCPU");
+        std::cout << "Loading 3DS model: " << filename << std::endl;
+        name = filename;
+        
+        loadedFromCache = useMeshCache && loadCache(filename);
+        return loadedFromCache || loadSource(filename, useMeshCache);
+    }
+    
+    // GL half of load(): acquire material textures (pre-decoded by the asset
+    // loader when given), upload the buffers and compile the display list
+    void uploadGL(const std::vector<DecodedImage>* decodedTextures = nullptr) {
+        PROFILE_SCOPE("Model3DS::uploadGL");
+        for (size_t i = 0; i < materials.size(); i++) {
+            Material& material = materials[i];
+            if (material.texturePath.empty()) continue;
+            if (decodedTextures && i < decodedTextures->size() && (*decodedTextures)[i].isValid()) {
+                material.textureId = textureRegistry.acquire((*decodedTextures)[i]);
+            } else {
+                material.textureId = loadTexture(material.texturePath);
             }
         }
         
-        // Normalize all vertex normals
-        for (auto& n : normals) {
-            n = n.normalized();
+        std::cout << "Loaded 3DS model" << (loadedFromCache ? " from cache" : "") << " with "
+                  << gpuMesh.vertices.size() << " vertices, " << triangleCount() << " triangles, "
+                  << subMeshes.size() << " objects and " << materials.size() << " materials" << std::endl;
+        
+        isLoaded = true;
+        gpuMesh.upload();
+        buildDisplayList();
+    }
+    
+    // Parse the 3DS file and build the mesh (no GL calls); optionally
+    // writes the .ccmesh cache
+    bool loadSource(const std::string& filename, bool writeCache) {
+        MappedFile source;
+        if (!source.open(filename)) {
+            std::cerr << "Error: Could not open 3DS file: " << filename << std::endl;
+            return false;
+        }
+        if (!parse((const unsigned char*)source.data, source.size, modelDirectory(filename))) return false;
+        
+        if (skippedFaces > 0) {
+            std::cerr << "Warning: " << filename << " has " << skippedFaces
+                      << " faces with out-of-range vertices" << std::endl;
         }
         
-        // Update face normal indices
-        for (auto& face : faces) {
-            face.normalIndices = face.vertexIndices;
+        buildGpuMesh();
+        
+        if (writeCache && !gpuMesh.vertices.empty()) {
+            writeMeshCache(filename, source.data, source.size, buildCacheData());
         }
+        return true;
     }
     
-    // Create OpenGL display list for faster rendering (batched by material)
-    void createDisplayList() {
-        displayList = glGenLists(1);
-        glNewList(displayList, GL_COMPILE);
+    int triangleCount() const {
+        return (int)gpuMesh.indices.size() / 3;
+    }
+    
+    // Compute normals once and fill gpuMesh. Each corner's normal is the
+    // area-weighted sum of the faces around its vertex that it blends with
+    // (per normalMode); corners sharing a vertex and an identical normal
+    // become one mesh vertex.
+    void buildGpuMesh() {
+        gpuMesh.vertices.clear();
+        gpuMesh.indices.clear();
+        bool hasTexCoords = !texCoords.empty();
+        size_t triangles = indices.size() / 3;
+        
+        std::vector<Vector3> faceNormals(triangles);  // Unnormalised: length = 2x area
+        for (size_t t = 0; t < triangles; t++) {
+            const Vector3& v0 = vertices[indices[t * 3]];
+            faceNormals[t] = (vertices[indices[t * 3 + 1]] - v0).cross(vertices[indices[t * 3 + 2]] - v0);
+        }
         
-        // Group faces by material for batch rendering
-        std::map<std::string, std::vector<const Face*>> facesByMaterial;
-        for (const auto& face : faces) {
-            facesByMaterial[face.materialName].push_back(&face);
+        // Triangles around each vertex (compressed rows)
+        std::vector<uint32_t> facesStart(vertices.size() + 1, 0);
+        std::vector<uint32_t> vertexFaces(indices.size());
+        if (normalMode != NORMALS_3DS_FLAT) {
+            for (uint32_t index : indices) facesStart[index + 1]++;
+            for (size_t v = 0; v < vertices.size(); v++) facesStart[v + 1] += facesStart[v];
+            std::vector<uint32_t> fill(facesStart.begin(), facesStart.end() - 1);
+            for (size_t c = 0; c < indices.size(); c++) vertexFaces[fill[indices[c]]++] = (uint32_t)(c / 3);
         }
         
-        // Render each material group
-        for (const auto& group : facesByMaterial) {
-            // Apply material once per group
-            if (!group.first.empty()) {
-                auto it = materials.find(group.first);
-                if (it != materials.end()) {
-                    it->second.apply();
+        std::unordered_map<CornerKey, uint32_t, CornerKeyHash> vertexForCorner;
+        std::map<std::tuple<float, float, float>, int> normalIds;
+        vertexForCorner.reserve(indices.size());
+        gpuMesh.indices.reserve(indices.size());
+        
+        for (size_t c = 0; c < indices.size(); c++) {
+            uint32_t v = indices[c];
+            size_t t = c / 3;
+            uint32_t groups = smoothingGroups.empty() ? 0 : smoothingGroups[t];
+            
+            Vector3 normal = faceNormals[t];
+            bool blend = normalMode == NORMALS_3DS_SMOOTH || (normalMode == NORMALS_3DS_SMOOTHING_GROUPS && groups != 0);
+            if (blend) {
+                normal = Vector3(0, 0, 0);
+                for (uint32_t f = facesStart[v]; f < facesStart[v + 1]; f++) {
+                    uint32_t other = vertexFaces[f];
+                    if (normalMode == NORMALS_3DS_SMOOTH || (smoothingGroups[other] & groups) != 0) {
+                        normal = normal + faceNormals[other];
+                    }
                 }
             }
+            normal = normal.normalized();
             
-            // Batch all triangles for this material
-            glBegin(GL_TRIANGLES);
-            for (const Face* face : group.second) {
-                if (face->vertexIndices.size() < 3) continue;
-                
-                // Triangulate quads and polygons
-                for (size_t i = 1; i < face->vertexIndices.size() - 1; i++) {
-                    // First vertex of triangle fan
-                    int vIdx = face->vertexIndices[0];
-                    int nIdx = face->normalIndices[0];
-                    int tIdx = face->texCoordIndices[0];
-                    if (tIdx >= 0 && tIdx < (int)texCoords.size()) {
-                        glTexCoord2f(texCoords[tIdx].u, texCoords[tIdx].v);
-                    }
-                    if (nIdx >= 0 && nIdx < (int)normals.size()) {
-                        glNormal3f(normals[nIdx].x, normals[nIdx].y, normals[nIdx].z);
-                    }
-                    if (vIdx >= 0 && vIdx < (int)vertices.size()) {
-                        glVertex3f(vertices[vIdx].x, vertices[vIdx].y, vertices[vIdx].z);
-                    }
-                    
-                    // Second vertex
-                    vIdx = face->vertexIndices[i];
-                    nIdx = face->normalIndices[i];
-                    tIdx = face->texCoordIndices[i];
-                    if (tIdx >= 0 && tIdx < (int)texCoords.size()) {
-                        glTexCoord2f(texCoords[tIdx].u, texCoords[tIdx].v);
-                    }
-                    if (nIdx >= 0 && nIdx < (int)normals.size()) {
-                        glNormal3f(normals[nIdx].x, normals[nIdx].y, normals[nIdx].z);
-                    }
-                    if (vIdx >= 0 && vIdx < (int)vertices.size()) {
-                        glVertex3f(vertices[vIdx].x, vertices[vIdx].y, vertices[vIdx].z);
-                    }
-                    
-                    // Third vertex
-                    vIdx = face->vertexIndices[i + 1];
-                    nIdx = face->normalIndices[i + 1];
-                    tIdx = face->texCoordIndices[i + 1];
-                    if (tIdx >= 0 && tIdx < (int)texCoords.size()) {
-                        glTexCoord2f(texCoords[tIdx].u, texCoords[tIdx].v);
-                    }
-                    if (nIdx >= 0 && nIdx < (int)normals.size()) {
-                        glNormal3f(normals[nIdx].x, normals[nIdx].y, normals[nIdx].z);
-                    }
-                    if (vIdx >= 0 && vIdx < (int)vertices.size()) {
-                        glVertex3f(vertices[vIdx].x, vertices[vIdx].y, vertices[vIdx].z);
-                    }
+            int normalId = normalIds.emplace(std::make_tuple(normal.x, normal.y, normal.z), (int)normalIds.size()).first->second;
+            CornerKey key = { (int)v, 0, normalId };
+            auto inserted = vertexForCorner.emplace(key, (uint32_t)gpuMesh.vertices.size());
+            if (inserted.second) {
+                MeshVertex mv = { vertices[v].x, vertices[v].y, vertices[v].z, normal.x, normal.y, normal.z, 0, 0 };
+                if (hasTexCoords) {
+                    mv.u = texCoords[v].first;
+                    mv.v = texCoords[v].second;
                 }
+                gpuMesh.vertices.push_back(mv);
+            }
+            gpuMesh.indices.push_back(inserted.first->second);
+        }
+    }
+    
+    // Cache contents: the finished mesh (normals included), the material
+    // runs by material name and one named group per object. Material
+    // properties stay in the 3DS file and are re-read from it.
+    MeshCacheData buildCacheData() const {
+        MeshCacheData cache;
+        cache.sourceKind = MESH_CACHE_3DS;
+        cache.faceCount = (uint32_t)triangleCount();
+        cache.flags = normalCacheFlag();
+        if (!texCoords.empty()) cache.flags |= MESH_CACHE_HAS_TEXCOORDS;
+        
+        cache.vertices = gpuMesh.vertices;
+        cache.indices = gpuMesh.indices;
+        cache.ranges = materialRanges;
+        for (const auto& material : materials) cache.materialNames.push_back(material.name);
+        for (size_t i = 0; i < subMeshes.size(); i++) {
+            cache.groups.push_back({ (int)i, subMeshes[i].firstIndex, subMeshes[i].indexCount });
+            cache.groupNames.push_back(subMeshes[i].name);
+        }
+        
+        cache.minBounds = cache.maxBounds = vertices[0];
+        for (const auto& p : vertices) {
+            cache.minBounds = Vector3(std::min(cache.minBounds.x, p.x), std::min(cache.minBounds.y, p.y), std::min(cache.minBounds.z, p.z));
+            cache.maxBounds = Vector3(std::max(cache.maxBounds.x, p.x), std::max(cache.maxBounds.y, p.y), std::max(cache.maxBounds.z, p.z));
+        }
+        return cache;
+    }
+    
+    bool loadCache(const std::string& filename) {
+        MeshCacheData cache;
+        if (!readMeshCache(filename, MESH_CACHE_3DS, cache)) return false;
+        if (cache.vertices.empty()) return false;
+        if ((cache.flags & (MESH_CACHE_SMOOTH_NORMALS | MESH_CACHE_FLAT_NORMALS)) != normalCacheFlag()) return false;
+        
+        // Materials come from the source's EDIT_MATERIAL chunks; object data
+        // is skipped chunk by chunk without decoding
+        MappedFile source;
+        if (!source.open(filename)) return false;
+        materials.clear();
+        ChunkReader file((const unsigned char*)source.data, (const unsigned char*)source.data + source.size);
+        uint16_t id;
+        ChunkReader mainChunk, child, editorChild;
+        if (!file.nextChunk(id, mainChunk) || id != MAIN3DS) return false;
+        while (mainChunk.nextChunk(id, child)) {
+            if (id != EDIT3DS) continue;
+            while (child.nextChunk(id, editorChild)) {
+                if (id == EDIT_MATERIAL) parseMaterial(editorChild, modelDirectory(filename));
             }
-            glEnd();
+        }
+        bool namesMatch = materials.size() == cache.materialNames.size();
+        for (size_t i = 0; namesMatch && i < materials.size(); i++) {
+            namesMatch = materials[i].name == cache.materialNames[i];
+        }
+        if (!namesMatch) {
+            // Stale cache: loadSource parses the materials again from scratch
+            materials.clear();
+            return false;
         }
         
-        // Disable textures at end of display list
-        glDisable(GL_TEXTURE_2D);
+        // The mesh is ready to draw; keep positions (and UVs) per mesh vertex
+        // for callers that inspect the geometry
+        gpuMesh.vertices.swap(cache.vertices);
+        gpuMesh.indices.swap(cache.indices);
+        vertices.clear();
+        texCoords.clear();
+        bool hasTexCoords = (cache.flags & MESH_CACHE_HAS_TEXCOORDS) != 0;
+        for (const auto& mv : gpuMesh.vertices) {
+            vertices.push_back(Vector3(mv.px, mv.py, mv.pz));
+            if (hasTexCoords) texCoords.push_back(std::make_pair(mv.u, mv.v));
+        }
+        indices = gpuMesh.indices;
+        materialRanges = cache.ranges;
         
-        glEndList();
+        subMeshes.clear();
+        for (const auto& group : cache.groups) {
+            subMeshes.push_back({ cache.groupNames[group.materialId], group.firstCorner, group.cornerCount });
+        }
+        
+        minY = cache.minBounds.y;
+        maxY = cache.maxBounds.y;
+        minZ = cache.minBounds.z;
+        maxZ = cache.maxBounds.z;
+        return true;
+    }
+    
+    // Immediate-mode triangles for a run of mesh indices
+    void emitTriangles(int firstIndex, int indexCount) const {
+        glBegin(GL_TRIANGLES);
+        for (int i = firstIndex; i < firstIndex + indexCount; i++) {
+            const MeshVertex& mv = gpuMesh.vertices[gpuMesh.indices[i]];
+            glNormal3f(mv.nx, mv.ny, mv.nz);
+            glTexCoord2f(mv.u, mv.v);
+            glVertex3f(mv.px, mv.py, mv.pz);
+        }
+        glEnd();
+    }
+    
+    // Display list fallback: every object in one glBegin/glEnd batch
+    void buildDisplayList() {
+        if (!isLoaded || gpuMesh.indices.empty()) return;
+        
+        displayList = glGenLists(1);
+        renderState.beginList(displayList);
+        emitTriangles(0, (int)gpuMesh.indices.size());
+        renderState.endList();
         hasDisplayList = true;
     }
     
-    // Render the model
+    // Draw every object in the current transform with one call on the
+    // selected render path; the caller's material and texture apply
+    void drawMesh() const {
+        if (meshRenderPath == RENDER_PATH_BUFFERS && gpuMesh.uploaded) {
+            gpuMesh.bind();
+            gpuMesh.drawRange(0, (int)gpuMesh.indices.size());
+            gpuMesh.unbind();
+        } else if (meshRenderPath != RENDER_PATH_IMMEDIATE && hasDisplayList) {
+            renderState.callList(displayList);
+        } else {
+            emitTriangles(0, (int)gpuMesh.indices.size());
+        }
+    }
+    
+    // Draw with the file's own materials, one draw per material run
+    void drawMeshWithMaterials() const {
+        if (materialRanges.size() == 1) {
+            // One material (the flock): apply it and draw on the usual path
+            if (materialRanges[0].materialId >= 0) materials[materialRanges[0].materialId].apply();
+            drawMesh();
+            renderState.disable(GL_TEXTURE_2D);
+            return;
+        }
+        bool buffers = meshRenderPath == RENDER_PATH_BUFFERS && gpuMesh.uploaded;
+        if (buffers) gpuMesh.bind();
+        for (const auto& range : materialRanges) {
+            if (range.materialId >= 0) materials[range.materialId].apply();
+            if (buffers) gpuMesh.drawRange(range.firstCorner, range.cornerCount);
+            else emitTriangles(range.firstCorner, range.cornerCount);
+        }
+        if (buffers) gpuMesh.unbind();
+        renderState.disable(GL_TEXTURE_2D);
+    }
+    
+    // Draw one EDIT_OBJECT on its own (buffers when available)
+    void drawSubMesh(int index) const {
+        if (index < 0 || index >= (int)subMeshes.size()) return;
+        const SubMesh& subMesh = subMeshes[index];
+        if (meshRenderPath == RENDER_PATH_BUFFERS && gpuMesh.uploaded) {
+            gpuMesh.bind();
+            gpuMesh.drawRange(subMesh.firstIndex, subMesh.indexCount);
+            gpuMesh.unbind();
+        } else {
+            emitTriangles(subMesh.firstIndex, subMesh.indexCount);
+        }
+    }
+    
     void render() const {
         if (!isLoaded) return;
         
         glPushMatrix();
+        applyTransform();
+        drawMesh();
+        glPopMatrix();
+    }
+    
+    // render() with the file's materials and textures instead of the caller's
+    void renderWithMaterials() const {
+        if (!isLoaded) return;
         
-        // Apply transformations
+        glPushMatrix();
+        applyTransform();
+        drawMeshWithMaterials();
+        glPopMatrix();
+    }
+    
+    void setPosition(float x, float y, float z) {
+        position = Vector3(x, y, z);
+    }
+    
+    void setRotation(float rx, float ry, float rz) {
+        rotation = Vector3(rx, ry, rz);
+    }
+    
+    void setScale(float sx, float sy, float sz) {
+        scale = Vector3(sx, sy, sz);
+    }
+    
+    void setUniformScale(float s) {
+        scale = Vector3(s, s, s);
+    }
+    
+private:
+    int skippedFaces;  // Faces whose indices lay outside their object
+    
+    void applyTransform() const {
         glTranslatef(position.x, position.y, position.z);
         glRotatef(rotation.x, 1.0f, 0.0f, 0.0f);
         glRotatef(rotation.y, 0.0f, 1.0f, 0.0f);
         glRotatef(rotation.z, 0.0f, 0.0f, 1.0f);
         glScalef(scale.x, scale.y, scale.z);
-        
-        // Use display list for all models (pre-compiled for performance)
-        if (hasDisplayList) {
-            glCallList(displayList);
-        } else {
-            // Fallback to direct rendering
-            renderDirect();
+    }
+    
+    static std::string modelDirectory(const std::string& filename) {
+        size_t slash = filename.find_last_of("/\\");
+        return slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+    }
+    
+    uint32_t normalCacheFlag() const {
+        if (normalMode == NORMALS_3DS_SMOOTH) return MESH_CACHE_SMOOTH_NORMALS;
+        if (normalMode == NORMALS_3DS_FLAT) return MESH_CACHE_FLAT_NORMALS;
+        return 0;
+    }
+    
+    void parseEditor(ChunkReader editor, const std::string& directory) {
+        uint16_t id;
+        ChunkReader child;
+        while (editor.nextChunk(id, child)) {
+            if (id == EDIT_MATERIAL) parseMaterial(child, directory);
+            else if (id == EDIT_OBJECT) parseObject(child);
         }
-        
-        // Ensure textures are disabled after rendering
-        glDisable(GL_TEXTURE_2D);
-        
-        glPopMatrix();
     }
     
-    // Direct rendering for textured models (batched for performance)
-    void renderDirect() const {
-        // Group faces by material for batch rendering
-        std::map<std::string, std::vector<const Face*>> facesByMaterial;
-        for (const auto& face : faces) {
-            facesByMaterial[face.materialName].push_back(&face);
-        }
-        
-        // Render each material group
-        for (const auto& group : facesByMaterial) {
-            // Apply material once per group
-            if (!group.first.empty()) {
-                auto it = materials.find(group.first);
-                if (it != materials.end()) {
-                    it->second.apply();
-                }
+    // COLOR_* sub-chunk of a material colour (float or byte RGB)
+    static void parseColor(ChunkReader chunk, float* rgba) {
+        uint16_t id;
+        ChunkReader color;
+        while (chunk.nextChunk(id, color)) {
+            if (id == COLOR_F || id == LIN_COLOR_F) {
+                for (int i = 0; i < 3; i++) rgba[i] = color.readFloat();
+                return;
             }
-            
-            // Batch triangles together
-            glBegin(GL_TRIANGLES);
-            for (const Face* face : group.second) {
-                if (face->vertexIndices.size() < 3) continue;
-                
-                // Triangulate if needed (for quads and polygons)
-                for (size_t i = 1; i < face->vertexIndices.size() - 1; i++) {
-                    // First vertex of triangle fan
-                    int vIdx = face->vertexIndices[0];
-                    int nIdx = face->normalIndices[0];
-                    int tIdx = face->texCoordIndices[0];
-                    if (tIdx >= 0 && tIdx < (int)texCoords.size()) {
-                        glTexCoord2f(texCoords[tIdx].u, texCoords[tIdx].v);
-                    }
-                    if (nIdx >= 0 && nIdx < (int)normals.size()) {
-                        glNormal3f(normals[nIdx].x, normals[nIdx].y, normals[nIdx].z);
-                    }
-                    if (vIdx >= 0 && vIdx < (int)vertices.size()) {
-                        glVertex3f(vertices[vIdx].x, vertices[vIdx].y, vertices[vIdx].z);
-                    }
-                    
-                    // Second vertex
-                    vIdx = face->vertexIndices[i];
-                    nIdx = face->normalIndices[i];
-                    tIdx = face->texCoordIndices[i];
-                    if (tIdx >= 0 && tIdx < (int)texCoords.size()) {
-                        glTexCoord2f(texCoords[tIdx].u, texCoords[tIdx].v);
-                    }
-                    if (nIdx >= 0 && nIdx < (int)normals.size()) {
-                        glNormal3f(normals[nIdx].x, normals[nIdx].y, normals[nIdx].z);
-                    }
-                    if (vIdx >= 0 && vIdx < (int)vertices.size()) {
-                        glVertex3f(vertices[vIdx].x, vertices[vIdx].y, vertices[vIdx].z);
-                    }
-                    
-                    // Third vertex
-                    vIdx = face->vertexIndices[i + 1];
-                    nIdx = face->normalIndices[i + 1];
-                    tIdx = face->texCoordIndices[i + 1];
-                    if (tIdx >= 0 && tIdx < (int)texCoords.size()) {
-                        glTexCoord2f(texCoords[tIdx].u, texCoords[tIdx].v);
-                    }
-                    if (nIdx >= 0 && nIdx < (int)normals.size()) {
-                        glNormal3f(normals[nIdx].x, normals[nIdx].y, normals[nIdx].z);
-                    }
-                    if (vIdx >= 0 && vIdx < (int)vertices.size()) {
-                        glVertex3f(vertices[vIdx].x, vertices[vIdx].y, vertices[vIdx].z);
+            if (id == COLOR_24 || id == LIN_COLOR_24) {
+                for (int i = 0; i < 3; i++) rgba[i] = color.readU8() / 255.0f;
+                return;
+            }
+        }
+    }
+    
+    // PERCENT_* sub-chunk, returned as 0..1
+    static float parsePercent(ChunkReader chunk) {
+        uint16_t id;
+        ChunkReader percent;
+        while (chunk.nextChunk(id, percent)) {
+            if (id == PERCENT_I) return (int16_t)percent.readU16() / 100.0f;
+            if (id == PERCENT_F) return percent.readFloat() / 100.0f;
+        }
+        return 0.0f;
+    }
+    
+    void parseMaterial(ChunkReader chunk, const std::string& directory) {
+        Material material;
+        uint16_t id;
+        ChunkReader child, mapChild;
+        while (chunk.nextChunk(id, child)) {
+            switch (id) {
+                case MAT_NAME: material.name = child.readString(); break;
+                case MAT_AMBIENT: parseColor(child, material.ambient); break;
+                case MAT_DIFFUSE: parseColor(child, material.diffuse); break;
+                case MAT_SPECULAR: parseColor(child, material.specular); break;
+                case MAT_SHININESS: material.shininess = parsePercent(child) * 128.0f; break;
+                case MAT_TRANSPARENCY:
+                    material.transparency = 1.0f - parsePercent(child);
+                    material.diffuse[3] = material.transparency;
+                    break;
+                case MAT_TEXMAP:
+                    while (child.nextChunk(id, mapChild)) {
+                        if (id == MAT_MAPNAME) {
+                            material.textureFile = mapChild.readString();
+                            material.texturePath = directory + material.textureFile;
+                        }
                     }
-                }
+                    break;
             }
-            glEnd();
         }
+        materials.push_back(material);
     }
     
-    // Render with external texture (bypasses display list to use caller's bound texture)
-    void renderWithTexture() const {
-        if (!isLoaded) return;
+    void parseObject(ChunkReader chunk) {
+        // Each object becomes a sub-mesh with its own vertex numbering
+        SubMesh subMesh;
+        subMesh.name = chunk.readString();
+        subMesh.firstIndex = (int)indices.size();
         
-        glPushMatrix();
+        uint16_t id;
+        ChunkReader child;
+        while (chunk.nextChunk(id, child)) {
+            if (id == OBJ_TRIMESH) parseTriMesh(child);
+        }
         
-        glTranslatef(position.x, position.y, position.z);
-        glRotatef(rotation.x, 1.0f, 0.0f, 0.0f);
-        glRotatef(rotation.y, 0.0f, 1.0f, 0.0f);
-        glRotatef(rotation.z, 0.0f, 0.0f, 1.0f);
-        glScalef(scale.x, scale.y, scale.z);
+        subMesh.indexCount = (int)indices.size() - subMesh.firstIndex;
+        if (subMesh.indexCount > 0) subMeshes.push_back(subMesh);
+    }
+    
+    void parseTriMesh(ChunkReader chunk) {
+        uint32_t vertexBase = (uint32_t)vertices.size();
+        uint32_t vertexCount = 0;
+        ChunkReader faceChunk;
+        bool hasFaces = false;
         
-        // Render directly without display list to use caller's bound texture
-        glBegin(GL_TRIANGLES);
-        for (const auto& face : faces) {
-            if (face.vertexIndices.size() < 3) continue;
-            
-            for (size_t i = 1; i < face.vertexIndices.size() - 1; i++) {
-                // First vertex
-                int vIdx = face.vertexIndices[0];
-                int nIdx = face.normalIndices[0];
-                int tIdx = face.texCoordIndices[0];
-                if (tIdx >= 0 && tIdx < (int)texCoords.size()) {
-                    glTexCoord2f(texCoords[tIdx].u, texCoords[tIdx].v);
-                }
-                if (nIdx >= 0 && nIdx < (int)normals.size()) {
-                    glNormal3f(normals[nIdx].x, normals[nIdx].y, normals[nIdx].z);
-                }
-                if (vIdx >= 0 && vIdx < (int)vertices.size()) {
-                    glVertex3f(vertices[vIdx].x, vertices[vIdx].y, vertices[vIdx].z);
-                }
-                
-                // Second vertex
-                vIdx = face.vertexIndices[i];
-                nIdx = face.normalIndices[i];
-                tIdx = face.texCoordIndices[i];
-                if (tIdx >= 0 && tIdx < (int)texCoords.size()) {
-                    glTexCoord2f(texCoords[tIdx].u, texCoords[tIdx].v);
-                }
-                if (nIdx >= 0 && nIdx < (int)normals.size()) {
-                    glNormal3f(normals[nIdx].x, normals[nIdx].y, normals[nIdx].z);
-                }
-                if (vIdx >= 0 && vIdx < (int)vertices.size()) {
-                    glVertex3f(vertices[vIdx].x, vertices[vIdx].y, vertices[vIdx].z);
-                }
-                
-                // Third vertex
-                vIdx = face.vertexIndices[i + 1];
-                nIdx = face.normalIndices[i + 1];
-                tIdx = face.texCoordIndices[i + 1];
-                if (tIdx >= 0 && tIdx < (int)texCoords.size()) {
-                    glTexCoord2f(texCoords[tIdx].u, texCoords[tIdx].v);
-                }
-                if (nIdx >= 0 && nIdx < (int)normals.size()) {
-                    glNormal3f(normals[nIdx].x, normals[nIdx].y, normals[nIdx].z);
+        uint16_t id;
+        ChunkReader child;
+        while (chunk.nextChunk(id, child)) {
+            switch (id) {
+                case TRI_VERTEXL: {
+                    uint16_t count = child.readU16();
+                    const unsigned char* data = child.take((size_t)count * 12);
+                    if (!data) break;
+                    vertices.reserve(vertexBase + count);
+                    for (uint16_t i = 0; i < count; i++) {
+                        float x = ChunkReader::decodeFloat(data + i * 12);
+                        float y = ChunkReader::decodeFloat(data + i * 12 + 4);
+                        float z = ChunkReader::decodeFloat(data + i * 12 + 8);
+                        vertices.push_back(Vector3(x, y, z));
+                        // Track min/max Y and Z for ground positioning
+                        if (vertices.size() == 1) {
+                            minY = maxY = y;
+                            minZ = maxZ = z;
+                        } else {
+                            minY = std::min(minY, y); maxY = std::max(maxY, y);
+                            minZ = std::min(minZ, z); maxZ = std::max(maxZ, z);
+                        }
+                    }
+                    vertexCount = count;
+                    break;
                 }
-                if (vIdx >= 0 && vIdx < (int)vertices.size()) {
-                    glVertex3f(vertices[vIdx].x, vertices[vIdx].y, vertices[vIdx].z);
+                case TRI_MAPCOORD: {
+                    uint16_t count = child.readU16();
+                    const unsigned char* data = child.take((size_t)count * 8);
+                    if (!data) break;
+                    // Objects without UVs leave zeros so texCoords stays parallel to vertices
+                    texCoords.resize(vertexBase, std::make_pair(0.0f, 0.0f));
+                    for (uint16_t i = 0; i < count; i++) {
+                        texCoords.push_back(std::make_pair(ChunkReader::decodeFloat(data + i * 8),
+                                                           ChunkReader::decodeFloat(data + i * 8 + 4)));
+                    }
+                    break;
                 }
+                case TRI_FACEL:
+                    // Faces may precede the vertex list; read them last
+                    faceChunk = child;
+                    hasFaces = true;
+                    break;
             }
         }
-        glEnd();
-        
-        glPopMatrix();
+        if (hasFaces) parseFaces(faceChunk, vertexBase, vertexCount);
     }
     
-    // Render with procedural UV mapping based on vertex positions (for models without proper UVs)
-    void renderWithProceduralUV(float uvScale = 0.01f) const {
-        if (!isLoaded) return;
-        
-        glPushMatrix();
-        
-        glTranslatef(position.x, position.y, position.z);
-        glRotatef(rotation.x, 1.0f, 0.0f, 0.0f);
-        glRotatef(rotation.y, 0.0f, 1.0f, 0.0f);
-        glRotatef(rotation.z, 0.0f, 0.0f, 1.0f);
-        glScalef(scale.x, scale.y, scale.z);
+    // Face list plus its TRI_MATERIAL and TRI_SMOOTH sub-chunks. The
+    // object's triangles are then sorted by material into materialRanges.
+    void parseFaces(ChunkReader chunk, uint32_t vertexBase, uint32_t vertexCount) {
+        uint16_t count = chunk.readU16();
+        const unsigned char* data = chunk.take((size_t)count * 8);
+        if (!data) return;
         
-        // Render with procedural UV based on vertex position
-        glBegin(GL_TRIANGLES);
-        for (const auto& face : faces) {
-            if (face.vertexIndices.size() < 3) continue;
+        // File face number -> triangle slot (-1 when skipped)
+        std::vector<int> slotForFace(count, -1);
+        size_t firstTriangle = indices.size() / 3;
+        indices.reserve(indices.size() + (size_t)count * 3);
+        for (uint16_t i = 0; i < count; i++) {
+            uint16_t v1 = ChunkReader::decodeU16(data + i * 8);
+            uint16_t v2 = ChunkReader::decodeU16(data + i * 8 + 2);
+            uint16_t v3 = ChunkReader::decodeU16(data + i * 8 + 4);
             
-            for (size_t i = 1; i < face.vertexIndices.size() - 1; i++) {
-                // First vertex
-                int vIdx = face.vertexIndices[0];
-                int nIdx = face.normalIndices[0];
-                if (vIdx >= 0 && vIdx < (int)vertices.size()) {
-                    // Generate UV from vertex position (box mapping)
-                    float u = vertices[vIdx].x * uvScale;
-                    float v = vertices[vIdx].y * uvScale;
-                    glTexCoord2f(u, v);
-                }
-                if (nIdx >= 0 && nIdx < (int)normals.size()) {
-                    glNormal3f(normals[nIdx].x, normals[nIdx].y, normals[nIdx].z);
-                }
-                if (vIdx >= 0 && vIdx < (int)vertices.size()) {
-                    glVertex3f(vertices[vIdx].x, vertices[vIdx].y, vertices[vIdx].z);
-                }
-                
-                // Second vertex
-                vIdx = face.vertexIndices[i];
-                nIdx = face.normalIndices[i];
-                if (vIdx >= 0 && vIdx < (int)vertices.size()) {
-                    float u = vertices[vIdx].x * uvScale;
-                    float v = vertices[vIdx].y * uvScale;
-                    glTexCoord2f(u, v);
-                }
-                if (nIdx >= 0 && nIdx < (int)normals.size()) {
-                    glNormal3f(normals[nIdx].x, normals[nIdx].y, normals[nIdx].z);
-                }
-                if (vIdx >= 0 && vIdx < (int)vertices.size()) {
-                    glVertex3f(vertices[vIdx].x, vertices[vIdx].y, vertices[vIdx].z);
-                }
-                
-                // Third vertex
-                vIdx = face.vertexIndices[i + 1];
-                nIdx = face.normalIndices[i + 1];
-                if (vIdx >= 0 && vIdx < (int)vertices.size()) {
-                    float u = vertices[vIdx].x * uvScale;
-                    float v = vertices[vIdx].y * uvScale;
-                    glTexCoord2f(u, v);
+            // Faces must reference vertices of their own object
+            if (std::max(v1, std::max(v2, v3)) >= vertexCount) {
+                skippedFaces++;
+                continue;
+            }
+            slotForFace[i] = (int)(indices.size() / 3);
+            indices.push_back(vertexBase + v1);
+            indices.push_back(vertexBase + v2);
+            indices.push_back(vertexBase + v3);
+        }
+        size_t endTriangle = indices.size() / 3;
+        triangleMaterials.resize(endTriangle, -1);
+        smoothingGroups.resize(endTriangle, 0);
+        
+        uint16_t id;
+        ChunkReader child;
+        while (chunk.nextChunk(id, child)) {
+            if (id == TRI_MATERIAL) {
+                std::string materialName = child.readString();
+                int materialId = -1;
+                for (size_t m = 0; m < materials.size(); m++) {
+                    if (materials[m].name == materialName) materialId = (int)m;
                 }
-                if (nIdx >= 0 && nIdx < (int)normals.size()) {
-                    glNormal3f(normals[nIdx].x, normals[nIdx].y, normals[nIdx].z);
+                uint16_t faceCount = child.readU16();
+                const unsigned char* faces = child.take((size_t)faceCount * 2);
+                if (!faces) continue;
+                for (uint16_t i = 0; i < faceCount; i++) {
+                    uint16_t face = ChunkReader::decodeU16(faces + i * 2);
+                    if (face < count && slotForFace[face] >= 0) triangleMaterials[slotForFace[face]] = materialId;
                 }
-                if (vIdx >= 0 && vIdx < (int)vertices.size()) {
-                    glVertex3f(vertices[vIdx].x, vertices[vIdx].y, vertices[vIdx].z);
+            } else if (id == TRI_SMOOTH) {
+                const unsigned char* groups = child.take((size_t)count * 4);
+                if (!groups) continue;
+                for (uint16_t i = 0; i < count; i++) {
+                    if (slotForFace[i] >= 0) smoothingGroups[slotForFace[i]] = ChunkReader::decodeU32(groups + i * 4);
                 }
             }
         }
-        glEnd();
         
-        glPopMatrix();
+        sortObjectByMaterial(firstTriangle, endTriangle);
     }
     
-    // Render with custom color (ignores material)
-    void renderWithColor(float r, float g, float b, float a = 1.0f) const {
-        if (!isLoaded) return;
-        
-        glPushMatrix();
+    // Stable-sort an object's triangles by material and append its runs
+    void sortObjectByMaterial(size_t firstTriangle, size_t endTriangle) {
+        std::vector<size_t> order;
+        for (size_t t = firstTriangle; t < endTriangle; t++) order.push_back(t);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return triangleMaterials[a] < triangleMaterials[b];
+        });
         
-        glTranslatef(position.x, position.y, position.z);
-        glRotatef(rotation.x, 1.0f, 0.0f, 0.0f);
-        glRotatef(rotation.y, 0.0f, 1.0f, 0.0f);
-        glRotatef(rotation.z, 0.0f, 0.0f, 1.0f);
-        glScalef(scale.x, scale.y, scale.z);
+        std::vector<uint32_t> sortedIndices;
+        std::vector<int> sortedMaterials;
+        std::vector<uint32_t> sortedGroups;
+        for (size_t t : order) {
+            sortedIndices.insert(sortedIndices.end(), &indices[t * 3], &indices[t * 3] + 3);
+            sortedMaterials.push_back(triangleMaterials[t]);
+            sortedGroups.push_back(smoothingGroups[t]);
+        }
+        std::copy(sortedIndices.begin(), sortedIndices.end(), indices.begin() + firstTriangle * 3);
+        std::copy(sortedMaterials.begin(), sortedMaterials.end(), triangleMaterials.begin() + firstTriangle);
+        std::copy(sortedGroups.begin(), sortedGroups.end(), smoothingGroups.begin() + firstTriangle);
         
-        glColor4f(r, g, b, a);
+        for (size_t t = firstTriangle; t < endTriangle; t++) {
+            if (t == firstTriangle || triangleMaterials[t] != triangleMaterials[t - 1]) {
+                materialRanges.push_back({ triangleMaterials[t], (int)t * 3, 0 });
+            }
+            materialRanges.back().cornerCount += 3;
+        }
+    }
+};
+
+// ============================================================================
+// ASSET LOADER - Worker threads decode/parse, the GL thread uploads
+// ============================================================================
+
+// Scenes request textures and models during init(); worker threads do the
+// CPU work (stb_image decoding, OBJ/MTL/3DS parsing or cache reads) and push
+// finished jobs to an upload queue. finish() runs on the GL thread and
+// drains that queue into glTexImage2D, display lists and buffer uploads,
+// calling each request's callback once its asset is usable.
+class AssetLoader {
+public:
+    typedef std::function<void(bool)> ReadyCallback;
+    
+    AssetLoader() : threadCount(-1), stopping(false), outstanding(0) {}
+    ~AssetLoader() { stopWorkers(); }
+    
+    // 0 = do the CPU work on the calling thread; -1 (default) = one thread
+    // per core, leaving one for the GL thread
+    void setThreadCount(int count) {
+        threadCount = count;
+    }
+    
+    // Decode a texture; *target receives the GL texture once uploaded
+    void requestTexture(const std::string& path, GLuint* target, ReadyCallback onReady = nullptr) {
+        Job* job = addJob(JOB_TEXTURE, path, onReady);
+        job->textureTarget = target;
+        submit(job);
+    }
+    
+    // Load an OBJ model into an object the caller owns
+    void requestOBJ(OBJModel* model, const std::string& path, ReadyCallback onReady = nullptr) {
+        Job* job = addJob(JOB_OBJ, path, onReady);
+        job->objModel = model;
+        submit(job);
+    }
+    
+    // Load a 3DS model into an object the caller owns
+    void request3DS(Model3DS* model, const std::string& path, ReadyCallback onReady = nullptr) {
+        Job* job = addJob(JOB_3DS, path, onReady);
+        job->model3DS = model;
+        submit(job);
+    }
+    
+    // Upload everything as it finishes, then print per-asset and total times
+    void finish() {
+        while (true) {
+            Job* job = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(uploadMutex);
+                uploadReady.wait(lock, [this] { return !uploads.empty() || outstanding == 0; });
+                if (uploads.empty()) break;
+                job = uploads.front();
+                uploads.pop_front();
+            }
+            
+            auto uploadStart = std::chrono::steady_clock::now();
+            upload(job);
+            job->uploadMs = elapsedMs(uploadStart);
+            if (job->onReady) job->onReady(job->ok);
+            
+            std::lock_guard<std::mutex> lock(uploadMutex);
+            outstanding--;
+        }
         
-        GLfloat matDiffuse[] = { r, g, b, a };
-        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, matDiffuse);
+        stopWorkers();
+        textureRegistry.enforceBudget(textureConfig.budgetBytes());
+        report();
+        jobs.clear();
+        claimedTextures.clear();
+    }
+    
+private:
+    enum JobKind { JOB_TEXTURE, JOB_OBJ, JOB_3DS };
+    
+    struct Job {
+        JobKind kind;
+        std::string path;
+        ReadyCallback onReady;
+        GLuint* textureTarget;
+        OBJModel* objModel;
+        Model3DS* model3DS;
+        
+        // Results of the CPU phase
+        bool ok;
+        DecodedImage image;
+        std::vector<DecodedImage> materialImages;
+        double loadMs;
+        double uploadMs;
+        
+        Job() : kind(JOB_TEXTURE), textureTarget(nullptr), objModel(nullptr), model3DS(nullptr),
+                ok(false), loadMs(0.0), uploadMs(0.0) {}
+    };
+    
+    int threadCount;
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Job>> jobs;  // All requests, in order, for the report
+    std::chrono::steady_clock::time_point firstRequest;
+    
+    std::deque<Job*> pending;               // Waiting for a worker
+    std::mutex pendingMutex;
+    std::condition_variable pendingReady;
+    bool stopping;
+    
+    std::set<std::string> claimedTextures;  // Canonical paths some job decodes
+    std::mutex claimMutex;
+    
+    std::deque<Job*> uploads;               // CPU work done, waiting for the GL thread
+    std::mutex uploadMutex;
+    std::condition_variable uploadReady;
+    int outstanding;                        // Requested but not yet uploaded
+    
+    static double elapsedMs(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    
+    Job* addJob(JobKind kind, const std::string& path, ReadyCallback onReady) {
+        if (jobs.empty()) firstRequest = std::chrono::steady_clock::now();
+        jobs.push_back(std::unique_ptr<Job>(new Job()));
+        Job* job = jobs.back().get();
+        job->kind = kind;
+        job->path = path;
+        job->onReady = onReady;
         
-        if (hasDisplayList) {
-            glCallList(displayList);
+        std::lock_guard<std::mutex> lock(uploadMutex);
+        outstanding++;
+        return job;
+    }
+    
+    // True for the first job to ask for a texture that is not resident yet
+    bool claimTexture(const std::string& path) {
+        if (textureRegistry.isResident(path)) return false;
+        std::lock_guard<std::mutex> lock(claimMutex);
+        return claimedTextures.insert(canonicalTexturePath(path)).second;
+    }
+    
+    void submit(Job* job) {
+        if (threadCount == 0) {
+            runCPU(job);
+            return;
         }
+        if (workers.empty()) startWorkers();
         
-        glPopMatrix();
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pending.push_back(job);
+        pendingReady.notify_one();
     }
     
-    // Set position
-    void setPosition(float x, float y, float z) {
-        position = Vector3(x, y, z);
+    void startWorkers() {
+        int count = threadCount;
+        if (count < 0) {
+            count = (int)std::thread::hardware_concurrency() - 1;
+            if (count < 1) count = 1;
+        }
+        stopping = false;
+        for (int i = 0; i < count; i++) {
+            workers.emplace_back([this, i] {
+                PROFILE_THREAD_NAME("loader " + std::to_string(i + 1));
+                workerLoop();
+            });
+        }
     }
     
-    // Set rotation (degrees)
-    void setRotation(float rx, float ry, float rz) {
-        rotation = Vector3(rx, ry, rz);
+    void stopWorkers() {
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            stopping = true;
+            pendingReady.notify_all();
+        }
+        for (auto& worker : workers) worker.join();
+        workers.clear();
     }
     
-    // Set scale
-    void setScale(float sx, float sy, float sz) {
-        scale = Vector3(sx, sy, sz);
+    void workerLoop() {
+        while (true) {
+            Job* job = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(pendingMutex);
+                pendingReady.wait(lock, [this] { return !pending.empty() || stopping; });
+                if (pending.empty()) return;
+                job = pending.front();
+                pending.pop_front();
+            }
+            runCPU(job);
+        }
     }
     
-    void setUniformScale(float s) {
-        scale = Vector3(s, s, s);
+    // CPU phase: no GL calls allowed here
+    void runCPU(Job* job) {
+        PROFILE_SCOPE("AssetLoader::runCPU");
+        auto start = std::chrono::steady_clock::now();
+        switch (job->kind) {
+            case JOB_TEXTURE:
+                // Only the first request for a path decodes it; the others
+                // pick the texture up from the registry at upload time
+                if (claimTexture(job->path)) {
+                    job->image = decodeImage(job->path);
+                    job->ok = job->image.isValid();
+                } else {
+                    job->ok = true;
+                }
+                break;
+            case JOB_OBJ:
+                job->ok = job->objModel->loadCPU(job->path);
+                if (job->ok) {
+                    // Decode material textures here too, one slot per material
+                    job->materialImages.resize(job->objModel->materials.size());
+                    for (size_t i = 0; i < job->objModel->materials.size(); i++) {
+                        const std::string& texturePath = job->objModel->materials[i].texturePath;
+                        if (!texturePath.empty() && claimTexture(texturePath)) {
+                            job->materialImages[i] = decodeImage(texturePath);
+                        }
+                    }
+                }
+                break;
+            case JOB_3DS:
+                job->ok = job->model3DS->loadCPU(job->path);
+                if (job->ok) {
+                    job->materialImages.resize(job->model3DS->materials.size());
+                    for (size_t i = 0; i < job->model3DS->materials.size(); i++) {
+                        const std::string& texturePath = job->model3DS->materials[i].texturePath;
+                        if (!texturePath.empty() && claimTexture(texturePath)) {
+                            job->materialImages[i] = decodeImage(texturePath);
+                        }
+                    }
+                }
+                break;
+        }
+        job->loadMs = elapsedMs(start);
+        
+        std::lock_guard<std::mutex> lock(uploadMutex);
+        uploads.push_back(job);
+        uploadReady.notify_one();
+    }
+    
+    // GL phase, on the thread that owns the context
+    void upload(Job* job) {
+        PROFILE_SCOPE("AssetLoader::upload");
+        if (!job->ok) return;
+        switch (job->kind) {
+            case JOB_TEXTURE:
+                if (job->image.isValid()) {
+                    *job->textureTarget = textureRegistry.acquire(job->image);
+                    job->image = DecodedImage();  // Free the pixels now
+                } else {
+                    *job->textureTarget = textureRegistry.acquire(job->path);
+                }
+                job->ok = *job->textureTarget != 0;
+                break;
+            case JOB_OBJ:
+                job->objModel->uploadGL(&job->materialImages);
+                job->materialImages.clear();
+                break;
+            case JOB_3DS:
+                job->model3DS->uploadGL(&job->materialImages);
+                job->materialImages.clear();
+                break;
+        }
+    }
+    
+    void report() const {
+        if (jobs.empty()) return;
+        double totalMs = elapsedMs(firstRequest);
+        double loadSum = 0.0, uploadSum = 0.0;
+        
+        std::cout << "Asset load times (load = decode/parse on "
+                  << (threadCount == 0 ? "main thread" : "worker threads") << ", upload = GL thread):" << std::endl;
+        for (const auto& job : jobs) {
+            std::cout << "  " << job->path << ": load " << job->loadMs << " ms, upload "
+                      << job->uploadMs << " ms" << (job->ok ? "" : " (FAILED)") << std::endl;
+            loadSum += job->loadMs;
+            uploadSum += job->uploadMs;
+        }
+        std::cout << "Loaded " << jobs.size() << " assets in " << totalMs << " ms (sum of loads "
+                  << loadSum << " ms, uploads " << uploadSum << " ms)" << std::endl;
+        std::cout << "Textures resident: " << textureRegistry.textureCount() << " (estimated VRAM "
+                  << textureRegistry.bytesResident() / 1024 << " KB)" << std::endl;
+        textureRegistry.printReport();
     }
 };
 
+AssetLoader assetLoader;
+
 // ============================================================================
-// 3DS MODEL CLASS - Basic 3DS file loader
+// MODEL MANAGER - Manages all loaded models
 // ============================================================================
 
-// 3DS file chunk IDs
-#define MAIN3DS       0x4D4D
-#define EDIT3DS       0x3D3D
-#define EDIT_OBJECT   0x4000
-#define OBJ_TRIMESH   0x4100
-#define TRI_VERTEXL   0x4110
-#define TRI_FACEL     0x4120
-#define TRI_MAPCOORD  0x4140
-
-class Model3DS {
-public:
-    std::vector<Vector3> vertices;
-    std::vector<std::pair<float, float>> texCoords;  // UV coordinates
-    std::vector<std::vector<int>> faces;
-    float minY, maxY, minZ, maxZ;  // For positioning on ground
-    
-    Vector3 position;
-    Vector3 rotation;
-    Vector3 scale;
-    
-    GLuint displayList;
-    bool hasDisplayList;
-    bool isLoaded;
-    std::string name;
+class ModelManager {
+private:
+    std::map<std::string, OBJModel*> models;
     
-    Model3DS() : hasDisplayList(false), isLoaded(false), displayList(0), minY(0), maxY(0), minZ(0), maxZ(0) {
-        position = Vector3(0, 0, 0);
-        rotation = Vector3(0, 0, 0);
-        scale = Vector3(1, 1, 1);
+public:
+    ~ModelManager() {
+        for (auto& pair : models) {
+            delete pair.second;
+        }
+        models.clear();
     }
     
-    ~Model3DS() {
-        if (hasDisplayList) {
-            glDeleteLists(displayList, 1);
+    // Load a model and store it with a name
+    OBJModel* loadModel(const std::string& name, const std::string& filename) {
+        OBJModel* model = new OBJModel();
+        if (model->load(filename)) {
+            models[name] = model;
+            return model;
         }
+        delete model;
+        return nullptr;
     }
     
-    unsigned short readShort(std::ifstream& file) {
-        unsigned short value;
-        file.read(reinterpret_cast<char*>(&value), sizeof(unsigned short));
-        return value;
+    // Queue a model on the asset loader and store it under a name right away.
+    // On failure the model is removed again after onReady(false) has run.
+    OBJModel* requestModel(const std::string& name, const std::string& filename,
+                           AssetLoader::ReadyCallback onReady = nullptr) {
+        OBJModel* model = new OBJModel();
+        models[name] = model;
+        assetLoader.requestOBJ(model, filename, [this, name, onReady](bool ok) {
+            if (onReady) onReady(ok);
+            if (!ok) unloadModel(name);
+        });
+        return model;
     }
     
-    unsigned int readInt(std::ifstream& file) {
-        unsigned int value;
-        file.read(reinterpret_cast<char*>(&value), sizeof(unsigned int));
-        return value;
+    // Get a loaded model by name
+    OBJModel* getModel(const std::string& name) {
+        auto it = models.find(name);
+        if (it != models.end()) {
+            return it->second;
+        }
+        return nullptr;
     }
     
-    float readFloat(std::ifstream& file) {
-        float value;
-        file.read(reinterpret_cast<char*>(&value), sizeof(float));
-        return value;
+    // Check if model exists
+    bool hasModel(const std::string& name) {
+        return models.find(name) != models.end();
     }
     
-    std::string readString(std::ifstream& file) {
-        std::string str;
-        char c;
-        while (file.read(&c, 1) && c != '\0') {
-            str += c;
+    // Unload a specific model
+    void unloadModel(const std::string& name) {
+        auto it = models.find(name);
+        if (it != models.end()) {
+            delete it->second;
+            models.erase(it);
         }
-        return str;
     }
     
-    void processChunk(std::ifstream& file, unsigned short chunkID, unsigned int chunkLength) {
-        unsigned int currentPos = file.tellg();
-        unsigned int endPos = currentPos + chunkLength - 6;
-        
-        switch(chunkID) {
-            case MAIN3DS:
-            case EDIT3DS:
-                // Container chunks - read sub-chunks
-                while (file.tellg() < endPos) {
-                    unsigned short subChunkID = readShort(file);
-                    unsigned int subChunkLength = readInt(file);
-                    processChunk(file, subChunkID, subChunkLength);
-                }
-                break;
-                
-            case EDIT_OBJECT:
-                {
-                    std::string objectName = readString(file);
-                    // Read sub-chunks for this object
-                    while (file.tellg() < endPos) {
-                        unsigned short subChunkID = readShort(file);
-                        unsigned int subChunkLength = readInt(file);
-                        processChunk(file, subChunkID, subChunkLength);
-                    }
-                }
-                break;
-                
-            case OBJ_TRIMESH:
-                // Triangle mesh - read sub-chunks
-                while (file.tellg() < endPos) {
-                    unsigned short subChunkID = readShort(file);
-                    unsigned int subChunkLength = readInt(file);
-                    processChunk(file, subChunkID, subChunkLength);
-                }
-                break;
-                
-            case TRI_VERTEXL:
-                {
-                    unsigned short numVertices = readShort(file);
-                    for (int i = 0; i < numVertices; i++) {
-                        float x = readFloat(file);
-                        float y = readFloat(file);
-                        float z = readFloat(file);
-                        vertices.push_back(Vector3(x, y, z));
-                        // Track min/max Y and Z for ground positioning
-                        if (vertices.size() == 1) {
-                            minY = maxY = y;
-                            minZ = maxZ = z;
-                        } else {
-                            if (y < minY) minY = y;
-                            if (y > maxY) maxY = y;
-                            if (z < minZ) minZ = z;
-                            if (z > maxZ) maxZ = z;
+    // Get all model names
+    std::vector<std::string> getModelNames() {
+        std::vector<std::string> names;
+        for (const auto& pair : models) {
+            names.push_back(pair.first);
+        }
+        return names;
+    }
+};
+
+// Global model manager
+ModelManager modelManager;
+
+// ============================================================================
+// OBJ LOAD BENCHMARK - Compares the in-place parser with the old stream parser
+// ============================================================================
+
+// Face layout used by the original parser
+struct LegacyFace {
+    std::vector<int> vertexIndices;
+    std::vector<int> texCoordIndices;
+    std::vector<int> normalIndices;
+    std::string materialName;
+};
+
+// Reference implementation: the original istringstream/stoi parser, kept only
+// so the benchmark can check the fast parser produces identical output
+void parseOBJLegacy(std::istream& file, OBJModel& model, std::vector<LegacyFace>& faces) {
+    std::string currentMaterial = "";
+    std::string line;
+
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
+        std::istringstream iss(line);
+        std::string prefix;
+        iss >> prefix;
+
+        if (prefix == "v") {
+            Vector3 v;
+            iss >> v.x >> v.y >> v.z;
+            model.vertices.push_back(v);
+        }
+        else if (prefix == "vn") {
+            Vector3 n;
+            iss >> n.x >> n.y >> n.z;
+            model.normals.push_back(n);
+        }
+        else if (prefix == "vt") {
+            Vector2 t;
+            iss >> t.u >> t.v;
+            model.texCoords.push_back(t);
+        }
+        else if (prefix == "f") {
+            LegacyFace face;
+            face.materialName = currentMaterial;
+            std::string vertexData;
+
+            while (iss >> vertexData) {
+                int vIdx = 0, vtIdx = 0, vnIdx = 0;
+                size_t pos1 = vertexData.find('/');
+                if (pos1 == std::string::npos) {
+                    vIdx = std::stoi(vertexData);
+                } else {
+                    vIdx = std::stoi(vertexData.substr(0, pos1));
+                    size_t pos2 = vertexData.find('/', pos1 + 1);
+                    if (pos2 == std::string::npos) {
+                        vtIdx = std::stoi(vertexData.substr(pos1 + 1));
+                    } else {
+                        std::string vtStr = vertexData.substr(pos1 + 1, pos2 - pos1 - 1);
+                        if (!vtStr.empty()) {
+                            vtIdx = std::stoi(vtStr);
                         }
+                        vnIdx = std::stoi(vertexData.substr(pos2 + 1));
                     }
                 }
-                break;
-            
-            case TRI_MAPCOORD:
-                {
-                    unsigned short numCoords = readShort(file);
-                    for (int i = 0; i < numCoords; i++) {
-                        float u = readFloat(file);
-                        float v = readFloat(file);
-                        texCoords.push_back(std::make_pair(u, v));
-                    }
-                }
-                break;
-                
-            case TRI_FACEL:
-                {
-                    unsigned short numFaces = readShort(file);
-                    for (int i = 0; i < numFaces; i++) {
-                        unsigned short v1 = readShort(file);
-                        unsigned short v2 = readShort(file);
-                        unsigned short v3 = readShort(file);
-                        unsigned short flags = readShort(file);
-                        
-                        std::vector<int> face;
-                        face.push_back(v1);
-                        face.push_back(v2);
-                        face.push_back(v3);
-                        faces.push_back(face);
-                    }
-                }
-                break;
-                
-            default:
-                // Skip unknown chunks
-                file.seekg(endPos);
-                break;
+
+                if (vIdx < 0) vIdx = model.vertices.size() + vIdx + 1;
+                if (vtIdx < 0) vtIdx = model.texCoords.size() + vtIdx + 1;
+                if (vnIdx < 0) vnIdx = model.normals.size() + vnIdx + 1;
+
+                face.vertexIndices.push_back(vIdx - 1);
+                face.texCoordIndices.push_back(vtIdx - 1);
+                face.normalIndices.push_back(vnIdx - 1);
+            }
+
+            if (face.vertexIndices.size() >= 3) {
+                faces.push_back(face);
+            }
+        }
+        else if (prefix == "mtllib") {
+            std::string mtlFile;
+            std::getline(iss >> std::ws, mtlFile);
+            model.materialLibraries.push_back(mtlFile);
+        }
+        else if (prefix == "usemtl") {
+            std::getline(iss >> std::ws, currentMaterial);
         }
     }
-    
-    bool load(const std::string& filename) {
-        std::ifstream file(filename, std::ios::binary);
-        if (!file.is_open()) {
-            std::cerr << "Error: Could not open 3DS file: " << filename << std::endl;
-            return false;
+}
+
+// Returns the number of differences between the legacy parse and the fast
+// parse (0 = identical); legacy faces are fan-triangulated for comparison
+int compareParsedOBJ(const OBJModel& a, const std::vector<LegacyFace>& legacyFaces, const OBJModel& b) {
+    int differences = 0;
+    auto sameVec3 = [](const Vector3& p, const Vector3& q) {
+        return memcmp(&p, &q, sizeof(Vector3)) == 0;
+    };
+
+    if (a.vertices.size() != b.vertices.size()) differences++;
+    else for (size_t i = 0; i < a.vertices.size(); i++) if (!sameVec3(a.vertices[i], b.vertices[i])) differences++;
+
+    if (a.normals.size() != b.normals.size()) differences++;
+    else for (size_t i = 0; i < a.normals.size(); i++) if (!sameVec3(a.normals[i], b.normals[i])) differences++;
+
+    if (a.texCoords.size() != b.texCoords.size()) differences++;
+    else for (size_t i = 0; i < a.texCoords.size(); i++) {
+        if (a.texCoords[i].u != b.texCoords[i].u || a.texCoords[i].v != b.texCoords[i].v) differences++;
+    }
+
+    if ((int)legacyFaces.size() != b.faceCount()) differences++;
+    else for (size_t i = 0; i < legacyFaces.size(); i++) {
+        const LegacyFace& fa = legacyFaces[i];
+        int c = b.faceOffsets[i];
+        bool same = b.faceOffsets[i + 1] - c == 3 * ((int)fa.vertexIndices.size() - 2);
+        for (size_t t = 1; same && t + 1 < fa.vertexIndices.size(); t++) {
+            const size_t fan[3] = { 0, t, t + 1 };
+            for (size_t k : fan) {
+                same = same && fa.vertexIndices[k] == b.cornerVertices[c] &&
+                       fa.texCoordIndices[k] == b.cornerTexCoords[c] &&
+                       fa.normalIndices[k] == b.cornerNormals[c];
+                c++;
+            }
         }
-        
-        std::cout << "Loading 3DS model: " << filename << std::endl;
-        name = filename;
-        
-        // Read main chunk
-        unsigned short chunkID = readShort(file);
-        unsigned int chunkLength = readInt(file);
-        
-        if (chunkID != MAIN3DS) {
-            std::cerr << "Error: Not a valid 3DS file!" << std::endl;
-            file.close();
-            return false;
+        int materialId = b.faceMaterials[i];
+        const std::string& materialName = materialId >= 0 ? b.materials[materialId].name : std::string();
+        if (!same || fa.materialName != materialName) differences++;
+    }
+
+    if (a.materialLibraries != b.materialLibraries) differences++;
+    return differences;
+}
+
+// Usage: crystalcaves --bench-obj [file.obj ...]
+// Times both parsers on each file and verifies their output matches.
+// Runs without a GL context (materials and display lists are not built).
+int runOBJLoadBenchmark(std::vector<std::string> files, int iterations) {
+    if (files.empty()) {
+        files = {
+            "models/16433_Pig.obj", "models/Minecraft Tree.obj", "models/stones.obj",
+            "models/trap.obj", "models/wolf_minecraft.obj", "models/Cow Minecraft.obj",
+            "models/Creeper.obj"
+        };
+    }
+
+    bool allMatch = true;
+    std::cout << "OBJ load benchmark (" << iterations << " iterations, best time)" << std::endl;
+
+    for (const auto& filename : files) {
+        double bestLegacy = 1e30, bestFast = 1e30;
+        int differences = 0;
+        bool opened = true;
+
+        for (int iter = 0; iter < iterations && opened; iter++) {
+            OBJModel legacyModel, fastModel;
+            std::vector<LegacyFace> legacyFaces;
+
+            auto t0 = std::chrono::steady_clock::now();
+            std::ifstream stream(filename);
+            if (!stream.is_open()) { opened = false; break; }
+            parseOBJLegacy(stream, legacyModel, legacyFaces);
+            auto t1 = std::chrono::steady_clock::now();
+
+            MappedFile mapped;
+            if (!mapped.open(filename)) { opened = false; break; }
+            fastModel.parseOBJ(mapped.data, mapped.size);
+            auto t2 = std::chrono::steady_clock::now();
+
+            bestLegacy = std::min(bestLegacy, std::chrono::duration<double, std::milli>(t1 - t0).count());
+            bestFast = std::min(bestFast, std::chrono::duration<double, std::milli>(t2 - t1).count());
+            if (iter == 0) differences = compareParsedOBJ(legacyModel, legacyFaces, fastModel);
         }
-        
-        // Process all chunks
-        processChunk(file, chunkID, chunkLength);
-        
-        file.close();
-        
-        std::cout << "Loaded 3DS model with " << vertices.size() << " vertices and " 
-                  << faces.size() << " faces" << std::endl;
-        
-        isLoaded = true;
-        buildDisplayList();
-        return true;
+
+        if (!opened) {
+            std::cerr << "  " << filename << ": could not open" << std::endl;
+            allMatch = false;
+            continue;
+        }
+
+        std::cout << "  " << filename << ": legacy " << bestLegacy << " ms, fast " << bestFast
+                  << " ms (" << (bestFast > 0.0 ? bestLegacy / bestFast : 0.0) << "x), "
+                  << (differences == 0 ? "output matches" : "OUTPUT DIFFERS") << std::endl;
+        if (differences != 0) {
+            std::cerr << "    " << differences << " mismatching elements" << std::endl;
+            allMatch = false;
+        }
+    }
+
+    return allMatch ? 0 : 1;
+}
+
+// ============================================================================
+// 3DS LOAD BENCHMARK - Compares the chunk reader with the old stream parser
+// ============================================================================
+
+// Reference implementation: the original ifstream parser, one read() per
+// value, kept only so the benchmark can check the chunk reader's geometry
+struct Legacy3DSParser {
+    std::vector<Vector3> vertices;
+    std::vector<uint32_t> indices;
+    uint32_t objectVertexBase = 0;
+    
+    template <typename T> static T read(std::ifstream& file) {
+        T value;
+        file.read(reinterpret_cast<char*>(&value), sizeof(T));
+        return value;
     }
     
-    void buildDisplayList() {
-        if (!isLoaded || vertices.empty() || faces.empty()) return;
-        
-        bool hasTexCoords = !texCoords.empty() && texCoords.size() >= vertices.size();
-        
-        displayList = glGenLists(1);
-        glNewList(displayList, GL_COMPILE);
-        
-        for (const auto& face : faces) {
-            if (face.size() == 3) {
-                glBegin(GL_TRIANGLES);
-                
-                // Calculate face normal
-                Vector3 v0 = vertices[face[0]];
-                Vector3 v1 = vertices[face[1]];
-                Vector3 v2 = vertices[face[2]];
-                
-                Vector3 edge1 = v1 - v0;
-                Vector3 edge2 = v2 - v0;
-                Vector3 normal = edge1.cross(edge2).normalized();
-                
-                glNormal3f(normal.x, normal.y, normal.z);
-                
-                if (hasTexCoords) {
-                    glTexCoord2f(texCoords[face[0]].first, texCoords[face[0]].second);
+    void processChunk(std::ifstream& file, unsigned short chunkID, unsigned int chunkLength) {
+        unsigned int endPos = (unsigned int)file.tellg() + chunkLength - 6;
+        
+        switch (chunkID) {
+            case MAIN3DS:
+            case EDIT3DS:
+            case EDIT_OBJECT:
+            case OBJ_TRIMESH:
+                if (chunkID == EDIT_OBJECT) {
+                    char c;
+                    while (file.read(&c, 1) && c != '\0') {}
+                    objectVertexBase = (uint32_t)vertices.size();
                 }
-                glVertex3f(v0.x, v0.y, v0.z);
-                
-                if (hasTexCoords) {
-                    glTexCoord2f(texCoords[face[1]].first, texCoords[face[1]].second);
+                while (file && (unsigned int)file.tellg() < endPos) {
+                    unsigned short subChunkID = read<unsigned short>(file);
+                    unsigned int subChunkLength = read<unsigned int>(file);
+                    processChunk(file, subChunkID, subChunkLength);
                 }
-                glVertex3f(v1.x, v1.y, v1.z);
+                break;
                 
-                if (hasTexCoords) {
-                    glTexCoord2f(texCoords[face[2]].first, texCoords[face[2]].second);
+            case TRI_VERTEXL: {
+                unsigned short numVertices = read<unsigned short>(file);
+                for (int i = 0; i < numVertices; i++) {
+                    float x = read<float>(file);
+                    float y = read<float>(file);
+                    float z = read<float>(file);
+                    vertices.push_back(Vector3(x, y, z));
                 }
-                glVertex3f(v2.x, v2.y, v2.z);
+                break;
+            }
                 
-                glEnd();
+            case TRI_FACEL: {
+                unsigned short numFaces = read<unsigned short>(file);
+                for (int i = 0; i < numFaces; i++) {
+                    unsigned short v1 = read<unsigned short>(file);
+                    unsigned short v2 = read<unsigned short>(file);
+                    unsigned short v3 = read<unsigned short>(file);
+                    read<unsigned short>(file);  // Face flags
+                    if (objectVertexBase + std::max(v1, std::max(v2, v3)) >= vertices.size()) continue;
+                    indices.push_back(objectVertexBase + v1);
+                    indices.push_back(objectVertexBase + v2);
+                    indices.push_back(objectVertexBase + v3);
+                }
+                file.seekg(endPos);
+                break;
             }
+                
+            default:
+                file.seekg(endPos);
+                break;
         }
-        
-        glEndList();
-        hasDisplayList = true;
-        
-        std::cout << "Model has " << texCoords.size() << " texture coordinates" << std::endl;
-    }
-    
-    void render() const {
-        if (!isLoaded) return;
-        
-        glPushMatrix();
-        
-        glTranslatef(position.x, position.y, position.z);
-        glRotatef(rotation.x, 1.0f, 0.0f, 0.0f);
-        glRotatef(rotation.y, 0.0f, 1.0f, 0.0f);
-        glRotatef(rotation.z, 0.0f, 0.0f, 1.0f);
-        glScalef(scale.x, scale.y, scale.z);
-        
-        if (hasDisplayList) {
-            glCallList(displayList);
-        }
-        
-        glPopMatrix();
-    }
-    
-    void setPosition(float x, float y, float z) {
-        position = Vector3(x, y, z);
-    }
-    
-    void setRotation(float rx, float ry, float rz) {
-        rotation = Vector3(rx, ry, rz);
-    }
-    
-    void setScale(float sx, float sy, float sz) {
-        scale = Vector3(sx, sy, sz);
     }
     
-    void setUniformScale(float s) {
-        scale = Vector3(s, s, s);
+    bool parse(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.is_open()) return false;
+        unsigned short chunkID = read<unsigned short>(file);
+        unsigned int chunkLength = read<unsigned int>(file);
+        if (chunkID != MAIN3DS) return false;
+        processChunk(file, chunkID, chunkLength);
+        return true;
     }
 };
 
-// ============================================================================
-// MODEL MANAGER - Manages all loaded models
-// ============================================================================
+// Number of vertices and triangles that differ. The chunk reader sorts each
+// object's triangles by material, so triangles are compared as sorted lists.
+int compareParsed3DS(const Legacy3DSParser& a, const Model3DS& b) {
+    int differences = 0;
+    if (a.vertices.size() != b.vertices.size()) return std::abs((int)a.vertices.size() - (int)b.vertices.size()) + 1;
+    for (size_t i = 0; i < a.vertices.size(); i++) {
+        const Vector3& p = a.vertices[i];
+        const Vector3& q = b.vertices[i];
+        if (p.x != q.x || p.y != q.y || p.z != q.z) differences++;
+    }
+    
+    auto triangles = [](const std::vector<uint32_t>& indices) {
+        std::vector<std::array<uint32_t, 3>> list;
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) list.push_back({ indices[i], indices[i + 1], indices[i + 2] });
+        std::sort(list.begin(), list.end());
+        return list;
+    };
+    auto ta = triangles(a.indices);
+    auto tb = triangles(b.indices);
+    if (ta.size() != tb.size()) return differences + std::abs((int)ta.size() - (int)tb.size()) + 1;
+    for (size_t i = 0; i < ta.size(); i++) {
+        if (ta[i] != tb[i]) differences++;
+    }
+    return differences;
+}
 
-class ModelManager {
-private:
-    std::map<std::string, OBJModel*> models;
-    
-public:
-    ~ModelManager() {
-        for (auto& pair : models) {
-            delete pair.second;
+// Usage: crystalcaves --bench-3ds [file.3ds ...]
+// Times both parsers on each file, verifies the geometry matches and times
+// a full CPU load (parse plus normals). Runs without a GL context.
+int run3DSLoadBenchmark(std::vector<std::string> files, int iterations) {
+    if (files.empty()) {
+        files = { "models/Flock N190413.3ds" };
+    }
+    
+    bool allMatch = true;
+    std::cout << "3DS load benchmark (" << iterations << " iterations, best time)" << std::endl;
+    
+    for (const auto& filename : files) {
+        double bestLegacy = 1e30, bestReader = 1e30, bestLoad = 1e30;
+        int differences = 0;
+        bool opened = true;
+        size_t triangles = 0, materials = 0, objects = 0;
+        
+        for (int iter = 0; iter < iterations && opened; iter++) {
+            Legacy3DSParser legacy;
+            Model3DS model;
+            
+            auto t0 = std::chrono::steady_clock::now();
+            if (!legacy.parse(filename)) { opened = false; break; }
+            auto t1 = std::chrono::steady_clock::now();
+            
+            MappedFile mapped;
+            if (!mapped.open(filename)) { opened = false; break; }
+            model.parse((const unsigned char*)mapped.data, mapped.size, "");
+            auto t2 = std::chrono::steady_clock::now();
+            
+            Model3DS loaded;
+            loaded.loadSource(filename, false);
+            auto t3 = std::chrono::steady_clock::now();
+            
+            bestLegacy = std::min(bestLegacy, std::chrono::duration<double, std::milli>(t1 - t0).count());
+            bestReader = std::min(bestReader, std::chrono::duration<double, std::milli>(t2 - t1).count());
+            bestLoad = std::min(bestLoad, std::chrono::duration<double, std::milli>(t3 - t2).count());
+            if (iter == 0) {
+                differences = compareParsed3DS(legacy, model);
+                triangles = model.indices.size() / 3;
+                materials = model.materials.size();
+                objects = model.subMeshes.size();
+            }
         }
-        models.clear();
-    }
-    
-    // Load a model and store it with a name
-    OBJModel* loadModel(const std::string& name, const std::string& filename) {
-        OBJModel* model = new OBJModel();
-        if (model->load(filename)) {
-            models[name] = model;
-            return model;
+        
+        if (!opened) {
+            std::cerr << "  " << filename << ": could not open" << std::endl;
+            allMatch = false;
+            continue;
         }
-        delete model;
-        return nullptr;
-    }
-    
-    // Get a loaded model by name
-    OBJModel* getModel(const std::string& name) {
-        auto it = models.find(name);
-        if (it != models.end()) {
-            return it->second;
+        
+        std::cout << "  " << filename << " (" << triangles << " triangles, " << objects << " objects, "
+                  << materials << " materials): legacy " << bestLegacy << " ms, reader " << bestReader
+                  << " ms (" << (bestReader > 0.0 ? bestLegacy / bestReader : 0.0) << "x), full load "
+                  << bestLoad << " ms, " << (differences == 0 ? "geometry matches" : "GEOMETRY DIFFERS") << std::endl;
+        if (differences != 0) {
+            std::cerr << "    " << differences << " mismatching elements" << std::endl;
+            allMatch = false;
         }
-        return nullptr;
     }
     
-    // Check if model exists
-    bool hasModel(const std::string& name) {
-        return models.find(name) != models.end();
+    return allMatch ? 0 : 1;
+}
+
+// ============================================================================
+// MESH CACHE REBUILD - Offline regeneration of every .ccmesh file
+// ============================================================================
+
+// Usage: crystalcaves --rebuild-caches [model files...]
+// Parses each source and rewrites its cache without opening a window.
+int rebuildMeshCaches(std::vector<std::string> files) {
+    if (files.empty()) {
+        files = {
+            "models/16433_Pig.obj", "models/Minecraft Tree.obj", "models/stones.obj",
+            "models/trap.obj", "models/wolf_minecraft.obj", "models/Cow Minecraft.obj",
+            "models/Creeper.obj", "models/Flock N190413.3ds"
+        };
     }
     
-    // Unload a specific model
-    void unloadModel(const std::string& name) {
-        auto it = models.find(name);
-        if (it != models.end()) {
-            delete it->second;
-            models.erase(it);
+    int failures = 0;
+    for (const auto& filename : files) {
+        bool is3DS = filename.size() >= 4 &&
+                     (filename.compare(filename.size() - 4, 4, ".3ds") == 0 ||
+                      filename.compare(filename.size() - 4, 4, ".3DS") == 0);
+        bool ok;
+        if (is3DS) {
+            Model3DS model;
+            ok = model.loadSource(filename, true) && !model.vertices.empty();
+        } else {
+            OBJModel model;
+            ok = model.loadSource(filename, true);
         }
-    }
-    
-    // Get all model names
-    std::vector<std::string> getModelNames() {
-        std::vector<std::string> names;
-        for (const auto& pair : models) {
-            names.push_back(pair.first);
+        if (!ok) {
+            std::cerr << "Failed to rebuild cache for " << filename << std::endl;
+            failures++;
         }
-        return names;
     }
-};
-
-// Global model manager
-ModelManager modelManager;
+    return failures == 0 ? 0 : 1;
+}
 
 // ============================================================================
 // GLOBAL VARIABLES
@@ -1359,10 +7126,6 @@ bool keyD = false;
 // Current scene (1 or 2)
 int currentScene = 1;
 
-// Forward declaration for scene collision checking
-typedef bool (*CollisionCheckFunc)(float x, float z, float radius);
-CollisionCheckFunc sceneCollisionCheck = nullptr;
-
 // Global steve textures for player rendering
 GLuint g_steveFaceTexture = 0;
 
@@ -1460,6 +7223,148 @@ void drawTexturedCube() {
     glEnd();
 }
 
+// ============================================================================
+// COLLISION QUERIES - Contacts returned by scene collision tests
+// ============================================================================
+
+// What a collision contact touched
+enum ColliderTag {
+    COLLIDER_WALL,
+    COLLIDER_TREE,
+    COLLIDER_BOULDER,
+    COLLIDER_MOB,
+    COLLIDER_STONE,
+    COLLIDER_TRAP,
+    COLLIDER_LAVA
+};
+
+// One object overlapping a query circle
+struct Contact {
+    ColliderTag kind;
+    int index;            // Object index in the scene's own array (-1 for walls)
+    bool blocking;        // Stops movement; traps and lava are walked through
+    float penetration;    // Overlap depth along the normal
+    float normalX, normalZ;  // Unit direction that pushes the circle out
+};
+
+// Everything a query circle overlaps
+struct CollisionResult {
+    std::vector<Contact> contacts;
+    
+    void clear() { contacts.clear(); }
+    
+    bool blocked() const {
+        for (const auto& contact : contacts) if (contact.blocking) return true;
+        return false;
+    }
+    
+    bool touches(ColliderTag kind) const {
+        return find(kind) != nullptr;
+    }
+    
+    // First contact of a kind, or null
+    const Contact* find(ColliderTag kind) const {
+        for (const auto& contact : contacts) if (contact.kind == kind) return &contact;
+        return nullptr;
+    }
+    
+    // Circle (x, z, radius) against a circular obstacle; adds a contact
+    // when they overlap (strictly, like the old "dist < r1 + r2" checks)
+    void addCircle(ColliderTag kind, int index, bool blocking, float x, float z, float radius,
+                   float objX, float objZ, float objRadius) {
+        float dx = x - objX;
+        float dz = z - objZ;
+        float reach = radius + objRadius;
+        float distSq = dx * dx + dz * dz;
+        if (distSq >= reach * reach) return;
+        
+        float dist = sqrt(distSq);
+        Contact contact = { kind, index, blocking, reach - dist, 1.0f, 0.0f };
+        if (dist > 1e-6f) {
+            contact.normalX = dx / dist;
+            contact.normalZ = dz / dist;
+        }
+        contacts.push_back(contact);
+    }
+    
+    // Point strictly inside an axis-aligned rectangle; the normal points to
+    // the nearest edge and penetration is the distance to it
+    void addPointInRect(ColliderTag kind, int index, bool blocking, float x, float z,
+                        float rectX, float rectZ, float halfX, float halfZ) {
+        float dx = x - rectX;
+        float dz = z - rectZ;
+        float insideX = halfX - fabs(dx);
+        float insideZ = halfZ - fabs(dz);
+        if (insideX <= 0.0f || insideZ <= 0.0f) return;
+        
+        Contact contact = { kind, index, blocking, 0.0f, 0.0f, 0.0f };
+        if (insideX < insideZ) {
+            contact.penetration = insideX;
+            contact.normalX = dx < 0.0f ? -1.0f : 1.0f;
+        } else {
+            contact.penetration = insideZ;
+            contact.normalZ = dz < 0.0f ? -1.0f : 1.0f;
+        }
+        contacts.push_back(contact);
+    }
+    
+    // Circle centre against the inside of a room centred on the origin,
+    // |x| <= limitX and |z| <= limitZ (limits already allow for the radius)
+    void addRoomWalls(float x, float z, float limitX, float limitZ) {
+        if (x > limitX) contacts.push_back({ COLLIDER_WALL, -1, true, x - limitX, -1.0f, 0.0f });
+        if (x < -limitX) contacts.push_back({ COLLIDER_WALL, -1, true, -limitX - x, 1.0f, 0.0f });
+        if (z > limitZ) contacts.push_back({ COLLIDER_WALL, -1, true, z - limitZ, 0.0f, -1.0f });
+        if (z < -limitZ) contacts.push_back({ COLLIDER_WALL, -1, true, -limitZ - z, 0.0f, 1.0f });
+    }
+};
+
+// Anything the player can collide with (implemented by the scenes)
+class CollisionWorld {
+public:
+    virtual ~CollisionWorld() {}
+    
+    // Append every contact for a circle at (x, z) to result
+    virtual void queryCollision(float x, float z, float radius, CollisionResult& result) const = 0;
+};
+
+// World the player currently moves in (the active scene)
+const CollisionWorld* collisionWorld = nullptr;
+
+// ============================================================================
+// INTERPOLATED RENDERING - Drawing between simulation steps
+// ============================================================================
+
+// Frames land between fixed simulation steps, so anything that moves keeps
+// its state from the start of the current step and is drawn blended toward
+// the current state by the game loop's leftover fraction. Moves no single
+// step could make (respawns, teleports) are drawn where they land.
+const float MAX_BLENDED_MOVE = 1.0f;
+
+Vector3 blendPosition(const Vector3& previous, const Vector3& current, float alpha) {
+    Vector3 step = current - previous;
+    if (step.length() >= MAX_BLENDED_MOVE) return current;
+    return previous + step * alpha;
+}
+
+// Headings in degrees, the short way round
+float blendDegrees(float previous, float current, float alpha) {
+    float diff = current - previous;
+    while (diff > 180.0f) diff -= 360.0f;
+    while (diff < -180.0f) diff += 360.0f;
+    return previous + diff * alpha;
+}
+
+// What a frame is drawn from, built once per frame by display(). The
+// simulation state itself is never changed for drawing.
+struct RenderView {
+    float alpha;     // Fraction of a step since the previous step (0..1)
+    float time;      // animationTime at that fraction
+    Vector3 eye;     // Camera, following the blended player
+    Vector3 center;
+    
+    RenderView() : alpha(1.0f), time(0.0f) {}
+};
+
 // ============================================================================
 // PLAYER CLASS
 // ============================================================================
@@ -1484,9 +7389,39 @@ public:
     bool isMoving;        // Is player currently moving
     float bodyYaw;        // Character body rotation (separate from camera yaw)
     
+    // State at the start of the current simulation step (see saveStep)
+    Vector3 previousPosition;
+    float previousBodyYaw;
+    
+private:
+    // Result of the latest collision query and where it was made
+    CollisionResult contacts;
+    const CollisionWorld* contactsWorld = nullptr;
+    float contactsX = 0.0f, contactsZ = 0.0f;
+    
+    const CollisionResult& queryContacts(float x, float z) {
+        contacts.clear();
+        if (collisionWorld) collisionWorld->queryCollision(x, z, radius, contacts);
+        contactsWorld = collisionWorld;
+        contactsX = x;
+        contactsZ = z;
+        return contacts;
+    }
+    
+public:
     Player() : position(0.0f, 0.0f, 5.0f), yaw(0.0f), pitch(0.0f), isFirstPerson(false), radius(0.3f),
                velocityY(0.0f), isJumping(false), isOnGround(true), playerHeight(1.7f), groundLevel(0.0f),
-               walkAnimation(0.0f), isMoving(false), bodyYaw(180.0f) {}
+               walkAnimation(0.0f), isMoving(false), bodyYaw(180.0f),
+               previousPosition(position), previousBodyYaw(bodyYaw) {}
+    
+    // Record where the step starts; frames are drawn blended from here
+    void saveStep() {
+        previousPosition = position;
+        previousBodyYaw = bodyYaw;
+    }
+    
+    Vector3 renderPosition(float alpha) const { return blendPosition(previousPosition, position, alpha); }
+    float renderBodyYaw(float alpha) const { return blendDegrees(previousBodyYaw, bodyYaw, alpha); }
     
     void jump() {
         if (isOnGround && !isJumping) {
@@ -1522,25 +7457,43 @@ public:
     void move(float forward, float right) {
         // Calculate movement direction based on yaw
         float radYaw = yaw * M_PI / 180.0f;
-        
-        // Calculate target position
-        float targetX = position.x + sin(radYaw) * forward + cos(radYaw) * right;
-        float targetZ = position.z - (cos(radYaw) * forward - sin(radYaw) * right);
-        
-        // Check collision before moving
-        if (!hasCollision(targetX, targetZ)) {
-            position.x = targetX;
-            position.z = targetZ;
+        float moveX = sin(radYaw) * forward + cos(radYaw) * right;
+        float moveZ = -(cos(radYaw) * forward - sin(radYaw) * right);
+        
+        // Slide along whatever blocks the move: drop the part of the motion
+        // heading into the deepest blocking contact and try again. Contacts
+        // the motion leads away from don't block, so overlaps can be left.
+        for (int attempt = 0; attempt < 3; attempt++) {
+            float targetX = position.x + moveX;
+            float targetZ = position.z + moveZ;
+            const CollisionResult& result = queryContacts(targetX, targetZ);
+            const Contact* blocker = nullptr;
+            float into = 0.0f;
+            for (const auto& contact : result.contacts) {
+                float dot = moveX * contact.normalX + moveZ * contact.normalZ;
+                if (contact.blocking && dot < 0.0f && (!blocker || contact.penetration > blocker->penetration)) {
+                    blocker = &contact;
+                    into = dot;
+                }
+            }
+            if (!blocker) {
+                position.x = targetX;
+                position.z = targetZ;
+                return;
+            }
+            moveX -= blocker->normalX * into;
+            moveZ -= blocker->normalZ * into;
+            if (moveX * moveX + moveZ * moveZ < 1e-8f) return;
         }
     }
     
-    // Check collision using scene's collision detection
-    bool hasCollision(float targetX, float targetZ) {
-        // Use scene collision check if available
-        if (sceneCollisionCheck != nullptr) {
-            return sceneCollisionCheck(targetX, targetZ, radius);
+    // Contacts at the player's current position. Reuses the last query
+    // (usually move()'s) while the position and world are unchanged.
+    const CollisionResult& contactsHere() {
+        if (contactsWorld != collisionWorld || contactsX != position.x || contactsZ != position.z) {
+            queryContacts(position.x, position.z);
         }
-        return false;
+        return contacts;
     }
     
     void rotate(float dYaw, float dPitch) {
@@ -1557,14 +7510,15 @@ public:
         isFirstPerson = !isFirstPerson;
     }
     
-    void render() {
+    void render(float alpha) {
         if (isFirstPerson) return;
         
         glPushMatrix();
-        glTranslatef(position.x, position.y, position.z);
+        Vector3 at = renderPosition(alpha);
+        glTranslatef(at.x, at.y, at.z);
         // Character body uses bodyYaw (updated only when moving forward)
         // Character faces the direction of movement, camera sees the back
-        glRotatef(bodyYaw, 0.0f, 1.0f, 0.0f);
+        glRotatef(renderBodyYaw(alpha), 0.0f, 1.0f, 0.0f);
         
         // Minecraft-style blocky character with animations
         
@@ -1594,34 +7548,34 @@ public:
         
         // Use Steve face texture if available
         if (g_steveFaceTexture) {
-            glEnable(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D, g_steveFaceTexture);
+            renderState.enable(GL_TEXTURE_2D);
+            renderState.bindTexture(g_steveFaceTexture);
             glColor3f(1.0f, 1.0f, 1.0f);
             drawTexturedCube();
-            glDisable(GL_TEXTURE_2D);
+            renderState.disable(GL_TEXTURE_2D);
         } else {
             glColor3f(0.8f, 0.6f, 0.5f); // Skin tone fallback
-            glutSolidCube(1.0f);
+            solidCube(1.0f);
             
             // Draw face on the front of the head (fallback)
-            glDisable(GL_LIGHTING);
+            renderState.disable(GL_LIGHTING);
             glColor3f(0.0f, 0.0f, 0.0f);
             glPushMatrix();
             glTranslatef(-0.2f, 0.15f, 0.51f);
             glScalef(0.15f, 0.2f, 0.05f);
-            glutSolidCube(1.0f);
+            solidCube(1.0f);
             glPopMatrix();
             glPushMatrix();
             glTranslatef(0.2f, 0.15f, 0.51f);
             glScalef(0.15f, 0.2f, 0.05f);
-            glutSolidCube(1.0f);
+            solidCube(1.0f);
             glPopMatrix();
             glPushMatrix();
             glTranslatef(0.0f, -0.2f, 0.51f);
             glScalef(0.4f, 0.1f, 0.05f);
-            glutSolidCube(1.0f);
+            solidCube(1.0f);
             glPopMatrix();
-            glEnable(GL_LIGHTING);
+            renderState.enable(GL_LIGHTING);
         }
         
         glPopMatrix();
@@ -1702,7 +7656,9 @@ public:
         glPopMatrix();
     }
     
-    void getCameraTransform(Vector3& eye, Vector3& center) {
+    // Camera on the player blended alpha of the way into the current step
+    void getCameraTransform(Vector3& eye, Vector3& center, float alpha) {
+        Vector3 at = renderPosition(alpha);
         float radYaw = yaw * M_PI / 180.0f;
         float radPitch = pitch * M_PI / 180.0f;
         
@@ -1712,7 +7668,7 @@ public:
         forward.z = -cos(radYaw) * cos(radPitch);
         
         if (isFirstPerson) {
-            eye = position + Vector3(0.0f, 1.6f, 0.0f); // Eye level
+            eye = at + Vector3(0.0f, 1.6f, 0.0f); // Eye level
             center = eye + forward;
         } else {
             // Third person camera orbits around player - player always centered
@@ -1721,14 +7677,14 @@ public:
             
             // Camera orbits around the player based on yaw and pitch
             // Camera is positioned behind and above/below based on pitch
-            eye.x = position.x - forward.x * distance;
-            eye.y = position.y + playerHeight - forward.y * distance;
-            eye.z = position.z - forward.z * distance;
+            eye.x = at.x - forward.x * distance;
+            eye.y = at.y + playerHeight - forward.y * distance;
+            eye.z = at.z - forward.z * distance;
             
             // Always look at the player's center (keeps character centered on screen)
-            center.x = position.x;
-            center.y = position.y + playerHeight;
-            center.z = position.z;
+            center.x = at.x;
+            center.y = at.y + playerHeight;
+            center.z = at.z;
         }
     }
 };
@@ -1768,26 +7724,323 @@ struct Sparkle {
     float velocityY;
     float size;
 };
-std::vector<Sparkle> sparkles;
+std::vector<Sparkle> sparkles;
+
+// Flame particle for burning effect
+struct Flame {
+    Vector3 position;
+    float lifetime;
+    Vector3 velocity;
+    float size;
+};
+std::vector<Flame> flames;
+bool isPlayerBurning = false;  // Track if player is currently on lava
+
+// Animation timer
+float animationTime = 0.0f;
+
+// ============================================================================
+// SPATIAL HASH GRID - Broadphase for circle overlap queries on the XZ plane
+// ============================================================================
+
+// Obstacles are circles or axis-aligned rectangles hashed into square
+// cells; a query only tests the entries in the cells its circle covers.
+// Scenes keep one grid for obstacles placed at init and one for things
+// that move (updated with move()).
+class SpatialHashGrid {
+public:
+    enum Shape { SHAPE_CIRCLE, SHAPE_RECT };
+    
+    struct Entry {
+        Shape shape;
+        float x, z;            // Centre
+        float halfX, halfZ;    // Rectangle half extents (circles: radius in both)
+        int tag;               // Caller's obstacle kind
+        int index;             // Caller's index into its own array
+    };
+    
+    explicit SpatialHashGrid(float cellSize = 4.0f) : cellSize(cellSize), queryStamp(0) {}
+    
+    void clear() {
+        cells.clear();
+        entries.clear();
+        visitStamps.clear();
+    }
+    
+    // Add an obstacle; returns a handle for move()
+    int addCircle(float x, float z, float radius, int tag, int index) {
+        return add({ SHAPE_CIRCLE, x, z, radius, radius, tag, index });
+    }
+    
+    int addRect(float x, float z, float halfX, float halfZ, int tag, int index) {
+        return add({ SHAPE_RECT, x, z, halfX, halfZ, tag, index });
+    }
+    
+    // Move an entry, re-bucketing it only when its cell range changes
+    void move(int handle, float x, float z) {
+        if (handle < 0 || handle >= (int)entries.size()) return;
+        Entry& entry = entries[handle];
+        int oldRange[4], newRange[4];
+        cellRange(entry.x, entry.z, entry.halfX, entry.halfZ, oldRange);
+        cellRange(x, z, entry.halfX, entry.halfZ, newRange);
+        entry.x = x;
+        entry.z = z;
+        if (std::equal(oldRange, oldRange + 4, newRange)) return;
+        
+        forEachCell(oldRange, [&](std::vector<int>& cell) {
+            auto it = std::find(cell.begin(), cell.end(), handle);
+            if (it != cell.end()) {
+                *it = cell.back();
+                cell.pop_back();
+            }
+        });
+        insert(handle);
+    }
+    
+    // Call visit(entry) for every entry overlapping the circle, each once.
+    // Overlap is strict (touching edges don't count), matching the scenes'
+    // original "dist < radius + r" and open-interval tests.
+    template <typename Visitor>
+    void queryCircle(float x, float z, float radius, Visitor visit) const {
+        int range[4];
+        cellRange(x, z, radius, radius, range);
+        unsigned stamp = ++queryStamp;
+        for (int cx = range[0]; cx <= range[2]; cx++) {
+            for (int cz = range[1]; cz <= range[3]; cz++) {
+                auto it = cells.find(cellKey(cx, cz));
+                if (it == cells.end()) continue;
+                for (int handle : it->second) {
+                    if (visitStamps[handle] == stamp) continue;
+                    visitStamps[handle] = stamp;
+                    const Entry& entry = entries[handle];
+                    if (overlaps(entry, x, z, radius)) visit(entry);
+                }
+            }
+        }
+    }
+    
+    // True when anything with the given tag overlaps the circle
+    bool anyOverlap(float x, float z, float radius, int tag) const {
+        bool found = false;
+        queryCircle(x, z, radius, [&](const Entry& entry) { found = found || entry.tag == tag; });
+        return found;
+    }
+    
+    static bool overlaps(const Entry& entry, float x, float z, float radius) {
+        float dx = x - entry.x;
+        float dz = z - entry.z;
+        if (entry.shape == SHAPE_CIRCLE) {
+            float reach = radius + entry.halfX;
+            return dx * dx + dz * dz < reach * reach;
+        }
+        // Rectangle: centre strictly inside, or within radius of the edge
+        float ex = fabs(dx) - entry.halfX;
+        float ez = fabs(dz) - entry.halfZ;
+        if (ex < 0.0f && ez < 0.0f) return true;
+        ex = std::max(ex, 0.0f);
+        ez = std::max(ez, 0.0f);
+        return ex * ex + ez * ez < radius * radius;
+    }
+    
+    size_t entryCount() const { return entries.size(); }
+    size_t cellCount() const { return cells.size(); }
+    
+private:
+    float cellSize;
+    std::unordered_map<uint64_t, std::vector<int>> cells;
+    std::vector<Entry> entries;
+    mutable std::vector<unsigned> visitStamps;  // Dedupes entries spanning several cells
+    mutable unsigned queryStamp;
+    
+    // Cell x in the high 32 bits, z in the low; shifted unsigned, since
+    // left-shifting a negative signed value is undefined before C++20
+    static uint64_t cellKey(int cx, int cz) {
+        return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cz;
+    }
+    
+    // Inclusive cell range {minX, minZ, maxX, maxZ} covered by a box
+    void cellRange(float x, float z, float halfX, float halfZ, int* range) const {
+        range[0] = (int)floor((x - halfX) / cellSize);
+        range[1] = (int)floor((z - halfZ) / cellSize);
+        range[2] = (int)floor((x + halfX) / cellSize);
+        range[3] = (int)floor((z + halfZ) / cellSize);
+    }
+    
+    template <typename Func>
+    void forEachCell(const int* range, Func func) {
+        for (int cx = range[0]; cx <= range[2]; cx++) {
+            for (int cz = range[1]; cz <= range[3]; cz++) {
+                func(cells[cellKey(cx, cz)]);
+            }
+        }
+    }
+    
+    int add(const Entry& entry) {
+        entries.push_back(entry);
+        visitStamps.push_back(0);
+        int handle = (int)entries.size() - 1;
+        insert(handle);
+        return handle;
+    }
+    
+    void insert(int handle) {
+        const Entry& entry = entries[handle];
+        int range[4];
+        cellRange(entry.x, entry.z, entry.halfX, entry.halfZ, range);
+        forEachCell(range, [&](std::vector<int>& cell) { cell.push_back(handle); });
+    }
+};
+
+// ============================================================================
+// SIMULATION RANDOM - Seeded per-subsystem generators and state hashing
+// ============================================================================
+
+// Small PCG32 generator. Each subsystem draws from its own stream, so one
+// subsystem consuming more numbers (an extra flame, say) doesn't shift the
+// sequences the others see, and a recorded seed replays the same game on
+// every platform (rand() differs between C libraries).
+class SimRandom {
+public:
+    static constexpr int MAX_VALUE = 0x7FFFFFFF;
+    
+    explicit SimRandom(uint64_t seedValue = 1) { seed(seedValue); }
+    
+    void seed(uint64_t seedValue) {
+        state = 0;
+        nextBits();
+        state += seedValue;
+        nextBits();
+    }
+    
+    // 0..MAX_VALUE, a drop-in for rand() at `% n` call sites
+    int next() { return (int)(nextBits() >> 1); }
+    
+    // Uniform in [0, 1)
+    float uniform() { return (nextBits() >> 8) * (1.0f / 16777216.0f); }
+    
+    uint64_t getState() const { return state; }
+    
+private:
+    uint64_t state;
+    
+    uint32_t nextBits() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint32_t shifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+        uint32_t rotation = (uint32_t)(old >> 59);
+        return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+    }
+};
+
+// Gameplay streams; scene layouts use their own fixed-seed generators
+SimRandom mobRandom;     // Scene 1 wander targets
+SimRandom batRandom;     // Scene 2 bat targets
+SimRandom effectRandom;  // Flame and sparkle particles
+
+uint64_t simulationSeed = 1;  // --seed, or the seed stored in a replay
+
+// Derive each stream from one session seed (splitmix64 per stream)
+void seedSimulationRandom(uint64_t seed) {
+    simulationSeed = seed;
+    SimRandom* streams[] = { &mobRandom, &batRandom, &effectRandom };
+    uint64_t mix = seed;
+    for (SimRandom* stream : streams) {
+        mix += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = mix;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        stream->seed(z ^ (z >> 31));
+    }
+}
+
+// FNV-1a over the raw bytes of simulation state; equal hashes after the
+// same step mean a replay is still in lockstep with its recording
+struct StateHash {
+    uint64_t value = 1469598103934665603ULL;
+    
+    void addBytes(const void* data, size_t size) {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < size; i++) value = (value ^ bytes[i]) * 1099511628211ULL;
+    }
+    void add(float v) { addBytes(&v, sizeof(v)); }
+    void add(int v) { addBytes(&v, sizeof(v)); }
+    void add(bool v) { add(v ? 1 : 0); }
+    void add(uint64_t v) { addBytes(&v, sizeof(v)); }
+    void add(const Vector3& v) { add(v.x); add(v.y); add(v.z); }
+};
 
-// Flame particle for burning effect
-struct Flame {
+// ============================================================================
+// KINEMATIC AGENT - Time-based movement shared by mobs and crystals
+// ============================================================================
+
+// Position plus a heading about the Y axis, advanced by elapsed seconds so
+// movement is the same at any simulation rate. Heading is in degrees in
+// the glRotatef sense used by the mob models: 0 faces -Z, 90 faces +X.
+struct KinematicAgent {
     Vector3 position;
-    float lifetime;
-    Vector3 velocity;
-    float size;
+    float heading;    // Degrees
+    float speed;      // Units per second
+    float turnRate;   // Degrees per second toward the travel direction, 0 = instant
+    float spinRate;   // Degrees per second of continuous spin (spin())
+    Vector3 previousPosition;  // At the start of the current step, for drawing
+    float previousHeading;
+    
+    KinematicAgent(const Vector3& startPosition = Vector3(0, 0, 0), float startHeading = 0.0f,
+                   float unitsPerSecond = 0.0f, float degreesPerSecond = 0.0f, float spinDegreesPerSecond = 0.0f)
+        : position(startPosition), heading(startHeading), speed(unitsPerSecond),
+          turnRate(degreesPerSecond), spinRate(spinDegreesPerSecond),
+          previousPosition(startPosition), previousHeading(startHeading) {}
+    
+    // Call before moving in a step; drawing blends from here
+    void saveStep() {
+        previousPosition = position;
+        previousHeading = heading;
+    }
+    
+    Vector3 renderPosition(float alpha) const { return blendPosition(previousPosition, position, alpha); }
+    float renderHeading(float alpha) const { return blendDegrees(previousHeading, heading, alpha); }
+    
+    // Walk toward target on the XZ plane at `speed`, stopping within
+    // arriveRadius. Returns false once arrived.
+    bool seek(const Vector3& target, float arriveRadius, float deltaTime) {
+        float dx = target.x - position.x;
+        float dz = target.z - position.z;
+        float distance = sqrt(dx * dx + dz * dz);
+        if (distance <= arriveRadius) return false;
+        
+        float step = std::min(speed * deltaTime, distance);
+        position.x += dx / distance * step;
+        position.z += dz / distance * step;
+        turnToward(atan2(dx, -dz) * 180.0f / M_PI, deltaTime);
+        return true;
+    }
+    
+    // Rotate the heading toward targetHeading by at most turnRate * deltaTime
+    void turnToward(float targetHeading, float deltaTime) {
+        float diff = targetHeading - heading;
+        while (diff > 180.0f) diff -= 360.0f;
+        while (diff < -180.0f) diff += 360.0f;
+        float maxTurn = turnRate * deltaTime;
+        if (turnRate > 0.0f && fabs(diff) > maxTurn) diff = diff > 0.0f ? maxTurn : -maxTurn;
+        heading = wrapDegrees(heading + diff);
+    }
+    
+    // Turn continuously at spinRate (crystals)
+    void spin(float deltaTime) {
+        heading = wrapDegrees(heading + spinRate * deltaTime);
+    }
+    
+    static float wrapDegrees(float degrees) {
+        degrees = fmod(degrees, 360.0f);
+        return degrees < 0.0f ? degrees + 360.0f : degrees;
+    }
 };
-std::vector<Flame> flames;
-bool isPlayerBurning = false;  // Track if player is currently on lava
-
-// Animation timer
-float animationTime = 0.0f;
 
 // ============================================================================
 // SCENE CLASS - Base class for all scenes
 // ============================================================================
 
-class Scene {
+class Scene : public CollisionWorld {
 public:
     std::string name;
     float ambientLight[4];
@@ -1806,10 +8059,16 @@ public:
     }
     
     virtual void init() = 0;
-    virtual void render() = 0;
+    virtual void render(const RenderView& view) = 0;
     virtual void update(float deltaTime) = 0;
     virtual void cleanup() = 0;
     
+    // Mix the state update() advances into a replay checksum
+    virtual void hashState(StateHash& /*hash*/) const {}
+    
+    // Scenes without obstacles collide with nothing
+    void queryCollision(float /*x*/, float /*z*/, float /*radius*/, CollisionResult& /*result*/) const override {}
+    
     // Helper to add a model to the scene
     void addModel(OBJModel* model) {
         if (model) sceneModels.push_back(model);
@@ -1833,16 +8092,15 @@ void drawPortalComponent(Vector3 position, bool isActive, GLuint frameTexture) {
     
     float portalWidth = 2.0f;
     float portalHeight = 3.0f;
-    float portalDepth = 0.2f;
     
     // Enable blending for transparency
-    glEnable(GL_BLEND);
+    renderState.enable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     
     // Enable texture for portal frame
-    glEnable(GL_TEXTURE_2D);
+    renderState.enable(GL_TEXTURE_2D);
     if (frameTexture) {
-        glBindTexture(GL_TEXTURE_2D, frameTexture);
+        renderState.bindTexture(frameTexture);
     }
     
     // Draw portal frame edges (always visible) - Minecraft style thick blocks with texture
@@ -1850,11 +8108,11 @@ void drawPortalComponent(Vector3 position, bool isActive, GLuint frameTexture) {
     GLfloat frameAmbient[] = { 1.0f, 1.0f, 1.0f, 1.0f };
     GLfloat frameSpecular[] = { 0.5f, 0.5f, 0.5f, 1.0f };
     GLfloat frameEmission[] = { 0.2f, 0.2f, 0.2f, 1.0f };  // Slight glow to make texture visible
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, frameDiffuse);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, frameAmbient);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, frameSpecular);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, frameEmission);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 30.0f);
+    renderState.material(GL_DIFFUSE, frameDiffuse);
+    renderState.material(GL_AMBIENT, frameAmbient);
+    renderState.material(GL_SPECULAR, frameSpecular);
+    renderState.material(GL_EMISSION, frameEmission);
+    renderState.shininess(30.0f);
     glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
     
     float frameThickness = 0.4f;  // Much thicker blocks like Minecraft
@@ -1864,36 +8122,36 @@ void drawPortalComponent(Vector3 position, bool isActive, GLuint frameTexture) {
     glPushMatrix();
     glTranslatef(-portalWidth/2.0f - frameThickness/2.0f, portalHeight/2.0f, 0.0f);
     glScalef(frameThickness, portalHeight + frameThickness*2, frameDepth);
-    glutSolidCube(1.0f);
+    solidCube(1.0f);
     glPopMatrix();
     
     // Right edge - wider block
     glPushMatrix();
     glTranslatef(portalWidth/2.0f + frameThickness/2.0f, portalHeight/2.0f, 0.0f);
     glScalef(frameThickness, portalHeight + frameThickness*2, frameDepth);
-    glutSolidCube(1.0f);
+    solidCube(1.0f);
     glPopMatrix();
     
     // Top edge - wider block
     glPushMatrix();
     glTranslatef(0.0f, portalHeight + frameThickness/2.0f, 0.0f);
     glScalef(portalWidth, frameThickness, frameDepth);
-    glutSolidCube(1.0f);
+    solidCube(1.0f);
     glPopMatrix();
     
     // Bottom edge - wider block
     glPushMatrix();
     glTranslatef(0.0f, frameThickness/2.0f, 0.0f);
     glScalef(portalWidth, frameThickness, frameDepth);
-    glutSolidCube(1.0f);
+    solidCube(1.0f);
     glPopMatrix();
     
     // Disable texture for portal interior
-    glDisable(GL_TEXTURE_2D);
+    renderState.disable(GL_TEXTURE_2D);
     
     // Reset frame emission before drawing portal interior
     GLfloat noEmission[] = { 0.0f, 0.0f, 0.0f, 1.0f };
-    glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, noEmission);
+    renderState.material(GL_EMISSION, noEmission);
     
     // Draw portal interior - Minecraft Nether Portal style
     if (isActive) {
@@ -1912,9 +8170,9 @@ void drawPortalComponent(Vector3 position, bool isActive, GLuint frameTexture) {
             GLfloat portalAmbient[] = { 0.3f * glowPulse, 0.1f * glowPulse, 0.5f * glowPulse, layerAlpha };
             GLfloat portalEmission[] = { 0.4f * glowPulse, 0.15f * glowPulse, 0.6f * glowPulse, 1.0f };
             
-            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, portalDiffuse);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, portalAmbient);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, portalEmission);
+            renderState.material(GL_DIFFUSE, portalDiffuse);
+            renderState.material(GL_AMBIENT, portalAmbient);
+            renderState.material(GL_EMISSION, portalEmission);
             glColor4f(0.5f * glowPulse, 0.2f * glowPulse, 0.7f * glowPulse, layerAlpha);
             
             // Draw wavy portal surface (like nether portal distortion)
@@ -1950,9 +8208,9 @@ void drawPortalComponent(Vector3 position, bool isActive, GLuint frameTexture) {
                 
                 float particleGlow = 0.8f + 0.2f * sin(portalTime * 5.0f + i);
                 GLfloat particleEmission[] = { 0.5f * particleGlow, 0.2f * particleGlow, 0.7f * particleGlow, 1.0f };
-                glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, particleEmission);
+                renderState.material(GL_EMISSION, particleEmission);
                 glColor4f(0.6f * particleGlow, 0.25f * particleGlow, 0.8f * particleGlow, 0.9f);
-                glutSolidSphere(0.04f, 6, 6);
+                solidSphere(0.04f, 6, 6);
                 glPopMatrix();
             }
         }
@@ -1972,20 +8230,25 @@ void drawPortalComponent(Vector3 position, bool isActive, GLuint frameTexture) {
             
             float particleGlow = 0.7f + 0.3f * sin(portalTime * 6.0f + i);
             GLfloat swirlEmission[] = { 0.6f * particleGlow, 0.25f * particleGlow, 0.8f * particleGlow, 1.0f };
-            glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, swirlEmission);
+            renderState.material(GL_EMISSION, swirlEmission);
             glColor4f(0.7f * particleGlow, 0.3f * particleGlow, 0.9f * particleGlow, 0.8f);
-            glutSolidSphere(0.05f, 6, 6);
+            solidSphere(0.05f, 6, 6);
             glPopMatrix();
         }
         
         // Reset emission
-        glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, noEmission);
+        renderState.material(GL_EMISSION, noEmission);
     }
     
-    glDisable(GL_BLEND);
+    renderState.disable(GL_BLEND);
     glPopMatrix();
 }
 
+// Trees added to the forest on top of the hand-placed ones (--forest-trees)
+int extraForestTrees = 0;
+// Flowers and grass tufts added to the forest floor (--ground-cover)
+int extraGroundCover = 0;
+
 class Scene1_CaveEntrance : public Scene {
 private:
     // Scene-specific model pointers for easy access
@@ -2003,30 +8266,27 @@ private:
     GLuint creeperTexture;  // Creeper texture
     Model3DS* flockModel;  // Flock 3DS model
     GLuint grassTexture;  // Floor grass texture
-    GLuint flockTexture;  // Flock/bird texture
     GLuint skyTexture;    // Sky texture
     GLuint steveFaceTexture;  // Steve face texture for player head
     GLuint portalFrameTexture;  // Portal frame texture
     
-    // Wolf position and AI
-    Vector3 wolfPosition;
-    float wolfRotation;
+    // Wolf movement and AI
+    KinematicAgent wolf;
     float wolfWanderTime;
+    float wolfWanderInterval;  // Seconds until the next target, rolled when one is picked
     Vector3 wolfTargetPosition;
-    float wolfMoveSpeed;
     
-    // Cow position and AI
-    Vector3 cowPosition;
-    float cowRotation;
+    // Cow movement and AI
+    KinematicAgent cow;
     float cowWanderTime;
+    float cowWanderInterval;
     Vector3 cowTargetPosition;
-    float cowMoveSpeed;
     
-    // Creeper position and AI (4 creepers total)
+    // Creeper movement and AI (4 creepers total)
     struct CreeperData {
-        Vector3 position;
-        float rotation;
+        KinematicAgent agent;
         float wanderTime;
+        float wanderInterval;
         Vector3 targetPosition;
         bool alive;
         bool chasing;
@@ -2043,13 +8303,20 @@ private:
     Vector3 flockPosition;
     float flockRotation;
     float flockTime;  // For animation
+    Vector3 previousFlockPosition;  // At the start of the current step, for drawing
+    float previousFlockRotation;
     
-    // Pig AI variables
-    Vector3 pigPosition;
-    float pigRotation;
+    // Pig movement and AI
+    KinematicAgent pig;
     float pigWanderTime;
+    float pigWanderInterval;
     Vector3 pigTargetPosition;
-    float pigMoveSpeed;
+    
+    // Collision broadphase: trees and boulders, plus a layer for the
+    // wandering pig, wolf and cow (handles into mobObstacles)
+    SpatialHashGrid staticObstacles;
+    SpatialHashGrid mobObstacles;
+    int pigCollider, wolfCollider, cowCollider;
     
     // Minecraft tree instances for the forest
     struct MinecraftTreeInstance {
@@ -2058,51 +8325,72 @@ private:
         float yOffset;  // Height offset based on scale
     };
     std::vector<MinecraftTreeInstance> minecraftTrees;
+    InstanceBatch treeBatch;
     
     // Boulder instances
     struct BoulderInstance {
         float x, y, z;
         float scale;
         float rotationY;
+        int variant;    // Which rock mesh
     };
     std::vector<BoulderInstance> boulders;
+    
+    // Procedural rock meshes, built once at init; each variant draws its
+    // boulders as one instanced batch (display list / immediate otherwise)
+    static constexpr int BOULDER_VARIANTS = 4;
+    GpuMesh boulderMeshes[BOULDER_VARIANTS];
+    GLuint boulderLists[BOULDER_VARIANTS];
+    InstanceBatch boulderBatches[BOULDER_VARIANTS];
     GLuint stoneTexture;  // Stone texture for boulders
     
-    // Flower instances for forest floor
+    // Flowers and grass tufts on the forest floor
     struct Flower {
         float x, z;
         float scale;
         int colorType;  // 0=red, 1=yellow, 2=blue, 3=white, 4=pink, 5=purple
         float swayPhase;
     };
-    std::vector<Flower> flowers;
+    GroundCover groundCover;
+    static constexpr int GRASS_TUFTS = 300;
     
     // Sun animation variables
     float sunTime;          // Time variable for sun movement
     float sunX, sunY, sunZ; // Sun position
     
+    // Mob speeds in units per second (the old per-tick offsets x 62.5 ticks/s)
+    static constexpr float PIG_SPEED = 1.25f;
+    static constexpr float WOLF_SPEED = 1.875f;
+    static constexpr float COW_SPEED = 1.25f;
+    static constexpr float CREEPER_WANDER_SPEED = 1.25f;
+    static constexpr float CREEPER_CHASE_SPEED = 2.5f;
+    static constexpr float MOB_TURN_RATE = 540.0f;  // Degrees per second
+    static constexpr float FLOCK_TURN_RATE = 31.25f;  // Degrees per second (was 0.5 per tick)
+    
 public:
     Scene1_CaveEntrance() : Scene("Enchanted Forest"), 
-                            caveModel(nullptr), entranceRocksModel(nullptr), 
-                            pigModel(nullptr), minecraftTree(nullptr),
+                            caveModel(nullptr), crystalModel(nullptr), entranceRocksModel(nullptr), 
+                            pigModel(nullptr), minecraftTree(nullptr), wallTexture(0),
                             wolfModel(nullptr), wolfTexture(0), cowModel(nullptr), cowTexture(0),
                             creeperModel(nullptr), creeperTexture(0), flockModel(nullptr),
-                            grassTexture(0), stoneTexture(0), flockTexture(0), wallTexture(0),
-                            skyTexture(0), steveFaceTexture(0), portalFrameTexture(0),
-                            wolfPosition(-10.0f, 0.0f, 10.0f), wolfRotation(0.0f),
-                            wolfWanderTime(0.0f), wolfTargetPosition(-10.0f, 0.0f, 10.0f), wolfMoveSpeed(0.03f),
-                            cowPosition(-15.0f, 0.0f, -15.0f), cowRotation(0.0f),
-                            cowWanderTime(0.0f), cowTargetPosition(-15.0f, 0.0f, -15.0f), cowMoveSpeed(0.02f),
+                            grassTexture(0), skyTexture(0), steveFaceTexture(0), portalFrameTexture(0),
+                            wolf(Vector3(-10.0f, 0.0f, 10.0f), 0.0f, WOLF_SPEED, MOB_TURN_RATE),
+                            wolfWanderTime(0.0f), wolfWanderInterval(3.0f), wolfTargetPosition(-10.0f, 0.0f, 10.0f),
+                            cow(Vector3(-15.0f, 0.0f, -15.0f), 0.0f, COW_SPEED, MOB_TURN_RATE),
+                            cowWanderTime(0.0f), cowWanderInterval(5.0f), cowTargetPosition(-15.0f, 0.0f, -15.0f),
                             creeperDetectRadius(15.0f), creeperExplodeRadius(2.0f),
                             flockPosition(0.0f, 15.0f, 0.0f), flockRotation(0.0f), flockTime(0.0f),
-                            pigPosition(0.0f, 0.0f, -5.0f), pigRotation(0.0f),
-                            pigWanderTime(0.0f), pigTargetPosition(0.0f, 0.0f, -5.0f), pigMoveSpeed(0.02f),
+                            previousFlockPosition(flockPosition), previousFlockRotation(flockRotation),
+                            pig(Vector3(0.0f, 0.0f, -5.0f), 0.0f, PIG_SPEED, MOB_TURN_RATE),
+                            pigWanderTime(0.0f), pigWanderInterval(5.0f), pigTargetPosition(0.0f, 0.0f, -5.0f),
+                            pigCollider(-1), wolfCollider(-1), cowCollider(-1), stoneTexture(0),
                             sunTime(0.0f), sunX(50.0f), sunY(40.0f), sunZ(0.0f) {
         // Initialize 4 creepers at different positions
-        creepers[0] = {Vector3(15.0f, 0.0f, -10.0f), 0.0f, 0.0f, Vector3(15.0f, 0.0f, -10.0f), true, false, 0.0f, false, 0.0f, Vector3(0.0f, 0.0f, 0.0f)};
-        creepers[1] = {Vector3(-20.0f, 0.0f, 15.0f), 0.0f, 0.0f, Vector3(-20.0f, 0.0f, 15.0f), true, false, 0.0f, false, 0.0f, Vector3(0.0f, 0.0f, 0.0f)};
-        creepers[2] = {Vector3(20.0f, 0.0f, 20.0f), 0.0f, 0.0f, Vector3(20.0f, 0.0f, 20.0f), true, false, 0.0f, false, 0.0f, Vector3(0.0f, 0.0f, 0.0f)};
-        creepers[3] = {Vector3(-10.0f, 0.0f, -20.0f), 0.0f, 0.0f, Vector3(-10.0f, 0.0f, -20.0f), true, false, 0.0f, false, 0.0f, Vector3(0.0f, 0.0f, 0.0f)};
+        creepers[0] = {KinematicAgent(Vector3(15.0f, 0.0f, -10.0f), 0.0f, CREEPER_WANDER_SPEED, MOB_TURN_RATE), 0.0f, 4.0f, Vector3(15.0f, 0.0f, -10.0f), true, false, 0.0f, false, 0.0f, Vector3(0.0f, 0.0f, 0.0f)};
+        creepers[1] = {KinematicAgent(Vector3(-20.0f, 0.0f, 15.0f), 0.0f, CREEPER_WANDER_SPEED, MOB_TURN_RATE), 0.0f, 4.0f, Vector3(-20.0f, 0.0f, 15.0f), true, false, 0.0f, false, 0.0f, Vector3(0.0f, 0.0f, 0.0f)};
+        creepers[2] = {KinematicAgent(Vector3(20.0f, 0.0f, 20.0f), 0.0f, CREEPER_WANDER_SPEED, MOB_TURN_RATE), 0.0f, 4.0f, Vector3(20.0f, 0.0f, 20.0f), true, false, 0.0f, false, 0.0f, Vector3(0.0f, 0.0f, 0.0f)};
+        creepers[3] = {KinematicAgent(Vector3(-10.0f, 0.0f, -20.0f), 0.0f, CREEPER_WANDER_SPEED, MOB_TURN_RATE), 0.0f, 4.0f, Vector3(-10.0f, 0.0f, -20.0f), true, false, 0.0f, false, 0.0f, Vector3(0.0f, 0.0f, 0.0f)};
+        for (int v = 0; v < BOULDER_VARIANTS; v++) boulderLists[v] = 0;
         // Bright outdoor daytime lighting
         ambientLight[0] = 0.5f;
         ambientLight[1] = 0.6f;
@@ -2125,123 +8413,96 @@ public:
         //     addModel(caveModel);
         // }
         
+        // Models and textures are queued on the asset loader; they are parsed
+        // and decoded in parallel and become usable before the first frame
+        // (initScenes() waits for the loader)
+        
         // Load the pink pig model
-        pigModel = modelManager.loadModel("pink_pig", "models/16433_Pig.obj");
-        if (pigModel) {
-            std::cout << "Pig model loaded successfully!" << std::endl;
-        } else {
-            std::cout << "Failed to load pig model!" << std::endl;
-        }
+        pigModel = modelManager.requestModel("pink_pig", "models/16433_Pig.obj", [this](bool ok) {
+            if (!ok) {
+                std::cout << "Failed to load pig model!" << std::endl;
+                pigModel = nullptr;
+            }
+        });
         
         // Load the Minecraft tree model
-        minecraftTree = modelManager.loadModel("minecraft_tree", "models/Minecraft Tree.obj");
-        if (minecraftTree) {
-            std::cout << "Minecraft tree loaded successfully!" << std::endl;
-            minecraftTree->setPosition(-5.0f, 3.85f, -5.0f);  // Raised to put base on ground (lowest Y is -425 * 0.009 = -3.83)
-            minecraftTree->setUniformScale(0.009f);  // User requested scale
-            addModel(minecraftTree);
-        } else {
-            std::cout << "Failed to load Minecraft tree!" << std::endl;
-        }
+        minecraftTree = modelManager.requestModel("minecraft_tree", "models/Minecraft Tree.obj", [this](bool ok) {
+            if (ok) {
+                minecraftTree->setPosition(-5.0f, 3.85f, -5.0f);  // Raised to put base on ground (lowest Y is -425 * 0.009 = -3.83)
+                minecraftTree->setUniformScale(0.009f);  // User requested scale
+                addModel(minecraftTree);
+            } else {
+                std::cout << "Failed to load Minecraft tree!" << std::endl;
+                minecraftTree = nullptr;
+            }
+        });
         
         // Load wall texture for the border walls
-        wallTexture = loadTexture("models/hedge2.jpeg");
-        if (wallTexture) {
-            std::cout << "Wall texture loaded successfully!" << std::endl;
-        } else {
-            std::cout << "Failed to load wall texture!" << std::endl;
-        }
+        assetLoader.requestTexture("models/hedge2.jpeg", &wallTexture);
         
         // Load grass texture for the floor
-        grassTexture = loadTexture("models/herbe 2.jpg");
-        if (grassTexture) {
-            std::cout << "Grass texture loaded successfully!" << std::endl;
-        }
+        assetLoader.requestTexture("models/herbe 2.jpg", &grassTexture);
         
         // Load stone texture for boulders
-        stoneTexture = loadTexture("models/minecraft_stone.jpg");
-        if (stoneTexture) {
-            std::cout << "Stone texture loaded successfully!" << std::endl;
-        }
+        assetLoader.requestTexture("models/minecraft_stone.jpg", &stoneTexture);
         
         // Load sky texture
-        skyTexture = loadTexture("models/sky.jpg");
-        if (skyTexture) {
-            std::cout << "Sky texture loaded successfully!" << std::endl;
-        }
+        assetLoader.requestTexture("models/sky.jpg", &skyTexture);
         
-        // Load Steve face texture for player head
-        steveFaceTexture = loadTexture("models/steveFace.jpg");
-        if (steveFaceTexture) {
-            std::cout << "Steve face texture loaded successfully!" << std::endl;
-        }
+        // Load Steve face texture for player head, copied to the global
+        // variable for Player class access
+        assetLoader.requestTexture("models/steveFace.jpg", &steveFaceTexture, [this](bool) {
+            g_steveFaceTexture = steveFaceTexture;
+        });
         
         // Load portal frame texture
-        portalFrameTexture = loadTexture("models/images.jpg");
-        if (portalFrameTexture) {
-            std::cout << "Portal frame texture loaded successfully!" << std::endl;
-        }
-        
-        // Copy steve face texture to global variable for Player class access
-        g_steveFaceTexture = steveFaceTexture;
+        assetLoader.requestTexture("models/images.jpg", &portalFrameTexture);
         
         // Load wolf model and texture (replaces dog)
         wolfModel = new OBJModel();
-        if (wolfModel->load("models/wolf_minecraft.obj")) {
-            std::cout << "Wolf model loaded successfully!" << std::endl;
-        } else {
-            std::cout << "Failed to load wolf model!" << std::endl;
-            delete wolfModel;
-            wolfModel = nullptr;
-        }
-        wolfTexture = loadTexture("models/HD_wolf.png");
-        if (wolfTexture) {
-            std::cout << "Wolf texture loaded successfully!" << std::endl;
-        }
+        assetLoader.requestOBJ(wolfModel, "models/wolf_minecraft.obj", [this](bool ok) {
+            if (!ok) {
+                std::cout << "Failed to load wolf model!" << std::endl;
+                delete wolfModel;
+                wolfModel = nullptr;
+            }
+        });
+        assetLoader.requestTexture("models/HD_wolf.png", &wolfTexture);
         
         // Load cow model and texture
         cowModel = new OBJModel();
-        if (cowModel->load("models/Cow Minecraft.obj")) {
-            std::cout << "Cow model loaded successfully!" << std::endl;
-        } else {
-            std::cout << "Failed to load cow model!" << std::endl;
-            delete cowModel;
-            cowModel = nullptr;
-        }
-        cowTexture = loadTexture("pig texture.jpg");
-        if (cowTexture) {
-            std::cout << "Cow texture (pig texture) loaded successfully!" << std::endl;
-        }
+        assetLoader.requestOBJ(cowModel, "models/Cow Minecraft.obj", [this](bool ok) {
+            if (!ok) {
+                std::cout << "Failed to load cow model!" << std::endl;
+                delete cowModel;
+                cowModel = nullptr;
+            }
+        });
+        assetLoader.requestTexture("pig texture.jpg", &cowTexture);
         
         // Load Creeper model and texture
         creeperModel = new OBJModel();
-        if (creeperModel->load("models/Creeper.obj")) {
-            std::cout << "Creeper model loaded successfully!" << std::endl;
-        } else {
-            std::cout << "Failed to load Creeper model!" << std::endl;
-            delete creeperModel;
-            creeperModel = nullptr;
-        }
-        creeperTexture = loadTexture("models/creeper2.jpg");
-        if (creeperTexture) {
-            std::cout << "Creeper texture loaded successfully!" << std::endl;
-        }
+        assetLoader.requestOBJ(creeperModel, "models/Creeper.obj", [this](bool ok) {
+            if (!ok) {
+                std::cout << "Failed to load Creeper model!" << std::endl;
+                delete creeperModel;
+                creeperModel = nullptr;
+            }
+        });
+        assetLoader.requestTexture("models/creeper2.jpg", &creeperTexture);
         
         // Load flock texture and model
-        flockTexture = loadTexture("models/swallowt.jpg");
-        if (flockTexture) {
-            std::cout << "Flock texture loaded successfully!" << std::endl;
-        }
         flockModel = new Model3DS();
-        if (flockModel->load("models/Flock N190413.3ds")) {
-            std::cout << "Flock model loaded successfully!" << std::endl;
-            flockModel->setPosition(flockPosition.x, flockPosition.y, flockPosition.z);
-            flockModel->setUniformScale(0.01f);
-        } else {
-            std::cout << "Failed to load flock model!" << std::endl;
-            delete flockModel;
-            flockModel = nullptr;
-        }
+        assetLoader.request3DS(flockModel, "models/Flock N190413.3ds", [this](bool ok) {
+            if (ok) {
+                flockModel->setPosition(flockPosition.x, flockPosition.y, flockPosition.z);
+                flockModel->setUniformScale(0.01f);
+            } else {
+                std::cout << "Failed to load flock model!" << std::endl;
+                delete flockModel;
+                flockModel = nullptr;
+            }
+        });
         
         // Note: Creeper.fbx cannot be loaded (FBX format not supported)
         // Convert to OBJ format using Blender to use it
@@ -2252,13 +8513,16 @@ public:
         // Generate boulders
         generateBoulders();
         
+        buildCollisionGrid();
+        generateGroundCover();
+        
         // Set up collision callback for this scene
         scene1Instance = this;
         
         std::cout << "Scene 1 initialized" << std::endl;
     }
     
-    void render() override {
+    void render(const RenderView& view) override {
         // Calculate time of day based on sun position
         // sunY ranges from 100 (horizon) to 180 (noon peak)
         float timeOfDay = (sunY - 100.0f) / 80.0f;  // 0.0 = sunrise/sunset, 1.0 = noon
@@ -2293,13 +8557,15 @@ public:
         glLightfv(GL_LIGHT0, GL_SPECULAR, lightSpecular);
         
         // Draw sky dome (simple gradient effect using a large sphere)
-        drawSky();
+        RenderSection section("sky");
+        drawSky(view);
         
         // Draw grass ground with texture
+        section.next("ground");
         glPushMatrix();
-        glDisable(GL_LIGHTING);  // Disable lighting for flat texture
-        glEnable(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, grassTexture);
+        renderState.disable(GL_LIGHTING);  // Disable lighting for flat texture
+        renderState.enable(GL_TEXTURE_2D);
+        renderState.bindTexture(grassTexture);
         glColor3f(1.0f, 1.0f, 1.0f);  // White to show texture at full brightness
         glBegin(GL_QUADS);
             glTexCoord2f(0.0f, 0.0f); glVertex3f(-50.0f, 0.0f, -50.0f);
@@ -2307,49 +8573,55 @@ public:
             glTexCoord2f(50.0f, 50.0f); glVertex3f(50.0f, 0.0f, 50.0f);
             glTexCoord2f(50.0f, 0.0f); glVertex3f(50.0f, 0.0f, -50.0f);
         glEnd();
-        glDisable(GL_TEXTURE_2D);
-        glEnable(GL_LIGHTING);  // Re-enable lighting for other objects
+        renderState.disable(GL_TEXTURE_2D);
+        renderState.enable(GL_LIGHTING);  // Re-enable lighting for other objects
         glPopMatrix();
         
         // Render border walls
+        section.next("walls");
         renderBorderWalls();
         
         // Render boulders
+        section.next("boulders");
         renderBoulders();
         
-        // Render flowers on the forest floor
-        renderFlowers();
+        // Render flowers and grass on the forest floor
+        section.next("flowers");
+        groundCover.render(view.time);
         
-        // Render all Minecraft tree instances using display list
-        if (minecraftTree && minecraftTree->hasDisplayList) {
-            for (const auto& treeInst : minecraftTrees) {
-                glPushMatrix();
-                // Position and scale the tree
-                glTranslatef(treeInst.x, treeInst.yOffset, treeInst.z);
-                glScalef(treeInst.scale, treeInst.scale, treeInst.scale);
-                
-                // Use display list for performance
-                glCallList(minecraftTree->displayList);
-                
-                glPopMatrix();
-            }
-            glDisable(GL_TEXTURE_2D);
+        // Render all Minecraft tree instances from the shared mesh
+        section.next("trees");
+        if (minecraftTree && minecraftTree->isLoaded) {
+            treeBatch.draw(minecraftTree->gpuMesh, minecraftTree->materialRanges,
+                           [this](int id) { minecraftTree->materials[id].apply(); },
+                           [this](const LodPlacement& at) { minecraftTree->drawMesh(at); }, &minecraftTree->lods);
+            renderState.disable(GL_TEXTURE_2D);
         }
         
         // Render all loaded OBJ models (excluding trees, we handle them separately)
+        section.next("models");
         for (auto* model : sceneModels) {
             if (model && model != minecraftTree) model->render();
         }
         
+        // Mob highlights; the wolf, cow and creepers only set diffuse and
+        // ambient and keep these, so they are applied even when the pig is
+        // culled
+        section.next("mobs");
+        GLfloat pinkSpecular[] = { 0.5f, 0.4f, 0.4f, 1.0f };
+        renderState.material(GL_SPECULAR, pinkSpecular);
+        renderState.shininess(30.0f);
+        
         // Render the pink pig
-        if (pigModel) {
+        Vector3 pigAt = pig.renderPosition(view.alpha);
+        if (pigModel && sphereInView(pigAt.x, pigAt.y, pigAt.z, pigModel->originRadius() * 0.03f)) {
             glPushMatrix();
             
             // Disable textures for the pig - it should be solid pink
-            glDisable(GL_TEXTURE_2D);
+            renderState.disable(GL_TEXTURE_2D);
             
-            glTranslatef(pigPosition.x, pigPosition.y, pigPosition.z);
-            glRotatef(pigRotation, 0.0f, 1.0f, 0.0f);  // Rotate to face direction of movement
+            glTranslatef(pigAt.x, pigAt.y, pigAt.z);
+            glRotatef(pig.renderHeading(view.alpha), 0.0f, 1.0f, 0.0f);  // Rotate to face direction of movement
             glRotatef(-90.0f, 1.0f, 0.0f, 0.0f);
             glRotatef(180.0f, 0.0f, 0.0f, 1.0f);
             glScalef(0.03f, 0.03f, 0.03f);  // Half player size
@@ -2357,79 +8629,78 @@ public:
             // Set pink material
             GLfloat pinkDiffuse[] = { 1.0f, 0.6f, 0.7f, 1.0f };
             GLfloat pinkAmbient[] = { 0.4f, 0.2f, 0.25f, 1.0f };
-            GLfloat pinkSpecular[] = { 0.5f, 0.4f, 0.4f, 1.0f };
-            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, pinkDiffuse);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, pinkAmbient);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, pinkSpecular);
-            glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 30.0f);
+            renderState.material(GL_DIFFUSE, pinkDiffuse);
+            renderState.material(GL_AMBIENT, pinkAmbient);
             glColor3f(1.0f, 0.6f, 0.7f);
             
-            pigModel->render();
+            pigModel->render(LodPlacement(pigAt, 0.03f));
             glPopMatrix();
         }
         
         // Render the wolf (dog) - with HD_wolf.png texture
-        if (wolfModel) {
+        Vector3 wolfAt = wolf.renderPosition(view.alpha);
+        if (wolfModel && sphereInView(wolfAt.x, 0.4f, wolfAt.z, wolfModel->originRadius() * 0.025f)) {
             glPushMatrix();
             
             // Position wolf on the ground - rotate to stand upright
             float wolfScale = 0.025f;  // Half player size
             float wolfYOffset = 0.4f;  // Raise slightly above ground
-            glTranslatef(wolfPosition.x, wolfYOffset, wolfPosition.z);
-            glRotatef(wolfRotation, 0.0f, 1.0f, 0.0f);
+            glTranslatef(wolfAt.x, wolfYOffset, wolfAt.z);
+            glRotatef(wolf.renderHeading(view.alpha), 0.0f, 1.0f, 0.0f);
             glRotatef(-90.0f, 1.0f, 0.0f, 0.0f);  // Rotate to stand upright
             glScalef(wolfScale, wolfScale, wolfScale);
             
             // Enable texture and bind wolf texture
-            glEnable(GL_TEXTURE_2D);
+            renderState.enable(GL_TEXTURE_2D);
             if (wolfTexture) {
-                glBindTexture(GL_TEXTURE_2D, wolfTexture);
+                renderState.bindTexture(wolfTexture);
             }
             
             // White material to allow texture colors to show
             GLfloat wolfDiffuse[] = { 1.0f, 1.0f, 1.0f, 1.0f };
             GLfloat wolfAmbient[] = { 0.8f, 0.8f, 0.8f, 1.0f };
-            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, wolfDiffuse);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, wolfAmbient);
+            renderState.material(GL_DIFFUSE, wolfDiffuse);
+            renderState.material(GL_AMBIENT, wolfAmbient);
             glColor3f(1.0f, 1.0f, 1.0f);
             
-            wolfModel->renderWithTexture();
+            wolfModel->renderWithTexture(LodPlacement(Vector3(wolfAt.x, wolfYOffset, wolfAt.z), wolfScale));
             
             // Disable texture after rendering
-            glDisable(GL_TEXTURE_2D);
+            renderState.disable(GL_TEXTURE_2D);
             
             glPopMatrix();
         }
         
         // Render the cow - with Cow Minecraft.jpg texture
-        if (cowModel) {
+        Vector3 cowAt = cow.renderPosition(view.alpha);
+        if (cowModel && sphereInView(cowAt.x, 0.4f, cowAt.z, cowModel->originRadius() * 0.03f)) {
             glPushMatrix();
             
             // Position cow on the ground - rotate to stand upright
             float cowScale = 0.03f;  // Slightly bigger than the wolf/dog
             float cowYOffset = 0.4f;  // Raise slightly above ground
-            glTranslatef(cowPosition.x, cowYOffset, cowPosition.z);
-            glRotatef(cowRotation, 0.0f, 1.0f, 0.0f);
+            glTranslatef(cowAt.x, cowYOffset, cowAt.z);
+            glRotatef(cow.renderHeading(view.alpha), 0.0f, 1.0f, 0.0f);
             glRotatef(-90.0f, 1.0f, 0.0f, 0.0f);  // Rotate to stand upright
             glScalef(cowScale, cowScale, cowScale);
             
             // Enable texture and bind cow texture
-            glEnable(GL_TEXTURE_2D);
+            renderState.enable(GL_TEXTURE_2D);
             if (cowTexture) {
-                glBindTexture(GL_TEXTURE_2D, cowTexture);
+                renderState.bindTexture(cowTexture);
             }
             
             // White material to allow texture colors to show
             GLfloat cowDiffuse[] = { 1.0f, 1.0f, 1.0f, 1.0f };
             GLfloat cowAmbient[] = { 0.8f, 0.8f, 0.8f, 1.0f };
-            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, cowDiffuse);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, cowAmbient);
+            renderState.material(GL_DIFFUSE, cowDiffuse);
+            renderState.material(GL_AMBIENT, cowAmbient);
             glColor3f(1.0f, 1.0f, 1.0f);
             
-            cowModel->renderWithTexture();
+            cowModel->renderWithTexture(LodPlacement(Vector3(cowAt.x, cowYOffset, cowAt.z), cowScale));
             
             // Disable texture after rendering
-            glDisable(GL_TEXTURE_2D);
+            renderState.disable(GL_TEXTURE_2D);
             
             glPopMatrix();
         }
@@ -2439,14 +8710,18 @@ public:
         if (creeperModel) {
             for (int i = 0; i < 4; i++) {
                 if (!creepers[i].alive) continue;
+                Vector3 creeperPosition = creepers[i].agent.renderPosition(view.alpha);
+                if (!sphereInView(creeperPosition.x, 0.8f, creeperPosition.z,
+                                  creeperModel->originRadius() * 0.008f)) continue;
                 glPushMatrix();
                 
                 // Position Creeper on the ground
                 float creeperScale = 0.008f;
                 float creeperYOffset = 0.8f;
-                glTranslatef(creepers[i].position.x, creeperYOffset, creepers[i].position.z);
-                glRotatef(creepers[i].rotation, 0.0f, 1.0f, 0.0f);
+                glTranslatef(creeperPosition.x, creeperYOffset, creeperPosition.z);
+                glRotatef(creepers[i].agent.renderHeading(view.alpha), 0.0f, 1.0f, 0.0f);
                 glScalef(creeperScale, creeperScale, creeperScale);
+                LodPlacement creeperAt(Vector3(creeperPosition.x, creeperYOffset, creeperPosition.z), creeperScale);
                 
                 // Flash when about to explode
                 float flashIntensity = 0.0f;
@@ -2456,8 +8731,8 @@ public:
                 
                 // Use creeper2.jpg texture for the body
                 if (creeperTexture) {
-                    glEnable(GL_TEXTURE_2D);
-                    glBindTexture(GL_TEXTURE_2D, creeperTexture);
+                    renderState.enable(GL_TEXTURE_2D);
+                    renderState.bindTexture(creeperTexture);
                     // Set texture to repeat for proper tiling
                     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
                     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -2468,59 +8743,59 @@ public:
                     glColor3f(tintR, tintG, tintB);
                     GLfloat creeperDiffuse[] = { 0.8f, 0.8f, 0.8f, 1.0f };
                     GLfloat creeperAmbient[] = { 0.5f, 0.5f, 0.5f, 1.0f };
-                    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, creeperDiffuse);
-                    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, creeperAmbient);
+                    renderState.material(GL_DIFFUSE, creeperDiffuse);
+                    renderState.material(GL_AMBIENT, creeperAmbient);
                     // Use procedural UV mapping - creeper model is about 375 units tall (-260 to 115)
                     // Scale of 0.015 gives more frequent texture tiling (5x smaller pattern)
-                    creeperModel->renderWithProceduralUV(0.015f);
-                    glDisable(GL_TEXTURE_2D);
+                    creeperModel->renderWithProceduralUV(0.015f, creeperAt);
+                    renderState.disable(GL_TEXTURE_2D);
                 } else {
-                    glDisable(GL_TEXTURE_2D);
+                    renderState.disable(GL_TEXTURE_2D);
                     glColor3f(0.3f, 0.3f, 0.3f);  // Gray fallback
-                    creeperModel->render();
+                    creeperModel->render(creeperAt);
                 }
                 
                 // Draw creeper face - model coords: X=side(±33), Y=up(-260 to 115), Z=front/back(±160)
                 // Head is at Y=50 to 115, face should be on +Z side (around Z=34)
                 GLfloat blackDiffuse[] = { 0.0f, 0.0f, 0.0f, 1.0f };
                 GLfloat blackAmbient[] = { 0.0f, 0.0f, 0.0f, 1.0f };
-                glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, blackDiffuse);
-                glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, blackAmbient);
+                renderState.material(GL_DIFFUSE, blackDiffuse);
+                renderState.material(GL_AMBIENT, blackAmbient);
                 glColor3f(0.0f, 0.0f, 0.0f);
                 
                 // Left eye (square) - on head front face
                 glPushMatrix();
                 glTranslatef(-12.0f, 90.0f, 34.0f);  // X=left, Y=up on head, Z=front
                 glScalef(8.0f, 12.0f, 2.0f);
-                glutSolidCube(1.0f);
+                solidCube(1.0f);
                 glPopMatrix();
                 
                 // Right eye (square)
                 glPushMatrix();
                 glTranslatef(12.0f, 90.0f, 34.0f);
                 glScalef(8.0f, 12.0f, 2.0f);
-                glutSolidCube(1.0f);
+                solidCube(1.0f);
                 glPopMatrix();
                 
                 // Mouth (sad frown shape - 3 parts)
                 glPushMatrix();
                 glTranslatef(0.0f, 65.0f, 34.0f);
                 glScalef(16.0f, 5.0f, 2.0f);
-                glutSolidCube(1.0f);
+                solidCube(1.0f);
                 glPopMatrix();
                 
                 // Left corner of frown
                 glPushMatrix();
                 glTranslatef(-12.0f, 72.0f, 34.0f);
                 glScalef(5.0f, 5.0f, 2.0f);
-                glutSolidCube(1.0f);
+                solidCube(1.0f);
                 glPopMatrix();
                 
                 // Right corner of frown
                 glPushMatrix();
                 glTranslatef(12.0f, 72.0f, 34.0f);
                 glScalef(5.0f, 5.0f, 2.0f);
-                glutSolidCube(1.0f);
+                solidCube(1.0f);
                 glPopMatrix();
                 
                 glPopMatrix();
@@ -2535,39 +8810,44 @@ public:
         }
         
         // Render the flock (birds flying high in the sky) - 3x bigger
+        section.next("flock");
         if (flockModel) {
             glPushMatrix();
-            glEnable(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D, flockTexture);
             
             // Flock circles high in the sky
-            glTranslatef(flockPosition.x, flockPosition.y, flockPosition.z);
-            glRotatef(flockRotation, 0.0f, 1.0f, 0.0f);
+            Vector3 flockAt = blendPosition(previousFlockPosition, flockPosition, view.alpha);
+            glTranslatef(flockAt.x, flockAt.y, flockAt.z);
+            glRotatef(blendDegrees(previousFlockRotation, flockRotation, view.alpha), 0.0f, 1.0f, 0.0f);
             glRotatef(-90.0f, 1.0f, 0.0f, 0.0f);
             glScalef(0.045f, 0.045f, 0.045f);  // 3x bigger (0.015 * 3 = 0.045)
             
-            GLfloat birdDiffuse[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-            GLfloat birdAmbient[] = { 0.7f, 0.7f, 0.7f, 1.0f };
-            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, birdDiffuse);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, birdAmbient);
-            glColor3f(1.0f, 1.0f, 1.0f);
-            
-            flockModel->render();
-            glDisable(GL_TEXTURE_2D);
+            // The file's material: white, textured with swallowt.jpg
+            flockModel->renderWithMaterials();
             glPopMatrix();
         }
         
         // Draw the treasure chest
+        section.next("chest");
         drawChest();
         
         // Draw the portal
+        section.next("portal");
         drawPortal();
+        section.end();
         
         // Draw scene label
         drawSceneLabel();
     }
     
     void update(float deltaTime) override {
+        // Frames are drawn from here toward the state this step leaves
+        pig.saveStep();
+        wolf.saveStep();
+        cow.saveStep();
+        for (CreeperData& creeper : creepers) creeper.agent.saveStep();
+        previousFlockPosition = flockPosition;
+        previousFlockRotation = flockRotation;
+        
         // Update portal animation
         portalTime += deltaTime;
         
@@ -2585,7 +8865,7 @@ public:
         
         // Update flock - circle around the scene
         flockTime += deltaTime;
-        flockRotation += 0.5f;  // Rotate slowly
+        flockRotation += FLOCK_TURN_RATE * deltaTime;  // Rotate slowly
         if (flockRotation > 360.0f) flockRotation -= 360.0f;
         
         // Flock flies in a circle high in the sky
@@ -2600,6 +8880,11 @@ public:
         // Update cow - wander around randomly
         updateCowAI(deltaTime);
         
+        // Keep the mob layer of the collision grid in step
+        mobObstacles.move(pigCollider, pig.position.x, pig.position.z);
+        mobObstacles.move(wolfCollider, wolf.position.x, wolf.position.z);
+        mobObstacles.move(cowCollider, cow.position.x, cow.position.z);
+        
         // Update Creeper - wander around randomly
         updateCreeperAI(deltaTime);
         
@@ -2614,38 +8899,72 @@ public:
         }
     }
     
+    void hashState(StateHash& hash) const override {
+        const KinematicAgent* mobs[] = { &pig, &wolf, &cow };
+        for (const KinematicAgent* mob : mobs) {
+            hash.add(mob->position);
+            hash.add(mob->heading);
+        }
+        hash.add(pigTargetPosition);
+        hash.add(wolfTargetPosition);
+        hash.add(cowTargetPosition);
+        hash.add(pigWanderTime);
+        hash.add(wolfWanderTime);
+        hash.add(cowWanderTime);
+        hash.add(pigWanderInterval);
+        hash.add(wolfWanderInterval);
+        hash.add(cowWanderInterval);
+        for (const CreeperData& creeper : creepers) {
+            hash.add(creeper.agent.position);
+            hash.add(creeper.agent.heading);
+            hash.add(creeper.targetPosition);
+            hash.add(creeper.wanderTime);
+            hash.add(creeper.wanderInterval);
+            hash.add(creeper.alive);
+            hash.add(creeper.chasing);
+            hash.add(creeper.fuseTime);
+            hash.add(creeper.explosionTime);
+        }
+        hash.add(flockPosition);
+        hash.add(sunTime);
+    }
+    
     void cleanup() override {
         std::cout << "Cleaning up Scene 1" << std::endl;
         minecraftTrees.clear();
         boulders.clear();
-        if (wallTexture) {
-            glDeleteTextures(1, &wallTexture);
-            wallTexture = 0;
+        treeBatch.clear();
+        groundCover.release();
+        for (int v = 0; v < BOULDER_VARIANTS; v++) {
+            boulderBatches[v].clear();
+            boulderMeshes[v].release();
+            if (boulderLists[v]) glDeleteLists(boulderLists[v], 1);
+            boulderLists[v] = 0;
+        }
+        staticObstacles.clear();
+        mobObstacles.clear();
+        
+        // Drop this scene's texture references; textures shared with Scene 2
+        // or a model stay resident until their last user releases them
+        GLuint* textures[] = { &wallTexture, &wolfTexture, &cowTexture, &creeperTexture, &grassTexture,
+                               &skyTexture, &steveFaceTexture, &portalFrameTexture, &stoneTexture };
+        for (GLuint* texture : textures) {
+            releaseTexture(*texture);
+            *texture = 0;
         }
+        
         if (wolfModel) {
             delete wolfModel;
             wolfModel = nullptr;
         }
-        if (wolfTexture) {
-            glDeleteTextures(1, &wolfTexture);
-            wolfTexture = 0;
-        }
         if (cowModel) {
             delete cowModel;
             cowModel = nullptr;
         }
-        if (cowTexture) {
-            glDeleteTextures(1, &cowTexture);
-            cowTexture = 0;
-        }
         if (creeperModel) {
             delete creeperModel;
             creeperModel = nullptr;
         }
-        if (creeperTexture) {
-            glDeleteTextures(1, &creeperTexture);
-            creeperTexture = 0;
-        }
         if (flockModel) {
             delete flockModel;
             flockModel = nullptr;
@@ -2704,6 +9023,39 @@ private:
             minecraftTrees.push_back(tree);
         }
         
+        // --forest-trees: scatter more trees across the floor, clear of the
+        // spawn point, chest, portal and walls (own generator, so the layout
+        // generators keep their sequences)
+        std::mt19937 forestRng(2024);
+        std::uniform_real_distribution<float> coordinate(-46.0f, 46.0f);
+        std::uniform_real_distribution<float> scale(0.007f, 0.014f);
+        auto keepClear = [](float x, float z) {
+            const float clearings[][3] = {
+                { 0.0f, 0.0f, 6.0f },
+                { chestPosition.x, chestPosition.z, 4.0f },
+                { portalPosition.x, portalPosition.z, 6.0f },
+            };
+            for (const auto& c : clearings) {
+                if ((x - c[0]) * (x - c[0]) + (z - c[1]) * (z - c[1]) < c[2] * c[2]) return true;
+            }
+            return false;
+        };
+        for (int i = 0; i < extraForestTrees; i++) {
+            MinecraftTreeInstance tree;
+            do {
+                tree.x = coordinate(forestRng);
+                tree.z = coordinate(forestRng);
+            } while (keepClear(tree.x, tree.z));
+            tree.scale = scale(forestRng);
+            tree.yOffset = baseVertexY * tree.scale;
+            minecraftTrees.push_back(tree);
+        }
+        
+        treeBatch.clear();
+        for (const auto& tree : minecraftTrees) {
+            treeBatch.add(tree.x, tree.yOffset, tree.z, 0.0f, tree.scale, tree.scale, tree.scale);
+        }
+        
         std::cout << "Generated " << minecraftTrees.size() << " Minecraft trees for the forest" << std::endl;
     }
     
@@ -2713,11 +9065,11 @@ private:
         const float wallHeight = 5.0f;       // Height of walls
         const float wallLength = 100.0f;     // Full length of wall (2 * borderDistance)
         
-        glEnable(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, wallTexture);
+        renderState.enable(GL_TEXTURE_2D);
+        renderState.bindTexture(wallTexture);
         
         // Disable back-face culling so walls are visible from both sides
-        glDisable(GL_CULL_FACE);
+        renderState.disable(GL_CULL_FACE);
         
         glColor3f(1.0f, 1.0f, 1.0f);  // White to show true texture colors
         
@@ -2757,13 +9109,22 @@ private:
         
         glEnd();
         
-        glEnable(GL_CULL_FACE);  // Re-enable culling
-        glDisable(GL_TEXTURE_2D);
+        renderState.enable(GL_CULL_FACE);  // Re-enable culling
+        renderState.disable(GL_TEXTURE_2D);
     }
     
     void generateBoulders() {
         boulders.clear();
         
+        for (int v = 0; v < BOULDER_VARIANTS; v++) {
+            boulderBatches[v].clear();
+            buildRockMesh(boulderMeshes[v], 7001 + v, 16, 12);
+            if (!boulderLists[v]) boulderLists[v] = glGenLists(1);
+            renderState.beginList(boulderLists[v]);
+            boulderMeshes[v].drawImmediate();
+            renderState.endList();
+        }
+        
         // Create boulder positions scattered around the scene
         // Avoid the center area where player spawns
         float boulderData[][4] = {
@@ -2794,20 +9155,23 @@ private:
             b.scale = boulderData[i][2];
             b.y = b.scale * 0.3f;  // Slightly sink into ground based on size
             b.rotationY = boulderData[i][3];
+            b.variant = i % BOULDER_VARIANTS;
             boulders.push_back(b);
+            boulderBatches[b.variant].add(b.x, b.y, b.z, b.rotationY, b.scale, b.scale * 0.7f, b.scale);  // Flatten slightly
         }
         
         std::cout << "Generated " << boulders.size() << " boulders" << std::endl;
         
         // Generate flowers scattered across the forest floor
-        srand(11111);  // Fixed seed for consistent flower placement
+        groundCover.build();
+        SimRandom flowerRandom(11111);  // Fixed seed for consistent flower placement
         for (int i = 0; i < 80; i++) {  // 80 flowers
             Flower f;
-            f.x = -45.0f + (rand() % 9000) / 100.0f;  // -45 to 45
-            f.z = -45.0f + (rand() % 9000) / 100.0f;  // -45 to 45
-            f.scale = 0.15f + (rand() % 15) / 100.0f;  // 0.15 to 0.30
-            f.colorType = rand() % 6;  // 0-5 for different colors
-            f.swayPhase = (rand() % 628) / 100.0f;  // Random phase for swaying
+            f.x = -45.0f + (flowerRandom.next() % 9000) / 100.0f;  // -45 to 45
+            f.z = -45.0f + (flowerRandom.next() % 9000) / 100.0f;  // -45 to 45
+            f.scale = 0.15f + (flowerRandom.next() % 15) / 100.0f;  // 0.15 to 0.30
+            f.colorType = flowerRandom.next() % 6;  // 0-5 for different colors
+            f.swayPhase = (flowerRandom.next() % 628) / 100.0f;  // Random phase for swaying
             
             // Don't place flowers too close to center (player spawn) or trees
             float distFromCenter = sqrt(f.x * f.x + f.z * f.z);
@@ -2825,10 +9189,41 @@ private:
             }
             if (tooCloseToTree) continue;
             
-            flowers.push_back(f);
+            groundCover.addFlower(f.x, f.z, f.scale, f.colorType, f.swayPhase);
+        }
+        
+        std::cout << "Generated " << groundCover.flowerCount() << " flowers" << std::endl;
+    }
+    
+    // Grass tufts, plus --ground-cover extra flowers, kept off the spawn
+    // point and out of trees and boulders (needs the collision grid)
+    void generateGroundCover() {
+        std::mt19937 rng(31337);
+        std::uniform_real_distribution<float> coordinate(-48.0f, 48.0f);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        auto blocked = [this](float x, float z) {
+            return x * x + z * z < 3.0f * 3.0f ||
+                   staticObstacles.anyOverlap(x, z, 0.6f, COLLIDER_TREE) ||
+                   staticObstacles.anyOverlap(x, z, 0.3f, COLLIDER_BOULDER);
+        };
+        
+        for (int i = 0; i < GRASS_TUFTS + extraGroundCover; i++) {
+            float x = coordinate(rng), z = coordinate(rng);
+            float scale = 0.6f + 0.6f * unit(rng);
+            float rotation = 360.0f * unit(rng);
+            float phase = 2.0f * (float)M_PI * unit(rng);
+            if (!blocked(x, z)) groundCover.addTuft(x, z, scale, rotation, phase);
+        }
+        for (int i = 0; i < extraGroundCover; i++) {
+            float x = coordinate(rng), z = coordinate(rng);
+            float scale = 0.15f + 0.15f * unit(rng);
+            int colorType = (int)(unit(rng) * GroundCover::FLOWER_COLORS);
+            float phase = 2.0f * (float)M_PI * unit(rng);
+            if (!blocked(x, z)) groundCover.addFlower(x, z, scale, colorType, phase);
         }
         
-        std::cout << "Generated " << flowers.size() << " flowers" << std::endl;
+        std::cout << "Ground cover: " << groundCover.flowerCount() << " flowers, "
+                  << groundCover.tuftCount() << " grass tufts" << std::endl;
     }
     
     void renderExplosion(const Vector3& explosionPosition, float explosionTime) {
@@ -2836,9 +9231,9 @@ private:
         glPushMatrix();
         glTranslatef(explosionPosition.x, 1.0f, explosionPosition.z);
         
-        glDisable(GL_LIGHTING);
-        glDisable(GL_TEXTURE_2D);
-        glEnable(GL_BLEND);
+        renderState.disable(GL_LIGHTING);
+        renderState.disable(GL_TEXTURE_2D);
+        renderState.enable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE);  // Additive blending for fire effect
         
         // Explosion parameters based on time
@@ -2938,158 +9333,74 @@ private:
             }
         }
         
-        glDisable(GL_BLEND);
-        glEnable(GL_LIGHTING);
+        renderState.disable(GL_BLEND);
+        renderState.enable(GL_LIGHTING);
         glPopMatrix();
     }
     
     void renderBoulders() {
         if (stoneTexture == 0) return;
         
-        glEnable(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, stoneTexture);
+        renderState.enable(GL_TEXTURE_2D);
+        renderState.bindTexture(stoneTexture);
         
         // Set stone material
         GLfloat stoneDiffuse[] = { 0.8f, 0.8f, 0.8f, 1.0f };
         GLfloat stoneAmbient[] = { 0.4f, 0.4f, 0.4f, 1.0f };
         GLfloat stoneSpecular[] = { 0.2f, 0.2f, 0.2f, 1.0f };
-        glMaterialfv(GL_FRONT, GL_DIFFUSE, stoneDiffuse);
-        glMaterialfv(GL_FRONT, GL_AMBIENT, stoneAmbient);
-        glMaterialfv(GL_FRONT, GL_SPECULAR, stoneSpecular);
-        glMaterialf(GL_FRONT, GL_SHININESS, 10.0f);
+        renderState.material(GL_DIFFUSE, stoneDiffuse);
+        renderState.material(GL_AMBIENT, stoneAmbient);
+        renderState.material(GL_SPECULAR, stoneSpecular);
+        renderState.shininess(10.0f);
         glColor3f(0.8f, 0.8f, 0.8f);
         
-        for (const auto& boulder : boulders) {
-            glPushMatrix();
-            glTranslatef(boulder.x, boulder.y, boulder.z);
-            glRotatef(boulder.rotationY, 0.0f, 1.0f, 0.0f);
-            glScalef(boulder.scale, boulder.scale * 0.7f, boulder.scale);  // Flatten slightly
-            
-            // Draw textured sphere as boulder
-            GLUquadric* quad = gluNewQuadric();
-            gluQuadricTexture(quad, GL_TRUE);
-            gluQuadricNormals(quad, GLU_SMOOTH);
-            gluSphere(quad, 1.0f, 16, 12);
-            gluDeleteQuadric(quad);
-            
-            glPopMatrix();
+        for (int v = 0; v < BOULDER_VARIANTS; v++) {
+            const GpuMesh& mesh = boulderMeshes[v];
+            GLuint list = boulderLists[v];
+            boulderBatches[v].draw(mesh, std::vector<MaterialRange>(), [](int) {}, [&mesh, list](const LodPlacement&) {
+                if (meshRenderPath != RENDER_PATH_IMMEDIATE && list) {
+                    renderState.callList(list);
+                } else {
+                    mesh.drawImmediate();
+                }
+            });
         }
         
-        glDisable(GL_TEXTURE_2D);
-    }
-    
-    void renderFlowers() {
-        glDisable(GL_TEXTURE_2D);
-        glEnable(GL_LIGHTING);
-        
-        for (const auto& flower : flowers) {
-            glPushMatrix();
-            
-            // Slight swaying animation
-            float sway = sin(animationTime * 2.0f + flower.swayPhase) * 3.0f;
-            
-            glTranslatef(flower.x, 0.0f, flower.z);
-            glRotatef(sway, 0.0f, 0.0f, 1.0f);
-            glScalef(flower.scale, flower.scale, flower.scale);
-            
-            // Draw stem (green)
-            GLfloat stemDiffuse[] = { 0.2f, 0.6f, 0.1f, 1.0f };
-            GLfloat stemAmbient[] = { 0.1f, 0.3f, 0.05f, 1.0f };
-            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, stemDiffuse);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, stemAmbient);
-            glColor3f(0.2f, 0.6f, 0.1f);
-            
-            glPushMatrix();
-            glTranslatef(0.0f, 0.5f, 0.0f);
-            glScalef(0.1f, 1.0f, 0.1f);
-            glutSolidCube(1.0f);
-            glPopMatrix();
-            
-            // Draw leaves on stem
-            glPushMatrix();
-            glTranslatef(0.08f, 0.3f, 0.0f);
-            glRotatef(30.0f, 0.0f, 0.0f, 1.0f);
-            glScalef(0.3f, 0.15f, 0.08f);
-            glutSolidCube(1.0f);
-            glPopMatrix();
-            
-            glPushMatrix();
-            glTranslatef(-0.08f, 0.5f, 0.0f);
-            glRotatef(-30.0f, 0.0f, 0.0f, 1.0f);
-            glScalef(0.3f, 0.15f, 0.08f);
-            glutSolidCube(1.0f);
-            glPopMatrix();
-            
-            // Draw flower petals based on color type
-            float r, g, b;
-            switch (flower.colorType) {
-                case 0: r = 1.0f; g = 0.2f; b = 0.2f; break;  // Red
-                case 1: r = 1.0f; g = 0.9f; b = 0.2f; break;  // Yellow
-                case 2: r = 0.3f; g = 0.4f; b = 0.9f; break;  // Blue
-                case 3: r = 1.0f; g = 1.0f; b = 1.0f; break;  // White
-                case 4: r = 1.0f; g = 0.5f; b = 0.7f; break;  // Pink
-                default: r = 0.7f; g = 0.3f; b = 0.9f; break; // Purple
-            }
-            
-            GLfloat petalDiffuse[] = { r, g, b, 1.0f };
-            GLfloat petalAmbient[] = { r * 0.4f, g * 0.4f, b * 0.4f, 1.0f };
-            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, petalDiffuse);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, petalAmbient);
-            glColor3f(r, g, b);
-            
-            // Draw 5 petals around center
-            for (int p = 0; p < 5; p++) {
-                glPushMatrix();
-                glTranslatef(0.0f, 1.0f, 0.0f);
-                glRotatef(p * 72.0f, 0.0f, 1.0f, 0.0f);
-                glTranslatef(0.2f, 0.0f, 0.0f);
-                glScalef(0.25f, 0.08f, 0.15f);
-                glutSolidSphere(1.0f, 6, 4);
-                glPopMatrix();
-            }
-            
-            // Draw flower center (yellow/orange)
-            GLfloat centerDiffuse[] = { 1.0f, 0.8f, 0.2f, 1.0f };
-            GLfloat centerAmbient[] = { 0.5f, 0.4f, 0.1f, 1.0f };
-            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, centerDiffuse);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, centerAmbient);
-            glColor3f(1.0f, 0.8f, 0.2f);
-            
-            glPushMatrix();
-            glTranslatef(0.0f, 1.0f, 0.0f);
-            glutSolidSphere(0.12f, 8, 6);
-            glPopMatrix();
-            
-            glPopMatrix();
-        }
+        renderState.disable(GL_TEXTURE_2D);
     }
     
-    void drawSky() {
-        // Save current matrix state
-        glPushAttrib(GL_ALL_ATTRIB_BITS);
+    void drawSky(const RenderView& view) {
+        // Save the state the sky changes (rather than glPushAttrib of every
+        // attribute group each frame)
+        bool lighting = renderState.isEnabled(GL_LIGHTING);
+        bool depthTest = renderState.isEnabled(GL_DEPTH_TEST);
+        bool cullFace = renderState.isEnabled(GL_CULL_FACE);
+        bool blend = renderState.isEnabled(GL_BLEND);
+        bool texture = renderState.isEnabled(GL_TEXTURE_2D);
         glPushMatrix();
         
         // Disable everything that could interfere
-        glDisable(GL_LIGHTING);
-        glDisable(GL_DEPTH_TEST);
+        renderState.disable(GL_LIGHTING);
+        renderState.disable(GL_DEPTH_TEST);
         glDepthMask(GL_FALSE);
-        glDisable(GL_CULL_FACE);
-        glDisable(GL_BLEND);
+        renderState.disable(GL_CULL_FACE);
+        renderState.disable(GL_BLEND);
         
         // Move skybox to player position so player is always at center
-        glTranslatef(player.position.x, player.position.y, player.position.z);
+        Vector3 center = player.renderPosition(view.alpha);
+        glTranslatef(center.x, center.y, center.z);
         
         // Size of the skybox cube (half-extent) - make it very large
         float s = 400.0f;
         
         // Always draw the textured skybox if texture exists, otherwise use color
         if (skyTexture != 0) {
-            glEnable(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D, skyTexture);
+            renderState.enable(GL_TEXTURE_2D);
+            renderState.bindTexture(skyTexture);
             glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
             glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
         } else {
-            glDisable(GL_TEXTURE_2D);
+            renderState.disable(GL_TEXTURE_2D);
             glColor3f(0.5f, 0.7f, 1.0f);  // Light blue fallback
         }
         
@@ -3141,10 +9452,10 @@ private:
         glTexCoord2f(0.0f, 1.0f); glVertex3f(-s, -s,  s);
         glEnd();
         
-        glDisable(GL_TEXTURE_2D);
+        renderState.disable(GL_TEXTURE_2D);
         
         // Draw sun on the skybox (using dynamic position)
-        glEnable(GL_BLEND);
+        renderState.enable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
         
         // Sun glow (halo effect)
@@ -3167,11 +9478,17 @@ private:
         glVertex3f(sunX - sun, sunY + sun, -s + 2.0f);
         glEnd();
         
-        glDisable(GL_BLEND);
+        renderState.disable(GL_BLEND);
         
         // Restore state
         glPopMatrix();
-        glPopAttrib();
+        glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+        glDepthMask(GL_TRUE);
+        if (lighting) renderState.enable(GL_LIGHTING);
+        if (depthTest) renderState.enable(GL_DEPTH_TEST);
+        if (cullFace) renderState.enable(GL_CULL_FACE);
+        if (blend) renderState.enable(GL_BLEND);
+        if (texture) renderState.enable(GL_TEXTURE_2D);
     }
     
     void drawChest() {
@@ -3181,7 +9498,7 @@ private:
         // Rotate slightly for visual interest
         glRotatef(25.0f, 0.0f, 1.0f, 0.0f);
         
-        glDisable(GL_TEXTURE_2D);
+        renderState.disable(GL_TEXTURE_2D);
         
         // Chest dimensions
         float chestWidth = 1.2f;
@@ -3192,23 +9509,23 @@ private:
         GLfloat woodDiffuse[] = { 0.55f, 0.35f, 0.15f, 1.0f };
         GLfloat woodAmbient[] = { 0.25f, 0.15f, 0.05f, 1.0f };
         GLfloat woodSpecular[] = { 0.2f, 0.15f, 0.1f, 1.0f };
-        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, woodDiffuse);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, woodAmbient);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, woodSpecular);
-        glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 10.0f);
+        renderState.material(GL_DIFFUSE, woodDiffuse);
+        renderState.material(GL_AMBIENT, woodAmbient);
+        renderState.material(GL_SPECULAR, woodSpecular);
+        renderState.shininess(10.0f);
         glColor3f(0.55f, 0.35f, 0.15f);
         
         glPushMatrix();
         glTranslatef(0.0f, chestHeight * 0.4f, 0.0f);
         glScalef(chestWidth, chestHeight * 0.8f, chestDepth);
-        glutSolidCube(1.0f);
+        solidCube(1.0f);
         glPopMatrix();
         
         // Lid - slightly different shade if opened
         if (chestOpened) {
             // Open lid - rotated back
             GLfloat openDiffuse[] = { 0.45f, 0.28f, 0.12f, 1.0f };
-            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, openDiffuse);
+            renderState.material(GL_DIFFUSE, openDiffuse);
             glColor3f(0.45f, 0.28f, 0.12f);
             
             glPushMatrix();
@@ -3216,30 +9533,30 @@ private:
             glRotatef(-110.0f, 1.0f, 0.0f, 0.0f);  // Lid open
             glTranslatef(0.0f, 0.0f, chestDepth * 0.2f);
             glScalef(chestWidth * 1.02f, 0.15f, chestDepth);
-            glutSolidCube(1.0f);
+            solidCube(1.0f);
             glPopMatrix();
             
             // Gold inside the chest (visible when open)
             GLfloat goldDiffuse[] = { 1.0f, 0.84f, 0.0f, 1.0f };
             GLfloat goldAmbient[] = { 0.4f, 0.35f, 0.0f, 1.0f };
             GLfloat goldSpecular[] = { 1.0f, 0.95f, 0.7f, 1.0f };
-            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, goldDiffuse);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, goldAmbient);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, goldSpecular);
-            glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 80.0f);
+            renderState.material(GL_DIFFUSE, goldDiffuse);
+            renderState.material(GL_AMBIENT, goldAmbient);
+            renderState.material(GL_SPECULAR, goldSpecular);
+            renderState.shininess(80.0f);
             glColor3f(1.0f, 0.84f, 0.0f);
             
             glPushMatrix();
             glTranslatef(0.0f, chestHeight * 0.5f, 0.0f);
             glScalef(chestWidth * 0.7f, chestHeight * 0.3f, chestDepth * 0.6f);
-            glutSolidCube(1.0f);
+            solidCube(1.0f);
             glPopMatrix();
         } else {
             // Closed lid
             glPushMatrix();
             glTranslatef(0.0f, chestHeight * 0.85f, 0.0f);
             glScalef(chestWidth * 1.02f, 0.15f, chestDepth * 1.02f);
-            glutSolidCube(1.0f);
+            solidCube(1.0f);
             glPopMatrix();
         }
         
@@ -3247,24 +9564,24 @@ private:
         GLfloat metalDiffuse[] = { 0.83f, 0.69f, 0.22f, 1.0f };
         GLfloat metalAmbient[] = { 0.4f, 0.33f, 0.1f, 1.0f };
         GLfloat metalSpecular[] = { 1.0f, 0.9f, 0.5f, 1.0f };
-        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, metalDiffuse);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, metalAmbient);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, metalSpecular);
-        glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 60.0f);
+        renderState.material(GL_DIFFUSE, metalDiffuse);
+        renderState.material(GL_AMBIENT, metalAmbient);
+        renderState.material(GL_SPECULAR, metalSpecular);
+        renderState.shininess(60.0f);
         glColor3f(0.83f, 0.69f, 0.22f);
         
         // Front band
         glPushMatrix();
         glTranslatef(0.0f, chestHeight * 0.4f, chestDepth * 0.51f);
         glScalef(chestWidth * 1.05f, 0.08f, 0.05f);
-        glutSolidCube(1.0f);
+        solidCube(1.0f);
         glPopMatrix();
         
         // Lock (if not opened)
         if (!chestOpened) {
             glPushMatrix();
             glTranslatef(0.0f, chestHeight * 0.75f, chestDepth * 0.52f);
-            glutSolidSphere(0.1f, 8, 8);
+            solidSphere(0.1f, 8, 8);
             glPopMatrix();
         }
         
@@ -3287,90 +9604,48 @@ private:
         pigWanderTime += deltaTime;
         
         // Pick a new random target every 5-7 seconds
-        if (pigWanderTime > 5.0f + (rand() % 20) / 10.0f) {
+        if (pigWanderTime > pigWanderInterval) {
             pigWanderTime = 0.0f;
+            pigWanderInterval = 5.0f + (mobRandom.next() % 20) / 10.0f;
             // Pick random position within bounds
-            pigTargetPosition.x = -20.0f + (rand() % 400) / 10.0f;
-            pigTargetPosition.z = -20.0f + (rand() % 400) / 10.0f;
+            pigTargetPosition.x = -20.0f + (mobRandom.next() % 400) / 10.0f;
+            pigTargetPosition.z = -20.0f + (mobRandom.next() % 400) / 10.0f;
         }
         
-        // Move towards random target
-        float dx = pigTargetPosition.x - pigPosition.x;
-        float dz = pigTargetPosition.z - pigPosition.z;
-        float distance = sqrt(dx * dx + dz * dz);
-        
-        if (distance > 0.5f) {
-            // Normalize direction
-            float dirX = dx / distance;
-            float dirZ = dz / distance;
-            
-            // Move pig towards target
-            pigPosition.x += dirX * pigMoveSpeed;
-            pigPosition.z += dirZ * pigMoveSpeed;
-            
-            // Calculate rotation to face movement direction
-            pigRotation = atan2(dx, -dz) * 180.0f / M_PI;
-        }
+        // Walk towards target, turning to face the way it walks
+        pig.seek(pigTargetPosition, 0.5f, deltaTime);
     }
     
     void updateWolfAI(float deltaTime) {
         wolfWanderTime += deltaTime;
         
         // Pick a new random target every 3-5 seconds
-        if (wolfWanderTime > 3.0f + (rand() % 20) / 10.0f) {
+        if (wolfWanderTime > wolfWanderInterval) {
             wolfWanderTime = 0.0f;
+            wolfWanderInterval = 3.0f + (mobRandom.next() % 20) / 10.0f;
             // Pick random position within bounds (avoid edges)
-            wolfTargetPosition.x = -15.0f + (rand() % 300) / 10.0f;
-            wolfTargetPosition.z = -15.0f + (rand() % 300) / 10.0f;
+            wolfTargetPosition.x = -15.0f + (mobRandom.next() % 300) / 10.0f;
+            wolfTargetPosition.z = -15.0f + (mobRandom.next() % 300) / 10.0f;
         }
         
-        // Move towards target
-        float dx = wolfTargetPosition.x - wolfPosition.x;
-        float dz = wolfTargetPosition.z - wolfPosition.z;
-        float distance = sqrt(dx * dx + dz * dz);
-        
-        if (distance > 0.5f) {
-            // Normalize direction
-            float dirX = dx / distance;
-            float dirZ = dz / distance;
-            
-            // Move wolf towards target
-            wolfPosition.x += dirX * wolfMoveSpeed;
-            wolfPosition.z += dirZ * wolfMoveSpeed;
-            
-            // Calculate rotation to face movement direction
-            wolfRotation = atan2(dx, -dz) * 180.0f / M_PI;
-        }
+        // Walk towards target, turning to face the way it walks
+        wolf.seek(wolfTargetPosition, 0.5f, deltaTime);
     }
     
     void updateCowAI(float deltaTime) {
         cowWanderTime += deltaTime;
         
         // Pick a new random target every 5-8 seconds (slower than wolf)
-        if (cowWanderTime > 5.0f + (rand() % 30) / 10.0f) {
+        if (cowWanderTime > cowWanderInterval) {
             cowWanderTime = 0.0f;
+            cowWanderInterval = 5.0f + (mobRandom.next() % 30) / 10.0f;
             // Pick random position within bounds (avoid edges)
-            cowTargetPosition.x = -20.0f + (rand() % 400) / 10.0f;
-            cowTargetPosition.z = -20.0f + (rand() % 400) / 10.0f;
+            cowTargetPosition.x = -20.0f + (mobRandom.next() % 400) / 10.0f;
+            cowTargetPosition.z = -20.0f + (mobRandom.next() % 400) / 10.0f;
         }
         
-        // Move towards target
-        float dx = cowTargetPosition.x - cowPosition.x;
-        float dz = cowTargetPosition.z - cowPosition.z;
-        float distance = sqrt(dx * dx + dz * dz);
-        
-        if (distance > 0.5f) {
-            // Normalize direction
-            float dirX = dx / distance;
-            float dirZ = dz / distance;
-            
-            // Move cow towards target (slower)
-            cowPosition.x += dirX * cowMoveSpeed;
-            cowPosition.z += dirZ * cowMoveSpeed;
-            
-            // Calculate rotation to face movement direction
-            cowRotation = atan2(dx, -dz) * 180.0f / M_PI;
-        }
+        // Walk towards target, turning to face the way it walks
+        cow.seek(cowTargetPosition, 0.5f, deltaTime);
     }
     
     void updateCreeperAI(float deltaTime) {
@@ -3382,8 +9657,8 @@ private:
             if (!creeper.alive) continue;
             
             // Calculate distance to player
-            float playerDx = player.position.x - creeper.position.x;
-            float playerDz = player.position.z - creeper.position.z;
+            float playerDx = player.position.x - creeper.agent.position.x;
+            float playerDz = player.position.z - creeper.agent.position.z;
             float playerDistance = sqrt(playerDx * playerDx + playerDz * playerDz);
             
             // Check if player is within detection radius
@@ -3392,21 +9667,9 @@ private:
             }
             
             if (creeper.chasing) {
-                // Chase the player!
-                float creeperChaseSpeed = 0.04f;  // Faster when chasing
-                
-                if (playerDistance > 0.1f) {
-                    // Normalize direction toward player
-                    float dirX = playerDx / playerDistance;
-                    float dirZ = playerDz / playerDistance;
-                    
-                    // Move toward player
-                    creeper.position.x += dirX * creeperChaseSpeed;
-                    creeper.position.z += dirZ * creeperChaseSpeed;
-                    
-                    // Face the player
-                    creeper.rotation = atan2(playerDx, -playerDz) * 180.0f / M_PI;
-                }
+                // Chase the player (faster than wandering)
+                creeper.agent.speed = CREEPER_CHASE_SPEED;
+                creeper.agent.seek(player.position, 0.1f, deltaTime);
                 
                 // Check if close enough to explode
                 if (playerDistance < creeperExplodeRadius) {
@@ -3415,7 +9678,7 @@ private:
                     // Explode after 1.5 seconds of being close
                     if (creeper.fuseTime >= 1.5f) {
                         // BOOM! Creeper explodes - start explosion animation
-                        creeper.explosionPosition = creeper.position;
+                        creeper.explosionPosition = creeper.agent.position;
                         creeper.exploding = true;
                         creeper.explosionTime = 0.0f;
                         creeper.alive = false;
@@ -3441,96 +9704,55 @@ private:
                 creeper.wanderTime += deltaTime;
                 
                 // Pick a new random target every 4-6 seconds
-                if (creeper.wanderTime > 4.0f + (rand() % 20) / 10.0f) {
+                if (creeper.wanderTime > creeper.wanderInterval) {
                     creeper.wanderTime = 0.0f;
-                    creeper.targetPosition.x = -20.0f + (rand() % 400) / 10.0f;
-                    creeper.targetPosition.z = -20.0f + (rand() % 400) / 10.0f;
+                    creeper.wanderInterval = 4.0f + (mobRandom.next() % 20) / 10.0f;
+                    creeper.targetPosition.x = -20.0f + (mobRandom.next() % 400) / 10.0f;
+                    creeper.targetPosition.z = -20.0f + (mobRandom.next() % 400) / 10.0f;
                 }
                 
                 // Move towards random target
-                float dx = creeper.targetPosition.x - creeper.position.x;
-                float dz = creeper.targetPosition.z - creeper.position.z;
-                float distance = sqrt(dx * dx + dz * dz);
-                
-                if (distance > 0.5f) {
-                    float dirX = dx / distance;
-                    float dirZ = dz / distance;
-                    
-                    float creeperMoveSpeed = 0.02f;
-                    creeper.position.x += dirX * creeperMoveSpeed;
-                    creeper.position.z += dirZ * creeperMoveSpeed;
-                    
-                    creeper.rotation = atan2(dx, -dz) * 180.0f / M_PI;
-                }
+                creeper.agent.speed = CREEPER_WANDER_SPEED;
+                creeper.agent.seek(creeper.targetPosition, 0.5f, deltaTime);
             }
         }
     }
     
 public:
-    // Check if a position collides with scene objects
-    bool checkSceneCollision(float x, float z, float radius) {
-        // Check collision with trees
-        for (const auto& tree : minecraftTrees) {
-            float dx = x - tree.x;
-            float dz = z - tree.z;
-            float dist = sqrt(dx * dx + dz * dz);
-            float treeRadius = 1.0f;  // Tree trunk radius
-            if (dist < radius + treeRadius) return true;
-        }
-        
-        // Check collision with border walls (at floor edge)
-        float borderLimit = 49.0f;  // At the floor edge (50 - player radius)
-        if (fabs(x) > borderLimit || fabs(z) > borderLimit) return true;
-        
-        // Check collision with boulders
-        for (const auto& boulder : boulders) {
-            float dx = x - boulder.x;
-            float dz = z - boulder.z;
-            float dist = sqrt(dx * dx + dz * dz);
-            float boulderRadius = boulder.scale * 0.8f;
-            if (dist < radius + boulderRadius) return true;
-        }
-        
-        // Check collision with pig
-        {
-            float dx = x - pigPosition.x;
-            float dz = z - pigPosition.z;
-            float dist = sqrt(dx * dx + dz * dz);
-            if (dist < radius + 1.5f) return true;  // Pig collision radius
-        }
-        
-        // Check collision with wolf
-        {
-            float dx = x - wolfPosition.x;
-            float dz = z - wolfPosition.z;
-            float dist = sqrt(dx * dx + dz * dz);
-            if (dist < radius + 0.5f) return true;  // Wolf collision radius
+    // Everything a circle at (x, z) touches: border walls, trees, boulders
+    // and the pig, wolf and cow, all blocking
+    void queryCollision(float x, float z, float radius, CollisionResult& result) const override {
+        // Border walls at the floor edge (50 - player radius)
+        float borderLimit = 49.0f;
+        result.addRoomWalls(x, z, borderLimit, borderLimit);
+        
+        auto addObstacle = [&](const SpatialHashGrid::Entry& entry) {
+            result.addCircle((ColliderTag)entry.tag, entry.index, true, x, z, radius, entry.x, entry.z, entry.halfX);
+        };
+        staticObstacles.queryCircle(x, z, radius, addObstacle);
+        mobObstacles.queryCircle(x, z, radius, addObstacle);
+    }
+    
+private:
+    // Hash trees and boulders into the static layer and the mobs into the
+    // dynamic one. Collision radii: trunk 1.0, boulder 0.8 x scale,
+    // pig 1.5, wolf 0.5, cow 1.0.
+    void buildCollisionGrid() {
+        staticObstacles.clear();
+        for (size_t i = 0; i < minecraftTrees.size(); i++) {
+            staticObstacles.addCircle(minecraftTrees[i].x, minecraftTrees[i].z, 1.0f, COLLIDER_TREE, (int)i);
         }
-        
-        // Check collision with cow
-        {
-            float dx = x - cowPosition.x;
-            float dz = z - cowPosition.z;
-            float dist = sqrt(dx * dx + dz * dz);
-            if (dist < radius + 1.0f) return true;  // Cow collision radius
+        for (size_t i = 0; i < boulders.size(); i++) {
+            staticObstacles.addCircle(boulders[i].x, boulders[i].z, boulders[i].scale * 0.8f, COLLIDER_BOULDER, (int)i);
         }
         
-        return false;
+        mobObstacles.clear();
+        pigCollider = mobObstacles.addCircle(pig.position.x, pig.position.z, 1.5f, COLLIDER_MOB, 0);
+        wolfCollider = mobObstacles.addCircle(wolf.position.x, wolf.position.z, 0.5f, COLLIDER_MOB, 1);
+        cowCollider = mobObstacles.addCircle(cow.position.x, cow.position.z, 1.0f, COLLIDER_MOB, 2);
     }
 };
 
-// Static collision check function for Scene1
-bool scene1CollisionCheck(float x, float z, float radius) {
-    if (scene1Instance) {
-        return scene1Instance->checkSceneCollision(x, z, radius);
-    }
-    return false;
-}
-
-// Forward declaration for Scene2 collision - defined after Scene2 class
-bool scene2CollisionCheck(float x, float z, float radius);
-int lastScene2CollisionType = 0;  // 0=none, 1=stone, 2=trap, 3=wall
-
 // ============================================================================
 // SCENE 2: Deep Crystal Cavern
 // ============================================================================
@@ -3575,6 +9797,7 @@ private:
         float scale;
     };
     std::vector<Stone> stones;
+    InstanceBatch stoneBatch;
     
     struct Trap {
         Vector3 position;
@@ -3582,148 +9805,113 @@ private:
         float collisionRadius;
     };
     std::vector<Trap> traps;
+    
+    // Collision broadphase for stones, traps and lava pools (built in init)
+    SpatialHashGrid obstacles;
+    
+    // Sorted submission for the room contents (see render)
+    RenderQueue renderQueue;
+    Material stoneMaterial;  // Walls, floor, ceiling and stones
+    Material lavaMaterial;   // Bright emissive pools
+    Material batMaterial;    // Matte; drawBat sets its own colours
 
 public:
     float lavaDamageTimer;  // Timer for lava damage (public for timer access)
     
     // Purple crystals (collectibles) - public for timer access
-    struct Crystal {
-        Vector3 position;
-        float rotation;
-        float bobPhase;
-        bool collected;
-    };
-    std::vector<Crystal> crystals;
-    
-    // Flying bats (harmless, atmospheric)
-    struct Bat {
-        Vector3 position;       // Current position
-        Vector3 targetPos;      // Where bat is flying to
-        float wingAngle;        // Wing flapping animation
-        float wingSpeed;        // How fast wings flap
-        float flySpeed;         // Movement speed
-        float size;             // Scale of the bat
-    };
-    std::vector<Bat> bats;
-
-    Scene2_DeepCavern() : Scene("Dark Stone Dungeon"), stoneTexture(0), lavaTexture(0), amethystTexture(0), batTexture(0), portalFrameTexture(0), lavaDamageTimer(0.0f) {
-        // Extremely dark ambient for dungeon atmosphere (old lighting)
-        ambientLight[0] = 0.02f;
-        ambientLight[1] = 0.02f;
-        ambientLight[2] = 0.02f;
-        scene2Instance = this;  // Set global instance for collision callback
-    }
-    
-    // Check if player is in a lava pool
-    bool checkLavaCollision(float x, float z, float radius) {
-        for (const auto& lava : lavaPools) {
-            float halfSize = lava.size / 2.0f;
-            if (x > lava.x - halfSize && x < lava.x + halfSize &&
-                z > lava.z - halfSize && z < lava.z + halfSize) {
-                return true;
-            }
-        }
-        return false;
-    }
-    
-    // Get lava depth at position
-    float getLavaDepth(float x, float z) {
-        for (const auto& lava : lavaPools) {
-            float halfSize = lava.size / 2.0f;
-            if (x > lava.x - halfSize && x < lava.x + halfSize &&
-                z > lava.z - halfSize && z < lava.z + halfSize) {
-                return lava.depth;
-            }
-        }
-        return 0.0f;
-    }
-    
-    // Collision check for stones only (blocks movement)
-    // Returns: 0 = no collision, 1 = stone collision, 3 = wall collision
-    int checkSceneCollision(float x, float z, float radius) {
-        float hw = roomWidth / 2.0f - radius;
-        float hd = roomDepth / 2.0f - radius;
-        
-        // Wall collision
-        if (x < -hw || x > hw || z < -hd || z > hd) {
-            return 3;
-        }
-        
-        // Stone collision (blocks movement)
-        // Large stones (scale >= 6) cannot be jumped over
-        // Smaller stones can be jumped over
-        for (const auto& stone : stones) {
-            float dx = x - stone.position.x;
-            float dz = z - stone.position.z;
-            float dist = sqrt(dx*dx + dz*dz);
-            float collisionRadius = radius + stone.scale * 0.6f;
-            
-            if (dist < collisionRadius) {
-                // Large stones always block (can't jump over)
-                if (stone.scale >= 6.0f) {
-                    return 1;
-                }
-                // Smaller stones only block when on ground
-                if (player.position.y <= player.groundLevel + 0.1f) {
-                    return 1;
-                }
-            }
-        }
-        
-        // Traps do NOT block movement - player can walk through them
-        return 0;
-    }
+    static constexpr float CRYSTAL_SPIN_RATE = 62.5f;  // Degrees per second (was 1 per frame)
+    struct Crystal {
+        KinematicAgent agent;   // Spins in place
+        float bobPhase;
+        bool collected;
+    };
+    std::vector<Crystal> crystals;
     
-    // Check if player is touching a trap (for damage, doesn't block movement)
-    bool checkTrapCollision(float x, float z, float radius) {
-        for (const auto& trap : traps) {
-            float dx = x - trap.position.x;
-            float dz = z - trap.position.z;
-            float dist = sqrt(dx*dx + dz*dz);
-            if (dist < radius + trap.collisionRadius) {
-                return true;  // Touching a trap!
+    // Flying bats (harmless, atmospheric)
+    struct Bat {
+        Vector3 position;       // Current position
+        Vector3 targetPos;      // Where bat is flying to
+        float wingAngle;        // Wing flapping animation
+        float wingSpeed;        // How fast wings flap
+        float flySpeed;         // Movement speed
+        float size;             // Scale of the bat
+        Vector3 previousPosition;  // At the start of the current step, for drawing
+        float previousWingAngle;
+    };
+    std::vector<Bat> bats;
+
+    Scene2_DeepCavern() : Scene("Dark Stone Dungeon"), stoneTexture(0), lavaTexture(0), amethystTexture(0), batTexture(0), portalFrameTexture(0), lavaDamageTimer(0.0f) {
+        // Extremely dark ambient for dungeon atmosphere (old lighting)
+        ambientLight[0] = 0.02f;
+        ambientLight[1] = 0.02f;
+        ambientLight[2] = 0.02f;
+        scene2Instance = this;  // Set global instance for collision callback
+        
+        // Diffuse is the vertex colour the surfaces were drawn with, since
+        // GL_COLOR_MATERIAL makes it both ambient and diffuse
+        const GLfloat white[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        const GLfloat stoneAmbient[4] = { 0.3f, 0.3f, 0.3f, 1.0f };
+        const GLfloat lavaAmbient[4] = { 0.8f, 0.3f, 0.1f, 1.0f };
+        const GLfloat lavaEmission[4] = { 0.6f, 0.2f, 0.0f, 1.0f };
+        const GLfloat matteSpecular[4] = { 0.1f, 0.1f, 0.1f, 1.0f };
+        Material* matte[] = { &stoneMaterial, &lavaMaterial, &batMaterial };
+        for (Material* material : matte) {
+            memcpy(material->diffuse, white, sizeof(white));
+            memcpy(material->specular, matteSpecular, sizeof(matteSpecular));
+            material->shininess = 10.0f;
+        }
+        memcpy(stoneMaterial.ambient, stoneAmbient, sizeof(stoneAmbient));
+        memcpy(lavaMaterial.ambient, lavaAmbient, sizeof(lavaAmbient));
+        memcpy(lavaMaterial.emission, lavaEmission, sizeof(lavaEmission));
+    }
+    
+    // Everything a circle at (x, z) touches. Walls and stones block
+    // (stones under scale 6 only while on the ground, so they can be jumped
+    // over); traps touch within their radius and lava pools when the centre
+    // is inside, neither blocking.
+    void queryCollision(float x, float z, float radius, CollisionResult& result) const override {
+        result.addRoomWalls(x, z, roomWidth / 2.0f - radius, roomDepth / 2.0f - radius);
+        
+        bool onGround = player.position.y <= player.groundLevel + 0.1f;
+        obstacles.queryCircle(x, z, radius, [&](const SpatialHashGrid::Entry& entry) {
+            switch (entry.tag) {
+                case COLLIDER_STONE:
+                    result.addCircle(COLLIDER_STONE, entry.index, stones[entry.index].scale >= 6.0f || onGround,
+                                     x, z, radius, entry.x, entry.z, entry.halfX);
+                    break;
+                case COLLIDER_TRAP:
+                    result.addCircle(COLLIDER_TRAP, entry.index, false, x, z, radius, entry.x, entry.z, entry.halfX);
+                    break;
+                case COLLIDER_LAVA:
+                    result.addPointInRect(COLLIDER_LAVA, entry.index, false, x, z, entry.x, entry.z, entry.halfX, entry.halfZ);
+                    break;
             }
-        }
-        return false;
+        });
     }
     
     void init() override {
         std::cout << "Initializing Scene 2: " << name << std::endl;
         
+        // Textures and models are queued on the asset loader (see Scene 1)
+        
         // Load stone texture
-        stoneTexture = loadTexture("models/minecraft_stone.jpg");
-        if (stoneTexture) {
-            std::cout << "Stone texture loaded for dungeon!" << std::endl;
-        }
+        assetLoader.requestTexture("models/minecraft_stone.jpg", &stoneTexture);
         
         // Load amethyst texture for crystals
-        amethystTexture = loadTexture("models/amethyst.jpg");
-        if (amethystTexture) {
-            std::cout << "Amethyst texture loaded for crystals!" << std::endl;
-        }
+        assetLoader.requestTexture("models/amethyst.jpg", &amethystTexture);
         
         // Load bat texture for flying bats
-        batTexture = loadTexture("models/bat.jpg");
-        if (batTexture) {
-            std::cout << "Bat texture loaded for flying bats!" << std::endl;
-        }
+        assetLoader.requestTexture("models/bat.jpg", &batTexture);
         
         // Load portal frame texture
-        portalFrameTexture = loadTexture("models/images.jpg");
-        if (portalFrameTexture) {
-            std::cout << "Portal frame texture loaded for Scene 2!" << std::endl;
-        }
+        assetLoader.requestTexture("models/images.jpg", &portalFrameTexture);
         
         // Load stones and trap models
         stonesModel = new OBJModel();
-        if (stonesModel->load("models/stones.obj")) {
-            std::cout << "Stones model loaded!" << std::endl;
-        }
+        assetLoader.requestOBJ(stonesModel, "models/stones.obj");
         
         trapModel = new OBJModel();
-        if (trapModel->load("models/trap.obj")) {
-            std::cout << "Trap model loaded!" << std::endl;
-        }
+        assetLoader.requestOBJ(trapModel, "models/trap.obj");
         
         // Place stones around the dungeon - scaled for 100x100 room
         stones.push_back({Vector3(-30.0f, 0.0f, -30.0f), 45.0f, 5.0f});   // big boulder
@@ -3776,6 +9964,12 @@ public:
         stones.push_back({Vector3(47.0f, 0.0f, 22.0f), 220.0f, 7.0f});
         stones.push_back({Vector3(46.0f, 0.0f, 35.0f), 265.0f, 9.0f});
         
+        stoneBatch.clear();
+        for (const auto& stone : stones) {
+            stoneBatch.add(stone.position.x, stone.position.y, stone.position.z, stone.rotation,
+                           stone.scale, stone.scale, stone.scale);
+        }
+        
         // Place traps in the dungeon (dangerous!) - scaled for 100x100 room
         traps.push_back({Vector3(-15.0f, 0.0f, -15.0f), 0.0f, 2.0f});
         traps.push_back({Vector3(20.0f, 0.0f, 10.0f), 45.0f, 2.0f});
@@ -3787,35 +9981,32 @@ public:
         traps.push_back({Vector3(-10.0f, 0.0f, 40.0f), 315.0f, 2.0f});
         
         // Place 10 purple crystals scattered around the dungeon (collectibles for winning)
-        crystals.push_back({Vector3(-35.0f, 1.5f, -35.0f), 0.0f, 0.0f, false});
-        crystals.push_back({Vector3(30.0f, 1.5f, -30.0f), 45.0f, 1.0f, false});
-        crystals.push_back({Vector3(-25.0f, 1.5f, 20.0f), 90.0f, 2.0f, false});
-        crystals.push_back({Vector3(35.0f, 1.5f, 15.0f), 135.0f, 3.0f, false});
-        crystals.push_back({Vector3(-15.0f, 1.5f, 35.0f), 180.0f, 4.0f, false});
-        crystals.push_back({Vector3(25.0f, 1.5f, 35.0f), 225.0f, 5.0f, false});
-        crystals.push_back({Vector3(10.0f, 1.5f, -35.0f), 270.0f, 0.5f, false});
-        crystals.push_back({Vector3(-40.0f, 1.5f, 10.0f), 315.0f, 1.5f, false});
-        crystals.push_back({Vector3(40.0f, 1.5f, -10.0f), 60.0f, 2.5f, false});
-        crystals.push_back({Vector3(5.0f, 1.5f, 25.0f), 150.0f, 3.5f, false});
+        crystals.push_back({KinematicAgent(Vector3(-35.0f, 1.5f, -35.0f), 0.0f, 0.0f, 0.0f, CRYSTAL_SPIN_RATE), 0.0f, false});
+        crystals.push_back({KinematicAgent(Vector3(30.0f, 1.5f, -30.0f), 45.0f, 0.0f, 0.0f, CRYSTAL_SPIN_RATE), 1.0f, false});
+        crystals.push_back({KinematicAgent(Vector3(-25.0f, 1.5f, 20.0f), 90.0f, 0.0f, 0.0f, CRYSTAL_SPIN_RATE), 2.0f, false});
+        crystals.push_back({KinematicAgent(Vector3(35.0f, 1.5f, 15.0f), 135.0f, 0.0f, 0.0f, CRYSTAL_SPIN_RATE), 3.0f, false});
+        crystals.push_back({KinematicAgent(Vector3(-15.0f, 1.5f, 35.0f), 180.0f, 0.0f, 0.0f, CRYSTAL_SPIN_RATE), 4.0f, false});
+        crystals.push_back({KinematicAgent(Vector3(25.0f, 1.5f, 35.0f), 225.0f, 0.0f, 0.0f, CRYSTAL_SPIN_RATE), 5.0f, false});
+        crystals.push_back({KinematicAgent(Vector3(10.0f, 1.5f, -35.0f), 270.0f, 0.0f, 0.0f, CRYSTAL_SPIN_RATE), 0.5f, false});
+        crystals.push_back({KinematicAgent(Vector3(-40.0f, 1.5f, 10.0f), 315.0f, 0.0f, 0.0f, CRYSTAL_SPIN_RATE), 1.5f, false});
+        crystals.push_back({KinematicAgent(Vector3(40.0f, 1.5f, -10.0f), 60.0f, 0.0f, 0.0f, CRYSTAL_SPIN_RATE), 2.5f, false});
+        crystals.push_back({KinematicAgent(Vector3(5.0f, 1.5f, 25.0f), 150.0f, 0.0f, 0.0f, CRYSTAL_SPIN_RATE), 3.5f, false});
         
         // Load lava texture
-        lavaTexture = loadTexture("models/lava.jpeg");
-        if (lavaTexture) {
-            std::cout << "Lava texture loaded!" << std::endl;
-        }
+        assetLoader.requestTexture("models/lava.jpeg", &lavaTexture);
         
         // Generate random lava pools in the dungeon floor - scaled for 100x100 room
-        srand(12345);  // Fixed seed for consistent layout
+        SimRandom layoutRandom(12345);  // Fixed seed for consistent layout
         float lavaDepth = 0.5f;  // Half player height (player height is 1.0f)
         for (int i = 0; i < 15; i++) {  // 15 lava pools for larger room
             bool validPosition = false;
             float lx, lz;
-            float lavaSize = 2.0f + (rand() % 150) / 100.0f;  // 2.0 to 3.5 units
+            float lavaSize = 2.0f + (layoutRandom.next() % 150) / 100.0f;  // 2.0 to 3.5 units
             
             // Try to find a valid position (not overlapping stones or traps)
             for (int attempts = 0; attempts < 50 && !validPosition; attempts++) {
-                lx = -40.0f + (rand() % 8000) / 100.0f;  // -40 to 40
-                lz = -40.0f + (rand() % 8000) / 100.0f;  // -40 to 40
+                lx = -40.0f + (layoutRandom.next() % 8000) / 100.0f;  // -40 to 40
+                lz = -40.0f + (layoutRandom.next() % 8000) / 100.0f;  // -40 to 40
                 
                 validPosition = true;
                 
@@ -3865,6 +10056,19 @@ public:
             }
         }
         
+        // Hash stones (0.6 x scale), traps and lava squares for collision queries
+        obstacles.clear();
+        for (size_t i = 0; i < stones.size(); i++) {
+            obstacles.addCircle(stones[i].position.x, stones[i].position.z, stones[i].scale * 0.6f, COLLIDER_STONE, (int)i);
+        }
+        for (size_t i = 0; i < traps.size(); i++) {
+            obstacles.addCircle(traps[i].position.x, traps[i].position.z, traps[i].collisionRadius, COLLIDER_TRAP, (int)i);
+        }
+        for (size_t i = 0; i < lavaPools.size(); i++) {
+            float halfSize = lavaPools[i].size / 2.0f;
+            obstacles.addRect(lavaPools[i].x, lavaPools[i].z, halfSize, halfSize, COLLIDER_LAVA, (int)i);
+        }
+        
         // Create torches on the walls - more torches for larger room
         float torchHeight = 5.0f;
         float halfWidth = roomWidth / 2.0f - 0.5f;
@@ -3895,23 +10099,25 @@ public:
         torches.push_back({Vector3(halfWidth, torchHeight, 35.0f), 1.6f, 4.1f, 1.0f});
         
         // Initialize flying bats
-        srand(54321);  // Fixed seed for consistent bat positions
+        SimRandom batLayoutRandom(54321);  // Fixed seed for consistent bat positions
         for (int i = 0; i < 12; i++) {  // 12 bats flying around
             Bat bat;
             // Random starting position - fly throughout the cave
-            bat.position.x = -35.0f + (rand() % 7000) / 100.0f;  // -35 to 35
-            bat.position.y = 4.0f + (rand() % 800) / 100.0f;     // 4 to 12 (visible height)
-            bat.position.z = -35.0f + (rand() % 7000) / 100.0f;  // -35 to 35
+            bat.position.x = -35.0f + (batLayoutRandom.next() % 7000) / 100.0f;  // -35 to 35
+            bat.position.y = 4.0f + (batLayoutRandom.next() % 800) / 100.0f;     // 4 to 12 (visible height)
+            bat.position.z = -35.0f + (batLayoutRandom.next() % 7000) / 100.0f;  // -35 to 35
             
             // Random target position
-            bat.targetPos.x = -35.0f + (rand() % 7000) / 100.0f;
-            bat.targetPos.y = 4.0f + (rand() % 800) / 100.0f;
-            bat.targetPos.z = -35.0f + (rand() % 7000) / 100.0f;
+            bat.targetPos.x = -35.0f + (batLayoutRandom.next() % 7000) / 100.0f;
+            bat.targetPos.y = 4.0f + (batLayoutRandom.next() % 800) / 100.0f;
+            bat.targetPos.z = -35.0f + (batLayoutRandom.next() % 7000) / 100.0f;
             
-            bat.wingAngle = (rand() % 628) / 100.0f;  // Random starting wing phase
-            bat.wingSpeed = 15.0f + (rand() % 500) / 100.0f;  // 15-20 flaps per second
-            bat.flySpeed = 3.0f + (rand() % 300) / 100.0f;    // 3-6 units per second
-            bat.size = 0.8f + (rand() % 40) / 100.0f;         // 0.8 to 1.2 scale (much bigger!)
+            bat.wingAngle = (batLayoutRandom.next() % 628) / 100.0f;  // Random starting wing phase
+            bat.wingSpeed = 15.0f + (batLayoutRandom.next() % 500) / 100.0f;  // 15-20 flaps per second
+            bat.flySpeed = 3.0f + (batLayoutRandom.next() % 300) / 100.0f;    // 3-6 units per second
+            bat.size = 0.8f + (batLayoutRandom.next() % 40) / 100.0f;         // 0.8 to 1.2 scale (much bigger!)
+            bat.previousPosition = bat.position;
+            bat.previousWingAngle = bat.wingAngle;
             
             bats.push_back(bat);
         }
@@ -3921,7 +10127,7 @@ public:
                   << bats.size() << " bats" << std::endl;
     }
     
-    void render() override {
+    void render(const RenderView& view) override {
         // Set very dark ambient lighting
         glLightModelfv(GL_LIGHT_MODEL_AMBIENT, ambientLight);
         
@@ -3952,172 +10158,156 @@ public:
             lightIndex++;
         }
         
-        // Enable texturing
-        glEnable(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, stoneTexture);
-        
-        // Set material for stone surfaces
-        GLfloat stoneDiffuse[] = { 0.8f, 0.8f, 0.8f, 1.0f };
-        GLfloat stoneAmbient[] = { 0.3f, 0.3f, 0.3f, 1.0f };
-        GLfloat stoneSpecular[] = { 0.1f, 0.1f, 0.1f, 1.0f };
-        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, stoneDiffuse);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, stoneAmbient);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, stoneSpecular);
-        glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 10.0f);
-        glColor3f(1.0f, 1.0f, 1.0f);
-        
-        float hw = roomWidth / 2.0f;
-        float hd = roomDepth / 2.0f;
-        float tileSize = 4.0f;  // Texture tiling
-        
-        // Draw floor
-        glBegin(GL_QUADS);
-        glNormal3f(0.0f, 1.0f, 0.0f);
-        glTexCoord2f(0.0f, 0.0f); glVertex3f(-hw, 0.0f, -hd);
-        glTexCoord2f(0.0f, roomDepth/tileSize); glVertex3f(-hw, 0.0f, hd);
-        glTexCoord2f(roomWidth/tileSize, roomDepth/tileSize); glVertex3f(hw, 0.0f, hd);
-        glTexCoord2f(roomWidth/tileSize, 0.0f); glVertex3f(hw, 0.0f, -hd);
-        glEnd();
-        
-        // Draw ceiling
-        glBegin(GL_QUADS);
-        glNormal3f(0.0f, -1.0f, 0.0f);
-        glTexCoord2f(0.0f, 0.0f); glVertex3f(-hw, roomHeight, -hd);
-        glTexCoord2f(roomWidth/tileSize, 0.0f); glVertex3f(hw, roomHeight, -hd);
-        glTexCoord2f(roomWidth/tileSize, roomDepth/tileSize); glVertex3f(hw, roomHeight, hd);
-        glTexCoord2f(0.0f, roomDepth/tileSize); glVertex3f(-hw, roomHeight, hd);
-        glEnd();
-        
-        // Draw north wall (negative Z)
-        glBegin(GL_QUADS);
-        glNormal3f(0.0f, 0.0f, 1.0f);
-        glTexCoord2f(0.0f, 0.0f); glVertex3f(-hw, 0.0f, -hd);
-        glTexCoord2f(roomWidth/tileSize, 0.0f); glVertex3f(hw, 0.0f, -hd);
-        glTexCoord2f(roomWidth/tileSize, roomHeight/tileSize); glVertex3f(hw, roomHeight, -hd);
-        glTexCoord2f(0.0f, roomHeight/tileSize); glVertex3f(-hw, roomHeight, -hd);
-        glEnd();
-        
-        // Draw south wall (positive Z)
-        glBegin(GL_QUADS);
-        glNormal3f(0.0f, 0.0f, -1.0f);
-        glTexCoord2f(0.0f, 0.0f); glVertex3f(hw, 0.0f, hd);
-        glTexCoord2f(roomWidth/tileSize, 0.0f); glVertex3f(-hw, 0.0f, hd);
-        glTexCoord2f(roomWidth/tileSize, roomHeight/tileSize); glVertex3f(-hw, roomHeight, hd);
-        glTexCoord2f(0.0f, roomHeight/tileSize); glVertex3f(hw, roomHeight, hd);
-        glEnd();
-        
-        // Draw west wall (negative X)
-        glBegin(GL_QUADS);
-        glNormal3f(1.0f, 0.0f, 0.0f);
-        glTexCoord2f(0.0f, 0.0f); glVertex3f(-hw, 0.0f, hd);
-        glTexCoord2f(roomDepth/tileSize, 0.0f); glVertex3f(-hw, 0.0f, -hd);
-        glTexCoord2f(roomDepth/tileSize, roomHeight/tileSize); glVertex3f(-hw, roomHeight, -hd);
-        glTexCoord2f(0.0f, roomHeight/tileSize); glVertex3f(-hw, roomHeight, hd);
-        glEnd();
-        
-        // Draw east wall (positive X)
-        glBegin(GL_QUADS);
-        glNormal3f(-1.0f, 0.0f, 0.0f);
-        glTexCoord2f(0.0f, 0.0f); glVertex3f(hw, 0.0f, -hd);
-        glTexCoord2f(roomDepth/tileSize, 0.0f); glVertex3f(hw, 0.0f, hd);
-        glTexCoord2f(roomDepth/tileSize, roomHeight/tileSize); glVertex3f(hw, roomHeight, hd);
-        glTexCoord2f(0.0f, roomHeight/tileSize); glVertex3f(hw, roomHeight, -hd);
-        glEnd();
-        
-        glDisable(GL_TEXTURE_2D);
-        
+        // Room, stones, traps, lava, crystals and bats go through the render
+        // queue, grouped by texture and material
+        RenderSection section("room");
+        renderQueue.submit(PASS_OPAQUE, stoneTexture, &stoneMaterial, nullptr, true, [this] {
+            float hw = roomWidth / 2.0f;
+            float hd = roomDepth / 2.0f;
+            float tileSize = 4.0f;  // Texture tiling
+            
+            // Draw floor
+            glBegin(GL_QUADS);
+            glNormal3f(0.0f, 1.0f, 0.0f);
+            glTexCoord2f(0.0f, 0.0f); glVertex3f(-hw, 0.0f, -hd);
+            glTexCoord2f(0.0f, roomDepth/tileSize); glVertex3f(-hw, 0.0f, hd);
+            glTexCoord2f(roomWidth/tileSize, roomDepth/tileSize); glVertex3f(hw, 0.0f, hd);
+            glTexCoord2f(roomWidth/tileSize, 0.0f); glVertex3f(hw, 0.0f, -hd);
+            glEnd();
+            
+            // Draw ceiling
+            glBegin(GL_QUADS);
+            glNormal3f(0.0f, -1.0f, 0.0f);
+            glTexCoord2f(0.0f, 0.0f); glVertex3f(-hw, roomHeight, -hd);
+            glTexCoord2f(roomWidth/tileSize, 0.0f); glVertex3f(hw, roomHeight, -hd);
+            glTexCoord2f(roomWidth/tileSize, roomDepth/tileSize); glVertex3f(hw, roomHeight, hd);
+            glTexCoord2f(0.0f, roomDepth/tileSize); glVertex3f(-hw, roomHeight, hd);
+            glEnd();
+            
+            // Draw north wall (negative Z)
+            glBegin(GL_QUADS);
+            glNormal3f(0.0f, 0.0f, 1.0f);
+            glTexCoord2f(0.0f, 0.0f); glVertex3f(-hw, 0.0f, -hd);
+            glTexCoord2f(roomWidth/tileSize, 0.0f); glVertex3f(hw, 0.0f, -hd);
+            glTexCoord2f(roomWidth/tileSize, roomHeight/tileSize); glVertex3f(hw, roomHeight, -hd);
+            glTexCoord2f(0.0f, roomHeight/tileSize); glVertex3f(-hw, roomHeight, -hd);
+            glEnd();
+            
+            // Draw south wall (positive Z)
+            glBegin(GL_QUADS);
+            glNormal3f(0.0f, 0.0f, -1.0f);
+            glTexCoord2f(0.0f, 0.0f); glVertex3f(hw, 0.0f, hd);
+            glTexCoord2f(roomWidth/tileSize, 0.0f); glVertex3f(-hw, 0.0f, hd);
+            glTexCoord2f(roomWidth/tileSize, roomHeight/tileSize); glVertex3f(-hw, roomHeight, hd);
+            glTexCoord2f(0.0f, roomHeight/tileSize); glVertex3f(hw, roomHeight, hd);
+            glEnd();
+            
+            // Draw west wall (negative X)
+            glBegin(GL_QUADS);
+            glNormal3f(1.0f, 0.0f, 0.0f);
+            glTexCoord2f(0.0f, 0.0f); glVertex3f(-hw, 0.0f, hd);
+            glTexCoord2f(roomDepth/tileSize, 0.0f); glVertex3f(-hw, 0.0f, -hd);
+            glTexCoord2f(roomDepth/tileSize, roomHeight/tileSize); glVertex3f(-hw, roomHeight, -hd);
+            glTexCoord2f(0.0f, roomHeight/tileSize); glVertex3f(-hw, roomHeight, hd);
+            glEnd();
+            
+            // Draw east wall (positive X)
+            glBegin(GL_QUADS);
+            glNormal3f(-1.0f, 0.0f, 0.0f);
+            glTexCoord2f(0.0f, 0.0f); glVertex3f(hw, 0.0f, -hd);
+            glTexCoord2f(roomDepth/tileSize, 0.0f); glVertex3f(hw, 0.0f, hd);
+            glTexCoord2f(roomDepth/tileSize, roomHeight/tileSize); glVertex3f(hw, roomHeight, hd);
+            glTexCoord2f(0.0f, roomHeight/tileSize); glVertex3f(hw, roomHeight, -hd);
+            glEnd();
+        });
+            
         // Draw stones with minecraft_stone texture
+        section.next("stones");
         if (stonesModel) {
             if (stoneTexture) {
-                glEnable(GL_TEXTURE_2D);
-                glBindTexture(GL_TEXTURE_2D, stoneTexture);
-            }
-            for (const auto& stone : stones) {
-                glPushMatrix();
-                glTranslatef(stone.position.x, stone.position.y, stone.position.z);
-                glRotatef(stone.rotation, 0.0f, 1.0f, 0.0f);
-                glScalef(stone.scale, stone.scale, stone.scale);
-                if (stoneTexture) {
-                    stonesModel->renderWithTexture();
-                } else {
-                    stonesModel->render();
-                }
-                glPopMatrix();
-            }
-            if (stoneTexture) {
-                glDisable(GL_TEXTURE_2D);
+                renderQueue.submit(PASS_OPAQUE, stoneTexture, &stoneMaterial, &stonesModel->gpuMesh, true, [this] {
+                    stoneBatch.draw(stonesModel->gpuMesh, std::vector<MaterialRange>(), [](int) {},
+                                    [this](const LodPlacement& at) { stonesModel->renderWithTexture(at); },
+                                    &stonesModel->lods);
+                });
+            } else {
+                renderQueue.submit(PASS_OPAQUE, 0, nullptr, &stonesModel->gpuMesh, true, [this] {
+                    stoneBatch.draw(stonesModel->gpuMesh, stonesModel->materialRanges,
+                                    [this](int id) { stonesModel->materials[id].apply(); },
+                                    [this](const LodPlacement& at) { stonesModel->render(at); }, &stonesModel->lods);
+                });
             }
         }
         
         // Draw traps
+        section.next("traps");
         if (trapModel) {
+            float trapRadius = trapModel->originRadius() * 1.5f;
             for (const auto& trap : traps) {
-                glPushMatrix();
-                glTranslatef(trap.position.x, trap.position.y, trap.position.z);
-                glRotatef(trap.rotation, 0.0f, 1.0f, 0.0f);
-                glScalef(1.5f, 1.5f, 1.5f);  // Scale traps to be visible
-                trapModel->render();
-                glPopMatrix();
+                if (!sphereInView(trap.position.x, trap.position.y, trap.position.z, trapRadius)) continue;
+                renderQueue.submit(PASS_OPAQUE, 0, nullptr, &trapModel->gpuMesh, true, [this, &trap] {
+                    glPushMatrix();
+                    glTranslatef(trap.position.x, trap.position.y, trap.position.z);
+                    glRotatef(trap.rotation, 0.0f, 1.0f, 0.0f);
+                    glScalef(1.5f, 1.5f, 1.5f);  // Scale traps to be visible
+                    trapModel->render(LodPlacement(trap.position, 1.5f));
+                    glPopMatrix();
+                });
             }
         }
         
-        // Draw lava pools
+        // Draw lava pools: glowing squares slightly above the floor
+        section.next("lava");
         if (lavaTexture) {
-            glEnable(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D, lavaTexture);
-            
-            // Bright emissive material for lava
-            GLfloat lavaEmission[] = { 0.6f, 0.2f, 0.0f, 1.0f };
-            GLfloat lavaDiffuse[] = { 1.0f, 0.5f, 0.1f, 1.0f };
-            GLfloat lavaAmbient[] = { 0.8f, 0.3f, 0.1f, 1.0f };
-            glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, lavaEmission);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, lavaDiffuse);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, lavaAmbient);
-            glColor3f(1.0f, 1.0f, 1.0f);
-            
             for (const auto& lava : lavaPools) {
                 float hs = lava.size / 2.0f;
-                float lavaY = 0.02f;  // Slightly above floor level to be visible
-                
-                // Draw the lava surface (no pit, just a glowing pool on the floor)
-                glBindTexture(GL_TEXTURE_2D, lavaTexture);
-                glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, lavaEmission);
-                glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, lavaDiffuse);
-                
-                glBegin(GL_QUADS);
-                glNormal3f(0.0f, 1.0f, 0.0f);
-                glTexCoord2f(0.0f, 0.0f); glVertex3f(lava.x - hs, lavaY, lava.z - hs);
-                glTexCoord2f(0.0f, 1.0f); glVertex3f(lava.x - hs, lavaY, lava.z + hs);
-                glTexCoord2f(1.0f, 1.0f); glVertex3f(lava.x + hs, lavaY, lava.z + hs);
-                glTexCoord2f(1.0f, 0.0f); glVertex3f(lava.x + hs, lavaY, lava.z - hs);
-                glEnd();
+                float lavaY = 0.02f;
+                if (!sphereInView(lava.x, lavaY, lava.z, hs * 1.415f)) continue;
+                renderQueue.submit(PASS_OPAQUE, lavaTexture, &lavaMaterial, nullptr, true, [&lava, hs, lavaY] {
+                    glBegin(GL_QUADS);
+                    glNormal3f(0.0f, 1.0f, 0.0f);
+                    glTexCoord2f(0.0f, 0.0f); glVertex3f(lava.x - hs, lavaY, lava.z - hs);
+                    glTexCoord2f(0.0f, 1.0f); glVertex3f(lava.x - hs, lavaY, lava.z + hs);
+                    glTexCoord2f(1.0f, 1.0f); glVertex3f(lava.x + hs, lavaY, lava.z + hs);
+                    glTexCoord2f(1.0f, 0.0f); glVertex3f(lava.x + hs, lavaY, lava.z - hs);
+                    glEnd();
+                });
             }
-            
-            // Reset emission
-            GLfloat noEmission[] = { 0.0f, 0.0f, 0.0f, 1.0f };
-            glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, noEmission);
-            glDisable(GL_TEXTURE_2D);
         }
         
-        // Draw torches
-        for (const auto& torch : torches) {
-            drawTorch(torch);
+        // Draw purple crystals (collectibles); bounds cover the bobbing
+        section.next("crystals");
+        for (const auto& crystal : crystals) {
+            if (!crystal.collected &&
+                sphereInView(crystal.agent.position.x, crystal.agent.position.y, crystal.agent.position.z, 0.75f)) {
+                renderQueue.submit(PASS_OPAQUE, amethystTexture, nullptr, nullptr, true,
+                                   [this, &crystal, &view] { drawCrystal(crystal, view); });
+            }
         }
         
-        // Draw purple crystals (collectibles)
-        for (auto& crystal : crystals) {
-            if (!crystal.collected) {
-                drawCrystal(crystal);
+        // Draw flying bats; wings reach about 2.2 * size
+        section.next("bats");
+        for (auto& bat : bats) {
+            Vector3 batAt = blendPosition(bat.previousPosition, bat.position, view.alpha);
+            if (sphereInView(batAt.x, batAt.y, batAt.z, bat.size * 2.5f)) {
+                renderQueue.submit(PASS_OPAQUE, batTexture, &batMaterial, nullptr, true,
+                                   [this, &bat, &view] { drawBat(bat, view); });
             }
         }
         
-        // Draw flying bats
-        for (auto& bat : bats) {
-            drawBat(bat);
+        section.next("render queue");
+        renderQueue.flush();
+        
+        // Draw torches (their lights above stay on when the torch is culled)
+        section.next("torches");
+        for (const auto& torch : torches) {
+            if (sphereInView(torch.position.x, torch.position.y, torch.position.z, 1.6f)) drawTorch(torch);
         }
         
         // Draw the portal (exit portal in Scene 2)
+        section.next("portal");
         drawPortalScene2();
+        section.end();
         
         // Disable extra lights
         for (int i = 0; i < 8; i++) {
@@ -4133,6 +10323,12 @@ public:
     void update(float deltaTime) override {
         // Update portal animation for Scene 2 as well
         portalTime += deltaTime;
+        
+        // Spin the crystals
+        for (auto& crystal : crystals) {
+            crystal.agent.saveStep();
+            crystal.agent.spin(deltaTime);
+        }
 
         // Update torch flickering
         for (auto& torch : torches) {
@@ -4147,6 +10343,9 @@ public:
         
         // Update flying bats
         for (auto& bat : bats) {
+            bat.previousPosition = bat.position;
+            bat.previousWingAngle = bat.wingAngle;
+            
             // Animate wing flapping
             bat.wingAngle += deltaTime * bat.wingSpeed;
             
@@ -4164,9 +10363,9 @@ public:
                 bat.position.z += (dz / dist) * moveSpeed;
             } else {
                 // Reached target, pick new random target
-                bat.targetPos.x = -35.0f + (rand() % 7000) / 100.0f;
-                bat.targetPos.y = 4.0f + (rand() % 800) / 100.0f;  // 4-12 height range
-                bat.targetPos.z = -35.0f + (rand() % 7000) / 100.0f;
+                bat.targetPos.x = -35.0f + (batRandom.next() % 7000) / 100.0f;
+                bat.targetPos.y = 4.0f + (batRandom.next() % 800) / 100.0f;  // 4-12 height range
+                bat.targetPos.z = -35.0f + (batRandom.next() % 7000) / 100.0f;
             }
             
             // Keep bats within bounds
@@ -4176,23 +10375,28 @@ public:
         }
     }
     
-    void cleanup() override {
-        std::cout << "Cleaning up Scene 2" << std::endl;
-        if (stoneTexture) {
-            glDeleteTextures(1, &stoneTexture);
-            stoneTexture = 0;
+    void hashState(StateHash& hash) const override {
+        for (const Crystal& crystal : crystals) {
+            hash.add(crystal.agent.heading);
+            hash.add(crystal.collected);
         }
-        if (lavaTexture) {
-            glDeleteTextures(1, &lavaTexture);
-            lavaTexture = 0;
-        }
-        if (amethystTexture) {
-            glDeleteTextures(1, &amethystTexture);
-            amethystTexture = 0;
+        for (const Bat& bat : bats) {
+            hash.add(bat.position);
+            hash.add(bat.targetPos);
+            hash.add(bat.wingAngle);
         }
-        if (batTexture) {
-            glDeleteTextures(1, &batTexture);
-            batTexture = 0;
+        for (const Torch& torch : torches) hash.add(torch.flickerPhase);
+        hash.add(lavaDamageTimer);
+    }
+    
+    void cleanup() override {
+        std::cout << "Cleaning up Scene 2" << std::endl;
+        
+        // Drop this scene's texture references (see Scene 1)
+        GLuint* textures[] = { &stoneTexture, &lavaTexture, &amethystTexture, &batTexture, &portalFrameTexture };
+        for (GLuint* texture : textures) {
+            releaseTexture(*texture);
+            *texture = 0;
         }
         if (stonesModel) {
             delete stonesModel;
@@ -4204,19 +10408,22 @@ public:
         }
         torches.clear();
         stones.clear();
+        stoneBatch.clear();
         traps.clear();
         lavaPools.clear();
+        obstacles.clear();
         bats.clear();
     }
     
 private:
-    void drawBat(Bat& bat) {
+    void drawBat(const Bat& bat, const RenderView& view) {
         glPushMatrix();
-        glTranslatef(bat.position.x, bat.position.y, bat.position.z);
+        Vector3 at = blendPosition(bat.previousPosition, bat.position, view.alpha);
+        glTranslatef(at.x, at.y, at.z);
         
         // Face direction of movement
-        float dx = bat.targetPos.x - bat.position.x;
-        float dz = bat.targetPos.z - bat.position.z;
+        float dx = bat.targetPos.x - at.x;
+        float dz = bat.targetPos.z - at.z;
         float angle = atan2(dx, dz) * 180.0f / 3.14159f;
         glRotatef(angle, 0.0f, 1.0f, 0.0f);
         
@@ -4225,19 +10432,19 @@ private:
         // Enable bat texture if available
         bool useTexture = (batTexture != 0);
         if (useTexture) {
-            glEnable(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D, batTexture);
+            renderState.enable(GL_TEXTURE_2D);
+            renderState.bindTexture(batTexture);
             glColor3f(1.0f, 1.0f, 1.0f);  // Use texture colors
         } else {
             // Dark gray/brown bat material (fallback)
-            glDisable(GL_TEXTURE_2D);
+            renderState.disable(GL_TEXTURE_2D);
             glColor3f(0.15f, 0.12f, 0.1f);
         }
         
         GLfloat batDiffuse[] = { 0.6f, 0.6f, 0.6f, 1.0f };
         GLfloat batAmbient[] = { 0.4f, 0.4f, 0.4f, 1.0f };
-        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, batDiffuse);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, batAmbient);
+        renderState.material(GL_DIFFUSE, batDiffuse);
+        renderState.material(GL_AMBIENT, batAmbient);
         
         // Body (elongated sphere) - draw as textured quad sphere approximation
         glPushMatrix();
@@ -4247,9 +10454,10 @@ private:
             gluQuadricTexture(quadric, GL_TRUE);
             gluQuadricNormals(quadric, GLU_SMOOTH);
             gluSphere(quadric, 1.0f, 12, 8);
+            glCounter.shape(12 * 7 * 2);
             gluDeleteQuadric(quadric);
         } else {
-            glutSolidSphere(1.0f, 10, 8);
+            solidSphere(1.0f, 10, 8);
         }
         glPopMatrix();
         
@@ -4261,64 +10469,66 @@ private:
             gluQuadricTexture(quadric, GL_TRUE);
             gluQuadricNormals(quadric, GLU_SMOOTH);
             gluSphere(quadric, 0.35f, 10, 6);
+            glCounter.shape(10 * 5 * 2);
             gluDeleteQuadric(quadric);
         } else {
-            glutSolidSphere(0.35f, 8, 6);
+            solidSphere(0.35f, 8, 6);
         }
         
         // Ears (small cones)
         if (useTexture) {
-            glDisable(GL_TEXTURE_2D);
+            renderState.disable(GL_TEXTURE_2D);
             glColor3f(0.15f, 0.12f, 0.1f);
         }
         glPushMatrix();
         glTranslatef(-0.15f, 0.25f, 0.0f);
         glRotatef(-20.0f, 0.0f, 0.0f, 1.0f);
         glRotatef(-90.0f, 1.0f, 0.0f, 0.0f);
-        glutSolidCone(0.08f, 0.25f, 6, 2);
+        solidCone(0.08f, 0.25f, 6, 2);
         glPopMatrix();
         
         glPushMatrix();
         glTranslatef(0.15f, 0.25f, 0.0f);
         glRotatef(20.0f, 0.0f, 0.0f, 1.0f);
         glRotatef(-90.0f, 1.0f, 0.0f, 0.0f);
-        glutSolidCone(0.08f, 0.25f, 6, 2);
+        solidCone(0.08f, 0.25f, 6, 2);
         glPopMatrix();
         
         // Eyes (tiny red spheres)
         GLfloat eyeDiffuse[] = { 0.6f, 0.1f, 0.1f, 1.0f };
         GLfloat eyeEmission[] = { 0.3f, 0.05f, 0.05f, 1.0f };
-        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, eyeDiffuse);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, eyeEmission);
+        renderState.material(GL_DIFFUSE, eyeDiffuse);
+        renderState.material(GL_EMISSION, eyeEmission);
         glColor3f(0.6f, 0.1f, 0.1f);
         
         glPushMatrix();
         glTranslatef(-0.12f, 0.05f, 0.25f);
-        glutSolidSphere(0.06f, 6, 4);
+        solidSphere(0.06f, 6, 4);
         glPopMatrix();
         
         glPushMatrix();
         glTranslatef(0.12f, 0.05f, 0.25f);
-        glutSolidSphere(0.06f, 6, 4);
+        solidSphere(0.06f, 6, 4);
         glPopMatrix();
         
         GLfloat noEmission[] = { 0.0f, 0.0f, 0.0f, 1.0f };
-        glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, noEmission);
+        renderState.material(GL_EMISSION, noEmission);
         
         glPopMatrix();  // End head
         
         // Wings (animated triangular membranes)
         if (useTexture) {
-            glEnable(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D, batTexture);
+            renderState.enable(GL_TEXTURE_2D);
+            renderState.bindTexture(batTexture);
             glColor3f(1.0f, 1.0f, 1.0f);
         } else {
             glColor3f(0.12f, 0.1f, 0.08f);
         }
-        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, batDiffuse);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, batAmbient);
+        renderState.material(GL_DIFFUSE, batDiffuse);
+        renderState.material(GL_AMBIENT, batAmbient);
         
-        float wingFlap = sin(bat.wingAngle) * 40.0f;  // -40 to +40 degrees
+        float wingAngle = bat.previousWingAngle + (bat.wingAngle - bat.previousWingAngle) * view.alpha;
+        float wingFlap = sin(wingAngle) * 40.0f;  // -40 to +40 degrees
         
         // Left wing
         glPushMatrix();
@@ -4343,7 +10553,7 @@ private:
         glEnd();
         
         // Wing finger bones
-        if (useTexture) glDisable(GL_TEXTURE_2D);
+        if (useTexture) renderState.disable(GL_TEXTURE_2D);
         glColor3f(0.2f, 0.15f, 0.12f);
         glBegin(GL_LINES);
         glVertex3f(0.0f, 0.02f, 0.0f);
@@ -4362,8 +10572,8 @@ private:
         glRotatef(-wingFlap + 10.0f, 0.0f, 0.0f, 1.0f);
         
         if (useTexture) {
-            glEnable(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D, batTexture);
+            renderState.enable(GL_TEXTURE_2D);
+            renderState.bindTexture(batTexture);
             glColor3f(1.0f, 1.0f, 1.0f);
         } else {
             glColor3f(0.12f, 0.1f, 0.08f);
@@ -4385,7 +10595,7 @@ private:
         glEnd();
         
         // Wing finger bones
-        if (useTexture) glDisable(GL_TEXTURE_2D);
+        if (useTexture) renderState.disable(GL_TEXTURE_2D);
         glColor3f(0.2f, 0.15f, 0.12f);
         glBegin(GL_LINES);
         glVertex3f(0.0f, 0.02f, 0.0f);
@@ -4404,14 +10614,14 @@ private:
         glTranslatef(-0.1f, -0.2f, 0.0f);
         glRotatef(20.0f, 1.0f, 0.0f, 0.0f);
         glScalef(0.05f, 0.3f, 0.05f);
-        glutSolidCube(1.0f);
+        solidCube(1.0f);
         glPopMatrix();
         
         glPushMatrix();
         glTranslatef(0.1f, -0.2f, 0.0f);
         glRotatef(20.0f, 1.0f, 0.0f, 0.0f);
         glScalef(0.05f, 0.3f, 0.05f);
-        glutSolidCube(1.0f);
+        solidCube(1.0f);
         glPopMatrix();
         
         glPopMatrix();
@@ -4422,8 +10632,6 @@ private:
         glTranslatef(torch.position.x, torch.position.y, torch.position.z);
         
         // Rotate torch to face into room based on wall position
-        float hw = roomWidth / 2.0f - 0.5f;
-        float hd = roomDepth / 2.0f - 0.5f;
         if (fabs(torch.position.x) > fabs(torch.position.z)) {
             // On east/west wall
             if (torch.position.x > 0) glRotatef(-90.0f, 0.0f, 1.0f, 0.0f);
@@ -4434,11 +10642,11 @@ private:
         }
         
         // Draw torch handle (brown)
-        glDisable(GL_TEXTURE_2D);
+        renderState.disable(GL_TEXTURE_2D);
         GLfloat handleDiffuse[] = { 0.4f, 0.25f, 0.1f, 1.0f };
         GLfloat handleAmbient[] = { 0.2f, 0.1f, 0.05f, 1.0f };
-        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, handleDiffuse);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, handleAmbient);
+        renderState.material(GL_DIFFUSE, handleDiffuse);
+        renderState.material(GL_AMBIENT, handleAmbient);
         glColor3f(0.4f, 0.25f, 0.1f);
         
         glPushMatrix();
@@ -4448,6 +10656,7 @@ private:
         // Torch stick
         GLUquadric* quad = gluNewQuadric();
         gluCylinder(quad, 0.08f, 0.06f, 0.8f, 8, 1);
+        glCounter.shape(8 * 2);
         
         // Torch head (fire)
         glTranslatef(0.0f, 0.0f, 0.8f);
@@ -4456,52 +10665,50 @@ private:
         float glow = torch.intensity;
         GLfloat fireEmission[] = { 1.0f * glow, 0.5f * glow, 0.1f * glow, 1.0f };
         GLfloat fireDiffuse[] = { 1.0f, 0.6f, 0.1f, 1.0f };
-        glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, fireEmission);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, fireDiffuse);
+        renderState.material(GL_EMISSION, fireEmission);
+        renderState.material(GL_DIFFUSE, fireDiffuse);
         glColor3f(1.0f * glow, 0.5f * glow, 0.1f);
         
         // Draw flame as a cone
-        glutSolidCone(0.15f, 0.4f * (0.8f + 0.2f * glow), 8, 4);
+        solidCone(0.15f, 0.4f * (0.8f + 0.2f * glow), 8, 4);
         
         // Reset emission
         GLfloat noEmission[] = { 0.0f, 0.0f, 0.0f, 1.0f };
-        glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, noEmission);
+        renderState.material(GL_EMISSION, noEmission);
         
         gluDeleteQuadric(quad);
         glPopMatrix();
         glPopMatrix();
     }
     
-    void drawCrystal(Crystal& crystal) {
+    void drawCrystal(const Crystal& crystal, const RenderView& view) {
         glPushMatrix();
         
         // Apply bobbing animation
-        float bobOffset = sin(animationTime * 2.0f + crystal.bobPhase) * 0.2f;
-        glTranslatef(crystal.position.x, crystal.position.y + bobOffset, crystal.position.z);
+        float bobOffset = sin(view.time * 2.0f + crystal.bobPhase) * 0.2f;
+        glTranslatef(crystal.agent.position.x, crystal.agent.position.y + bobOffset, crystal.agent.position.z);
         
-        // Rotate crystal slowly
-        crystal.rotation += 1.0f;
-        if (crystal.rotation > 360.0f) crystal.rotation -= 360.0f;
-        glRotatef(crystal.rotation, 0.0f, 1.0f, 0.0f);
+        // Spin (advanced in update())
+        glRotatef(crystal.agent.renderHeading(view.alpha), 0.0f, 1.0f, 0.0f);
         
         // Enable amethyst texture
-        glEnable(GL_TEXTURE_2D);
+        renderState.enable(GL_TEXTURE_2D);
         if (amethystTexture) {
-            glBindTexture(GL_TEXTURE_2D, amethystTexture);
+            renderState.bindTexture(amethystTexture);
         }
         
         // Purple glowing material with texture
-        float glowPulse = 0.7f + 0.3f * sin(animationTime * 3.0f + crystal.bobPhase);
+        float glowPulse = 0.7f + 0.3f * sin(view.time * 3.0f + crystal.bobPhase);
         GLfloat crystalDiffuse[] = { 1.0f * glowPulse, 1.0f * glowPulse, 1.0f * glowPulse, 0.95f };
         GLfloat crystalAmbient[] = { 0.6f * glowPulse, 0.4f * glowPulse, 0.7f * glowPulse, 0.95f };
         GLfloat crystalEmission[] = { 0.3f * glowPulse, 0.15f * glowPulse, 0.4f * glowPulse, 1.0f };
         GLfloat crystalSpecular[] = { 1.0f, 0.9f, 1.0f, 1.0f };
         
-        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, crystalDiffuse);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, crystalAmbient);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, crystalEmission);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, crystalSpecular);
-        glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 100.0f);
+        renderState.material(GL_DIFFUSE, crystalDiffuse);
+        renderState.material(GL_AMBIENT, crystalAmbient);
+        renderState.material(GL_EMISSION, crystalEmission);
+        renderState.material(GL_SPECULAR, crystalSpecular);
+        renderState.shininess(100.0f);
         
         glColor4f(1.0f * glowPulse, 1.0f * glowPulse, 1.0f * glowPulse, 0.95f);
         
@@ -4554,25 +10761,16 @@ private:
         glEnd();
         
         // Disable texture
-        glDisable(GL_TEXTURE_2D);
+        renderState.disable(GL_TEXTURE_2D);
         
         // Reset emission
         GLfloat noEmission[] = { 0.0f, 0.0f, 0.0f, 1.0f };
-        glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, noEmission);
+        renderState.material(GL_EMISSION, noEmission);
         
         glPopMatrix();
     }
 };
 
-// Static collision check function for Scene2 (only blocks on walls and stones)
-bool scene2CollisionCheck(float x, float z, float radius) {
-    if (scene2Instance) {
-        lastScene2CollisionType = scene2Instance->checkSceneCollision(x, z, radius);
-        return lastScene2CollisionType != 0;  // Only walls (3) and stones (1) block movement
-    }
-    return false;
-}
-
 // ============================================================================
 // SCENE MANAGER
 // ============================================================================
@@ -4582,15 +10780,18 @@ Scene* scene2 = nullptr;
 Scene* currentScenePtr = nullptr;
 
 void initScenes() {
+    PROFILE_SCOPE("initScenes");
     scene1 = new Scene1_CaveEntrance();
     scene2 = new Scene2_DeepCavern();
     
+    // Scenes queue their assets; wait here while the GL thread uploads them
     scene1->init();
     scene2->init();
+    assetLoader.finish();
     
     currentScenePtr = scene1;
     currentScene = 1;
-    sceneCollisionCheck = scene1CollisionCheck;  // Set collision check for scene 1
+    collisionWorld = scene1;
     
     // Start background music for Scene 1
     playBackgroundMusic("nature.wav");
@@ -4604,12 +10805,12 @@ void switchScene(int sceneNumber) {
     if (sceneNumber == 1) {
         currentScenePtr = scene1;
         currentScene = 1;
-        sceneCollisionCheck = scene1CollisionCheck;
+        collisionWorld = scene1;
         playBackgroundMusic("nature.wav");  // Play nature background music for Scene 1
     } else if (sceneNumber == 2) {
         currentScenePtr = scene2;
         currentScene = 2;
-        sceneCollisionCheck = scene2CollisionCheck;  // Collision with stones, traps, walls
+        collisionWorld = scene2;  // Walls and stones block; traps and lava are reported
         playBackgroundMusic("lava.wav");  // Play lava background music for Scene 2
     }
 }
@@ -4625,11 +10826,179 @@ void cleanupScenes() {
     }
 }
 
+// ============================================================================
+// PERF OVERLAY - Frame-time graph and GL counters drawn over the HUD
+// ============================================================================
+
+// Toggled with 'O' (or --perf-overlay). Shows the recent frame times as a
+// graph against the 60 and 30 fps lines, the last frame's simulation and
+// render time, glCounter's totals, live particles, and the render sections
+// that cost the most. Render sections are only timed while it is showing.
+class PerfOverlay {
+public:
+    static constexpr int HISTORY = 120;   // Frames in the graph
+    static constexpr int TOP_SECTIONS = 8;
+    
+    PerfOverlay() : visible(false), next(0), filled(0), pendingSimulationMs(0.0), simulationMs(0.0),
+                    renderMs(0.0), haveLastFrame(false) {
+        frameHistory.fill(0.0f);
+    }
+    
+    void setVisible(bool on) {
+        visible = on;
+        RenderSection::collecting = on;
+    }
+    bool isVisible() const { return visible; }
+    
+    // Simulation steps run since the last rendered frame
+    void addSimulationTime(double ms) { pendingSimulationMs += ms; }
+    
+    // Top of display()
+    void beginFrame() {
+        glCounter.reset();
+        RenderSection::frame.clear();
+        frameStart = renderEnd = std::chrono::steady_clock::now();
+    }
+    
+    // Drawing done, before the buffer swap; the swap waits for vsync in
+    // LOOP_VSYNC, so it counts toward the frame time but not render time
+    void endRender() {
+        renderEnd = std::chrono::steady_clock::now();
+    }
+    
+    // End of display(): keep this frame's numbers for the next overlay
+    void endFrame() {
+        auto now = std::chrono::steady_clock::now();
+        renderMs = std::chrono::duration<double, std::milli>(renderEnd - frameStart).count();
+        double frameMs = haveLastFrame ? std::chrono::duration<double, std::milli>(now - lastFrameEnd).count() : renderMs;
+        lastFrameEnd = now;
+        haveLastFrame = true;
+        
+        frameHistory[next] = (float)frameMs;
+        next = (next + 1) % HISTORY;
+        filled = std::min(filled + 1, HISTORY);
+        simulationMs = pendingSimulationMs;
+        pendingSimulationMs = 0.0;
+        
+        counts = glCounter.totals();
+        sections = RenderSection::frame;
+        GLCallCounts attributed;
+        double attributedMs = 0.0;
+        for (const auto& section : sections) {
+            attributed += section.counts;
+            attributedMs += section.ms;
+        }
+        sections.push_back({ "(other)", counts - attributed, std::max(0.0, renderMs - attributedMs) });
+        std::sort(sections.begin(), sections.end(),
+                  [](const RenderSectionStats& a, const RenderSectionStats& b) { return a.ms > b.ms; });
+    }
+    
+    // Draw in the bottom right corner; call inside renderHUD's 2D projection
+    void draw() const {
+        if (!visible) return;
+        const float width = 380.0f;
+        const float graphHeight = 80.0f;
+        const float lineHeight = 14.0f;
+        const int textLines = 4 + std::min((int)sections.size(), TOP_SECTIONS);
+        const float height = graphHeight + textLines * lineHeight + 24.0f;
+        const float left = windowWidth - width - 10.0f;
+        const float bottom = 10.0f;
+        
+        // Backing panel
+        renderState.disable(GL_TEXTURE_2D);
+        renderState.enable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glColor4f(0.0f, 0.0f, 0.0f, 0.6f);
+        glBegin(GL_QUADS);
+        glVertex2f(left, bottom);
+        glVertex2f(left + width, bottom);
+        glVertex2f(left + width, bottom + height);
+        glVertex2f(left, bottom + height);
+        glEnd();
+        renderState.disable(GL_BLEND);
+        
+        // Frame-time bars, oldest on the left; 50 ms fills the graph
+        const float graphLeft = left + 8.0f;
+        const float graphBottom = bottom + 8.0f;
+        const float barWidth = (width - 16.0f) / HISTORY;
+        const float msScale = graphHeight / 50.0f;
+        glBegin(GL_QUADS);
+        for (int i = 0; i < filled; i++) {
+            float ms = frameHistory[(next - filled + i + HISTORY) % HISTORY];
+            if (ms <= 1000.0f / 60.0f) glColor3f(0.3f, 0.9f, 0.3f);
+            else if (ms <= 1000.0f / 30.0f) glColor3f(0.95f, 0.8f, 0.2f);
+            else glColor3f(0.95f, 0.3f, 0.25f);
+            float x = graphLeft + (HISTORY - filled + i) * barWidth;
+            float top = graphBottom + std::min(ms, 50.0f) * msScale;
+            glVertex2f(x, graphBottom);
+            glVertex2f(x + barWidth - 1.0f, graphBottom);
+            glVertex2f(x + barWidth - 1.0f, top);
+            glVertex2f(x, top);
+        }
+        glEnd();
+        
+        // 60 and 30 fps budget lines
+        glColor3f(0.7f, 0.7f, 0.7f);
+        glBegin(GL_LINES);
+        for (float budget : { 1000.0f / 60.0f, 1000.0f / 30.0f }) {
+            glVertex2f(graphLeft, graphBottom + budget * msScale);
+            glVertex2f(graphLeft + HISTORY * barWidth, graphBottom + budget * msScale);
+        }
+        glEnd();
+        
+        // Text, top down
+        char line[128];
+        float y = bottom + height - lineHeight - 2.0f;
+        auto text = [&](float r, float g, float b) {
+            drawText(GLUT_BITMAP_8_BY_13, left + 8.0f, y, line, r, g, b);
+            y -= lineHeight;
+        };
+        
+        float lastFrameMs = filled > 0 ? frameHistory[(next - 1 + HISTORY) % HISTORY] : 0.0f;
+        snprintf(line, sizeof(line), "frame %5.1f ms (%3.0f fps)  sim %4.2f ms  render %5.2f ms",
+                 lastFrameMs, lastFrameMs > 0.0f ? 1000.0f / lastFrameMs : 0.0f, simulationMs, renderMs);
+        text(1.0f, 1.0f, 1.0f);
+        snprintf(line, sizeof(line), "draws %zu  tris %zu  lists %zu  binds %zu  mtl %zu",
+                 counts.drawCalls, counts.triangles, counts.listCalls, counts.textureBinds, counts.materialCalls);
+        text(1.0f, 1.0f, 1.0f);
+        snprintf(line, sizeof(line), "particles: %zu sparkles, %zu flames", sparkles.size(), flames.size());
+        text(1.0f, 1.0f, 1.0f);
+        snprintf(line, sizeof(line), "%-14s %7s %6s %8s %6s", "section", "ms", "draws", "tris", "binds");
+        text(0.6f, 0.8f, 1.0f);
+        for (int i = 0; i < (int)sections.size() && i < TOP_SECTIONS; i++) {
+            const RenderSectionStats& section = sections[i];
+            snprintf(line, sizeof(line), "%-14.14s %7.2f %6zu %8zu %6zu", section.name, section.ms,
+                     section.counts.drawCalls, section.counts.triangles, section.counts.textureBinds);
+            text(0.85f, 0.85f, 0.85f);
+        }
+    }
+    
+private:
+    bool visible;
+    std::array<float, HISTORY> frameHistory;  // Ring, newest at next - 1
+    int next;
+    int filled;
+    double pendingSimulationMs;
+    double simulationMs;
+    double renderMs;
+    GLCallCounts counts;
+    std::vector<RenderSectionStats> sections;  // Slowest first, plus "(other)"
+    std::chrono::steady_clock::time_point frameStart;
+    std::chrono::steady_clock::time_point renderEnd;
+    std::chrono::steady_clock::time_point lastFrameEnd;
+    bool haveLastFrame;
+};
+
+PerfOverlay perfOverlay;
+
 // ============================================================================
 // HUD RENDERING
 // ============================================================================
 
 void renderHUD() {
+    PROFILE_SCOPE("renderHUD");
+    PROFILE_GPU_SCOPE("renderHUD");
+    
     // Switch to 2D orthographic projection for HUD
     glMatrixMode(GL_PROJECTION);
     glPushMatrix();
@@ -4641,27 +11010,22 @@ void renderHUD() {
     glLoadIdentity();
     
     // Disable lighting for HUD
-    glDisable(GL_LIGHTING);
-    glDisable(GL_DEPTH_TEST);
+    renderState.disable(GL_LIGHTING);
+    renderState.disable(GL_DEPTH_TEST);
     
     // Draw scene indicator
-    glColor3f(1.0f, 1.0f, 1.0f);
-    
     std::string sceneText = "Scene " + std::to_string(currentScene) + ": " + currentScenePtr->name;
-    glRasterPos2f(10, windowHeight - 30);
-    for (char c : sceneText) {
-        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, c);
-    }
+    drawText(GLUT_BITMAP_HELVETICA_18, 10, windowHeight - 30, sceneText, 1.0f, 1.0f, 1.0f);
+    
+    // Hints and score are white, or the crystal icon's purple in scene 2
+    float hintR = 1.0f, hintG = 1.0f, hintB = 1.0f;
     
     // Draw crystal counter at top center
     if (currentScene == 2) {
-        glColor3f(0.8f, 0.4f, 1.0f);  // Purple color for crystals
         std::string crystalText = "Crystals: " + std::to_string(crystalsCollected) + "/10";
         int textWidth = crystalText.length() * 10;  // Approximate width
-        glRasterPos2f(windowWidth / 2 - textWidth / 2, windowHeight - 30);
-        for (char c : crystalText) {
-            glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, c);
-        }
+        drawText(GLUT_BITMAP_HELVETICA_18, windowWidth / 2 - textWidth / 2, windowHeight - 30, crystalText,
+                 0.8f, 0.4f, 1.0f);  // Purple color for crystals
         
         // Draw small crystal icon next to counter
         float iconX = windowWidth / 2 - textWidth / 2 - 25.0f;
@@ -4679,28 +11043,22 @@ void renderHUD() {
         glVertex2f(iconX, iconY - iconSize);
         glVertex2f(iconX + iconSize, iconY);
         glEnd();
+        hintR = 0.7f;
+        hintG = 0.3f;
+        hintB = 0.9f;
     }
     
     // Draw controls hint
     std::string controlsText = "1: Third Person | 2: First Person | 3/4: Switch Scenes | T: Toggle | Mouse: Look";
-    glRasterPos2f(10, windowHeight - 55);
-    for (char c : controlsText) {
-        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, c);
-    }
+    drawText(GLUT_BITMAP_HELVETICA_12, 10, windowHeight - 55, controlsText, hintR, hintG, hintB);
     
     // Draw view mode
     std::string viewText = "View: " + std::string(player.isFirstPerson ? "First Person" : "Third Person");
-    glRasterPos2f(10, windowHeight - 80);
-    for (char c : viewText) {
-        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, c);
-    }
+    drawText(GLUT_BITMAP_HELVETICA_12, 10, windowHeight - 80, viewText, hintR, hintG, hintB);
     
     // Draw score
     std::string scoreText = "Score: " + std::to_string(score);
-    glRasterPos2f(10, 30);
-    for (char c : scoreText) {
-        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, c);
-    }
+    drawText(GLUT_BITMAP_HELVETICA_18, 10, 30, scoreText, hintR, hintG, hintB);
     
     // Draw hearts (lives) in top right corner - 5 hearts total (Minecraft style - pixelated)
     float heartSpacing = 20.0f;
@@ -4802,12 +11160,8 @@ void renderHUD() {
         glEnd();
         
         // Key text
-        glColor3f(1.0f, 0.84f, 0.0f);
         std::string keyText = "Key Collected!";
-        glRasterPos2f(windowWidth - 130, windowHeight - 100);
-        for (char c : keyText) {
-            glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, c);
-        }
+        drawText(GLUT_BITMAP_HELVETICA_12, windowWidth - 130, windowHeight - 100, keyText, 1.0f, 0.84f, 0.0f);
     }
     
     // Draw crosshair in center of screen
@@ -4843,7 +11197,7 @@ void renderHUD() {
     // Draw damage flash if recently hit
     if (trapDamageCooldown > 1.2f) {
         glColor4f(1.0f, 0.0f, 0.0f, 0.3f);  // Semi-transparent red
-        glEnable(GL_BLEND);
+        renderState.enable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
         glBegin(GL_QUADS);
         glVertex2f(0, 0);
@@ -4851,62 +11205,591 @@ void renderHUD() {
         glVertex2f(windowWidth, windowHeight);
         glVertex2f(0, windowHeight);
         glEnd();
-        glDisable(GL_BLEND);
+        renderState.disable(GL_BLEND);
     }
     
     // Draw game over message if dead
     if (lives <= 0) {
-        glColor3f(1.0f, 0.0f, 0.0f);
         std::string gameOverText = "GAME OVER!";
-        glRasterPos2f(windowWidth / 2 - 60, windowHeight / 2);
-        for (char c : gameOverText) {
-            glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_24, c);
-        }
-        glColor3f(1.0f, 1.0f, 1.0f);
+        drawText(GLUT_BITMAP_TIMES_ROMAN_24, windowWidth / 2 - 60, windowHeight / 2, gameOverText, 1.0f, 0.0f, 0.0f);
         std::string restartText = "Press R to restart";
-        glRasterPos2f(windowWidth / 2 - 80, windowHeight / 2 - 30);
-        for (char c : restartText) {
-            glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, c);
+        drawText(GLUT_BITMAP_HELVETICA_18, windowWidth / 2 - 80, windowHeight / 2 - 30, restartText, 1.0f, 1.0f, 1.0f);
+    }
+    
+    // Draw YOU WIN message if all crystals collected
+    if (gameWon) {
+        std::string winText = "YOU WIN!";
+        drawText(GLUT_BITMAP_TIMES_ROMAN_24, windowWidth / 2 - 50, windowHeight / 2 + 40, winText,
+                 0.8f, 0.4f, 1.0f);  // Purple color
+        std::string winSubText = "All Crystals Collected!";
+        drawText(GLUT_BITMAP_HELVETICA_18, windowWidth / 2 - 90, windowHeight / 2 + 10, winSubText, 1.0f, 1.0f, 1.0f);
+        std::string congratsText = "Congratulations!";
+        drawText(GLUT_BITMAP_HELVETICA_18, windowWidth / 2 - 70, windowHeight / 2 - 20, congratsText, 1.0f, 1.0f, 1.0f);
+    }
+    
+    // Frame times and GL counters ('O')
+    perfOverlay.draw();
+    
+    // All of the above text in one draw
+    textRenderer.flush();
+    
+    // Restore matrices first
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopMatrix();
+    
+    // Re-enable lighting and depth test AFTER restoring matrices
+    renderState.enable(GL_DEPTH_TEST);
+    renderState.enable(GL_LIGHTING);
+}
+
+// ============================================================================
+// INPUT RECORDING - Per-step input log for deterministic replay
+// ============================================================================
+
+// Usage: crystalcaves --record session.ccrec [--seed N]
+//        crystalcaves --replay session.ccrec [--bench]
+// The simulation only advances in fixed steps and draws its random numbers
+// from seeded streams, so a session is fully described by its seed and the
+// gameplay input that arrived before each step: key presses and releases,
+// the look angles after mouse or arrow-key turns, and left clicks. A replay
+// feeds that input back before the same steps, one step per rendered frame
+// as fast as the machine allows (headless with --bench), so the same run
+// can be timed before and after a change.
+//
+// File layout (little-endian): "CCRP", u32 version, u64 seed, u32 checksum
+// interval, then records of a one-byte op and its payload:
+//   STEPS u16 n          run n simulation steps
+//   KEY_DOWN / KEY_UP u8 key
+//   LOOK f32 yaw, f32 pitch
+//   CLICK                left click at the current view
+//   CHECKSUM u32 step, u64 hash of the simulation state after that step
+const char INPUT_LOG_MAGIC[4] = { 'C', 'C', 'R', 'P' };
+const uint32_t INPUT_LOG_VERSION = 1;
+const uint32_t CHECKSUM_INTERVAL = 60;  // Steps between state hashes (about a second)
+
+enum InputOp : uint8_t {
+    INPUT_STEPS = 1,
+    INPUT_KEY_DOWN = 2,
+    INPUT_KEY_UP = 3,
+    INPUT_LOOK = 4,
+    INPUT_CLICK = 5,
+    INPUT_CHECKSUM = 6
+};
+
+// Input callbacks, replayed through the same code paths (defined with the
+// other callbacks)
+void keyboard(unsigned char key, int x, int y);
+void keyboardUp(unsigned char key, int x, int y);
+void mouseClick(int button, int state, int x, int y);
+
+// Hash of everything the simulation step advances
+uint64_t simulationChecksum() {
+    StateHash hash;
+    hash.add(player.position);
+    hash.add(player.yaw);
+    hash.add(player.pitch);
+    hash.add(player.bodyYaw);
+    hash.add(player.velocityY);
+    hash.add(player.groundLevel);
+    hash.add(player.walkAnimation);
+    hash.add(player.isJumping);
+    hash.add(player.isOnGround);
+    hash.add(player.isFirstPerson);
+    hash.add(lives);
+    hash.add(score);
+    hash.add(crystalsCollected);
+    hash.add(hasKey);
+    hash.add(chestOpened);
+    hash.add(portalOpened);
+    hash.add(gameWon);
+    hash.add(currentScene);
+    hash.add(trapDamageCooldown);
+    hash.add(portalCooldown);
+    hash.add(animationTime);
+    hash.add(portalTime);
+    for (const Sparkle& sparkle : sparkles) {
+        hash.add(sparkle.position);
+        hash.add(sparkle.lifetime);
+    }
+    for (const Flame& flame : flames) {
+        hash.add(flame.position);
+        hash.add(flame.lifetime);
+    }
+    hash.add(mobRandom.getState());
+    hash.add(batRandom.getState());
+    hash.add(effectRandom.getState());
+    if (scene1) scene1->hashState(hash);
+    if (scene2) scene2->hashState(hash);
+    return hash.value;
+}
+
+class InputLog {
+public:
+    ~InputLog() { stopRecording(); }
+    
+    bool isRecording() const { return recording; }
+    bool isReplaying() const { return replaying; }
+    
+    // Replays drive the keys that change the simulation; live presses of
+    // these are dropped while one runs
+    static bool isGameplayKey(unsigned char key) {
+        return strchr("1234tTrRwWaAsSdD ", key) != nullptr && key != 0;
+    }
+    
+    bool startRecording(const std::string& path) {
+        out.open(path, std::ios::binary);
+        if (!out) {
+            std::cerr << "Cannot record input to " << path << std::endl;
+            return false;
+        }
+        out.write(INPUT_LOG_MAGIC, 4);
+        writeValue(INPUT_LOG_VERSION);
+        writeValue(simulationSeed);
+        writeValue(CHECKSUM_INTERVAL);
+        recordPath = path;
+        recording = true;
+        std::cout << "Recording input to " << path << " (seed " << simulationSeed << ")" << std::endl;
+        return true;
+    }
+    
+    // Read a recording; its seed becomes the session seed
+    bool loadReplay(const std::string& path) {
+        MappedFile file;
+        if (!file.open(path)) {
+            std::cerr << "Cannot open replay " << path << std::endl;
+            return false;
+        }
+        data.assign(file.data, file.data + file.size);
+        uint32_t version = 0, interval = 0;
+        uint64_t seed = 0;
+        cursor = 4;
+        if (data.size() < 20 || memcmp(data.data(), INPUT_LOG_MAGIC, 4) != 0 ||
+            !readValue(version) || version != INPUT_LOG_VERSION || !readValue(seed) || !readValue(interval)) {
+            std::cerr << "Replay " << path << " is not a version " << INPUT_LOG_VERSION << " input log" << std::endl;
+            return false;
+        }
+        headerSize = cursor;
+        
+        // Count the steps up front so the replay knows where it ends
+        totalSteps = 0;
+        while (cursor < data.size()) {
+            uint8_t op = data[cursor++];
+            size_t payload = payloadSize(op);
+            if (payload == SIZE_MAX || cursor + payload > data.size()) {
+                std::cerr << "Replay " << path << " is damaged at byte " << cursor - 1 << std::endl;
+                return false;
+            }
+            if (op == INPUT_STEPS) {
+                uint16_t count = 0;
+                memcpy(&count, &data[cursor], sizeof(count));
+                totalSteps += count;
+            }
+            cursor += payload;
         }
+        cursor = headerSize;
+        seedSimulationRandom(seed);
+        replaying = true;
+        std::cout << "Replaying " << path << ": " << totalSteps << " steps, seed " << seed << std::endl;
+        return true;
+    }
+    
+    // Live input from the GLUT callbacks. The key and click hooks return
+    // false when a replay owns the input and the event should be dropped.
+    bool onKey(unsigned char key, bool down) {
+        if (!isGameplayKey(key)) return true;
+        if (replaying) return applying;
+        if (recording) {
+            writeOp(down ? INPUT_KEY_DOWN : INPUT_KEY_UP);
+            writeValue((uint8_t)key);
+        }
+        return true;
+    }
+    
+    bool onClick() {
+        if (replaying) return applying;
+        if (recording) writeOp(INPUT_CLICK);
+        return true;
+    }
+    
+    bool acceptsLook() const { return !replaying; }
+    
+    void onLook(float yaw, float pitch) {
+        if (!recording) return;
+        writeOp(INPUT_LOOK);
+        writeValue(yaw);
+        writeValue(pitch);
+    }
+    
+    // Apply the input recorded before the coming step
+    void beforeStep() {
+        if (!replaying || pendingSteps > 0) {
+            if (pendingSteps > 0) pendingSteps--;
+            return;
+        }
+        applying = true;
+        while (pendingSteps == 0 && cursor < data.size()) applyRecord();
+        applying = false;
+        if (pendingSteps > 0) pendingSteps--;
+    }
+    
+    void afterStep() {
+        steps++;
+        if (recording) {
+            unflushedSteps++;
+            if (unflushedSteps == 0xFFFF) flushSteps();
+            if (steps % CHECKSUM_INTERVAL == 0) writeChecksum();
+        } else if (replaying && steps == totalSteps) {
+            // Verify the hashes stored after the last step
+            while (cursor < data.size()) {
+                uint8_t op = data[cursor];
+                if (op == INPUT_CHECKSUM) applyRecord();
+                else cursor += 1 + payloadSize(op);
+            }
+        }
+    }
+    
+    bool replayFinished() const { return replaying && steps >= totalSteps; }
+    int64_t stepCount() const { return steps; }
+    int checksumsVerified() const { return verified; }
+    int checksumMismatches() const { return mismatches; }
+    
+    void stopRecording() {
+        if (!recording) return;
+        flushSteps();
+        if (steps % CHECKSUM_INTERVAL != 0) writeChecksum();
+        std::cout << "Recorded " << steps << " steps to " << recordPath << " (" << out.tellp() << " bytes)" << std::endl;
+        out.close();
+        recording = false;
+    }
+    
+    void printReplaySummary() const {
+        std::cout << "Replay: " << steps << " steps, " << verified << " checksums matched, "
+                  << mismatches << " mismatched";
+        if (mismatches > 0) std::cout << " (first at step " << firstMismatchStep << ")";
+        std::cout << std::endl;
+    }
+    
+private:
+    bool recording = false;
+    bool replaying = false;
+    bool applying = false;  // Inside beforeStep, feeding recorded input
+    int64_t steps = 0;
+    
+    std::ofstream out;
+    std::string recordPath;
+    uint32_t unflushedSteps = 0;
+    
+    std::vector<uint8_t> data;
+    size_t cursor = 0;
+    size_t headerSize = 0;
+    int64_t totalSteps = 0;
+    uint32_t pendingSteps = 0;
+    int verified = 0;
+    int mismatches = 0;
+    int64_t firstMismatchStep = -1;
+    
+    static size_t payloadSize(uint8_t op) {
+        switch (op) {
+            case INPUT_STEPS: return 2;
+            case INPUT_KEY_DOWN:
+            case INPUT_KEY_UP: return 1;
+            case INPUT_LOOK: return 8;
+            case INPUT_CLICK: return 0;
+            case INPUT_CHECKSUM: return 12;
+        }
+        return SIZE_MAX;
+    }
+    
+    template <typename T>
+    void writeValue(const T& value) { out.write((const char*)&value, sizeof(value)); }
+    
+    template <typename T>
+    bool readValue(T& value) {
+        if (cursor + sizeof(value) > data.size()) return false;
+        memcpy(&value, &data[cursor], sizeof(value));
+        cursor += sizeof(value);
+        return true;
+    }
+    
+    // Steps since the last event go out as one run before it
+    void flushSteps() {
+        if (unflushedSteps == 0) return;
+        out.put((char)INPUT_STEPS);
+        writeValue((uint16_t)unflushedSteps);
+        unflushedSteps = 0;
+    }
+    
+    void writeOp(InputOp op) {
+        flushSteps();
+        out.put((char)op);
+    }
+    
+    void writeChecksum() {
+        writeOp(INPUT_CHECKSUM);
+        writeValue((uint32_t)steps);
+        writeValue(simulationChecksum());
     }
     
-    // Draw YOU WIN message if all crystals collected
-    if (gameWon) {
-        glColor3f(0.8f, 0.4f, 1.0f);  // Purple color
-        std::string winText = "YOU WIN!";
-        glRasterPos2f(windowWidth / 2 - 50, windowHeight / 2 + 40);
-        for (char c : winText) {
-            glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_24, c);
-        }
-        glColor3f(1.0f, 1.0f, 1.0f);
-        std::string winSubText = "All Crystals Collected!";
-        glRasterPos2f(windowWidth / 2 - 90, windowHeight / 2 + 10);
-        for (char c : winSubText) {
-            glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, c);
+    void applyRecord() {
+        uint8_t op = data[cursor++];
+        switch (op) {
+            case INPUT_STEPS: {
+                uint16_t count = 0;
+                readValue(count);
+                pendingSteps = count;
+                break;
+            }
+            case INPUT_KEY_DOWN:
+            case INPUT_KEY_UP: {
+                uint8_t key = 0;
+                readValue(key);
+                if (op == INPUT_KEY_DOWN) keyboard(key, 0, 0);
+                else keyboardUp(key, 0, 0);
+                break;
+            }
+            case INPUT_LOOK:
+                readValue(player.yaw);
+                readValue(player.pitch);
+                break;
+            case INPUT_CLICK:
+                mouseClick(GLUT_LEFT_BUTTON, GLUT_DOWN, 0, 0);
+                break;
+            case INPUT_CHECKSUM: {
+                uint32_t step = 0;
+                uint64_t expected = 0;
+                readValue(step);
+                readValue(expected);
+                if (step == steps && simulationChecksum() == expected) {
+                    verified++;
+                } else {
+                    if (mismatches == 0) {
+                        firstMismatchStep = step;
+                        std::cerr << "Replay diverged from the recording at step " << step << std::endl;
+                    }
+                    mismatches++;
+                }
+                break;
+            }
         }
-        std::string congratsText = "Congratulations!";
-        glRasterPos2f(windowWidth / 2 - 70, windowHeight / 2 - 20);
-        for (char c : congratsText) {
-            glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, c);
+    }
+};
+
+InputLog inputLog;
+
+// ============================================================================
+// GAME LOOP - Fixed-timestep simulation with interpolated rendering
+// ============================================================================
+
+// The simulation always advances in SIMULATION_STEP increments (the old
+// timer's 16 ms, which movement speeds are tuned for). Each frame measures
+// real elapsed time, runs as many steps as fit, and renders everything
+// blended between the last two steps by the leftover fraction (RenderView).
+const float SIMULATION_STEP = 0.016f;
+const double MAX_FRAME_DELTA = 0.25;  // Longer stalls are dropped, not caught up
+
+// How frames are paced
+enum LoopMode {
+    LOOP_UNCAPPED,    // Render as fast as possible, swap interval 0
+    LOOP_VSYNC,       // Render from idle, swaps wait for the display refresh
+    LOOP_FIXED_RATE   // Render on a timer at targetFps, swap interval 0
+};
+
+const char* loopModeName(LoopMode mode) {
+    switch (mode) {
+        case LOOP_UNCAPPED: return "uncapped";
+        case LOOP_VSYNC: return "vsync";
+        case LOOP_FIXED_RATE: return "fixed rate";
+    }
+    return "unknown";
+}
+
+// Frame and simulation-step counters since the last reset
+struct GameLoopStats {
+    int frames = 0;
+    int simulationSteps = 0;
+    int maxStepsPerFrame = 0;
+    double frameTimeMs = 0.0;       // Sum of measured frame deltas
+    double worstFrameMs = 0.0;
+    double droppedMs = 0.0;         // Time discarded by the MAX_FRAME_DELTA clamp
+    
+    double averageFrameMs() const { return frames > 0 ? frameTimeMs / frames : 0.0; }
+    double framesPerSecond() const { return frameTimeMs > 0.0 ? frames * 1000.0 / frameTimeMs : 0.0; }
+    double stepsPerSecond() const { return frameTimeMs > 0.0 ? simulationSteps * 1000.0 / frameTimeMs : 0.0; }
+};
+
+// Forward declarations - one simulation step and the end of a replay,
+// defined with the callbacks
+void simulationStep(float deltaTime);
+void onReplayFinished();
+
+// Ask the driver for a swap interval (0 = no vsync). Returns false when the
+// platform offers no way to set it.
+bool setSwapInterval(int interval) {
+#if defined(__APPLE__)
+    GLint value = interval;
+    return CGLSetParameter(CGLGetCurrentContext(), kCGLCPSwapInterval, &value) == kCGLNoError;
+#else
+    typedef int (*SwapIntervalFunc)(int);
+#if defined(_WIN32)
+    SwapIntervalFunc swapInterval = (SwapIntervalFunc)getGLProcAddress("wglSwapIntervalEXT");
+    return swapInterval && swapInterval(interval) != 0;
+#else
+    // SGI rejects 0, so uncapped keeps the driver default there
+    for (const char* name : { "glXSwapIntervalMESA", "glXSwapIntervalSGI" }) {
+        SwapIntervalFunc swapInterval = (SwapIntervalFunc)getGLProcAddress(name);
+        if (swapInterval && swapInterval(interval) == 0) return true;
+    }
+    return false;
+#endif
+#endif
+}
+
+class GameLoop {
+public:
+    GameLoop() : mode(LOOP_VSYNC), targetFps(60), accumulator(0.0), alpha(1.0f), generation(0) {}
+    
+    // Select the pacing mode; takes effect immediately once running
+    void setMode(LoopMode newMode, int fps = 0) {
+        mode = newMode;
+        if (fps > 0) targetFps = fps;
+        if (running) start();
+    }
+    
+    LoopMode getMode() const { return mode; }
+    int getTargetFps() const { return targetFps; }
+    
+    // Run exactly one simulation step per frame, however long frames take
+    // (replays, so every recorded step is rendered)
+    void setLockstep(bool on) { lockstep = on; }
+    
+    // Register the GLUT callbacks for the current mode (window must exist)
+    void start() {
+        running = true;
+        generation++;  // Orphans any timer armed by the previous mode
+        // The timer paces fixed rate, so swaps must not also wait for vsync
+        if (!setSwapInterval(mode == LOOP_VSYNC ? 1 : 0)) {
+            std::cerr << "Warning: cannot set the swap interval, " << loopModeName(mode)
+                      << " uses the driver default" << std::endl;
+        }
+        lastTime = std::chrono::steady_clock::now();
+        nextDeadline = lastTime;
+        if (mode == LOOP_FIXED_RATE) {
+            glutIdleFunc(nullptr);
+            glutTimerFunc(0, onTimer, generation);
+        } else {
+            glutIdleFunc(onIdle);
+        }
+        std::cout << "Game loop: " << loopModeName(mode);
+        if (mode == LOOP_FIXED_RATE) std::cout << " at " << targetFps << " fps";
+        std::cout << ", simulation step " << SIMULATION_STEP * 1000.0f << " ms" << std::endl;
+    }
+    
+    // Measure the frame, run the due simulation steps and request a redraw
+    void tick() {
+        PROFILE_SCOPE("GameLoop::tick");
+        auto now = std::chrono::steady_clock::now();
+        double delta = std::chrono::duration<double>(now - lastTime).count();
+        lastTime = now;
+        
+        stats.frames++;
+        stats.frameTimeMs += delta * 1000.0;
+        stats.worstFrameMs = std::max(stats.worstFrameMs, delta * 1000.0);
+        if (delta > MAX_FRAME_DELTA) {
+            stats.droppedMs += (delta - MAX_FRAME_DELTA) * 1000.0;
+            delta = MAX_FRAME_DELTA;
+        }
+        
+        accumulator += delta;
+        if (lockstep) accumulator = SIMULATION_STEP;
+        int steps = 0;
+        auto simulationStart = std::chrono::steady_clock::now();
+        while (accumulator >= SIMULATION_STEP) {
+            simulationStep(SIMULATION_STEP);
+            accumulator -= SIMULATION_STEP;
+            steps++;
+        }
+        perfOverlay.addSimulationTime(std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - simulationStart).count());
+        stats.simulationSteps += steps;
+        stats.maxStepsPerFrame = std::max(stats.maxStepsPerFrame, steps);
+        alpha = lockstep ? 1.0f : (float)(accumulator / SIMULATION_STEP);
+        
+        if (inputLog.replayFinished()) {
+            onReplayFinished();
+            return;
         }
+        glutPostRedisplay();
     }
     
-    // Restore matrices first
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
-    glMatrixMode(GL_MODELVIEW);
-    glPopMatrix();
+    // Fraction of a step elapsed since the last simulation step (0..1)
+    float interpolationAlpha() const { return alpha; }
     
-    // Re-enable lighting and depth test AFTER restoring matrices
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_LIGHTING);
+    const GameLoopStats& getStats() const { return stats; }
+    
+    void printStats() const {
+        if (stats.frames == 0) return;
+        std::cout << "Game loop (" << loopModeName(mode) << "): " << stats.frames << " frames, "
+                  << stats.framesPerSecond() << " fps, frame " << stats.averageFrameMs() << " ms avg / "
+                  << stats.worstFrameMs << " ms worst, " << stats.simulationSteps << " steps ("
+                  << stats.stepsPerSecond() << "/s, up to " << stats.maxStepsPerFrame << " per frame), "
+                  << stats.droppedMs << " ms dropped" << std::endl;
+    }
+    
+    void resetStats() { stats = GameLoopStats(); }
+    
+private:
+    LoopMode mode;
+    int targetFps;
+    bool running = false;
+    bool lockstep = false;
+    double accumulator;    // Seconds of real time not yet simulated
+    float alpha;
+    int generation;
+    std::chrono::steady_clock::time_point lastTime;
+    std::chrono::steady_clock::time_point nextDeadline;
+    GameLoopStats stats;
+    
+    static void onIdle();
+    static void onTimer(int timerGeneration);
+};
+
+GameLoop gameLoop;
+
+void GameLoop::onIdle() {
+    gameLoop.tick();
+}
+
+void GameLoop::onTimer(int timerGeneration) {
+    if (timerGeneration != gameLoop.generation || gameLoop.mode != LOOP_FIXED_RATE) return;
+    gameLoop.tick();
+    
+    // Schedule against absolute deadlines so timer rounding doesn't drift;
+    // after a long frame, restart the schedule instead of bursting
+    auto period = std::chrono::microseconds(1000000 / gameLoop.targetFps);
+    auto now = std::chrono::steady_clock::now();
+    gameLoop.nextDeadline += period;
+    if (gameLoop.nextDeadline < now) gameLoop.nextDeadline = now;
+    int waitMs = (int)std::chrono::duration_cast<std::chrono::milliseconds>(gameLoop.nextDeadline - now).count();
+    glutTimerFunc(waitMs, onTimer, timerGeneration);
 }
 
 // ============================================================================
 // OPENGL CALLBACKS
 // ============================================================================
 
+// Frame time accumulated for the current render path, reported when the
+// path is switched with 'V'
+double renderPathFrameTimeMs = 0.0;
+int renderPathFrames = 0;
+
 void display() {
+    PROFILE_SCOPE("display");
+    PROFILE_COLLECT_GPU();
+    perfOverlay.beginFrame();
+    auto frameStart = std::chrono::steady_clock::now();
+    
     // Set clear color based on current scene
     if (currentScene == 2) {
         // Dark dungeon - nearly black background
@@ -4919,29 +11802,49 @@ void display() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glLoadIdentity();
     
+    // Draw between the last two simulation steps
+    RenderView view;
+    view.alpha = gameLoop.interpolationAlpha();
+    view.time = animationTime - (1.0f - view.alpha) * SIMULATION_STEP;
+    
     // Setup camera based on player view
-    Vector3 eye, center;
-    player.getCameraTransform(eye, center);
+    player.getCameraTransform(view.eye, view.center, view.alpha);
     
     gluLookAt(
-        eye.x, eye.y, eye.z,        // Eye position
-        center.x, center.y, center.z, // Look at point
-        0.0f, 1.0f, 0.0f             // Up vector
+        view.eye.x, view.eye.y, view.eye.z,          // Eye position
+        view.center.x, view.center.y, view.center.z, // Look at point
+        0.0f, 1.0f, 0.0f                             // Up vector
     );
     
+    lodEye = view.eye;
+    
+    // View volume for this frame's culling
+    GLfloat modelview[16];
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+    viewFrustum.extract(cameraProjection, modelview);
+    cullStats.visible = 0;
+    cullStats.culled = 0;
+    lodStats.fullTriangles = 0;
+    lodStats.drawnTriangles = 0;
+    renderState.resetStats();
+    
     // Render current scene
     if (currentScenePtr) {
-        currentScenePtr->render();
+        PROFILE_SCOPE("Scene::render");
+        PROFILE_GPU_SCOPE("Scene::render");
+        currentScenePtr->render(view);
     }
     
     // Render player (only in third person)
-    player.render();
+    RenderSection section("player");
+    player.render(view.alpha);
     
     // Render sparkle particles
-    glDisable(GL_LIGHTING);
-    glEnable(GL_BLEND);
+    section.next("particles");
+    renderState.disable(GL_LIGHTING);
+    renderState.enable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glDisable(GL_DEPTH_TEST);
+    renderState.disable(GL_DEPTH_TEST);
     
     for (const auto& sparkle : sparkles) {
         glPushMatrix();
@@ -4995,14 +11898,28 @@ void display() {
         glPopMatrix();
     }
     
-    glEnable(GL_DEPTH_TEST);
-    glDisable(GL_BLEND);
-    glEnable(GL_LIGHTING);
+    renderState.enable(GL_DEPTH_TEST);
+    renderState.disable(GL_BLEND);
+    renderState.enable(GL_LIGHTING);
     
     // Render HUD on top
+    section.next("hud");
     renderHUD();
+    section.end();
+    perfOverlay.endRender();
+    
+    // Headless frames stay in the offscreen framebuffer
+    if (!headlessRendering) {
+        PROFILE_SCOPE("swapBuffers");
+        glutSwapBuffers();
+    }
     
-    glutSwapBuffers();
+    lastFrameCullStats = cullStats;
+    lastFrameLodStats = lodStats;
+    lastFrameStateStats = renderState.stats;
+    renderPathFrameTimeMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+    renderPathFrames++;
+    perfOverlay.endFrame();
 }
 
 void reshape(int w, int h) {
@@ -5017,13 +11934,17 @@ void reshape(int w, int h) {
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
     gluPerspective(60.0f, (float)w / (float)h, 0.1f, 1000.0f);  // Far plane at 1000 for skybox
+    glGetFloatv(GL_PROJECTION_MATRIX, cameraProjection);
+    cameraPixelScale = cameraProjection[5] * h * 0.5f;
     glMatrixMode(GL_MODELVIEW);
     
     // Hide cursor - use crosshair instead
-    glutSetCursor(GLUT_CURSOR_NONE);
+    if (!headlessRendering) glutSetCursor(GLUT_CURSOR_NONE);
 }
 
-void keyboard(unsigned char key, int x, int y) {
+void keyboard(unsigned char key, int /*x*/, int /*y*/) {
+    if (!inputLog.onKey(key, true)) return;
+    
     switch (key) {
         case '1':
             // Third person view
@@ -5049,8 +11970,86 @@ void keyboard(unsigned char key, int x, int y) {
             player.toggleView();
             std::cout << "Switched to " << (player.isFirstPerson ? "First Person" : "Third Person") << " view" << std::endl;
             break;
+        case 'v':
+        case 'V':
+            // Cycle mesh render path (immediate -> display lists -> buffers)
+            {
+                if (renderPathFrames > 0) {
+                    std::cout << "Average frame time with " << meshRenderPathName(meshRenderPath) << ": "
+                              << renderPathFrameTimeMs / renderPathFrames << " ms over "
+                              << renderPathFrames << " frames" << std::endl;
+                }
+                meshRenderPath = (MeshRenderPath)((meshRenderPath + 1) % 3);
+                if (meshRenderPath == RENDER_PATH_BUFFERS && !glExt.hasBuffers) {
+                    meshRenderPath = RENDER_PATH_IMMEDIATE;
+                }
+                renderPathFrameTimeMs = 0.0;
+                renderPathFrames = 0;
+                std::cout << "Mesh render path: " << meshRenderPathName(meshRenderPath) << std::endl;
+            }
+            break;
+        case 'm':
+        case 'M':
+            // Toggle mipmapped texture sampling
+            textureRegistry.setMipmapsEnabled(!textureRegistry.areMipmapsEnabled());
+            std::cout << "Texture mipmaps: " << (textureRegistry.areMipmapsEnabled() ? "on" : "off") << std::endl;
+            break;
+        case 'c':
+        case 'C':
+            // Toggle frustum culling
+            std::cout << "Frustum culling: last frame " << lastFrameCullStats.visible << " visible, "
+                      << lastFrameCullStats.culled << " culled" << std::endl;
+            frustumCulling = !frustumCulling;
+            std::cout << "Frustum culling " << (frustumCulling ? "on" : "off") << std::endl;
+            break;
+        case 'k':
+        case 'K':
+            // Toggle level of detail
+            std::cout << "Level of detail: last frame " << lastFrameLodStats.drawnTriangles << " triangles drawn of "
+                      << lastFrameLodStats.fullTriangles << " at full detail" << std::endl;
+            lodEnabled = !lodEnabled;
+            std::cout << "Level of detail " << (lodEnabled ? "on" : "off") << std::endl;
+            break;
+        case 'g':
+        case 'G':
+            // Toggle the GL state cache
+            std::cout << "GL state: last frame " << lastFrameStateStats.enables << " enables, "
+                      << lastFrameStateStats.textureBinds << " texture binds, "
+                      << lastFrameStateStats.materialChanges << " material calls sent, "
+                      << lastFrameStateStats.skipped << " redundant calls skipped, "
+                      << lastFrameStateStats.drawItems << " queued draws" << std::endl;
+            renderState.setCaching(!renderState.isCaching());
+            renderState.invalidate();
+            std::cout << "GL state cache " << (renderState.isCaching() ? "on" : "off") << std::endl;
+            break;
+        case 'l':
+        case 'L':
+            // Cycle frame pacing (vsync -> uncapped -> fixed rate)
+            gameLoop.printStats();
+            gameLoop.resetStats();
+            if (gameLoop.getMode() == LOOP_VSYNC) gameLoop.setMode(LOOP_UNCAPPED);
+            else if (gameLoop.getMode() == LOOP_UNCAPPED) gameLoop.setMode(LOOP_FIXED_RATE);
+            else gameLoop.setMode(LOOP_VSYNC);
+            break;
+        case 'o':
+        case 'O':
+            // Toggle the performance overlay
+            perfOverlay.setVisible(!perfOverlay.isVisible());
+            std::cout << "Performance overlay " << (perfOverlay.isVisible() ? "on" : "off") << std::endl;
+            break;
+        case 'p':
+        case 'P':
+            // Dump the last few seconds of profiler scopes
+            {
+                static int traceCount = 0;
+                profiler.exportTrace("crystalcaves-trace-" + std::to_string(++traceCount) + ".json", traceSeconds);
+            }
+            break;
         case 27: // ESC key
+            gameLoop.printStats();
+            inputLog.stopRecording();
             cleanupScenes();
+            textRenderer.cleanup();
             exit(0);
             break;
         case 'f':
@@ -5129,10 +12128,12 @@ void keyboard(unsigned char key, int x, int y) {
             player.jump();
             break;
     }
-    glutPostRedisplay();
+    if (!headlessRendering) glutPostRedisplay();  // Headless replays call in directly
 }
 
-void keyboardUp(unsigned char key, int x, int y) {
+void keyboardUp(unsigned char key, int /*x*/, int /*y*/) {
+    if (!inputLog.onKey(key, false)) return;
+    
     switch (key) {
         case 'w':
         case 'W':
@@ -5153,7 +12154,8 @@ void keyboardUp(unsigned char key, int x, int y) {
     }
 }
 
-void specialKeys(int key, int x, int y) {
+void specialKeys(int key, int /*x*/, int /*y*/) {
+    if (!inputLog.acceptsLook()) return;
     float rotateSpeed = 3.0f;
     
     switch (key) {
@@ -5170,12 +12172,14 @@ void specialKeys(int key, int x, int y) {
             player.rotate(rotateSpeed, 0.0f);
             break;
     }
+    inputLog.onLook(player.yaw, player.pitch);
     glutPostRedisplay();
 }
 
-void mouseClick(int button, int state, int x, int y) {
+void mouseClick(int button, int state, int /*x*/, int /*y*/) {
     // Only handle left click when pressed (not released)
     if (button != GLUT_LEFT_BUTTON || state != GLUT_DOWN) return;
+    if (!inputLog.onClick()) return;
     
     // Only check for interactions in Scene 1
     if (currentScene != 1) return;
@@ -5261,8 +12265,12 @@ void mouseMotion(int x, int y) {
     int deltaX = x - lastMouseX;
     int deltaY = y - lastMouseY;
     
-    // Update camera rotation based on mouse movement
-    player.rotate(deltaX * mouseSensitivity, -deltaY * mouseSensitivity);
+    // Update camera rotation based on mouse movement (replays set the
+    // recorded angles instead)
+    if (inputLog.acceptsLook()) {
+        player.rotate(deltaX * mouseSensitivity, -deltaY * mouseSensitivity);
+        inputLog.onLook(player.yaw, player.pitch);
+    }
     
     // Update last mouse position
     lastMouseX = x;
@@ -5328,10 +12336,27 @@ void handlePortalTeleport() {
     }
 }
 
-void timer(int value) {
+// Replays end when the recorded steps run out: report and exit, failing
+// if the simulation drifted from the recording
+void onReplayFinished() {
+    gameLoop.printStats();
+    inputLog.printReplaySummary();
+    cleanupScenes();
+    textRenderer.cleanup();
+    exit(inputLog.checksumMismatches() > 0 ? 1 : 0);
+}
+
+// Advance the game by one fixed step; called by the game loop
+void simulationStep(float deltaTime) {
+    PROFILE_SCOPE("simulationStep");
+    
+    // Recorded input due before this step (replays only)
+    inputLog.beforeStep();
+    
+    player.saveStep();
+    
     // Update animation time
-    animationTime += 0.016f; // Approximately 60 FPS
-    float deltaTime = 0.016f;
+    animationTime += deltaTime;
     
     // Update player physics (jumping and gravity)
     player.updatePhysics(deltaTime);
@@ -5353,11 +12378,9 @@ void timer(int value) {
         moveSpeed = 0.0f;
     }
     
-    // Check if player is on lava in Scene 2 and apply slowdown
-    if (currentScene == 2 && scene2Instance) {
-        if (scene2Instance->checkLavaCollision(player.position.x, player.position.z, 0.2f)) {
-            moveSpeed *= 0.2f; // Slow down to 20% speed when on lava
-        }
+    // Slow down on lava (contacts from the end of the last step)
+    if (player.contactsHere().touches(COLLIDER_LAVA)) {
+        moveSpeed *= 0.2f; // Slow down to 20% speed when on lava
     }
     
     float forward = 0.0f;
@@ -5411,9 +12434,13 @@ void timer(int value) {
         player.move(forward, right);
     }
     
+    // Lava and traps come from the contacts at the new position (move()
+    // usually queried them already)
+    const CollisionResult& contacts = player.contactsHere();
+    
     // Check for lava damage in Scene 2
     if (currentScene == 2 && scene2Instance) {
-        if (scene2Instance->checkLavaCollision(player.position.x, player.position.z, 0.2f)) {
+        if (contacts.touches(COLLIDER_LAVA)) {
             // Player is walking on lava (no falling, lava is at ground level)
             isPlayerBurning = true;
             
@@ -5423,20 +12450,20 @@ void timer(int value) {
             if (flameSpawnTimer >= 0.05f) {  // Spawn flames frequently
                 for (int i = 0; i < 3; i++) {
                     Flame flame;
-                    float angle = ((float)rand() / RAND_MAX) * 2.0f * M_PI;
-                    float radius = ((float)rand() / RAND_MAX) * 0.3f;
+                    float angle = effectRandom.uniform() * 2.0f * M_PI;
+                    float radius = effectRandom.uniform() * 0.3f;
                     flame.position = Vector3(
                         player.position.x + cos(angle) * radius,
-                        player.position.y + ((float)rand() / RAND_MAX) * 0.5f,
+                        player.position.y + effectRandom.uniform() * 0.5f,
                         player.position.z + sin(angle) * radius
                     );
-                    flame.lifetime = 0.5f + ((float)rand() / RAND_MAX) * 0.5f;
+                    flame.lifetime = 0.5f + effectRandom.uniform() * 0.5f;
                     flame.velocity = Vector3(
-                        (((float)rand() / RAND_MAX) - 0.5f) * 0.3f,
-                        1.0f + ((float)rand() / RAND_MAX) * 1.0f,
-                        (((float)rand() / RAND_MAX) - 0.5f) * 0.3f
+                        (effectRandom.uniform() - 0.5f) * 0.3f,
+                        1.0f + effectRandom.uniform() * 1.0f,
+                        (effectRandom.uniform() - 0.5f) * 0.3f
                     );
-                    flame.size = 0.1f + ((float)rand() / RAND_MAX) * 0.1f;
+                    flame.size = 0.1f + effectRandom.uniform() * 0.1f;
                     flames.push_back(flame);
                 }
                 flameSpawnTimer = 0.0f;
@@ -5471,7 +12498,7 @@ void timer(int value) {
     // Check for trap damage in Scene 2 (traps don't block, but damage on contact) - only if on ground
     if (currentScene == 2 && trapDamageCooldown <= 0 && player.isOnGround) {
         if (scene2Instance) {
-            if (scene2Instance->checkTrapCollision(player.position.x, player.position.z, 0.3f)) {
+            if (contacts.touches(COLLIDER_TRAP)) {
                 lives -= 1.0f;
                 trapDamageCooldown = 1.5f;  // 1.5 second cooldown before taking damage again
                 playDamageSound();  // Play damage sound
@@ -5492,8 +12519,8 @@ void timer(int value) {
     if (currentScene == 2 && scene2Instance && !gameWon) {
         for (auto& crystal : scene2Instance->crystals) {
             if (!crystal.collected) {
-                float dx = player.position.x - crystal.position.x;
-                float dz = player.position.z - crystal.position.z;
+                float dx = player.position.x - crystal.agent.position.x;
+                float dz = player.position.z - crystal.agent.position.z;
                 float dist = sqrt(dx*dx + dz*dz);
                 if (dist < 1.0f) {  // Collection radius
                     crystal.collected = true;
@@ -5505,10 +12532,10 @@ void timer(int value) {
                     // Create sparkle effect
                     for (int i = 0; i < 20; i++) {
                         Sparkle sparkle;
-                        sparkle.position = crystal.position;
-                        sparkle.lifetime = 1.0f + (rand() % 100) / 100.0f;
-                        sparkle.velocityY = 2.0f + (rand() % 100) / 50.0f;
-                        sparkle.size = 0.1f + (rand() % 50) / 100.0f;
+                        sparkle.position = crystal.agent.position;
+                        sparkle.lifetime = 1.0f + (effectRandom.next() % 100) / 100.0f;
+                        sparkle.velocityY = 2.0f + (effectRandom.next() % 100) / 50.0f;
+                        sparkle.size = 0.1f + (effectRandom.next() % 50) / 100.0f;
                         sparkles.push_back(sparkle);
                     }
                     
@@ -5525,29 +12552,32 @@ void timer(int value) {
         }
     }
     
-    // Update sparkle particles
-    for (auto it = sparkles.begin(); it != sparkles.end(); ) {
-        it->lifetime -= deltaTime;
-        it->position.y += it->velocityY * deltaTime;
-        it->velocityY -= 5.0f * deltaTime;  // Gravity
-        if (it->lifetime <= 0.0f) {
-            it = sparkles.erase(it);
-        } else {
-            ++it;
+    // Update sparkle and flame particles
+    {
+        PROFILE_SCOPE("updateParticles");
+        for (auto it = sparkles.begin(); it != sparkles.end(); ) {
+            it->lifetime -= deltaTime;
+            it->position.y += it->velocityY * deltaTime;
+            it->velocityY -= 5.0f * deltaTime;  // Gravity
+            if (it->lifetime <= 0.0f) {
+                it = sparkles.erase(it);
+            } else {
+                ++it;
+            }
         }
-    }
-    
-    // Update flame particles
-    for (auto it = flames.begin(); it != flames.end(); ) {
-        it->lifetime -= deltaTime;
-        it->position.x += it->velocity.x * deltaTime;
-        it->position.y += it->velocity.y * deltaTime;
-        it->position.z += it->velocity.z * deltaTime;
-        it->velocity.y -= 0.5f * deltaTime;  // Light gravity for flames
-        if (it->lifetime <= 0.0f) {
-            it = flames.erase(it);
-        } else {
-            ++it;
+        
+        // Update flame particles
+        for (auto it = flames.begin(); it != flames.end(); ) {
+            it->lifetime -= deltaTime;
+            it->position.x += it->velocity.x * deltaTime;
+            it->position.y += it->velocity.y * deltaTime;
+            it->position.z += it->velocity.z * deltaTime;
+            it->velocity.y -= 0.5f * deltaTime;  // Light gravity for flames
+            if (it->lifetime <= 0.0f) {
+                it = flames.erase(it);
+            } else {
+                ++it;
+            }
         }
     }
     
@@ -5556,28 +12586,47 @@ void timer(int value) {
 
     // Update current scene
     if (currentScenePtr) {
-        currentScenePtr->update(0.016f);
+        PROFILE_SCOPE("Scene::update");
+        currentScenePtr->update(deltaTime);
     }
     
-    glutPostRedisplay();
-    glutTimerFunc(16, timer, 0); // ~60 FPS
+    inputLog.afterStep();
 }
 
 void initOpenGL() {
+    // Resolve buffer object entry points before any model is loaded
+    loadGLExtensions();
+    if (meshRenderPath == RENDER_PATH_BUFFERS && !glExt.hasBuffers) {
+        meshRenderPath = RENDER_PATH_DISPLAY_LIST;
+    }
+    std::cout << "Mesh render path: " << meshRenderPathName(meshRenderPath) << std::endl;
+    // llvmpipe runs the instancing vertex shader about half as fast as it
+    // draws the merged buffers, so auto only picks the shader on real GPUs
+    if (instancingMode == INSTANCING_AUTO && glExt.softwareRenderer) {
+        instancingMode = INSTANCING_MERGED;
+    }
+    if ((instancingMode == INSTANCING_AUTO || instancingMode == INSTANCING_HARDWARE) && !instanceShader.init()) {
+        instancingMode = INSTANCING_MERGED;
+    }
+    bool hardwareInstancing = instancingMode == INSTANCING_AUTO || instancingMode == INSTANCING_HARDWARE;
+    std::cout << "Instanced batches: " << (hardwareInstancing ? "hardware instancing" :
+                                           instancingMode == INSTANCING_MERGED ? "merged buffers" : "off")
+              << std::endl;
+    
     // Set background color to light blue sky
     glClearColor(0.53f, 0.81f, 0.92f, 1.0f);
     
     // Enable depth testing
-    glEnable(GL_DEPTH_TEST);
+    renderState.enable(GL_DEPTH_TEST);
     glDepthFunc(GL_LEQUAL);
     
     // Enable backface culling for performance
-    glEnable(GL_CULL_FACE);
+    renderState.enable(GL_CULL_FACE);
     glCullFace(GL_BACK);
     glFrontFace(GL_CCW);
     
     // Enable lighting
-    glEnable(GL_LIGHTING);
+    renderState.enable(GL_LIGHTING);
     glEnable(GL_LIGHT0);
     
     // Enable color material
@@ -5594,24 +12643,690 @@ void initOpenGL() {
     glHint(GL_LINE_SMOOTH_HINT, GL_FASTEST);
     
     // Enable blending for transparency
-    glEnable(GL_BLEND);
+    renderState.enable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     
     // Normalize normals (required when scaling)
     glEnable(GL_NORMALIZE);
     
     // Disable expensive features we don't need
-    glDisable(GL_FOG);
+    renderState.disable(GL_FOG);
     glDisable(GL_LINE_SMOOTH);
     glDisable(GL_POLYGON_SMOOTH);
     glDisable(GL_DITHER);
+    
+    // HUD font atlas (GLUT fonts need the window, so not when headless)
+    if (!headlessRendering) textRenderer.init();
+}
+
+// ============================================================================
+// COLLISION BENCHMARK - Linear obstacle scans against the spatial hash grid
+// ============================================================================
+
+// Usage: crystalcaves --bench-collision [obstacle counts...]
+// Scatters circular obstacles (radius 0.5-2) over a 200x200 area, then runs
+// the same player-sized queries as a linear sqrt scan (the scenes' old
+// checks) and through SpatialHashGrid, and checks both agree.
+int runCollisionBenchmark(std::vector<int> counts) {
+    if (counts.empty()) counts = { 100, 1000, 5000, 20000 };
+    const int queryCount = 100000;
+    const float area = 200.0f;
+    
+    struct Obstacle { float x, z, radius; };
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> coordinate(-area / 2, area / 2);
+    std::uniform_real_distribution<float> size(0.5f, 2.0f);
+    
+    std::vector<std::pair<float, float>> queries(queryCount);
+    for (auto& query : queries) query = std::make_pair(coordinate(rng), coordinate(rng));
+    const float queryRadius = 0.3f;
+    
+    bool allMatch = true;
+    std::cout << "Collision benchmark (" << queryCount << " circle queries, radius " << queryRadius << ")" << std::endl;
+    
+    for (int count : counts) {
+        std::vector<Obstacle> obstacles(count);
+        for (auto& obstacle : obstacles) obstacle = { coordinate(rng), coordinate(rng), size(rng) };
+        
+        auto t0 = std::chrono::steady_clock::now();
+        SpatialHashGrid grid;
+        for (int i = 0; i < count; i++) grid.addCircle(obstacles[i].x, obstacles[i].z, obstacles[i].radius, COLLIDER_BOULDER, i);
+        auto t1 = std::chrono::steady_clock::now();
+        
+        int linearHits = 0;
+        for (const auto& query : queries) {
+            for (const auto& obstacle : obstacles) {
+                float dx = query.first - obstacle.x;
+                float dz = query.second - obstacle.z;
+                if (sqrt(dx * dx + dz * dz) < queryRadius + obstacle.radius) {
+                    linearHits++;
+                    break;
+                }
+            }
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        
+        int gridHits = 0;
+        for (const auto& query : queries) {
+            if (grid.anyOverlap(query.first, query.second, queryRadius, COLLIDER_BOULDER)) gridHits++;
+        }
+        auto t3 = std::chrono::steady_clock::now();
+        
+        double buildMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        double linearNs = std::chrono::duration<double, std::nano>(t2 - t1).count() / queryCount;
+        double gridNs = std::chrono::duration<double, std::nano>(t3 - t2).count() / queryCount;
+        std::cout << "  " << count << " obstacles: build " << buildMs << " ms (" << grid.cellCount()
+                  << " cells), linear " << linearNs << " ns/query, grid " << gridNs << " ns/query ("
+                  << (gridNs > 0.0 ? linearNs / gridNs : 0.0) << "x), "
+                  << (linearHits == gridHits ? "hits match" : "HITS DIFFER") << " (" << gridHits << ")" << std::endl;
+        if (linearHits != gridHits) {
+            std::cerr << "    linear " << linearHits << " vs grid " << gridHits << std::endl;
+            allMatch = false;
+        }
+    }
+    return allMatch ? 0 : 1;
+}
+
+// ============================================================================
+// MIPMAP BENCHMARK - Frame time with and without texture mipmaps
+// ============================================================================
+
+// Usage: crystalcaves --bench-mips [frames]
+// Renders a fixed view of each scene with mipmapped sampling and with level 0
+// only, and reports the average and best frame time of each. Run with
+// LIBGL_ALWAYS_SOFTWARE=1 to measure llvmpipe, where texture cache misses
+// from unfiltered minification cost the most.
+int runMipmapBenchmark(int frames) {
+    reshape(windowWidth, windowHeight);
+    
+    struct Result { int scene; bool mipmaps; double averageMs, bestMs; };
+    std::vector<Result> results;
+    
+    for (int scene = 1; scene <= 2; scene++) {
+        // Spawn views: looking across the tiled floor towards the walls
+        switchScene(scene);
+        if (scene == 1) {
+            player.position = Vector3(0.0f, 0.0f, 5.0f);
+            player.yaw = 0.0f;
+        } else {
+            player.position = Vector3(portalPositionScene2.x, 0.0f, portalPositionScene2.z + 3.0f);
+            player.yaw = 180.0f;
+        }
+        player.pitch = 0.0f;
+        
+        for (int pass = 0; pass < 2; pass++) {
+            bool mipmaps = (pass == 1);
+            textureRegistry.setMipmapsEnabled(mipmaps);
+            
+            // Warm up caches and lazily compiled state before timing
+            for (int i = 0; i < 3; i++) { display(); glFinish(); }
+            
+            double totalMs = 0.0, bestMs = 1e9;
+            for (int i = 0; i < frames; i++) {
+                auto start = std::chrono::steady_clock::now();
+                display();
+                glFinish();
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                totalMs += ms;
+                bestMs = std::min(bestMs, ms);
+            }
+            results.push_back({scene, mipmaps, totalMs / frames, bestMs});
+        }
+    }
+    
+    std::cout << std::endl << "Mipmap benchmark (" << (const char*)glGetString(GL_RENDERER) << ", "
+              << windowWidth << "x" << windowHeight << ", " << frames << " frames)" << std::endl;
+    std::cout << "Scene  Mipmaps  Avg ms   Best ms" << std::endl;
+    for (const auto& r : results) {
+        char line[64];
+        snprintf(line, sizeof(line), "%-6d %-8s %-8.2f %.2f", r.scene, r.mipmaps ? "on" : "off", r.averageMs, r.bestMs);
+        std::cout << line << std::endl;
+    }
+    std::cout << "Estimated texture VRAM: " << textureRegistry.bytesResident() / 1024 << " KB" << std::endl;
+    
+    cleanupScenes();
+    return 0;
+}
+
+// ============================================================================
+// HEADLESS BENCHMARK - Scripted flythrough rendered offscreen, JSON report
+// ============================================================================
+
+// Usage: crystalcaves --bench [frames] [--bench-out report.json] [--replay session.ccrec]
+// Renders both scenes into a framebuffer object on an EGL context with no
+// window or display server (Mesa's surfaceless platform, which falls back to
+// llvmpipe on machines without a GPU). The player is flown along a fixed
+// camera spline through each scene for the given number of frames, one
+// simulation step per frame, and the CPU time of each frame (simulation plus
+// display() and glFinish) is reported as JSON on stdout or to the given file.
+// With --replay the recorded session drives the run instead of the spline.
+// Log output moves to stderr while the benchmark runs.
+
+// A point on the recorded flythrough; yaw is unwrapped so keys interpolate
+// the short way round
+struct CameraKey {
+    float x, z;
+    float yaw, pitch;
+};
+
+const std::vector<CameraKey> benchPathScene1 = {
+    { 0.0f, 5.0f, 0.0f, -5.0f }, { 8.0f, -3.0f, 30.0f, -10.0f }, { 12.0f, -18.0f, -20.0f, -5.0f },
+    { 0.0f, -30.0f, -90.0f, -8.0f }, { -12.0f, -20.0f, -160.0f, -5.0f }, { -15.0f, -5.0f, -200.0f, -10.0f },
+    { -8.0f, 8.0f, -300.0f, -5.0f }
+};
+
+const std::vector<CameraKey> benchPathScene2 = {
+    { 0.0f, -40.0f, 180.0f, -5.0f }, { 6.0f, -28.0f, 150.0f, -8.0f }, { 15.0f, -12.0f, 120.0f, -5.0f },
+    { 10.0f, 5.0f, 200.0f, -10.0f }, { -5.0f, 12.0f, 260.0f, -5.0f }, { -18.0f, 0.0f, 300.0f, -8.0f },
+    { -10.0f, -20.0f, 360.0f, -5.0f }
+};
+
+// Catmull-Rom through the keys, t in [0, 1] from the first key to the last
+CameraKey sampleCameraPath(const std::vector<CameraKey>& keys, float t) {
+    int last = (int)keys.size() - 1;
+    float position = std::min(std::max(t, 0.0f), 1.0f) * last;
+    int segment = std::min((int)position, last - 1);
+    float u = position - segment;
+    
+    const CameraKey& p0 = keys[std::max(segment - 1, 0)];
+    const CameraKey& p1 = keys[segment];
+    const CameraKey& p2 = keys[segment + 1];
+    const CameraKey& p3 = keys[std::min(segment + 2, last)];
+    auto spline = [u](float a, float b, float c, float d) {
+        return 0.5f * (2.0f * b + (c - a) * u + (2.0f * a - 5.0f * b + 4.0f * c - d) * u * u +
+                       (3.0f * b - a - 3.0f * c + d) * u * u * u);
+    };
+    return { spline(p0.x, p1.x, p2.x, p3.x), spline(p0.z, p1.z, p2.z, p3.z),
+             spline(p0.yaw, p1.yaw, p2.yaw, p3.yaw), spline(p0.pitch, p1.pitch, p2.pitch, p3.pitch) };
+}
+
+// Mean, max and nearest-rank percentiles of a set of samples
+struct TimingSummary {
+    double mean = 0.0, p50 = 0.0, p95 = 0.0, p99 = 0.0, max = 0.0;
+    
+    static TimingSummary of(std::vector<double> samples) {
+        TimingSummary s;
+        if (samples.empty()) return s;
+        std::sort(samples.begin(), samples.end());
+        auto rank = [&](double p) { return samples[std::min(samples.size() - 1, (size_t)std::ceil(p * samples.size()) - 1)]; };
+        for (double v : samples) s.mean += v;
+        s.mean /= samples.size();
+        s.p50 = rank(0.50);
+        s.p95 = rank(0.95);
+        s.p99 = rank(0.99);
+        s.max = samples.back();
+        return s;
+    }
+    
+    std::string json() const {
+        char text[160];
+        snprintf(text, sizeof(text), "{\"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f}",
+                 mean, p50, p95, p99, max);
+        return text;
+    }
+};
+
+std::string jsonString(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char)c >= 0x20) out += c;
+    }
+    return out + "\"";
+}
+
+#if defined(__linux__)
+
+// The few EGL declarations needed, so building needs no EGL headers and
+// running needs libEGL only for --bench
+typedef void* EGLDisplay;
+typedef void* EGLConfig;
+typedef void* EGLContext;
+typedef int32_t EGLint;
+typedef unsigned int EGLBoolean;
+typedef unsigned int EGLenum;
+
+const EGLenum EGL_PLATFORM_SURFACELESS_MESA = 0x31DD;
+const EGLint EGL_NONE = 0x3038;
+const EGLint EGL_SURFACE_TYPE = 0x3033;
+const EGLint EGL_PBUFFER_BIT = 0x0001;
+const EGLint EGL_RENDERABLE_TYPE = 0x3040;
+const EGLint EGL_OPENGL_BIT = 0x0008;
+const EGLenum EGL_OPENGL_API = 0x30A2;
+const EGLint EGL_CONTEXT_OPENGL_PROFILE_MASK = 0x30FD;
+const EGLint EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT = 0x0002;
+
+// OpenGL context with no window: EGL on Mesa's surfaceless platform, drawing
+// into a framebuffer object with colour and depth renderbuffers. GL calls
+// still go through libGL; with libglvnd (or Mesa's own libGL) they reach
+// whichever EGL or GLX context is current.
+class HeadlessContext {
+public:
+    ~HeadlessContext() { destroy(); }
+    
+    bool create(int width, int height) {
+        library = dlopen("libEGL.so.1", RTLD_NOW | RTLD_GLOBAL);
+        if (!library) {
+            std::cerr << "Headless: cannot load libEGL.so.1 (" << dlerror() << ")" << std::endl;
+            return false;
+        }
+        getProcAddress = (GetProcAddressFunc)dlsym(library, "eglGetProcAddress");
+        auto initialize = (InitializeFunc)dlsym(library, "eglInitialize");
+        auto bindAPI = (BindAPIFunc)dlsym(library, "eglBindAPI");
+        auto chooseConfig = (ChooseConfigFunc)dlsym(library, "eglChooseConfig");
+        auto createContext = (CreateContextFunc)dlsym(library, "eglCreateContext");
+        makeCurrent = (MakeCurrentFunc)dlsym(library, "eglMakeCurrent");
+        destroyContext = (DestroyContextFunc)dlsym(library, "eglDestroyContext");
+        terminate = (TerminateFunc)dlsym(library, "eglTerminate");
+        if (!getProcAddress || !initialize || !bindAPI || !chooseConfig || !createContext ||
+            !makeCurrent || !destroyContext || !terminate) {
+            std::cerr << "Headless: libEGL is missing core entry points" << std::endl;
+            return false;
+        }
+        
+        auto getPlatformDisplay = (GetPlatformDisplayFunc)getProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay) {
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, nullptr, nullptr);
+        }
+        if (!display || !initialize(display, nullptr, nullptr)) {
+            std::cerr << "Headless: EGL surfaceless platform unavailable (needs Mesa)" << std::endl;
+            display = nullptr;
+            return false;
+        }
+        
+        // Surface type defaults to window, which surfaceless configs lack
+        const EGLint configAttribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+        const EGLint contextAttribs[] = { EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT, EGL_NONE };
+        EGLConfig config = nullptr;
+        EGLint configCount = 0;
+        if (!bindAPI(EGL_OPENGL_API) || !chooseConfig(display, configAttribs, &config, 1, &configCount) ||
+            configCount == 0) {
+            std::cerr << "Headless: no desktop OpenGL config" << std::endl;
+            return false;
+        }
+        context = createContext(display, config, nullptr, contextAttribs);
+        if (!context || !makeCurrent(display, nullptr, nullptr, context)) {
+            std::cerr << "Headless: cannot create a compatibility profile context" << std::endl;
+            return false;
+        }
+        
+        // Extension lookups (loadGLExtensions) go through EGL from here on
+        activeContext = this;
+        contextProcAddress = [](const char* name) { return activeContext->getProcAddress(name); };
+        return createFramebuffer(width, height);
+    }
+    
+    void destroy() {
+        if (framebuffer) {
+            deleteFramebuffers(1, &framebuffer);
+            deleteRenderbuffers(2, renderbuffers);
+            framebuffer = 0;
+        }
+        if (context) {
+            makeCurrent(display, nullptr, nullptr, nullptr);
+            destroyContext(display, context);
+            context = nullptr;
+        }
+        if (display) {
+            terminate(display);
+            display = nullptr;
+        }
+        if (activeContext == this) {
+            contextProcAddress = nullptr;
+            activeContext = nullptr;
+        }
+        // libEGL stays loaded; drivers register exit handlers in it
+    }
+    
+private:
+    typedef void* (*GetProcAddressFunc)(const char* name);
+    typedef EGLDisplay (*GetPlatformDisplayFunc)(EGLenum platform, void* nativeDisplay, const EGLint* attribs);
+    typedef EGLBoolean (*InitializeFunc)(EGLDisplay display, EGLint* major, EGLint* minor);
+    typedef EGLBoolean (*BindAPIFunc)(EGLenum api);
+    typedef EGLBoolean (*ChooseConfigFunc)(EGLDisplay display, const EGLint* attribs, EGLConfig* configs, EGLint size, EGLint* count);
+    typedef EGLContext (*CreateContextFunc)(EGLDisplay display, EGLConfig config, EGLContext share, const EGLint* attribs);
+    typedef EGLBoolean (*MakeCurrentFunc)(EGLDisplay display, void* draw, void* read, EGLContext context);
+    typedef EGLBoolean (*DestroyContextFunc)(EGLDisplay display, EGLContext context);
+    typedef EGLBoolean (*TerminateFunc)(EGLDisplay display);
+    
+    bool createFramebuffer(int width, int height) {
+        auto genFramebuffers = (GenFramebuffersFunc)getProcAddress("glGenFramebuffers");
+        auto bindFramebuffer = (BindFramebufferFunc)getProcAddress("glBindFramebuffer");
+        auto checkStatus = (CheckFramebufferStatusFunc)getProcAddress("glCheckFramebufferStatus");
+        auto genRenderbuffers = (GenRenderbuffersFunc)getProcAddress("glGenRenderbuffers");
+        auto bindRenderbuffer = (BindRenderbufferFunc)getProcAddress("glBindRenderbuffer");
+        auto storage = (RenderbufferStorageFunc)getProcAddress("glRenderbufferStorage");
+        auto attach = (FramebufferRenderbufferFunc)getProcAddress("glFramebufferRenderbuffer");
+        deleteFramebuffers = (DeleteFramebuffersFunc)getProcAddress("glDeleteFramebuffers");
+        deleteRenderbuffers = (DeleteRenderbuffersFunc)getProcAddress("glDeleteRenderbuffers");
+        if (!genFramebuffers || !bindFramebuffer || !checkStatus || !genRenderbuffers || !bindRenderbuffer ||
+            !storage || !attach || !deleteFramebuffers || !deleteRenderbuffers) {
+            std::cerr << "Headless: framebuffer objects unsupported" << std::endl;
+            return false;
+        }
+        
+        genFramebuffers(1, &framebuffer);
+        bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        genRenderbuffers(2, renderbuffers);
+        const GLenum formats[2] = { GL_RGBA8, GL_DEPTH_COMPONENT24 };
+        const GLenum attachments[2] = { GL_COLOR_ATTACHMENT0, GL_DEPTH_ATTACHMENT };
+        for (int i = 0; i < 2; i++) {
+            bindRenderbuffer(GL_RENDERBUFFER, renderbuffers[i]);
+            storage(GL_RENDERBUFFER, formats[i], width, height);
+            attach(GL_FRAMEBUFFER, attachments[i], GL_RENDERBUFFER, renderbuffers[i]);
+        }
+        if (checkStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Headless: offscreen framebuffer incomplete" << std::endl;
+            return false;
+        }
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        return true;
+    }
+    
+    void* library = nullptr;
+    EGLDisplay display = nullptr;
+    EGLContext context = nullptr;
+    GLuint framebuffer = 0;
+    GLuint renderbuffers[2] = { 0, 0 };
+    GetProcAddressFunc getProcAddress = nullptr;
+    MakeCurrentFunc makeCurrent = nullptr;
+    DestroyContextFunc destroyContext = nullptr;
+    TerminateFunc terminate = nullptr;
+    DeleteFramebuffersFunc deleteFramebuffers = nullptr;
+    DeleteRenderbuffersFunc deleteRenderbuffers = nullptr;
+    
+    static HeadlessContext* activeContext;
+};
+
+HeadlessContext* HeadlessContext::activeContext = nullptr;
+
+int runHeadlessBenchmark(int frames, const std::string& outputPath) {
+    HeadlessContext context;
+    if (!context.create(windowWidth, windowHeight)) {
+        std::cerr << "Headless benchmark needs Mesa's EGL with the surfaceless platform" << std::endl;
+        return 1;
+    }
+    headlessRendering = true;
+    initOpenGL();
+    initScenes();
+    reshape(windowWidth, windowHeight);
+    
+    struct SceneTimes {
+        int scene;
+        std::string name;
+        std::vector<double> frameMs, simulationMs, renderMs;
+        double triangles = 0.0;  // Sum over the timed frames
+    };
+    std::vector<SceneTimes> scenes(2);
+    for (int scene = 1; scene <= 2; scene++) {
+        scenes[scene - 1].scene = scene;
+        scenes[scene - 1].name = (scene == 1 ? scene1 : scene2)->name;
+    }
+    
+    // One simulation step and one rendered frame, timed separately
+    auto runFrame = [](SceneTimes* times) {
+        auto start = std::chrono::steady_clock::now();
+        simulationStep(SIMULATION_STEP);
+        auto simulated = std::chrono::steady_clock::now();
+        display();
+        glFinish();
+        auto end = std::chrono::steady_clock::now();
+        if (!times) return;
+        times->simulationMs.push_back(std::chrono::duration<double, std::milli>(simulated - start).count());
+        times->renderMs.push_back(std::chrono::duration<double, std::milli>(end - simulated).count());
+        times->frameMs.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        times->triangles += (double)lastFrameLodStats.drawnTriangles;
+    };
+    
+    const int warmupFrames = inputLog.isReplaying() ? 10 : std::min(frames, 10);
+    if (inputLog.isReplaying()) {
+        // The recording decides path, scenes and length. Warm up with
+        // renders only, so every recorded step is simulated exactly once.
+        for (int i = 0; i < warmupFrames; i++) {
+            display();
+            glFinish();
+        }
+        while (!inputLog.replayFinished()) {
+            runFrame(&scenes[currentScene - 1]);
+        }
+    } else {
+        // Hazards along the path must not end the game mid-run
+        const float startLives = lives;
+        
+        for (int scene = 1; scene <= 2; scene++) {
+            switchScene(scene);
+            const std::vector<CameraKey>& path = scene == 1 ? benchPathScene1 : benchPathScene2;
+            for (int i = -warmupFrames; i < frames; i++) {
+                CameraKey key = sampleCameraPath(path, frames > 1 ? (float)std::max(i, 0) / (frames - 1) : 0.0f);
+                player.position = Vector3(key.x, player.position.y, key.z);
+                player.yaw = key.yaw;
+                player.pitch = key.pitch;
+                runFrame(i >= 0 ? &scenes[scene - 1] : nullptr);
+                lives = startLives;
+                
+                // A step can still teleport through a portal; stay in the scene
+                if (currentScene != scene) switchScene(scene);
+            }
+        }
+    }
+    for (const SceneTimes& times : scenes) {
+        std::cerr << "Benchmark: scene " << times.scene << ", " << times.frameMs.size() << " frames, "
+                  << TimingSummary::of(times.frameMs).mean << " ms/frame" << std::endl;
+    }
+    
+    std::vector<double> allFrame, allSimulation, allRender;
+    for (const auto& s : scenes) {
+        allFrame.insert(allFrame.end(), s.frameMs.begin(), s.frameMs.end());
+        allSimulation.insert(allSimulation.end(), s.simulationMs.begin(), s.simulationMs.end());
+        allRender.insert(allRender.end(), s.renderMs.begin(), s.renderMs.end());
+    }
+    
+    std::ostringstream report;
+    report << "{\n"
+           << "  \"renderer\": " << jsonString((const char*)glGetString(GL_RENDERER)) << ",\n"
+           << "  \"gl_version\": " << jsonString((const char*)glGetString(GL_VERSION)) << ",\n"
+           << "  \"width\": " << windowWidth << ",\n"
+           << "  \"height\": " << windowHeight << ",\n"
+           << "  \"mode\": " << (inputLog.isReplaying() ? "\"replay\"" : "\"flythrough\"") << ",\n"
+           << "  \"warmup_frames\": " << warmupFrames << ",\n"
+           << "  \"simulation_step_ms\": " << SIMULATION_STEP * 1000.0f << ",\n"
+           << "  \"render_path\": " << jsonString(meshRenderPathName(meshRenderPath)) << ",\n";
+    if (inputLog.isReplaying()) {
+        report << "  \"replay\": {\"seed\": " << simulationSeed << ", \"steps\": " << inputLog.stepCount()
+               << ", \"checksums_matched\": " << inputLog.checksumsVerified()
+               << ", \"checksums_mismatched\": " << inputLog.checksumMismatches() << "},\n";
+    } else {
+        report << "  \"frames_per_scene\": " << frames << ",\n";
+    }
+    report << "  \"scenes\": [\n";
+    for (size_t i = 0; i < scenes.size(); i++) {
+        const SceneTimes& s = scenes[i];
+        report << "    {\n"
+               << "      \"scene\": " << s.scene << ",\n"
+               << "      \"name\": " << jsonString(s.name) << ",\n"
+               << "      \"frames\": " << s.frameMs.size() << ",\n"
+               << "      \"average_triangles\": " << (long long)(s.frameMs.empty() ? 0.0 : s.triangles / s.frameMs.size()) << ",\n"
+               << "      \"frame_ms\": " << TimingSummary::of(s.frameMs).json() << ",\n"
+               << "      \"simulation_ms\": " << TimingSummary::of(s.simulationMs).json() << ",\n"
+               << "      \"render_ms\": " << TimingSummary::of(s.renderMs).json() << "\n"
+               << "    }" << (i + 1 < scenes.size() ? "," : "") << "\n";
+    }
+    report << "  ],\n"
+           << "  \"overall\": {\n"
+           << "    \"frames\": " << allFrame.size() << ",\n"
+           << "    \"frame_ms\": " << TimingSummary::of(allFrame).json() << ",\n"
+           << "    \"simulation_ms\": " << TimingSummary::of(allSimulation).json() << ",\n"
+           << "    \"render_ms\": " << TimingSummary::of(allRender).json() << "\n"
+           << "  }\n"
+           << "}\n";
+    
+    if (!traceOutputPath.empty()) profiler.exportTrace(traceOutputPath, traceSeconds);
+    cleanupScenes();
+    
+    if (outputPath.empty()) {
+        std::printf("%s", report.str().c_str());
+        std::fflush(stdout);
+    } else {
+        std::ofstream out(outputPath);
+        out << report.str();
+        if (!out) {
+            std::cerr << "Cannot write benchmark report to " << outputPath << std::endl;
+            return 1;
+        }
+        std::cerr << "Benchmark report written to " << outputPath << std::endl;
+    }
+    if (inputLog.isReplaying()) {
+        inputLog.printReplaySummary();
+        if (inputLog.checksumMismatches() > 0) return 1;
+    }
+    return 0;
+}
+
+#else
+
+int runHeadlessBenchmark(int frames, const std::string& outputPath) {
+    (void)frames;
+    (void)outputPath;
+    std::cerr << "The headless benchmark needs Linux with Mesa's EGL; use --bench-mips for a windowed run" << std::endl;
+    return 1;
 }
 
+#endif
+
 // ============================================================================
 // MAIN FUNCTION
 // ============================================================================
 
 int main(int argc, char** argv) {
+    int mipBenchmarkFrames = 0;
+    int headlessBenchmarkFrames = 0;
+    std::string benchmarkOutput;
+    std::string recordPath, replayPath;
+    uint64_t seed = 1;
+    double textureBudgetMB = -1.0;  // Overrides the textures.cfg budget when set
+    LoopMode loopMode = LOOP_VSYNC;
+    int loopFps = 60;
+    PROFILE_THREAD_NAME("main");
+    
+    // Command-line tools that run without opening a window
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--bench-obj") {
+            std::vector<std::string> files(argv + i + 1, argv + argc);
+            return runOBJLoadBenchmark(files, 5);
+        }
+        if (arg == "--bench-3ds") {
+            std::vector<std::string> files(argv + i + 1, argv + argc);
+            return run3DSLoadBenchmark(files, 5);
+        }
+        if (arg == "--bench-collision") {
+            std::vector<int> counts;
+            for (int j = i + 1; j < argc; j++) counts.push_back(atoi(argv[j]));
+            return runCollisionBenchmark(counts);
+        }
+        if (arg == "--rebuild-caches") {
+            std::vector<std::string> files(argv + i + 1, argv + argc);
+            return rebuildMeshCaches(files);
+        }
+        if (arg == "--load-threads" && i + 1 < argc) {
+            assetLoader.setThreadCount(atoi(argv[++i]));
+        }
+        if (arg == "--no-mesh-cache") {
+            useMeshCache = false;
+        }
+        if (arg == "--texture-budget" && i + 1 < argc) {
+            textureBudgetMB = atof(argv[++i]);
+        }
+        if (arg == "--bench-mips") {
+            mipBenchmarkFrames = 100;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) mipBenchmarkFrames = atoi(argv[++i]);
+        }
+        if (arg == "--bench") {
+            headlessBenchmarkFrames = 300;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) headlessBenchmarkFrames = atoi(argv[++i]);
+        }
+        if (arg == "--bench-out" && i + 1 < argc) {
+            benchmarkOutput = argv[++i];
+        }
+        if (arg == "--record" && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+        if (arg == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+        if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoull(argv[++i], nullptr, 10);
+        }
+        if (arg == "--loop" && i + 1 < argc) {
+            // uncapped | vsync | fixed[:fps]
+            std::string mode = argv[++i];
+            if (mode == "uncapped") loopMode = LOOP_UNCAPPED;
+            else if (mode == "vsync") loopMode = LOOP_VSYNC;
+            else if (mode.compare(0, 5, "fixed") == 0) {
+                loopMode = LOOP_FIXED_RATE;
+                if (mode.size() > 6 && mode[5] == ':') loopFps = std::max(1, atoi(mode.c_str() + 6));
+            }
+            else std::cerr << "Unknown loop mode '" << mode << "' (uncapped, vsync, fixed[:fps])" << std::endl;
+        }
+        if (arg == "--render-path" && i + 1 < argc) {
+            std::string path = argv[++i];
+            if (path == "immediate") meshRenderPath = RENDER_PATH_IMMEDIATE;
+            else if (path == "lists") meshRenderPath = RENDER_PATH_DISPLAY_LIST;
+            else if (path == "buffers") meshRenderPath = RENDER_PATH_BUFFERS;
+            else std::cerr << "Unknown render path '" << path << "' (immediate, lists, buffers)" << std::endl;
+        }
+        if (arg == "--instancing" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "auto") instancingMode = INSTANCING_AUTO;
+            else if (mode == "on") instancingMode = INSTANCING_HARDWARE;
+            else if (mode == "merged") instancingMode = INSTANCING_MERGED;
+            else if (mode == "off") instancingMode = INSTANCING_OFF;
+            else std::cerr << "Unknown instancing mode '" << mode << "' (auto, on, merged, off)" << std::endl;
+        }
+        if (arg == "--forest-trees" && i + 1 < argc) {
+            extraForestTrees = std::max(0, atoi(argv[++i]));
+        }
+        if (arg == "--ground-cover" && i + 1 < argc) {
+            extraGroundCover = std::max(0, atoi(argv[++i]));
+        }
+        if (arg == "--no-cull") {
+            frustumCulling = false;
+        }
+        if (arg == "--no-lod") {
+            lodEnabled = false;
+        }
+        if (arg == "--no-state-cache") {
+            renderState.setCaching(false);
+        }
+        if (arg == "--perf-overlay") {
+            perfOverlay.setVisible(true);
+        }
+        if (arg == "--trace-seconds" && i + 1 < argc) {
+            traceSeconds = std::max(0.1, atof(argv[++i]));
+        }
+        if (arg == "--trace-out" && i + 1 < argc) {
+            traceOutputPath = argv[++i];
+        }
+    }
+    
+    // Keep stdout for the benchmark report
+    if (headlessBenchmarkFrames > 0 && benchmarkOutput.empty()) {
+        std::cout.rdbuf(std::cerr.rdbuf());
+    }
+    
+    // Gameplay random streams; a replay brings its own seed
+    seedSimulationRandom(seed);
+    if (!replayPath.empty()) {
+        if (!recordPath.empty()) {
+            std::cerr << "--record and --replay can't be combined" << std::endl;
+            return 1;
+        }
+        if (!inputLog.loadReplay(replayPath)) return 1;
+        loopMode = LOOP_UNCAPPED;
+        gameLoop.setLockstep(true);
+    }
+
     std::cout << "==================================" << std::endl;
     std::cout << "  Crystal Caves - OpenGL Project  " << std::endl;
     std::cout << "==================================" << std::endl;
@@ -5623,12 +13338,30 @@ int main(int argc, char** argv) {
     std::cout << "  4 - Scene 1 (Forest)" << std::endl;
     std::cout << "  T - Toggle View" << std::endl;
     std::cout << "  F - Toggle Fullscreen" << std::endl;
+    std::cout << "  V - Cycle Mesh Render Path" << std::endl;
+    std::cout << "  M - Toggle Texture Mipmaps" << std::endl;
+    std::cout << "  L - Cycle Frame Pacing (prints loop stats)" << std::endl;
+    std::cout << "  C - Toggle Frustum Culling (prints counts)" << std::endl;
+    std::cout << "  K - Toggle Level of Detail (prints triangle counts)" << std::endl;
+    std::cout << "  G - Toggle GL State Cache (prints state changes)" << std::endl;
+    std::cout << "  O - Toggle Performance Overlay" << std::endl;
+    std::cout << "  P - Save Profiler Trace (last " << traceSeconds << " s, Chrome JSON)" << std::endl;
     std::cout << "  WASD - Move" << std::endl;
     std::cout << "  Mouse - Look around" << std::endl;
     std::cout << "  Left Click - Interact (chest)" << std::endl;
     std::cout << "  ESC - Exit" << std::endl;
     std::cout << std::endl;
     
+    // Per-texture filtering; loader threads read it, so load it first
+    textureConfig.load("textures.cfg");
+    if (textureBudgetMB >= 0.0) {
+        textureConfig.setBudgetBytes((size_t)(textureBudgetMB * 1024 * 1024));
+    }
+    
+    if (headlessBenchmarkFrames > 0) {
+        return runHeadlessBenchmark(headlessBenchmarkFrames, benchmarkOutput);
+    }
+    
     // Initialize GLUT
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
@@ -5645,6 +13378,10 @@ int main(int argc, char** argv) {
     // Initialize scenes
     initScenes();
     
+    if (mipBenchmarkFrames > 0) {
+        return runMipmapBenchmark(mipBenchmarkFrames);
+    }
+    
     // Register callbacks
     glutDisplayFunc(display);
     glutReshapeFunc(reshape);
@@ -5654,7 +13391,9 @@ int main(int argc, char** argv) {
     glutMouseFunc(mouseClick);  // Mouse click for chest interaction
     glutMotionFunc(mouseMotion);
     glutPassiveMotionFunc(mousePassiveMotion);
-    glutTimerFunc(0, timer, 0);
+    if (!recordPath.empty() && !inputLog.startRecording(recordPath)) return 1;
+    gameLoop.setMode(loopMode, loopFps);
+    gameLoop.start();
     
     // Start main loop
     glutMainLoop();